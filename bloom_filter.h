@@ -0,0 +1,142 @@
+#pragma once
+/*!
+    \file
+    \brief Блочный фильтр Блума для быстрых отрицательных ответов при поиске в каталоге
+
+    Все биты одного ключа лежат в одном блоке размером в кэш-линию (64 байта), поэтому проверка
+    ключа - одно обращение к памяти. Ложноотрицательных ответов нет, ложноположительные - около
+    0.5% при 16 битах на ключ. Удаление ключей не поддерживается - после удаления фильтр строится заново.
+ */
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <string_view>
+#include <vector>
+
+
+//----------------------------------------------------------------------------
+// marty_tr::
+namespace marty_tr {
+
+
+
+//----------------------------------------------------------------------------
+class BlockedBloomFilter
+{
+
+public:
+
+    static constexpr std::size_t blockBits  = 512;
+    static constexpr std::size_t bitsPerKey = 16;
+    static constexpr unsigned    numProbes  = 8;
+
+protected:
+
+    struct alignas(64) Block
+    {
+        std::uint64_t words[blockBits/64] = {};
+    };
+
+    std::vector<Block>     blocks    ;
+    std::size_t            blockMask = 0;
+    std::size_t            numKeys   = 0;
+    std::size_t            capacity  = 0;
+
+    static std::size_t blockIndex(std::uint64_t h, std::size_t mask)
+    {
+        return (std::size_t)(mix(h ^ 0x9E3779B97F4A7C15ull)) & mask;
+    }
+
+public:
+
+    //! Финализатор splitmix64
+    static std::uint64_t mix(std::uint64_t h)
+    {
+        h ^= h >> 30; h *= 0xBF58476D1CE4E5B9ull;
+        h ^= h >> 27; h *= 0x94D049BB133111EBull;
+        h ^= h >> 31;
+        return h;
+    }
+
+    static std::uint64_t hashStr(std::string_view str)
+    {
+        return mix((std::uint64_t)std::hash<std::string_view>()(str));
+    }
+
+    //! Хэш составного ключа
+    static std::uint64_t combine(std::uint64_t h, std::uint64_t v)
+    {
+        return mix(h ^ (v + 0x9E3779B97F4A7C15ull + (h<<6) + (h>>2)));
+    }
+
+    //! Очищает фильтр и выделяет место под expectedKeys ключей
+    void reset(std::size_t expectedKeys)
+    {
+        std::size_t numBlocks = 1;
+        while(numBlocks*blockBits < expectedKeys*bitsPerKey)
+            numBlocks *= 2;
+
+        blocks.assign(numBlocks, Block());
+        blockMask = numBlocks-1;
+        numKeys   = 0;
+        capacity  = numBlocks*blockBits/bitsPerKey;
+    }
+
+    void clear()
+    {
+        blocks.clear();
+        blockMask = 0;
+        numKeys   = 0;
+        capacity  = 0;
+    }
+
+    bool        empty()       const { return blocks.empty(); }
+    std::size_t size()        const { return numKeys;  }
+    //! Сколько ключей можно добавить без роста вероятности ложных срабатываний выше расчётной
+    std::size_t getCapacity() const { return capacity; }
+
+    void insert(std::uint64_t h)
+    {
+        if (blocks.empty())
+            return;
+
+        Block &b = blocks[blockIndex(h, blockMask)];
+
+        const std::uint32_t h1 = (std::uint32_t)h;
+        const std::uint32_t h2 = (std::uint32_t)(h>>32) | 1u;
+        for(unsigned i=0; i!=numProbes; ++i)
+        {
+            const std::uint32_t bit = (h1 + i*h2) & (blockBits-1);
+            b.words[bit>>6] |= (std::uint64_t)1 << (bit&63);
+        }
+
+        ++numKeys;
+    }
+
+    //! false - ключа точно нет; пустой фильтр всегда возвращает true
+    bool mayContain(std::uint64_t h) const
+    {
+        if (blocks.empty())
+            return true;
+
+        const Block &b = blocks[blockIndex(h, blockMask)];
+
+        const std::uint32_t h1 = (std::uint32_t)h;
+        const std::uint32_t h2 = (std::uint32_t)(h>>32) | 1u;
+        for(unsigned i=0; i!=numProbes; ++i)
+        {
+            const std::uint32_t bit = (h1 + i*h2) & (blockBits-1);
+            if (!(b.words[bit>>6] & ((std::uint64_t)1 << (bit&63))))
+                return false;
+        }
+
+        return true;
+    }
+
+}; // class BlockedBloomFilter
+
+//----------------------------------------------------------------------------
+
+} // namespace marty_tr
+
@@ -0,0 +1,559 @@
+#pragma once
+/*!
+    \file
+    \brief Образ каталога переводов - непрерывный блок памяти без указателей (только смещения)
+
+    Образ строится один раз (buildCatalogImage, tr_build_catalog_image) и может лежать где угодно:
+    в файле, в разделяемой памяти (см. catalog_image_shm.h), в ресурсах. Поиск идёт прямо по образу,
+    без разбора и без выделения памяти, поэтому процессы-воркеры после fork разделяют одну копию каталога.
+
+    Формат (все смещения - от начала образа, выравнивание таблиц - 8 байт):
+        CatalogImageHeader
+        языки       - CatalogImageLang[numLangs],  отсортированы по имени
+        категории   - CatalogImageCat[numCats],    сгруппированы по языкам, внутри языка отсортированы
+        сообщения   - CatalogImageMsg[numMsgs],    сгруппированы по категориям, внутри категории отсортированы
+        хэш-таблица - CatalogImageSlot[numSlots],  открытая адресация, ключи: язык, язык+категория, язык+категория+сообщение
+        строки      - все строки подряд, каждая завершается нулём, одинаковые строки хранятся один раз
+
+    Хэш свой (FNV-1a + splitmix), а не std::hash, чтобы образ, построенный одной программой, читался другой.
+    Порядок байт - родной для платформы, в заголовке записан маркер для проверки.
+ */
+
+#include "bloom_filter.h"
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+
+//----------------------------------------------------------------------------
+// marty_tr::
+namespace marty_tr {
+
+
+
+//----------------------------------------------------------------------------
+struct CatalogImageStrRef
+{
+    std::uint32_t       offset; // От начала блока строк
+    std::uint32_t       size  ;
+};
+
+struct CatalogImageHeader
+{
+    char                magic[8]     ; // "MTRCIMG"
+    std::uint32_t       version      ;
+    std::uint32_t       byteOrderMark; // 0x01020304 в родном порядке байт
+    std::uint64_t       totalSize    ;
+    std::uint32_t       numLangs     ;
+    std::uint32_t       numCats      ;
+    std::uint32_t       numMsgs      ;
+    std::uint32_t       numSlots     ; // Степень двойки
+    std::uint64_t       langsOffset  ;
+    std::uint64_t       catsOffset   ;
+    std::uint64_t       msgsOffset   ;
+    std::uint64_t       slotsOffset  ;
+    std::uint64_t       stringsOffset;
+    std::uint64_t       stringsSize  ;
+};
+
+struct CatalogImageLang
+{
+    CatalogImageStrRef  name    ;
+    std::uint32_t       firstCat;
+    std::uint32_t       numCats ;
+};
+
+struct CatalogImageCat
+{
+    CatalogImageStrRef  name     ;
+    std::uint32_t       langIndex;
+    std::uint32_t       firstMsg ;
+    std::uint32_t       numMsgs  ;
+    std::uint32_t       reserved ;
+};
+
+struct CatalogImageMsg
+{
+    CatalogImageStrRef  msgId   ;
+    CatalogImageStrRef  text    ;
+    std::uint32_t       catIndex;
+    std::uint32_t       reserved;
+};
+
+struct CatalogImageSlot
+{
+    std::uint64_t       hash ;
+    std::uint32_t       kind ; // 0 - пустой слот, иначе CatalogImageKeyKind
+    std::uint32_t       index; // Индекс в таблице языков/категорий/сообщений
+};
+
+//------------------------------
+enum class CatalogImageKeyKind : std::uint32_t
+{
+    lang = 1,
+    cat  = 2,
+    msg  = 3
+};
+
+//----------------------------------------------------------------------------
+
+
+
+
+//----------------------------------------------------------------------------
+namespace impl_helpers {
+
+inline
+const char* getCatalogImageMagic()
+{
+    return "MTRCIMG";
+}
+
+constexpr std::uint32_t catalogImageVersion       = 1;
+constexpr std::uint32_t catalogImageByteOrderMark = 0x01020304u;
+
+//------------------------------
+//! FNV-1a, не зависит от реализации стандартной библиотеки
+inline
+std::uint64_t catalogImageHashStr(std::string_view str)
+{
+    std::uint64_t h = 0xCBF29CE484222325ull;
+    for(char ch : str)
+    {
+        h ^= (std::uint8_t)ch;
+        h *= 0x100000001B3ull;
+    }
+    return BlockedBloomFilter::mix(h);
+}
+
+inline
+std::uint64_t catalogImageHashLang(std::string_view langId)
+{
+    return BlockedBloomFilter::combine((std::uint64_t)CatalogImageKeyKind::lang, catalogImageHashStr(langId));
+}
+
+inline
+std::uint64_t catalogImageHashCat(std::string_view langId, std::string_view catId)
+{
+    return BlockedBloomFilter::combine(BlockedBloomFilter::combine((std::uint64_t)CatalogImageKeyKind::cat, catalogImageHashStr(langId)), catalogImageHashStr(catId));
+}
+
+inline
+std::uint64_t catalogImageHashMsg(std::string_view langId, std::string_view catId, std::string_view msgId)
+{
+    std::uint64_t h = BlockedBloomFilter::combine((std::uint64_t)CatalogImageKeyKind::msg, catalogImageHashStr(langId));
+    h = BlockedBloomFilter::combine(h, catalogImageHashStr(catId));
+    return BlockedBloomFilter::combine(h, catalogImageHashStr(msgId));
+}
+
+//------------------------------
+inline
+std::size_t catalogImageAlign(std::size_t size)
+{
+    return (size+7) & ~(std::size_t)7;
+}
+
+} // namespace impl_helpers
+
+//----------------------------------------------------------------------------
+
+
+
+
+//----------------------------------------------------------------------------
+//! Строит образ каталога. TrMap - all_translations_map_t или совместимый вложенный контейнер lang->cat->msg->text
+/*! Тексты кладутся как есть - ссылки $(@...) должны быть уже разрешены (см. tr_build_catalog_image).
+ */
+template<typename TrMap> inline
+std::vector<char> buildCatalogImage(const TrMap &trAllMap)
+{
+    // Сортируем ключи - образ одного и того же каталога получается побайтно одинаковым
+    auto sortedKeys = [](const auto &m)
+    {
+        std::vector<const std::string*> keys; keys.reserve(m.size());
+        for(const auto &kvp : m)
+            keys.emplace_back(&kvp.first);
+        std::sort(keys.begin(), keys.end(), [](const std::string *a, const std::string *b) { return *a<*b; });
+        return keys;
+    };
+
+    std::vector<CatalogImageLang>  langs;
+    std::vector<CatalogImageCat>   cats ;
+    std::vector<CatalogImageMsg>   msgs ;
+    std::vector<CatalogImageSlot>  keys ; // Без раскладки по слотам
+    std::string                    strings;
+
+    // Одинаковые строки (msgId во всех языках, совпадающие тексты, текст, равный msgId) кладутся один раз
+    std::unordered_map<std::string_view, CatalogImageStrRef> stringRefs;
+
+    auto addString = [&](const std::string &str)
+    {
+        auto it = stringRefs.find(str);
+        if (it!=stringRefs.end())
+            return it->second;
+
+        if (strings.size()+str.size()+1 > (std::size_t)0xFFFFFFFFu)
+            throw std::runtime_error("tr: catalog image: strings block exceeds 4 GB");
+
+        CatalogImageStrRef ref;
+        ref.offset = (std::uint32_t)strings.size();
+        ref.size   = (std::uint32_t)str.size();
+        strings.append(str);
+        strings.append(1, '\0');
+        stringRefs.emplace(std::string_view(str), ref); // Ключ указывает в trAllMap, он живёт дольше
+        return ref;
+    };
+
+    for(const std::string *pLangId : sortedKeys(trAllMap))
+    {
+        const auto &catMap = trAllMap.find(*pLangId)->second;
+
+        CatalogImageLang lang;
+        lang.name     = addString(*pLangId);
+        lang.firstCat = (std::uint32_t)cats.size();
+        lang.numCats  = (std::uint32_t)catMap.size();
+        keys.push_back(CatalogImageSlot{impl_helpers::catalogImageHashLang(*pLangId), (std::uint32_t)CatalogImageKeyKind::lang, (std::uint32_t)langs.size()});
+        langs.emplace_back(lang);
+
+        for(const std::string *pCatId : sortedKeys(catMap))
+        {
+            const auto &msgMap = catMap.find(*pCatId)->second;
+
+            CatalogImageCat cat;
+            cat.name      = addString(*pCatId);
+            cat.langIndex = (std::uint32_t)(langs.size()-1);
+            cat.firstMsg  = (std::uint32_t)msgs.size();
+            cat.numMsgs   = (std::uint32_t)msgMap.size();
+            cat.reserved  = 0;
+            keys.push_back(CatalogImageSlot{impl_helpers::catalogImageHashCat(*pLangId, *pCatId), (std::uint32_t)CatalogImageKeyKind::cat, (std::uint32_t)cats.size()});
+            cats.emplace_back(cat);
+
+            for(const std::string *pMsgId : sortedKeys(msgMap))
+            {
+                CatalogImageMsg msg;
+                msg.msgId    = addString(*pMsgId);
+                msg.text     = addString(msgMap.find(*pMsgId)->second);
+                msg.catIndex = (std::uint32_t)(cats.size()-1);
+                msg.reserved = 0;
+                keys.push_back(CatalogImageSlot{impl_helpers::catalogImageHashMsg(*pLangId, *pCatId, *pMsgId), (std::uint32_t)CatalogImageKeyKind::msg, (std::uint32_t)msgs.size()});
+                msgs.emplace_back(msg);
+            }
+        }
+    }
+
+    // Заполнение хэш-таблицы не больше половины - в среднем около одной пробы на поиск
+    std::size_t numSlots = 16;
+    while(numSlots < keys.size()*2)
+        numSlots *= 2;
+
+    std::vector<CatalogImageSlot> slots(numSlots, CatalogImageSlot{0, 0, 0});
+    for(const auto &k : keys)
+    {
+        std::size_t pos = (std::size_t)k.hash & (numSlots-1);
+        while(slots[pos].kind)
+            pos = (pos+1) & (numSlots-1);
+        slots[pos] = k;
+    }
+
+    CatalogImageHeader hdr;
+    std::memset(&hdr, 0, sizeof(hdr));
+    std::memcpy(hdr.magic, impl_helpers::getCatalogImageMagic(), 8);
+    hdr.version       = impl_helpers::catalogImageVersion;
+    hdr.byteOrderMark = impl_helpers::catalogImageByteOrderMark;
+    hdr.numLangs      = (std::uint32_t)langs.size();
+    hdr.numCats       = (std::uint32_t)cats.size();
+    hdr.numMsgs       = (std::uint32_t)msgs.size();
+    hdr.numSlots      = (std::uint32_t)numSlots;
+
+    std::size_t pos   = impl_helpers::catalogImageAlign(sizeof(hdr));
+    hdr.langsOffset   = pos; pos = impl_helpers::catalogImageAlign(pos + langs.size()*sizeof(CatalogImageLang));
+    hdr.catsOffset    = pos; pos = impl_helpers::catalogImageAlign(pos + cats .size()*sizeof(CatalogImageCat ));
+    hdr.msgsOffset    = pos; pos = impl_helpers::catalogImageAlign(pos + msgs .size()*sizeof(CatalogImageMsg ));
+    hdr.slotsOffset   = pos; pos = impl_helpers::catalogImageAlign(pos + slots.size()*sizeof(CatalogImageSlot));
+    hdr.stringsOffset = pos; pos = pos + strings.size();
+    hdr.stringsSize   = strings.size();
+    hdr.totalSize     = pos;
+
+    std::vector<char> res(pos, 0);
+    std::memcpy(res.data(), &hdr, sizeof(hdr));
+    if (!langs.empty())   std::memcpy(res.data()+hdr.langsOffset  , langs.data()  , langs.size()*sizeof(CatalogImageLang));
+    if (!cats.empty())    std::memcpy(res.data()+hdr.catsOffset   , cats.data()   , cats .size()*sizeof(CatalogImageCat ));
+    if (!msgs.empty())    std::memcpy(res.data()+hdr.msgsOffset   , msgs.data()   , msgs .size()*sizeof(CatalogImageMsg ));
+    std::memcpy(res.data()+hdr.slotsOffset, slots.data(), slots.size()*sizeof(CatalogImageSlot));
+    if (!strings.empty()) std::memcpy(res.data()+hdr.stringsOffset, strings.data(), strings.size());
+
+    return res;
+}
+
+//----------------------------------------------------------------------------
+
+
+
+
+//----------------------------------------------------------------------------
+//! Поиск по образу каталога. Память образа не копируется и не принадлежит объекту
+/*! Образ проверяется при создании view (заголовок, границы таблиц и строк), поиск дальше не проверяет ничего.
+    Возвращаемые string_view указывают в образ и валидны, пока образ отображён в память.
+ */
+class CatalogImageView
+{
+
+protected:
+
+    const char                 *pData = 0;
+    std::size_t                 dataSize = 0;
+
+    const CatalogImageHeader   *pHeader  = 0;
+    const CatalogImageLang     *pLangs   = 0;
+    const CatalogImageCat      *pCats    = 0;
+    const CatalogImageMsg      *pMsgs    = 0;
+    const CatalogImageSlot     *pSlots   = 0;
+    const char                 *pStrings = 0;
+    std::size_t                 slotMask = 0;
+
+    static void checkRange(std::uint64_t offset, std::uint64_t size, std::uint64_t totalSize)
+    {
+        if (offset>totalSize || size>totalSize-offset)
+            throw std::runtime_error("tr: catalog image is corrupted");
+    }
+
+    void checkStr(const CatalogImageStrRef &ref) const
+    {
+        if ((std::uint64_t)ref.offset+ref.size >= pHeader->stringsSize || pStrings[ref.offset+ref.size]!=0)
+            throw std::runtime_error("tr: catalog image is corrupted");
+    }
+
+    std::string_view getStr(const CatalogImageStrRef &ref) const
+    {
+        return std::string_view(pStrings+ref.offset, ref.size);
+    }
+
+    //! Индекс элемента по ключу или npos. eq проверяет, что найденный элемент - тот самый
+    template<typename EqualTo>
+    std::size_t findKey(std::uint64_t h, CatalogImageKeyKind kind, EqualTo eq) const
+    {
+        std::size_t pos = (std::size_t)h & slotMask;
+        for(;;)
+        {
+            const CatalogImageSlot &s = pSlots[pos];
+            if (!s.kind)
+                return npos;
+
+            if (s.hash==h && s.kind==(std::uint32_t)kind && eq(s.index))
+                return s.index;
+
+            pos = (pos+1) & slotMask;
+        }
+    }
+
+    std::size_t findLang(std::string_view langId) const
+    {
+        if (!pHeader)
+            return npos;
+
+        return findKey( impl_helpers::catalogImageHashLang(langId), CatalogImageKeyKind::lang
+                      , [&](std::uint32_t idx) { return getStr(pLangs[idx].name)==langId; }
+                      );
+    }
+
+    std::size_t findCat(std::string_view langId, std::string_view catId) const
+    {
+        if (!pHeader)
+            return npos;
+
+        return findKey( impl_helpers::catalogImageHashCat(langId, catId), CatalogImageKeyKind::cat
+                      , [&](std::uint32_t idx)
+                        {
+                            const CatalogImageCat &c = pCats[idx];
+                            return getStr(c.name)==catId && getStr(pLangs[c.langIndex].name)==langId;
+                        }
+                      );
+    }
+
+
+public:
+
+    static constexpr std::size_t npos = (std::size_t)-1;
+
+    CatalogImageView() {}
+
+    //! Проверяет образ, при ошибке - std::runtime_error
+    CatalogImageView(const void *pImage, std::size_t imageSize)
+    : pData((const char*)pImage), dataSize(imageSize)
+    {
+        if (!pData || dataSize<sizeof(CatalogImageHeader) || ((std::uintptr_t)pData & 7))
+            throw std::runtime_error("tr: catalog image is too small or misaligned");
+
+        pHeader = (const CatalogImageHeader*)pData;
+        if (std::memcmp(pHeader->magic, impl_helpers::getCatalogImageMagic(), 8)!=0)
+            throw std::runtime_error("tr: not a catalog image");
+        if (pHeader->byteOrderMark!=impl_helpers::catalogImageByteOrderMark)
+            throw std::runtime_error("tr: catalog image byte order mismatch");
+        if (pHeader->version!=impl_helpers::catalogImageVersion)
+            throw std::runtime_error("tr: unsupported catalog image version");
+        if (pHeader->totalSize>dataSize || !pHeader->numSlots || (pHeader->numSlots & (pHeader->numSlots-1)))
+            throw std::runtime_error("tr: catalog image is corrupted");
+
+        const std::uint64_t totalSize = pHeader->totalSize;
+        checkRange(pHeader->langsOffset  , (std::uint64_t)pHeader->numLangs*sizeof(CatalogImageLang), totalSize);
+        checkRange(pHeader->catsOffset   , (std::uint64_t)pHeader->numCats *sizeof(CatalogImageCat ), totalSize);
+        checkRange(pHeader->msgsOffset   , (std::uint64_t)pHeader->numMsgs *sizeof(CatalogImageMsg ), totalSize);
+        checkRange(pHeader->slotsOffset  , (std::uint64_t)pHeader->numSlots*sizeof(CatalogImageSlot), totalSize);
+        checkRange(pHeader->stringsOffset, pHeader->stringsSize, totalSize);
+
+        if ((pHeader->langsOffset | pHeader->catsOffset | pHeader->msgsOffset | pHeader->slotsOffset) & 7)
+            throw std::runtime_error("tr: catalog image is corrupted");
+
+        pLangs   = (const CatalogImageLang*)(pData+pHeader->langsOffset);
+        pCats    = (const CatalogImageCat *)(pData+pHeader->catsOffset );
+        pMsgs    = (const CatalogImageMsg *)(pData+pHeader->msgsOffset );
+        pSlots   = (const CatalogImageSlot*)(pData+pHeader->slotsOffset);
+        pStrings = pData+pHeader->stringsOffset;
+        slotMask = pHeader->numSlots-1;
+
+        // Один проход по таблицам, чтобы поиск мог не проверять ничего
+        for(std::uint32_t i=0; i!=pHeader->numLangs; ++i)
+        {
+            checkStr(pLangs[i].name);
+            if ((std::uint64_t)pLangs[i].firstCat+pLangs[i].numCats > pHeader->numCats)
+                throw std::runtime_error("tr: catalog image is corrupted");
+        }
+
+        for(std::uint32_t i=0; i!=pHeader->numCats; ++i)
+        {
+            checkStr(pCats[i].name);
+            if (pCats[i].langIndex>=pHeader->numLangs || (std::uint64_t)pCats[i].firstMsg+pCats[i].numMsgs > pHeader->numMsgs)
+                throw std::runtime_error("tr: catalog image is corrupted");
+        }
+
+        for(std::uint32_t i=0; i!=pHeader->numMsgs; ++i)
+        {
+            checkStr(pMsgs[i].msgId);
+            checkStr(pMsgs[i].text);
+            if (pMsgs[i].catIndex>=pHeader->numCats)
+                throw std::runtime_error("tr: catalog image is corrupted");
+        }
+
+        std::size_t numUsed = 0;
+        for(std::uint32_t i=0; i!=pHeader->numSlots; ++i)
+        {
+            const CatalogImageSlot &s = pSlots[i];
+            if (!s.kind)
+                continue;
+
+            ++numUsed;
+            const std::uint32_t limit = s.kind==(std::uint32_t)CatalogImageKeyKind::lang ? pHeader->numLangs
+                                      : s.kind==(std::uint32_t)CatalogImageKeyKind::cat  ? pHeader->numCats
+                                      : s.kind==(std::uint32_t)CatalogImageKeyKind::msg  ? pHeader->numMsgs
+                                      : 0;
+            if (s.index>=limit)
+                throw std::runtime_error("tr: catalog image is corrupted");
+        }
+
+        if (numUsed==pHeader->numSlots) // Поиск отсутствующего ключа не остановится
+            throw std::runtime_error("tr: catalog image is corrupted");
+    }
+
+    bool        empty() const { return pHeader==0; }
+    const char* data()  const { return pData; }
+    std::size_t size()  const { return pHeader ? (std::size_t)pHeader->totalSize : 0; }
+
+    std::size_t getMsgCount() const { return pHeader ? pHeader->numMsgs : 0; }
+
+    //------------------------------
+    bool hasLang(std::string_view langId) const
+    {
+        return findLang(langId)!=npos;
+    }
+
+    bool hasCategory(std::string_view langId, std::string_view catId) const
+    {
+        return findCat(langId, catId)!=npos;
+    }
+
+    //! Одна проба хэш-таблицы (в среднем), сравнение строк - только у кандидата с совпавшим хэшем
+    std::optional<std::string_view> find(std::string_view langId, std::string_view catId, std::string_view msgId) const
+    {
+        if (!pHeader)
+            return std::nullopt;
+
+        std::size_t idx = findKey( impl_helpers::catalogImageHashMsg(langId, catId, msgId), CatalogImageKeyKind::msg
+                                 , [&](std::uint32_t i)
+                                   {
+                                       const CatalogImageMsg &m = pMsgs[i];
+                                       const CatalogImageCat &c = pCats[m.catIndex];
+                                       return getStr(m.msgId)==msgId && getStr(c.name)==catId && getStr(pLangs[c.langIndex].name)==langId;
+                                   }
+                                 );
+        if (idx==npos)
+            return std::nullopt;
+
+        return getStr(pMsgs[idx].text);
+    }
+
+    //------------------------------
+    //! handler(msgId, text) для всех сообщений категории
+    template<typename THandler>
+    void enumerateMsgs(std::string_view langId, std::string_view catId, THandler handler) const
+    {
+        std::size_t catIdx = findCat(langId, catId);
+        if (catIdx==npos)
+            return;
+
+        const CatalogImageCat &c = pCats[catIdx];
+        for(std::uint32_t i=c.firstMsg; i!=c.firstMsg+c.numMsgs; ++i)
+            handler(getStr(pMsgs[i].msgId), getStr(pMsgs[i].text));
+    }
+
+    //! handler(catId, msgId, text) для всех сообщений языка
+    template<typename THandler>
+    void enumerateLang(std::string_view langId, THandler handler) const
+    {
+        std::size_t langIdx = findLang(langId);
+        if (langIdx==npos)
+            return;
+
+        const CatalogImageLang &l = pLangs[langIdx];
+        for(std::uint32_t ci=l.firstCat; ci!=l.firstCat+l.numCats; ++ci)
+        {
+            const CatalogImageCat &c = pCats[ci];
+            for(std::uint32_t i=c.firstMsg; i!=c.firstMsg+c.numMsgs; ++i)
+                handler(getStr(c.name), getStr(pMsgs[i].msgId), getStr(pMsgs[i].text));
+        }
+    }
+
+    //! handler(langId, catId, msgId, text) для всех сообщений образа
+    template<typename THandler>
+    void enumerateAll(THandler handler) const
+    {
+        if (!pHeader)
+            return;
+
+        for(std::uint32_t li=0; li!=pHeader->numLangs; ++li)
+        {
+            const CatalogImageLang &l = pLangs[li];
+            for(std::uint32_t ci=l.firstCat; ci!=l.firstCat+l.numCats; ++ci)
+            {
+                const CatalogImageCat &c = pCats[ci];
+                for(std::uint32_t i=c.firstMsg; i!=c.firstMsg+c.numMsgs; ++i)
+                    handler(getStr(l.name), getStr(c.name), getStr(pMsgs[i].msgId), getStr(pMsgs[i].text));
+            }
+        }
+    }
+
+}; // class CatalogImageView
+
+//----------------------------------------------------------------------------
+
+} // namespace marty_tr
+
+// marty_tr::
+
@@ -0,0 +1,368 @@
+#pragma once
+/*!
+    \file
+    \brief Образ каталога в разделяемой памяти - один экземпляр на все процессы-воркеры
+
+    Типовое использование с pre-fork пулом: родитель до fork строит образ и создаёт анонимный
+    сегмент (на Linux - memfd, запечатанный от записи), подключает его к переводчику
+    (tr_set_catalog_image(shm.getView())), затем запускает воркеры - отображение наследуется,
+    страницы каталога общие, разбора и копирования в воркерах нет.
+
+    Несвязанные процессы могут подключиться к именованному сегменту (shm_open / именованный
+    FileMapping на Windows) через SharedCatalogImage::attach(name). Сегмент отображается только на чтение.
+ */
+
+#include "catalog_image.h"
+
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+#if defined(WIN32) || defined(_WIN32)
+
+    #if !defined(NOMINMAX)
+        #define NOMINMAX
+    #endif
+    #include <windows.h>
+
+#else
+
+    #include <fcntl.h>
+    #include <sys/mman.h>
+    #include <sys/stat.h>
+    #include <unistd.h>
+
+#endif
+
+
+//----------------------------------------------------------------------------
+// marty_tr::
+namespace marty_tr {
+
+
+
+//----------------------------------------------------------------------------
+class SharedCatalogImage
+{
+
+protected:
+
+    const void                 *pMem    = 0;
+    std::size_t                 memSize = 0;
+    CatalogImageView            view    ;
+
+    #if defined(WIN32) || defined(_WIN32)
+    HANDLE                      hMapping = 0;
+    #else
+    int                         fd       = -1;
+    #endif
+
+
+    static void throwSysError(const std::string &what)
+    {
+        #if defined(WIN32) || defined(_WIN32)
+            throw std::runtime_error("tr: " + what + ": error " + std::to_string((unsigned long)GetLastError()));
+        #else
+            throw std::runtime_error("tr: " + what + ": " + std::string(std::strerror(errno)));
+        #endif
+    }
+
+    #if !defined(WIN32) && !defined(_WIN32)
+
+    static void writeAll(int fd, const std::vector<char> &image)
+    {
+        std::size_t pos = 0;
+        while(pos<image.size())
+        {
+            ssize_t n = ::write(fd, image.data()+pos, image.size()-pos);
+            if (n<0)
+            {
+                if (errno==EINTR)
+                    continue;
+                throwSysError("catalog image write");
+            }
+            pos += (std::size_t)n;
+        }
+    }
+
+    //! Отображает fd только на чтение и проверяет образ, fd переходит во владение объекта
+    static SharedCatalogImage mapFd(int fd)
+    {
+        SharedCatalogImage res;
+        res.fd = fd;
+
+        struct stat st;
+        if (::fstat(fd, &st)!=0)
+            throwSysError("catalog image fstat");
+
+        res.memSize = (std::size_t)st.st_size;
+        if (!res.memSize)
+            throw std::runtime_error("tr: catalog image segment is empty");
+
+        void *p = ::mmap(0, res.memSize, PROT_READ, MAP_SHARED, fd, 0);
+        if (p==MAP_FAILED)
+            throwSysError("catalog image mmap");
+
+        res.pMem = p;
+        res.view = CatalogImageView(res.pMem, res.memSize);
+        return res;
+    }
+
+    #endif
+
+
+public:
+
+    SharedCatalogImage() {}
+    ~SharedCatalogImage() { close(); }
+
+    SharedCatalogImage(const SharedCatalogImage &) = delete;
+    SharedCatalogImage& operator=(const SharedCatalogImage &) = delete;
+
+    SharedCatalogImage(SharedCatalogImage &&other) noexcept
+    {
+        swap(other);
+    }
+
+    SharedCatalogImage& operator=(SharedCatalogImage &&other) noexcept
+    {
+        if (this!=&other)
+        {
+            close();
+            swap(other);
+        }
+        return *this;
+    }
+
+    void swap(SharedCatalogImage &other) noexcept
+    {
+        std::swap(pMem   , other.pMem   );
+        std::swap(memSize, other.memSize);
+        std::swap(view   , other.view   );
+        #if defined(WIN32) || defined(_WIN32)
+        std::swap(hMapping, other.hMapping);
+        #else
+        std::swap(fd      , other.fd      );
+        #endif
+    }
+
+    void close()
+    {
+        view = CatalogImageView();
+
+        #if defined(WIN32) || defined(_WIN32)
+
+            if (pMem)
+                UnmapViewOfFile(pMem);
+            if (hMapping)
+                CloseHandle(hMapping);
+            hMapping = 0;
+
+        #else
+
+            if (pMem)
+                ::munmap(const_cast<void*>(pMem), memSize);
+            if (fd>=0)
+                ::close(fd);
+            fd = -1;
+
+        #endif
+
+        pMem    = 0;
+        memSize = 0;
+    }
+
+    bool                    empty()   const { return view.empty(); }
+    const CatalogImageView& getView() const { return view; }
+
+    #if !defined(WIN32) && !defined(_WIN32)
+    //! Дескриптор сегмента, например, для передачи другому процессу через SCM_RIGHTS
+    int getFd() const { return fd; }
+    #endif
+
+    //------------------------------
+    //! Создаёт сегмент и копирует в него образ
+    /*! name пустое - анонимный сегмент, доступный только потомкам (после fork) и через getFd().
+        Иначе - именованный сегмент ("/name" для shm_open, имя объекта на Windows), к нему
+        можно подключиться по имени. Именованный POSIX-сегмент живёт до remove(name).
+
+        Существующий сегмент с тем же именем не переписывается (его уже могут отображать воркеры) -
+        create() бросает исключение. Чтобы выложить новый образ под прежним именем, сначала remove(name):
+        подключённые процессы продолжат работать со старым сегментом.
+
+        posixMode - права именованного POSIX-сегмента (по умолчанию только чтение владельцем, для
+        воркеров под другим пользователем той же группы - 0440). Пока образ записывается, прав нет
+        совсем, так что attach() не увидит недописанный сегмент. На Windows не используется.
+     */
+    static SharedCatalogImage create(const std::vector<char> &image, const std::string &name = std::string(), unsigned posixMode = 0400)
+    {
+        // Проверяем образ до того, как отдавать его воркерам
+        CatalogImageView(image.data(), image.size());
+
+        #if defined(WIN32) || defined(_WIN32)
+
+            (void)posixMode;
+
+            SharedCatalogImage res;
+            const unsigned long long sz = (unsigned long long)image.size();
+            res.hMapping = CreateFileMappingA( INVALID_HANDLE_VALUE, 0, PAGE_READWRITE
+                                             , (DWORD)(sz>>32), (DWORD)(sz&0xFFFFFFFFu)
+                                             , name.empty() ? (LPCSTR)0 : name.c_str()
+                                             );
+            if (!res.hMapping)
+                throwSysError("catalog image CreateFileMapping");
+
+            if (GetLastError()==ERROR_ALREADY_EXISTS)
+                throw std::runtime_error("tr: catalog image segment already exists: " + name);
+
+            void *pWrite = MapViewOfFile(res.hMapping, FILE_MAP_WRITE, 0, 0, image.size());
+            if (!pWrite)
+                throwSysError("catalog image MapViewOfFile");
+            std::memcpy(pWrite, image.data(), image.size());
+            UnmapViewOfFile(pWrite);
+
+            res.pMem = MapViewOfFile(res.hMapping, FILE_MAP_READ, 0, 0, image.size());
+            if (!res.pMem)
+                throwSysError("catalog image MapViewOfFile");
+
+            res.memSize = image.size();
+            res.view    = CatalogImageView(res.pMem, res.memSize);
+            return res;
+
+        #else
+
+            int fd = -1;
+
+            if (name.empty())
+            {
+                #if defined(__linux__) && defined(MFD_ALLOW_SEALING)
+                    fd = ::memfd_create("marty_tr_catalog", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+                #else
+                    // Без memfd - временный именованный сегмент, который сразу удаляется
+                    const std::string tmpName = "/marty_tr_catalog_" + std::to_string((long)::getpid()) + "_" + std::to_string((unsigned long long)(std::uintptr_t)image.data());
+                    fd = ::shm_open(tmpName.c_str(), O_RDWR | O_CREAT | O_EXCL, 0600);
+                    if (fd>=0)
+                        ::shm_unlink(tmpName.c_str());
+                #endif
+            }
+            else
+            {
+                // Только новый сегмент: O_TRUNC на уже отображённом воркерами сегменте даёт им SIGBUS
+                fd = ::shm_open(name.c_str(), O_RDWR | O_CREAT | O_EXCL, 0);
+            }
+
+            if (fd<0)
+                throwSysError("catalog image segment create");
+
+            bool ownName = !name.empty(); // Имя занято нашим сегментом - при ошибке удаляем
+            try
+            {
+                writeAll(fd, image);
+
+                #if defined(__linux__) && defined(MFD_ALLOW_SEALING) && defined(F_ADD_SEALS)
+                    // Анонимный сегмент запечатываем: ни родитель, ни воркеры не смогут его изменить
+                    if (name.empty() && ::fcntl(fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_WRITE | F_SEAL_SEAL)!=0)
+                        throwSysError("catalog image seal");
+                #endif
+
+                // Образ записан - открываем доступ и дальше работаем с дескриптором только на чтение
+                if (!name.empty())
+                {
+                    if (::fchmod(fd, (mode_t)posixMode)!=0)
+                        throwSysError("catalog image segment chmod");
+
+                    int roFd = ::shm_open(name.c_str(), O_RDONLY, 0);
+                    if (roFd<0)
+                        throwSysError("catalog image segment open");
+
+                    // Имя могли успеть удалить и занять другим сегментом
+                    struct stat stRw, stRo;
+                    if (::fstat(fd, &stRw)!=0 || ::fstat(roFd, &stRo)!=0 || stRw.st_dev!=stRo.st_dev || stRw.st_ino!=stRo.st_ino)
+                    {
+                        ::close(roFd);
+                        ownName = false;
+                        throw std::runtime_error("tr: catalog image segment was replaced while creating: " + name);
+                    }
+
+                    ::close(fd);
+                    fd = roFd;
+                }
+            }
+            catch(...)
+            {
+                ::close(fd);
+                if (ownName)
+                    ::shm_unlink(name.c_str()); // Недописанный сегмент не оставляем
+                throw;
+            }
+
+            return mapFd(fd);
+
+        #endif
+    }
+
+    //! Подключается к именованному сегменту только на чтение
+    static SharedCatalogImage attach(const std::string &name)
+    {
+        #if defined(WIN32) || defined(_WIN32)
+
+            SharedCatalogImage res;
+            res.hMapping = OpenFileMappingA(FILE_MAP_READ, FALSE, name.c_str());
+            if (!res.hMapping)
+                throwSysError("catalog image OpenFileMapping");
+
+            res.pMem = MapViewOfFile(res.hMapping, FILE_MAP_READ, 0, 0, 0);
+            if (!res.pMem)
+                throwSysError("catalog image MapViewOfFile");
+
+            MEMORY_BASIC_INFORMATION mbi;
+            if (!VirtualQuery(res.pMem, &mbi, sizeof(mbi)))
+                throwSysError("catalog image VirtualQuery");
+
+            res.memSize = (std::size_t)mbi.RegionSize;
+            res.view    = CatalogImageView(res.pMem, res.memSize);
+            return res;
+
+        #else
+
+            int fd = ::shm_open(name.c_str(), O_RDONLY, 0);
+            if (fd<0)
+                throwSysError("catalog image segment open");
+
+            return mapFd(fd);
+
+        #endif
+    }
+
+    #if !defined(WIN32) && !defined(_WIN32)
+
+    //! Подключается к сегменту по дескриптору (дескриптор дублируется, исходный остаётся у вызывающего)
+    static SharedCatalogImage attachFd(int srcFd)
+    {
+        int fd = ::fcntl(srcFd, F_DUPFD_CLOEXEC, 0);
+        if (fd<0)
+            throwSysError("catalog image dup");
+
+        return mapFd(fd);
+    }
+
+    //! Удаляет имя сегмента, уже подключённые процессы продолжают работать
+    static bool remove(const std::string &name)
+    {
+        return ::shm_unlink(name.c_str())==0;
+    }
+
+    #endif
+
+}; // class SharedCatalogImage
+
+//----------------------------------------------------------------------------
+
+} // namespace marty_tr
+
+// marty_tr::
+
@@ -0,0 +1,769 @@
+#pragma once
+/*!
+    \file
+    \brief Политики контейнеров для каталога переводов и таблиц макросов
+
+    Тип контейнера выбирается одним макросом MARTY_TR_CONTAINER_POLICY и не зависит от NDEBUG,
+    поэтому отладочная и релизная сборки ведут себя одинаково (и порядок обхода тот же), а
+    единицы трансляции одной программы видят одни и те же типы:
+
+        MARTY_TR_CONTAINER_POLICY_NODE_HASH     - std::unordered_map (по умолчанию)
+        MARTY_TR_CONTAINER_POLICY_ORDERED_MAP   - std::map (удобно разглядывать в отладчике)
+        MARTY_TR_CONTAINER_POLICY_FLAT_HASH     - FlatHashMap
+        MARTY_TR_CONTAINER_POLICY_SORTED_VECTOR - SortedVectorMap
+
+    Узловые контейнеры (NODE_HASH, ORDERED_MAP) не инвалидируют ссылки при вставке, на это рассчитывает
+    код, работающий с tr_get_all_translations() напрямую (auto &en = all["en-US"]; all["ru-RU"]...).
+    Плоские контейнеры (FLAT_HASH, SORTED_VECTOR) быстрее и компактнее, но вставка в них инвалидирует
+    ссылки и итераторы - их включают явно, когда каталог правится только через API переводчика.
+
+    Старые MARTY_TR_USE_UNORDERED_MAP / MARTY_TR_FORCE_USE_UNORDERED_MAP выбирают NODE_HASH.
+    На MSVC несовпадение политики в разных единицах трансляции - ошибка линковки (detect_mismatch).
+
+    Для сравнения политик в одной программе типы каталога доступны и явно: BasicTranslationsMaps<Policy>.
+
+    Контейнеры с ключами std::pmr::basic_string получают std::pmr::polymorphic_allocator, так что
+    BasicTranslationsMaps<Policy, std::pmr::string> целиком, со вложенными словарями и строками,
+    живёт в переданном memory_resource (арена клиента, huge pages и т.п.).
+ */
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <memory>
+#include <memory_resource>
+#include <set>
+#include <stdexcept>
+#include <string>
+#include <tuple>
+#include <type_traits>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+
+//----------------------------------------------------------------------------
+#define MARTY_TR_CONTAINER_POLICY_FLAT_HASH        1
+#define MARTY_TR_CONTAINER_POLICY_NODE_HASH        2
+#define MARTY_TR_CONTAINER_POLICY_ORDERED_MAP      3
+#define MARTY_TR_CONTAINER_POLICY_SORTED_VECTOR    4
+
+#if !defined(MARTY_TR_CONTAINER_POLICY)
+
+    #define MARTY_TR_CONTAINER_POLICY    MARTY_TR_CONTAINER_POLICY_NODE_HASH
+
+#endif
+
+#if MARTY_TR_CONTAINER_POLICY==MARTY_TR_CONTAINER_POLICY_FLAT_HASH
+    #define MARTY_TR_CONTAINER_POLICY_NAME    "flat_hash"
+#elif MARTY_TR_CONTAINER_POLICY==MARTY_TR_CONTAINER_POLICY_NODE_HASH
+    #define MARTY_TR_CONTAINER_POLICY_NAME    "node_hash"
+#elif MARTY_TR_CONTAINER_POLICY==MARTY_TR_CONTAINER_POLICY_ORDERED_MAP
+    #define MARTY_TR_CONTAINER_POLICY_NAME    "ordered_map"
+#elif MARTY_TR_CONTAINER_POLICY==MARTY_TR_CONTAINER_POLICY_SORTED_VECTOR
+    #define MARTY_TR_CONTAINER_POLICY_NAME    "sorted_vector"
+#else
+    #error "MARTY_TR_CONTAINER_POLICY: unknown container policy"
+#endif
+
+#if defined(_MSC_VER)
+    #pragma detect_mismatch("marty_tr_container_policy", MARTY_TR_CONTAINER_POLICY_NAME)
+#endif
+
+//----------------------------------------------------------------------------
+
+
+
+//----------------------------------------------------------------------------
+// marty_tr::
+namespace marty_tr {
+
+
+
+//----------------------------------------------------------------------------
+namespace impl_helpers {
+
+//! Итератор плоского словаря: хранится std::pair<Key,T>, наружу - std::pair<const Key,T>
+/*! Хранение с неконстантным ключом нужно, чтобы элементы можно было перемещать (рост вектора,
+    удаление переносом последнего) без копирования ключей. Пользователь видит ключ константным,
+    как у std::map/std::unordered_map; пары совпадают по раскладке (так же поступают libc++ и boost).
+ */
+template<typename Key, typename T, bool IsConst>
+class ConstKeyPairIterator
+{
+    typedef std::pair<Key,T>                                                                    storage_type;
+    typedef typename std::conditional<IsConst, const storage_type*, storage_type*>::type         storage_pointer;
+
+    static_assert(sizeof(std::pair<Key,T>)==sizeof(std::pair<const Key,T>), "ConstKeyPairIterator: pair layout mismatch");
+
+    storage_pointer    p = 0;
+
+    template<typename K, typename V, bool C> friend class ConstKeyPairIterator;
+
+public:
+
+    typedef std::random_access_iterator_tag                                                     iterator_category;
+    typedef std::pair<const Key,T>                                                              value_type;
+    typedef std::ptrdiff_t                                                                      difference_type;
+    typedef typename std::conditional<IsConst, const value_type*, value_type*>::type             pointer;
+    typedef typename std::conditional<IsConst, const value_type&, value_type&>::type             reference;
+
+    ConstKeyPairIterator() {}
+    explicit ConstKeyPairIterator(storage_pointer ptr) : p(ptr) {}
+
+    //! iterator -> const_iterator
+    template<bool OtherConst, typename std::enable_if<IsConst && !OtherConst, int>::type = 0>
+    ConstKeyPairIterator(const ConstKeyPairIterator<Key,T,OtherConst> &other) : p(other.p) {}
+
+    storage_pointer storage() const { return p; }
+
+    reference operator*()  const { return *reinterpret_cast<pointer>(p); }
+    pointer   operator->() const { return reinterpret_cast<pointer>(p); }
+    reference operator[](difference_type n) const { return *reinterpret_cast<pointer>(p+n); }
+
+    ConstKeyPairIterator& operator++()    { ++p; return *this; }
+    ConstKeyPairIterator& operator--()    { --p; return *this; }
+    ConstKeyPairIterator  operator++(int) { ConstKeyPairIterator r = *this; ++p; return r; }
+    ConstKeyPairIterator  operator--(int) { ConstKeyPairIterator r = *this; --p; return r; }
+
+    ConstKeyPairIterator& operator+=(difference_type n) { p += n; return *this; }
+    ConstKeyPairIterator& operator-=(difference_type n) { p -= n; return *this; }
+    ConstKeyPairIterator  operator+(difference_type n) const { return ConstKeyPairIterator(p+n); }
+    ConstKeyPairIterator  operator-(difference_type n) const { return ConstKeyPairIterator(p-n); }
+
+    template<bool C> difference_type operator-(const ConstKeyPairIterator<Key,T,C> &other) const { return p-other.p; }
+    template<bool C> bool operator==(const ConstKeyPairIterator<Key,T,C> &other) const { return p==other.p; }
+    template<bool C> bool operator!=(const ConstKeyPairIterator<Key,T,C> &other) const { return p!=other.p; }
+    template<bool C> bool operator< (const ConstKeyPairIterator<Key,T,C> &other) const { return p< other.p; }
+
+}; // class ConstKeyPairIterator
+
+} // namespace impl_helpers
+
+//----------------------------------------------------------------------------
+
+
+
+
+//----------------------------------------------------------------------------
+//! Хэш-таблица с плотным хранением элементов
+/*! Элементы лежат подряд в векторе (обход - последовательное чтение памяти), отдельная таблица
+    корзин по 8 байт (расстояние от идеальной позиции + 8 бит хэша, индекс элемента) с открытой
+    адресацией robin hood. Поиск почти всегда - одна-две соседние корзины, сравнение ключей только
+    при совпадении 8 бит хэша.
+
+    Отличия от std::unordered_map: вставка и удаление инвалидируют итераторы и ссылки, удаление
+    переносит последний элемент на место удалённого. value_type, как и у std::unordered_map, -
+    std::pair<const Key,T>, allocator_type - аллокатор хранимых std::pair<Key,T>.
+ */
+template< typename Key, typename T
+        , typename Hash      = std::hash<Key>
+        , typename KeyEqual  = std::equal_to<Key>
+        , typename Allocator = std::allocator< std::pair<Key,T> >
+        >
+class FlatHashMap
+{
+
+protected:
+
+    struct Bucket
+    {
+        std::uint32_t   distAndFingerprint; // 0 - корзина пуста
+        std::uint32_t   valueIndex;
+    };
+
+    typedef std::vector<std::pair<Key,T>, Allocator>                                                 values_vector_type;
+    typedef std::vector<Bucket, typename std::allocator_traits<Allocator>::template rebind_alloc<Bucket> > buckets_vector_type;
+
+public:
+
+    typedef Key                                                         key_type;
+    typedef T                                                           mapped_type;
+    typedef std::pair<const Key,T>                                      value_type;
+    typedef std::size_t                                                 size_type;
+    typedef Hash                                                        hasher;
+    typedef KeyEqual                                                    key_equal;
+    typedef Allocator                                                   allocator_type;
+    typedef impl_helpers::ConstKeyPairIterator<Key, T, false>           iterator;
+    typedef impl_helpers::ConstKeyPairIterator<Key, T, true >           const_iterator;
+
+protected:
+
+    static constexpr std::uint32_t  distInc         = 1u<<8;
+    static constexpr std::uint32_t  fingerprintMask = distInc-1;
+
+    values_vector_type              values ;
+    buckets_vector_type             buckets;
+    std::size_t                     bucketMask = 0;
+    std::size_t                     maxSize    = 0; // Заполнение таблицы корзин не больше 80%
+    Hash                            hashFn     ;
+    KeyEqual                        equalFn    ;
+
+
+    std::uint64_t mixedHash(const Key &key) const
+    {
+        std::uint64_t h = (std::uint64_t)hashFn(key);
+        h ^= h>>33;
+        h *= 0xFF51AFD7ED558CCDull;
+        h ^= h>>33;
+        return h;
+    }
+
+    static std::uint32_t distAndFingerprintOf(std::uint64_t h) { return distInc | (std::uint32_t)(h & fingerprintMask); }
+    std::size_t          bucketIndexOf(std::uint64_t h) const  { return (std::size_t)(h>>8) & bucketMask; }
+    std::size_t          nextBucket(std::size_t idx)    const  { return (idx+1) & bucketMask; }
+
+    //! Ставит b в корзину idx, сдвигая более "богатые" элементы дальше
+    void placeBucket(Bucket b, std::size_t idx)
+    {
+        while(buckets[idx].distAndFingerprint)
+        {
+            if (buckets[idx].distAndFingerprint<b.distAndFingerprint)
+                std::swap(b, buckets[idx]);
+            b.distAndFingerprint += distInc;
+            idx = nextBucket(idx);
+        }
+        buckets[idx] = b;
+    }
+
+    void rebuildBuckets(std::size_t numBuckets)
+    {
+        buckets.assign(numBuckets, Bucket{0, 0});
+        bucketMask = numBuckets-1;
+        maxSize    = numBuckets*4/5;
+
+        for(std::size_t i=0; i!=values.size(); ++i)
+        {
+            const std::uint64_t h = mixedHash(values[i].first);
+            placeBucket(Bucket{distAndFingerprintOf(h), (std::uint32_t)i}, bucketIndexOf(h));
+        }
+    }
+
+    void growFor(std::size_t numValues)
+    {
+        if (!buckets.empty() && numValues<=maxSize)
+            return;
+
+        if (numValues>=(std::size_t)0xFFFFFFFFu)
+            throw std::length_error("FlatHashMap: too many elements");
+
+        std::size_t numBuckets = buckets.empty() ? 8 : buckets.size();
+        while(numBuckets*4/5 < numValues)
+            numBuckets *= 2;
+
+        rebuildBuckets(numBuckets);
+    }
+
+    //! Корзина элемента с ключом key или npos
+    std::size_t findBucket(const Key &key) const
+    {
+        if (values.empty())
+            return npos;
+
+        const std::uint64_t h   = mixedHash(key);
+        std::uint32_t       daf = distAndFingerprintOf(h);
+        std::size_t         idx = bucketIndexOf(h);
+
+        for(;;)
+        {
+            const Bucket &b = buckets[idx];
+            if (b.distAndFingerprint==daf && equalFn(values[b.valueIndex].first, key))
+                return idx;
+            if (b.distAndFingerprint<daf)
+                return npos;
+            daf += distInc;
+            idx  = nextBucket(idx);
+        }
+    }
+
+    //! Индекс элемента с ключом key, при отсутствии - вставляет новый, сконструированный из args
+    /*! Элемент конструируется сразу в векторе, с его аллокатором (для polymorphic_allocator
+        ключ и значение получают тот же memory_resource)
+     */
+    template<typename... Args>
+    std::pair<std::size_t,bool> findOrInsert(const Key &key, Args&&... args)
+    {
+        growFor(values.size()+1);
+
+        const std::uint64_t h   = mixedHash(key);
+        std::uint32_t       daf = distAndFingerprintOf(h);
+        std::size_t         idx = bucketIndexOf(h);
+
+        for(;;)
+        {
+            const Bucket &b = buckets[idx];
+            if (b.distAndFingerprint==daf && equalFn(values[b.valueIndex].first, key))
+                return std::make_pair((std::size_t)b.valueIndex, false);
+            if (b.distAndFingerprint<daf)
+                break;
+            daf += distInc;
+            idx  = nextBucket(idx);
+        }
+
+        const std::size_t valueIndex = values.size();
+        values.emplace_back(std::forward<Args>(args)...);
+        placeBucket(Bucket{daf, (std::uint32_t)valueIndex}, idx);
+        return std::make_pair(valueIndex, true);
+    }
+
+    //! Удаляет элемент, на который указывает корзина bucketIdx
+    void eraseBucket(std::size_t bucketIdx)
+    {
+        const std::size_t valueIndex = buckets[bucketIdx].valueIndex;
+
+        // Обратный сдвиг: следующие за удалённым элементы встают ближе к своим идеальным позициям
+        std::size_t next = nextBucket(bucketIdx);
+        while(buckets[next].distAndFingerprint>=2*distInc)
+        {
+            buckets[bucketIdx] = Bucket{buckets[next].distAndFingerprint-distInc, buckets[next].valueIndex};
+            bucketIdx = next;
+            next      = nextBucket(next);
+        }
+        buckets[bucketIdx] = Bucket{0, 0};
+
+        // Последний элемент переезжает на место удалённого
+        const std::size_t lastIndex = values.size()-1;
+        if (valueIndex!=lastIndex)
+        {
+            std::size_t idx = bucketIndexOf(mixedHash(values[lastIndex].first));
+            while(buckets[idx].valueIndex!=lastIndex || !buckets[idx].distAndFingerprint)
+                idx = nextBucket(idx);
+            buckets[idx].valueIndex = (std::uint32_t)valueIndex;
+            values[valueIndex] = std::move(values[lastIndex]);
+        }
+        values.pop_back();
+    }
+
+
+public:
+
+    static constexpr std::size_t npos = (std::size_t)-1;
+
+    FlatHashMap() {}
+
+    explicit FlatHashMap(const Allocator &a) : values(a), buckets(a) {}
+
+    FlatHashMap(const FlatHashMap &other) = default;
+    FlatHashMap(FlatHashMap &&other) = default;
+    FlatHashMap& operator=(const FlatHashMap &other) = default;
+    FlatHashMap& operator=(FlatHashMap &&other) = default;
+
+    // Для uses-allocator конструирования, когда FlatHashMap - значение другого контейнера
+    FlatHashMap(const FlatHashMap &other, const Allocator &a)
+    : values(other.values, a), buckets(other.buckets, a), bucketMask(other.bucketMask), maxSize(other.maxSize), hashFn(other.hashFn), equalFn(other.equalFn)
+    {}
+
+    FlatHashMap(FlatHashMap &&other, const Allocator &a)
+    : values(std::move(other.values), a), buckets(std::move(other.buckets), a), bucketMask(other.bucketMask), maxSize(other.maxSize), hashFn(other.hashFn), equalFn(other.equalFn)
+    {
+        other.clear();
+    }
+
+    allocator_type  get_allocator() const { return values.get_allocator(); }
+
+    iterator        begin()        { return iterator(values.data()); }
+    iterator        end()          { return iterator(values.data()+values.size()); }
+    const_iterator  begin()  const { return const_iterator(values.data()); }
+    const_iterator  end()    const { return const_iterator(values.data()+values.size()); }
+    const_iterator  cbegin() const { return begin(); }
+    const_iterator  cend()   const { return end(); }
+
+    bool            empty()  const { return values.empty(); }
+    size_type       size()   const { return values.size(); }
+
+    void clear()
+    {
+        values.clear();
+        buckets.clear();
+        bucketMask = 0;
+        maxSize    = 0;
+    }
+
+    void reserve(size_type n)
+    {
+        values.reserve(n);
+        growFor(n);
+    }
+
+    void swap(FlatHashMap &other)
+    {
+        values.swap(other.values);
+        buckets.swap(other.buckets);
+        std::swap(bucketMask, other.bucketMask);
+        std::swap(maxSize   , other.maxSize   );
+        std::swap(hashFn    , other.hashFn    );
+        std::swap(equalFn   , other.equalFn   );
+    }
+
+    //------------------------------
+    iterator find(const Key &key)
+    {
+        const std::size_t b = findBucket(key);
+        return b==npos ? end() : begin()+(std::ptrdiff_t)buckets[b].valueIndex;
+    }
+
+    const_iterator find(const Key &key) const
+    {
+        const std::size_t b = findBucket(key);
+        return b==npos ? end() : begin()+(std::ptrdiff_t)buckets[b].valueIndex;
+    }
+
+    size_type count(const Key &key)    const { return findBucket(key)==npos ? 0 : 1; }
+    bool      contains(const Key &key) const { return findBucket(key)!=npos; }
+
+    T& at(const Key &key)
+    {
+        const std::size_t b = findBucket(key);
+        if (b==npos)
+            throw std::out_of_range("FlatHashMap::at: key not found");
+        return values[buckets[b].valueIndex].second;
+    }
+
+    const T& at(const Key &key) const
+    {
+        const std::size_t b = findBucket(key);
+        if (b==npos)
+            throw std::out_of_range("FlatHashMap::at: key not found");
+        return values[buckets[b].valueIndex].second;
+    }
+
+    T& operator[](const Key &key)
+    {
+        return values[findOrInsert(key, std::piecewise_construct, std::forward_as_tuple(key), std::forward_as_tuple()).first].second;
+    }
+
+    //------------------------------
+    std::pair<iterator,bool> insert(const value_type &v)
+    {
+        std::pair<std::size_t,bool> r = findOrInsert(v.first, v);
+        return std::make_pair(begin()+(std::ptrdiff_t)r.first, r.second);
+    }
+
+    std::pair<iterator,bool> insert(value_type &&v)
+    {
+        std::pair<std::size_t,bool> r = findOrInsert(v.first, std::move(v));
+        return std::make_pair(begin()+(std::ptrdiff_t)r.first, r.second);
+    }
+
+    template<typename... Args>
+    std::pair<iterator,bool> try_emplace(const Key &key, Args&&... args)
+    {
+        std::pair<std::size_t,bool> r = findOrInsert(key, std::piecewise_construct, std::forward_as_tuple(key), std::forward_as_tuple(std::forward<Args>(args)...));
+        return std::make_pair(begin()+(std::ptrdiff_t)r.first, r.second);
+    }
+
+    template<typename K, typename V>
+    std::pair<iterator,bool> emplace(K &&key, V &&val)
+    {
+        return insert(value_type(std::forward<K>(key), std::forward<V>(val)));
+    }
+
+    //------------------------------
+    size_type erase(const Key &key)
+    {
+        const std::size_t b = findBucket(key);
+        if (b==npos)
+            return 0;
+        eraseBucket(b);
+        return 1;
+    }
+
+    //! Возвращает итератор на ту же позицию - туда переезжает последний элемент
+    iterator erase(const_iterator it)
+    {
+        const std::size_t valueIndex = (std::size_t)(it-cbegin());
+
+        std::size_t idx = bucketIndexOf(mixedHash(it->first));
+        while(buckets[idx].valueIndex!=valueIndex || !buckets[idx].distAndFingerprint)
+            idx = nextBucket(idx);
+        eraseBucket(idx);
+
+        return begin()+(std::ptrdiff_t)valueIndex;
+    }
+
+    iterator erase(iterator it)
+    {
+        return erase(const_iterator(it));
+    }
+
+    //! Равенство содержимого, порядок элементов не важен
+    bool operator==(const FlatHashMap &other) const
+    {
+        if (size()!=other.size())
+            return false;
+
+        for(const std::pair<Key,T> &v : values)
+        {
+            const_iterator it = other.find(v.first);
+            if (it==other.end() || !(it->second==v.second))
+                return false;
+        }
+        return true;
+    }
+
+    bool operator!=(const FlatHashMap &other) const { return !(*this==other); }
+
+}; // class FlatHashMap
+
+//----------------------------------------------------------------------------
+
+
+
+
+//----------------------------------------------------------------------------
+//! Отсортированный вектор пар: минимум памяти, поиск двоичный, вставка и удаление - O(n)
+/*! Подходит для каталога, который загружается один раз и дальше только читается.
+    Обход - в порядке ключей, как у std::map. Вставка и удаление инвалидируют итераторы и ссылки.
+    value_type - std::pair<const Key,T>, как у FlatHashMap.
+ */
+template< typename Key, typename T
+        , typename Compare   = std::less<Key>
+        , typename Allocator = std::allocator< std::pair<Key,T> >
+        >
+class SortedVectorMap
+{
+
+protected:
+
+    typedef std::vector<std::pair<Key,T>, Allocator>        values_vector_type;
+
+public:
+
+    typedef Key                                                         key_type;
+    typedef T                                                           mapped_type;
+    typedef std::pair<const Key,T>                                      value_type;
+    typedef std::size_t                                                 size_type;
+    typedef Compare                                                     key_compare;
+    typedef Allocator                                                   allocator_type;
+    typedef impl_helpers::ConstKeyPairIterator<Key, T, false>           iterator;
+    typedef impl_helpers::ConstKeyPairIterator<Key, T, true >           const_iterator;
+
+protected:
+
+    typedef typename values_vector_type::iterator           storage_iterator;
+
+    values_vector_type              values;
+    Compare                         lessFn;
+
+    storage_iterator lowerBound(const Key &key)
+    {
+        return std::lower_bound(values.begin(), values.end(), key, [&](const std::pair<Key,T> &v, const Key &k) { return lessFn(v.first, k); });
+    }
+
+    std::size_t lowerBoundIndex(const Key &key) const
+    {
+        return (std::size_t)(std::lower_bound(values.begin(), values.end(), key, [&](const std::pair<Key,T> &v, const Key &k) { return lessFn(v.first, k); }) - values.begin());
+    }
+
+    bool isKeyAt(std::size_t idx, const Key &key) const
+    {
+        return idx!=values.size() && !lessFn(key, values[idx].first);
+    }
+
+    iterator       toIterator(storage_iterator it) { return begin()+(it-values.begin()); }
+    storage_iterator toStorage(const_iterator it)  { return values.begin()+(it-cbegin()); }
+
+
+public:
+
+    SortedVectorMap() {}
+
+    explicit SortedVectorMap(const Allocator &a) : values(a) {}
+
+    SortedVectorMap(const SortedVectorMap &other) = default;
+    SortedVectorMap(SortedVectorMap &&other) = default;
+    SortedVectorMap& operator=(const SortedVectorMap &other) = default;
+    SortedVectorMap& operator=(SortedVectorMap &&other) = default;
+
+    SortedVectorMap(const SortedVectorMap &other, const Allocator &a) : values(other.values, a), lessFn(other.lessFn) {}
+    SortedVectorMap(SortedVectorMap &&other, const Allocator &a) : values(std::move(other.values), a), lessFn(other.lessFn) {}
+
+    allocator_type  get_allocator() const { return values.get_allocator(); }
+
+    iterator        begin()        { return iterator(values.data()); }
+    iterator        end()          { return iterator(values.data()+values.size()); }
+    const_iterator  begin()  const { return const_iterator(values.data()); }
+    const_iterator  end()    const { return const_iterator(values.data()+values.size()); }
+    const_iterator  cbegin() const { return begin(); }
+    const_iterator  cend()   const { return end(); }
+
+    bool            empty()  const { return values.empty(); }
+    size_type       size()   const { return values.size(); }
+
+    void clear()                { values.clear(); }
+    void reserve(size_type n)   { values.reserve(n); }
+    void swap(SortedVectorMap &other) { values.swap(other.values); std::swap(lessFn, other.lessFn); }
+
+    //------------------------------
+    iterator find(const Key &key)
+    {
+        const std::size_t idx = lowerBoundIndex(key);
+        return isKeyAt(idx, key) ? begin()+(std::ptrdiff_t)idx : end();
+    }
+
+    const_iterator find(const Key &key) const
+    {
+        const std::size_t idx = lowerBoundIndex(key);
+        return isKeyAt(idx, key) ? begin()+(std::ptrdiff_t)idx : end();
+    }
+
+    size_type count(const Key &key)    const { return find(key)==end() ? 0 : 1; }
+    bool      contains(const Key &key) const { return find(key)!=end(); }
+
+    T& at(const Key &key)
+    {
+        iterator it = find(key);
+        if (it==end())
+            throw std::out_of_range("SortedVectorMap::at: key not found");
+        return it->second;
+    }
+
+    const T& at(const Key &key) const
+    {
+        const_iterator it = find(key);
+        if (it==end())
+            throw std::out_of_range("SortedVectorMap::at: key not found");
+        return it->second;
+    }
+
+    T& operator[](const Key &key)
+    {
+        storage_iterator it = lowerBound(key);
+        if (it==values.end() || lessFn(key, it->first))
+            it = values.emplace(it, std::piecewise_construct, std::forward_as_tuple(key), std::forward_as_tuple());
+        return it->second;
+    }
+
+    //------------------------------
+    std::pair<iterator,bool> insert(const value_type &v)
+    {
+        return try_emplace(v.first, v.second);
+    }
+
+    std::pair<iterator,bool> insert(value_type &&v)
+    {
+        return try_emplace(v.first, std::move(v.second));
+    }
+
+    template<typename... Args>
+    std::pair<iterator,bool> try_emplace(const Key &key, Args&&... args)
+    {
+        storage_iterator it = lowerBound(key);
+        if (it!=values.end() && !lessFn(key, it->first))
+            return std::make_pair(toIterator(it), false);
+        return std::make_pair(toIterator(values.emplace(it, std::piecewise_construct, std::forward_as_tuple(key), std::forward_as_tuple(std::forward<Args>(args)...))), true);
+    }
+
+    template<typename K, typename V>
+    std::pair<iterator,bool> emplace(K &&key, V &&val)
+    {
+        return insert(value_type(std::forward<K>(key), std::forward<V>(val)));
+    }
+
+    //------------------------------
+    size_type erase(const Key &key)
+    {
+        const std::size_t idx = lowerBoundIndex(key);
+        if (!isKeyAt(idx, key))
+            return 0;
+        values.erase(values.begin()+(std::ptrdiff_t)idx);
+        return 1;
+    }
+
+    iterator erase(const_iterator it) { return toIterator(values.erase(toStorage(it))); }
+    iterator erase(iterator it)       { return erase(const_iterator(it)); }
+
+    bool operator==(const SortedVectorMap &other) const { return values==other.values; }
+    bool operator!=(const SortedVectorMap &other) const { return values!=other.values; }
+
+}; // class SortedVectorMap
+
+//----------------------------------------------------------------------------
+
+
+
+
+//----------------------------------------------------------------------------
+namespace impl_helpers {
+
+template<typename T>
+struct IsPmrString : std::false_type {};
+
+template<typename CharType, typename Traits>
+struct IsPmrString< std::basic_string<CharType, Traits, std::pmr::polymorphic_allocator<CharType> > > : std::true_type {};
+
+//! Аллокатор контейнера с ключом Key: у pmr-строк - polymorphic_allocator, иначе std::allocator
+template<typename ValueType, typename Key>
+using ContainerAllocator = typename std::conditional< IsPmrString<Key>::value
+                                                    , std::pmr::polymorphic_allocator<ValueType>
+                                                    , std::allocator<ValueType>
+                                                    >::type;
+
+} // namespace impl_helpers
+
+//----------------------------------------------------------------------------
+// Политики: map_type<K,V> - словари каталога и макросов, set_type<K> - небольшие множества имён
+// (для них плоские контейнеры не дают выигрыша, используются стандартные)
+//----------------------------------------------------------------------------
+struct FlatHashContainerPolicy
+{
+    template<typename K, typename V> using map_type = FlatHashMap<K, V, std::hash<K>, std::equal_to<K>, impl_helpers::ContainerAllocator<std::pair<K,V>, K> >;
+    template<typename K>             using set_type = std::unordered_set<K, std::hash<K>, std::equal_to<K>, impl_helpers::ContainerAllocator<K, K> >;
+    static const char* name() { return "flat_hash"; }
+};
+
+struct NodeHashContainerPolicy
+{
+    template<typename K, typename V> using map_type = std::unordered_map<K, V, std::hash<K>, std::equal_to<K>, impl_helpers::ContainerAllocator<std::pair<const K,V>, K> >;
+    template<typename K>             using set_type = std::unordered_set<K, std::hash<K>, std::equal_to<K>, impl_helpers::ContainerAllocator<K, K> >;
+    static const char* name() { return "node_hash"; }
+};
+
+struct OrderedMapContainerPolicy
+{
+    template<typename K, typename V> using map_type = std::map<K, V, std::less<K>, impl_helpers::ContainerAllocator<std::pair<const K,V>, K> >;
+    template<typename K>             using set_type = std::set<K, std::less<K>, impl_helpers::ContainerAllocator<K, K> >;
+    static const char* name() { return "ordered_map"; }
+};
+
+struct SortedVectorContainerPolicy
+{
+    template<typename K, typename V> using map_type = SortedVectorMap<K, V, std::less<K>, impl_helpers::ContainerAllocator<std::pair<K,V>, K> >;
+    template<typename K>             using set_type = std::set<K, std::less<K>, impl_helpers::ContainerAllocator<K, K> >;
+    static const char* name() { return "sorted_vector"; }
+};
+
+//------------------------------
+#if MARTY_TR_CONTAINER_POLICY==MARTY_TR_CONTAINER_POLICY_FLAT_HASH
+    typedef FlatHashContainerPolicy         DefaultContainerPolicy;
+#elif MARTY_TR_CONTAINER_POLICY==MARTY_TR_CONTAINER_POLICY_NODE_HASH
+    typedef NodeHashContainerPolicy         DefaultContainerPolicy;
+#elif MARTY_TR_CONTAINER_POLICY==MARTY_TR_CONTAINER_POLICY_ORDERED_MAP
+    typedef OrderedMapContainerPolicy       DefaultContainerPolicy;
+#else
+    typedef SortedVectorContainerPolicy     DefaultContainerPolicy;
+#endif
+
+//------------------------------
+//! Типы каталога для заданной политики и типа строк
+/*! BasicTranslationsMaps<Policy, std::pmr::string> - каталог в memory_resource:
+    all_translations_map_t trMap(&arena); дальше все узлы, вложенные словари и строки берутся из arena.
+ */
+template<typename ContainerPolicy, typename StringType = std::string>
+struct BasicTranslationsMaps
+{
+    typedef StringType                                                                              string_type;
+    typedef typename ContainerPolicy::template map_type<StringType, StringType>                     translations_map_t;
+    typedef typename ContainerPolicy::template map_type<StringType, translations_map_t>             category_translations_map_t;
+    typedef typename ContainerPolicy::template map_type<StringType, category_translations_map_t>    all_translations_map_t;
+};
+
+//----------------------------------------------------------------------------
+
+} // namespace marty_tr
+
+// marty_tr::
+
@@ -0,0 +1,279 @@
+#pragma once
+/*!
+    \file
+    \brief Ширина текста в кодовых точках и в экранных колонках (для выравнивания в консоли)
+
+    Ширина символа в колонках: 0 - управляющие и комбинируемые символы, 2 - East Asian Wide/Fullwidth
+    (CJK, хангыль, большая часть эмодзи), 1 - остальные. Таблицы - сокращённая выборка
+    из EastAsianWidth.txt (W, F) и комбинируемых знаков (Mn, Me, Cf) распространённых письменностей.
+
+    Печатный ASCII считается блоками по 16/32 байта (SSE2/AVX2, см. simd_scan.h).
+ */
+
+#include "simd_scan.h"
+#include "utf_transcode.h"
+
+#include <cstddef>
+#include <cstdint>
+
+
+//----------------------------------------------------------------------------
+// marty_tr::utf::
+namespace marty_tr {
+namespace utf {
+
+
+
+//----------------------------------------------------------------------------
+namespace impl_helpers {
+
+struct CodepointRange
+{
+    std::uint32_t first;
+    std::uint32_t last ;
+};
+
+//------------------------------
+//! Символы нулевой ширины
+inline
+const CodepointRange* getZeroWidthRanges(std::size_t &size)
+{
+    static const CodepointRange ranges[] =
+    { {0x0300, 0x036F}, {0x0483, 0x0489}, {0x0591, 0x05BD}, {0x05BF, 0x05BF}, {0x05C1, 0x05C2}
+    , {0x05C4, 0x05C5}, {0x05C7, 0x05C7}, {0x0610, 0x061A}, {0x064B, 0x065F}, {0x0670, 0x0670}
+    , {0x06D6, 0x06DC}, {0x06DF, 0x06E4}, {0x06E7, 0x06E8}, {0x06EA, 0x06ED}, {0x0711, 0x0711}
+    , {0x0730, 0x074A}, {0x07A6, 0x07B0}, {0x0900, 0x0902}, {0x093A, 0x093A}, {0x093C, 0x093C}
+    , {0x0941, 0x0948}, {0x094D, 0x094D}, {0x0951, 0x0957}, {0x0962, 0x0963}, {0x0E31, 0x0E31}
+    , {0x0E34, 0x0E3A}, {0x0E47, 0x0E4E}, {0x1160, 0x11FF}, {0x200B, 0x200F}, {0x202A, 0x202E}
+    , {0x2060, 0x2064}, {0x20D0, 0x20FF}, {0x302A, 0x302D}, {0x3099, 0x309A}, {0xFE00, 0xFE0F}
+    , {0xFE20, 0xFE2F}, {0xFEFF, 0xFEFF}, {0xE0001, 0xE0001}, {0xE0020, 0xE007F}, {0xE0100, 0xE01EF}
+    };
+
+    size = sizeof(ranges)/sizeof(ranges[0]);
+    return &ranges[0];
+}
+
+//------------------------------
+//! Символы двойной ширины
+inline
+const CodepointRange* getWideRanges(std::size_t &size)
+{
+    static const CodepointRange ranges[] =
+    { {0x1100, 0x115F}, {0x231A, 0x231B}, {0x2329, 0x232A}, {0x23E9, 0x23EC}, {0x23F0, 0x23F0}
+    , {0x23F3, 0x23F3}, {0x25FD, 0x25FE}, {0x2614, 0x2615}, {0x2648, 0x2653}, {0x267F, 0x267F}
+    , {0x2693, 0x2693}, {0x26A1, 0x26A1}, {0x26AA, 0x26AB}, {0x26BD, 0x26BE}, {0x26C4, 0x26C5}
+    , {0x26CE, 0x26CE}, {0x26D4, 0x26D4}, {0x26EA, 0x26EA}, {0x26F2, 0x26F3}, {0x26F5, 0x26F5}
+    , {0x26FA, 0x26FA}, {0x26FD, 0x26FD}, {0x2705, 0x2705}, {0x270A, 0x270B}, {0x2728, 0x2728}
+    , {0x274C, 0x274C}, {0x274E, 0x274E}, {0x2753, 0x2755}, {0x2757, 0x2757}, {0x2795, 0x2797}
+    , {0x27B0, 0x27B0}, {0x27BF, 0x27BF}, {0x2B1B, 0x2B1C}, {0x2B50, 0x2B50}, {0x2B55, 0x2B55}
+    , {0x2E80, 0x303E}, {0x3041, 0x4DBF}, {0x4E00, 0xA4CF}, {0xA960, 0xA97F}, {0xAC00, 0xD7A3}
+    , {0xF900, 0xFAFF}, {0xFE10, 0xFE19}, {0xFE30, 0xFE6F}, {0xFF00, 0xFF60}, {0xFFE0, 0xFFE6}
+    , {0x16FE0, 0x16FE4}, {0x17000, 0x18CFF}, {0x1B000, 0x1B2FF}, {0x1F004, 0x1F004}, {0x1F0CF, 0x1F0CF}
+    , {0x1F18E, 0x1F18E}, {0x1F191, 0x1F19A}, {0x1F200, 0x1F202}, {0x1F210, 0x1F23B}, {0x1F240, 0x1F248}
+    , {0x1F250, 0x1F251}, {0x1F260, 0x1F265}, {0x1F300, 0x1F320}, {0x1F32D, 0x1F335}, {0x1F337, 0x1F37C}
+    , {0x1F37E, 0x1F393}, {0x1F3A0, 0x1F3CA}, {0x1F3CF, 0x1F3D3}, {0x1F3E0, 0x1F3F0}, {0x1F3F4, 0x1F3F4}
+    , {0x1F3F8, 0x1F43E}, {0x1F440, 0x1F440}, {0x1F442, 0x1F4FC}, {0x1F4FF, 0x1F53D}, {0x1F54B, 0x1F54E}
+    , {0x1F550, 0x1F567}, {0x1F57A, 0x1F57A}, {0x1F595, 0x1F596}, {0x1F5A4, 0x1F5A4}, {0x1F5FB, 0x1F64F}
+    , {0x1F680, 0x1F6C5}, {0x1F6CC, 0x1F6CC}, {0x1F6D0, 0x1F6D2}, {0x1F6D5, 0x1F6D7}, {0x1F6DC, 0x1F6DF}
+    , {0x1F6EB, 0x1F6EC}, {0x1F6F4, 0x1F6FC}, {0x1F7E0, 0x1F7EB}, {0x1F7F0, 0x1F7F0}, {0x1F90C, 0x1F93A}
+    , {0x1F93C, 0x1F945}, {0x1F947, 0x1F9FF}, {0x1FA70, 0x1FAFF}, {0x20000, 0x2FFFD}, {0x30000, 0x3FFFD}
+    };
+
+    size = sizeof(ranges)/sizeof(ranges[0]);
+    return &ranges[0];
+}
+
+//------------------------------
+inline
+bool isInRanges(std::uint32_t cp, const CodepointRange *ranges, std::size_t size)
+{
+    if (!size || cp<ranges[0].first || cp>ranges[size-1].last)
+        return false;
+
+    std::size_t lo = 0;
+    std::size_t hi = size;
+    while(lo<hi)
+    {
+        std::size_t mid = lo + (hi-lo)/2;
+        if (cp>ranges[mid].last)
+            lo = mid+1;
+        else if (cp<ranges[mid].first)
+            hi = mid;
+        else
+            return true;
+    }
+
+    return false;
+}
+
+//------------------------------
+//! Длина начального участка из печатного ASCII (0x20-0x7E)
+inline
+std::size_t findFirstNonPrintableAscii(const char *p, std::size_t size)
+{
+    std::size_t pos = 0;
+
+    // Знаковое сравнение: байты >= 0x80 отрицательны и тоже попадают в "< 0x20"
+    #if defined(MARTY_TR_SIMD_AVX2)
+
+        if (size>=32)
+        {
+            const __m256i ctrlBound = _mm256_set1_epi8(0x20);
+            const __m256i del       = _mm256_set1_epi8(0x7F);
+            for(; pos+32<=size; pos+=32)
+            {
+                const __m256i v = _mm256_loadu_si256((const __m256i*)(p+pos));
+                const __m256i bad = _mm256_or_si256(_mm256_cmpgt_epi8(ctrlBound, v), _mm256_cmpeq_epi8(v, del));
+                const std::uint32_t mask = (std::uint32_t)_mm256_movemask_epi8(bad);
+                if (mask)
+                    return pos + simd::impl_helpers::countTrailingZeros(mask);
+            }
+        }
+
+    #endif
+
+    #if defined(MARTY_TR_SIMD_SSE2)
+
+        if (size-pos>=16)
+        {
+            const __m128i ctrlBound = _mm_set1_epi8(0x20);
+            const __m128i del       = _mm_set1_epi8(0x7F);
+            for(; pos+16<=size; pos+=16)
+            {
+                const __m128i v = _mm_loadu_si128((const __m128i*)(p+pos));
+                const __m128i bad = _mm_or_si128(_mm_cmplt_epi8(v, ctrlBound), _mm_cmpeq_epi8(v, del));
+                const std::uint32_t mask = (std::uint32_t)_mm_movemask_epi8(bad);
+                if (mask)
+                    return pos + simd::impl_helpers::countTrailingZeros(mask);
+            }
+        }
+
+    #endif
+
+    for(; pos!=size; ++pos)
+    {
+        const std::uint8_t ch = (std::uint8_t)p[pos];
+        if (ch<0x20 || ch>=0x7F)
+            return pos;
+    }
+
+    return size;
+}
+
+//------------------------------
+//! Декодирует один символ из UTF-8/UTF-16/UTF-32 (по размеру CharType), сдвигает pos
+template<typename CharType> inline
+std::uint32_t decodeNext(const CharType *p, std::size_t size, std::size_t &pos)
+{
+    if constexpr (sizeof(CharType)==1)
+    {
+        return decodeUtf8((const char*)p, size, pos);
+    }
+    else if constexpr (sizeof(CharType)==2)
+    {
+        std::uint32_t cp = (std::uint32_t)p[pos++] & 0xFFFFu;
+        if (cp>=0xD800 && cp<=0xDBFF && pos<size && ((std::uint32_t)p[pos]&0xFC00u)==0xDC00u)
+            cp = 0x10000 + ((cp-0xD800)<<10) + (((std::uint32_t)p[pos++]&0xFFFFu)-0xDC00);
+        return cp;
+    }
+    else
+    {
+        return (std::uint32_t)p[pos++];
+    }
+}
+
+} // namespace impl_helpers
+
+//----------------------------------------------------------------------------
+
+
+
+
+//----------------------------------------------------------------------------
+//! Ширина символа в экранных колонках: 0, 1 или 2
+inline
+unsigned codepointDisplayWidth(std::uint32_t cp)
+{
+    if (cp<0x20 || (cp>=0x7F && cp<0xA0))
+        return 0;
+
+    if (cp<0x300)
+        return 1;
+
+    std::size_t size = 0;
+    const impl_helpers::CodepointRange *ranges = impl_helpers::getZeroWidthRanges(size);
+    if (impl_helpers::isInRanges(cp, ranges, size))
+        return 0;
+
+    ranges = impl_helpers::getWideRanges(size);
+    if (impl_helpers::isInRanges(cp, ranges, size))
+        return 2;
+
+    return 1;
+}
+
+//------------------------------
+//! Число кодовых точек, CharType задаёт кодировку: 1 байт - UTF-8, 2 - UTF-16, 4 - UTF-32
+template<typename CharType> inline
+std::size_t codepointsCount(const CharType *p, std::size_t size)
+{
+    if constexpr (sizeof(CharType)==4)
+    {
+        return size;
+    }
+    else
+    {
+        std::size_t res = 0;
+        std::size_t pos = 0;
+
+        while(pos<size)
+        {
+            if constexpr (sizeof(CharType)==1)
+            {
+                const std::size_t n = impl_helpers::findFirstNonAscii((const char*)p+pos, size-pos);
+                pos += n;
+                res += n;
+                if (pos>=size)
+                    break;
+            }
+
+            impl_helpers::decodeNext(p, size, pos);
+            ++res;
+        }
+
+        return res;
+    }
+}
+
+//------------------------------
+//! Ширина текста в экранных колонках
+template<typename CharType> inline
+std::size_t displayWidth(const CharType *p, std::size_t size)
+{
+    std::size_t res = 0;
+    std::size_t pos = 0;
+
+    while(pos<size)
+    {
+        if constexpr (sizeof(CharType)==1)
+        {
+            const std::size_t n = impl_helpers::findFirstNonPrintableAscii((const char*)p+pos, size-pos);
+            pos += n;
+            res += n;
+            if (pos>=size)
+                break;
+        }
+
+        res += codepointDisplayWidth(impl_helpers::decodeNext(p, size, pos));
+    }
+
+    return res;
+}
+
+//----------------------------------------------------------------------------
+
+} // namespace utf
+} // namespace marty_tr
+
+// marty_tr::utf::
+
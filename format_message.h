@@ -2,14 +2,30 @@
 /*!
     \file
     \brief Форматирование сообщений при помощи макросов (копия umba::FormatMessage)
+
+    Все строки FormatMessage (аргументы, таблица макросов, промежуточные строки форматирования
+    и substMacros, результат toString()) создаются с аллокатором текста сообщения или заданным явно:
+
+        std::pmr::monotonic_buffer_resource arena(buf, sizeof(buf));
+        FormatMessage<std::pmr::string> fm(std::allocator_arg, &arena, msg);
+
+    Так временные строки одного запроса берутся из арены запроса и освобождаются вместе с ней.
  */
 
 
 
+#include "display_width.h"
 #include "macro_helpers.h"
 #include "marty_tr.h"
+#include "message_template.h"
+#include "utf_transcode.h"
 
-#include "marty_utf/utf.h"
+#include <array>
+#include <bitset>
+#include <memory>
+#include <sstream>
+#include <type_traits>
+#include <utility>
 
 
 #if defined(FormatMessage)
@@ -17,6 +33,15 @@
 #endif
 
 
+//----------------------------------------------------------------------------
+#if !defined(MARTY_TR_FORMAT_MESSAGE_MAX_POSITIONAL_ARGS)
+
+    //! Максимальное число позиционных аргументов ($(1), $(2) ...) в FormatMessage
+    #define MARTY_TR_FORMAT_MESSAGE_MAX_POSITIONAL_ARGS    16
+
+#endif
+
+
 
 namespace marty_tr {
 
@@ -28,6 +53,14 @@ enum class EFormatAlign : unsigned
     right
 };
 
+//! Как считается ширина аргумента при выравнивании (fieldWidth)
+enum class EFormatWidthMode : unsigned
+{
+    codeUnits,      //!< Элементы строки (байты для UTF-8) - как раньше
+    codePoints,     //!< Кодовые точки
+    displayColumns  //!< Экранные колонки (CJK и эмодзи - 2, комбинируемые символы - 0)
+};
+
 
 
 
@@ -40,33 +73,59 @@ class FormatMessage
 
 public:
 
-    typedef umba::macros::StringStringMap<StringType>  macros_map_type;
+    typedef macros::StringStringMap<StringType>  macros_map_type;
+    typedef typename StringType::allocator_type  allocator_type;
+
+    static constexpr std::size_t maxPositionalArgs = MARTY_TR_FORMAT_MESSAGE_MAX_POSITIONAL_ARGS;
 
 protected:
 
-    umba::macros::StringStringMap<StringType>  formattedMacros    ;
-    StringType                                 messageText        ;
-    bool                                       fShowbase   = true ;
-    bool                                       fShowsign   = false;
-    unsigned                                   uBase       = 10   ;
+    allocator_type                               alloc              ; // Для всех строк, создаваемых FormatMessage
+    macros::StringStringMap<StringType>          formattedMacros    ;
+    std::array<StringType, maxPositionalArgs>    positionalArgs     ; // $(1) - positionalArgs[0]
+    std::bitset<maxPositionalArgs>               positionalArgsSet  ;
+    StringType                                   messageText        ;
+    bool                                         fShowbase   = true ;
+    bool                                         fShowsign   = false;
+    unsigned                                     uBase       = 10   ;
+    EFormatWidthMode                             eWidthMode  = EFormatWidthMode::codeUnits;
+    macros::SubstMacrosLimits                    substLimits        ;
+    std::shared_ptr< const MessageTemplate<StringType> >  pTemplate;  // Предварительно разобранный текст, если есть
 
     //TODO: !!! Надо подумать на тему замены десятичного разделителя и разделителя разрядов
 
 
 protected: // utils
 
+    std::size_t textWidth(const StringType &str) const
+    {
+        switch(eWidthMode)
+        {
+            case EFormatWidthMode::codePoints    : return utf::codepointsCount(str.data(), str.size());
+            case EFormatWidthMode::displayColumns: return utf::displayWidth(str.data(), str.size());
+            default                              : return str.size();
+        }
+    }
+
     StringType getComplementString( const StringType &str, std::size_t sz, CharType fillChar=(CharType)' ')
     {
-        if (str.size()>=sz)
-            return StringType();
+        std::size_t strWidth = textWidth(str);
+        if (strWidth>=sz)
+            return StringType(alloc);
+
+        return StringType( sz-strWidth, fillChar, alloc );
+    }
 
-        return StringType( sz-str.size(), fillChar );
+    template<std::size_t... Idx>
+    static std::array<StringType, maxPositionalArgs> makePositionalArgs(const allocator_type &a, std::index_sequence<Idx...>)
+    {
+        return { { ((void)Idx, StringType(a))... } };
     }
 
     template<typename UnsignedType>
-    static StringType formatUnsigned(UnsignedType u, UnsignedType base, std::size_t width)
+    StringType formatUnsigned(UnsignedType u, UnsignedType base, std::size_t width) const
     {
-        StringType resStr;
+        StringType resStr(alloc);
 
         for(std::size_t i=0; i<width || u; ++i)
         {
@@ -82,11 +141,10 @@ protected: // utils
     }
 
     template< typename UnsignedType >
-    static
-    typename std::enable_if<std::is_unsigned<UnsignedType>::value, typename StringType >::type
-    formatIntDecimal(UnsignedType u, bool showSign = false)
+    typename std::enable_if<std::is_unsigned<UnsignedType>::value, StringType >::type
+    formatIntDecimal(UnsignedType u, bool showSign = false) const
     {
-        StringType resStr;
+        StringType resStr(alloc);
 
         while(u)
         {
@@ -96,6 +154,11 @@ protected: // utils
             u /= 10;
         }
 
+        if (resStr.empty())
+        {
+            resStr.append(1,(CharType)'0');
+        }
+
         if (showSign)
         {
             resStr.append(1,(CharType)'+');
@@ -108,13 +171,12 @@ protected: // utils
     }
 
     template< typename IntType >
-    static
-    typename std::enable_if<std::is_signed<IntType>::value, typename StringType>::type
-    formatIntDecimal(IntType intVal, bool showSign = false)
+    typename std::enable_if<std::is_signed<IntType>::value, StringType>::type
+    formatIntDecimal(IntType intVal, bool showSign = false) const
     {
-        typedef std::make_unsigned<IntType>::type UnsignedType;
+        typedef typename std::make_unsigned<IntType>::type UnsignedType;
 
-        StringType resStr;
+        StringType resStr(alloc);
 
         bool neg = false;
 
@@ -134,6 +196,11 @@ protected: // utils
             u /= 10;
         }
 
+        if (resStr.empty())
+        {
+            resStr.append(1,(CharType)'0');
+        }
+
         if (neg || showSign)
         {
             resStr.append(1,(CharType)(neg ? '-': '+'));
@@ -145,9 +212,9 @@ protected: // utils
     }
 
 
-    static StringType getUnsignedPrefix(unsigned base)
+    StringType getUnsignedPrefix(unsigned base) const
     {
-        StringType resStr;
+        StringType resStr(alloc);
 
         switch(base)
         {
@@ -196,6 +263,115 @@ protected: // utils
         // }
     }
 
+    StringType alignArgText(const StringType &val, std::size_t fieldWidth, EFormatAlign align)
+    {
+        StringType completemntString = getComplementString( val, fieldWidth, (CharType)' ' /* fillChar */ );
+
+        // Собираем через append - operator+ от const-строк отдал бы результат аллокатору по умолчанию
+        StringType res(alloc);
+        res.reserve(val.size()+completemntString.size());
+        if (align==EFormatAlign::left)
+        {
+            res.append(val);
+            res.append(completemntString);
+        }
+        else if (align==EFormatAlign::right)
+        {
+            res.append(completemntString);
+            res.append(val);
+        }
+        else // center
+        {
+            std::size_t lenLeft  = completemntString.size()/2;
+            res.append(completemntString, 0, lenLeft);
+            res.append(val);
+            res.append(completemntString, lenLeft, StringType::npos);
+        }
+        return res;
+    }
+
+    template< class T
+            , typename = std::enable_if_t<std::is_integral<T>::value> >
+    StringType formatIntegralArg(T val, std::size_t fieldWidth)
+    {
+        typedef typename std::make_unsigned<T>::type UnsignedType;
+
+        if (uBase==10)
+        {
+            return formatIntDecimal(val, fShowsign);
+        }
+
+        std::size_t prefixWidth = getUnsignedPrefixLen((UnsignedType)uBase);
+        std::size_t numberWidth = prefixWidth<fieldWidth ? fieldWidth-prefixWidth : 0;
+
+        return fShowbase
+             ? getUnsignedPrefix((UnsignedType)uBase) + formatUnsigned<UnsignedType>(val, getCorrectBase(uBase), numberWidth)
+             :                                          formatUnsigned<UnsignedType>(val, getCorrectBase(uBase), numberWidth)
+             ;
+    }
+
+    template< class T
+            , typename = std::enable_if_t<std::is_floating_point<T>::value> >
+    StringType formatFloatingPointArg(T val, int precision)
+    {
+        std::basic_ostringstream<CharType> oss;
+
+        if (precision<0)
+        {
+            oss.precision(-precision);
+        }
+        else
+        {
+            oss.precision(precision);
+        }
+
+        oss << val;
+
+        const std::basic_string<CharType> ossStr = oss.str();
+        StringType str(ossStr.data(), ossStr.size(), alloc);
+
+        typename StringType::size_type numAddZeros = 0;
+        if (precision>=0)
+        {
+            typename StringType::size_type dotPos = str.rfind((CharType)'.');
+            if (dotPos==str.npos)
+            {
+                str.append(1,(CharType)'.');
+                numAddZeros = (typename StringType::size_type)precision;
+            }
+            else
+            {
+                typename StringType::size_type curNumDigits = str.size()-(dotPos+1);
+                if (curNumDigits<(typename StringType::size_type)precision)
+                {
+                    numAddZeros = (typename StringType::size_type)precision - curNumDigits;
+                }
+            }
+        }
+
+        str.append(numAddZeros, (CharType)'0');
+
+        return str;
+    }
+
+    //! Шаблон текста из кэша переводчика t, кэш шаблонов есть только для std::string
+    void findPrecompiledTemplate(const Translator &t)
+    {
+        if constexpr (std::is_same_v<StringType, std::string>)
+            pTemplate = t.findPrecompiledTemplate(messageText);
+        else
+            MARTY_ARG_USED(t);
+    }
+
+    StringType& positionalArg(std::size_t argIdx)
+    {
+        if (argIdx<1 || argIdx>maxPositionalArgs)
+            throw std::runtime_error("FormatMessage::arg: positional argument index is out of range");
+
+        positionalArgsSet.set(argIdx-1);
+        return positionalArgs[argIdx-1];
+    }
+
 
 public:
 
@@ -205,19 +381,89 @@ public:
 
     virtual ~FormatMessage() {}
 
+    //! Аллокатор - аллокатор текста сообщения
+    /*! Предкомпилированный шаблон ищется в кэше переводчика по умолчанию (tr_get_default_translator()).
+        Для текстов, переведённых другим экземпляром Translator, - конструкторы с const Translator&.
+     */
     FormatMessage( const StringType &msg, const std::string &ltag=std::string() )
-    : formattedMacros()
-    , messageText(msg)
+    : FormatMessage(std::allocator_arg, msg.get_allocator(), msg, ltag)
+    {}
+
+    FormatMessage( StringType &&msg, const std::string &ltag=std::string() )
+    : alloc(msg.get_allocator())
+    , formattedMacros(alloc)
+    , positionalArgs(makePositionalArgs(alloc, std::make_index_sequence<maxPositionalArgs>()))
+    , positionalArgsSet()
+    , messageText(std::move(msg))
     {
         MARTY_ARG_USED(ltag);
+        findPrecompiledTemplate(tr_get_default_translator());
+    }
+
+    //! Явно заданный аллокатор, например, polymorphic_allocator арены запроса
+    FormatMessage( std::allocator_arg_t, const allocator_type &a, const StringType &msg, const std::string &ltag=std::string() )
+    : FormatMessage(std::allocator_arg, a, tr_get_default_translator(), msg, ltag)
+    {}
+
+    //! Предкомпилированный шаблон ищется в кэше переводчика t (обычно того, который переводил msg)
+    FormatMessage( const Translator &t, const StringType &msg, const std::string &ltag=std::string() )
+    : FormatMessage(std::allocator_arg, msg.get_allocator(), t, msg, ltag)
+    {}
+
+    FormatMessage( std::allocator_arg_t, const allocator_type &a, const Translator &t, const StringType &msg, const std::string &ltag=std::string() )
+    : alloc(a)
+    , formattedMacros(alloc)
+    , positionalArgs(makePositionalArgs(alloc, std::make_index_sequence<maxPositionalArgs>()))
+    , positionalArgsSet()
+    , messageText(msg, alloc)
+    {
+        MARTY_ARG_USED(ltag);
+        findPrecompiledTemplate(t);
+    }
+
+    //! Готовый шаблон текста msg (или nullptr - тогда substMacros), кэши переводчиков не используются
+    FormatMessage( std::shared_ptr< const MessageTemplate<StringType> > pTpl, const StringType &msg, const std::string &ltag=std::string() )
+    : alloc(msg.get_allocator())
+    , formattedMacros(alloc)
+    , positionalArgs(makePositionalArgs(alloc, std::make_index_sequence<maxPositionalArgs>()))
+    , positionalArgsSet()
+    , messageText(msg, alloc)
+    , pTemplate(std::move(pTpl))
+    {
+        MARTY_ARG_USED(ltag);
+    }
+
+    allocator_type get_allocator() const
+    {
+        return alloc;
     }
 
 
     StringType toString() const
     {
-        return umba::macros::substMacros( messageText, umba::macros::MacroTextFromMapRef<StringType>(formattedMacros)
-                                        , umba::macros::smf_KeepUnknownVars | umba::macros::smf_DisableRecursion
-                                        );
+        if (pTemplate)
+        {
+            if (pTemplate->isLiteralOnly())
+                return pTemplate->literalText();
+
+            return pTemplate->render( [&](const StringType &name, std::size_t argIdx, typename MessageTemplate<StringType>::StringViewType &text)
+                                      {
+                                          if (argIdx && argIdx<=maxPositionalArgs && positionalArgsSet[argIdx-1])
+                                          {
+                                              text = positionalArgs[argIdx-1];
+                                              return true;
+                                          }
+
+                                          return macros::getMacroTextFromMap(formattedMacros, name, text);
+                                      }
+                                    , substLimits
+                                    );
+        }
+
+        return macros::substMacros( messageText, macros::MacroTextFromIndexedArgsRef<StringType, maxPositionalArgs>(positionalArgs, positionalArgsSet, formattedMacros)
+                                  , macros::smf_KeepUnknownVars | macros::smf_DisableRecursion
+                                  , substLimits
+                                  );
     }
 
     operator StringType() const
@@ -248,6 +494,13 @@ public:
     }
 
 
+    //! Ограничения на подстановку, для шаблонов из ненадёжных источников
+    FormatMessage& limits(const macros::SubstMacrosLimits &l)
+    {
+        substLimits = l;
+        return *this;
+    }
+
     FormatMessage& base(unsigned b)
     {
         if (b>36)
@@ -256,6 +509,17 @@ public:
         return *this;
     }
 
+    //! Режим подсчёта ширины для выравнивания аргументов
+    FormatMessage& widthMode(EFormatWidthMode m)
+    {
+        eWidthMode = m;
+        return *this;
+    }
+
+    FormatMessage& widthCodeUnits()  { return widthMode(EFormatWidthMode::codeUnits     ); }
+    FormatMessage& widthCodePoints() { return widthMode(EFormatWidthMode::codePoints    ); }
+    FormatMessage& widthColumns()    { return widthMode(EFormatWidthMode::displayColumns); }
+
     FormatMessage& hex() { return base(16); }
     FormatMessage& dec() { return base(10); }
     FormatMessage& oct() { return base(8 ); }
@@ -291,55 +555,15 @@ public:
 
     FormatMessage& arg(const StringType &argName, const StringType &val, std::size_t fieldWidth=0, EFormatAlign align=EFormatAlign::left)
     {
-        StringType completemntString = getComplementString( val, fieldWidth, (CharType)' ' /* fillChar */ );
-        if (align==EFormatAlign::left)
-        {
-            formattedMacros[argName] = val + completemntString;
-        }
-        else if (align==EFormatAlign::right)
-        {
-            formattedMacros[argName] = completemntString + val;
-        }
-        else // center
-        {
-            std::size_t lenLeft  = completemntString.size()/2;
-            std::size_t lenRight = completemntString.size()-lenLeft;
-            formattedMacros[argName] = StringType(completemntString, 0, lenLeft)
-                                     + val
-                                     + StringType(completemntString, lenLeft)
-                                     ;
-        }
-
+        formattedMacros[argName] = alignArgText(val, fieldWidth, align);
         return *this;
-
     }
 
     template< class T
             , typename = std::enable_if_t<std::is_integral<T>::value> >
     FormatMessage& arg(const StringType &argName, T val, std::size_t fieldWidth=0, EFormatAlign align=EFormatAlign::left)
     {
-        typedef std::make_signed<T>::type   IntType;
-        typedef std::make_unsigned<T>::type UnsignedType;
-
-        StringType  valFormatted;
-
-        if (uBase==10)
-        {
-            valFormatted = formatIntDecimal(val, fShowsign);
-
-        }
-        else
-        {
-            std::size_t prefixWidth = getUnsignedPrefixLen((UnsignedType)uBase);
-            std::size_t numberWidth = prefixWidth<fieldWidth ? fieldWidth-prefixWidth : 0;
-
-            valFormatted = fShowbase
-                         ? getUnsignedPrefix((UnsignedType)uBase) + formatUnsigned<UnsignedType>(val, getCorrectBase(uBase), numberWidth)
-                         :                                          formatUnsigned<UnsignedType>(val, getCorrectBase(uBase), numberWidth)
-                         ;
-        }
-
-        return arg(argName, valFormatted, fieldWidth, align);
+        return arg(argName, formatIntegralArg(val, fieldWidth), fieldWidth, align);
     }
 
     template< class T
@@ -351,43 +575,44 @@ public:
                       , EFormatAlign align=EFormatAlign::left
                       )
     {
-        std::basic_ostringstream<CharType> oss;
-
-        if (precision<0)
-        {
-            oss.precision(-precision);
-        }
-        else
-        {
-            oss.precision(precision);
-        }
+        return arg(argName, formatFloatingPointArg(val, precision), fieldWidth, align);
+    }
 
-        oss << val;
+    //! Позиционный аргумент, подставляется в $(argIdx), нумерация с единицы
+    FormatMessage& arg(std::size_t argIdx, const StringType &val, std::size_t fieldWidth=0, EFormatAlign align=EFormatAlign::left)
+    {
+        positionalArg(argIdx) = alignArgText(val, fieldWidth, align);
+        return *this;
+    }
 
-        StringType str = oss.str();
+    template< class T
+            , typename = std::enable_if_t<std::is_integral<T>::value> >
+    FormatMessage& arg(std::size_t argIdx, T val, std::size_t fieldWidth=0, EFormatAlign align=EFormatAlign::left)
+    {
+        return arg(argIdx, formatIntegralArg(val, fieldWidth), fieldWidth, align);
+    }
 
-        StringType::size_type numAddZeros = 0;
-        if (precision>=0)
-        {
-            StringType::size_type dotPos = str.rfind((CharType)'.');
-            if (dotPos==str.npos)
-            {
-                str.append(1,(CharType)'.');
-                numAddZeros = (StringType::size_type)precision;
-            }
-            else
-            {
-                StringType::size_type curNumDigits = str.size()-(dotPos+1);
-                if (curNumDigits<(StringType::size_type)precision)
-                {
-                    numAddZeros = (StringType::size_type)precision - curNumDigits;
-                }
-            }
-        }
+    template< class T
+            , typename = std::enable_if_t<std::is_floating_point<T>::value> >
+    FormatMessage& arg( std::size_t argIdx
+                      , T val
+                      , int precision=-2 //!< <0 - auto, the max number of digits after the decimal point, >0 - force number of digits
+                      , std::size_t fieldWidth=0
+                      , EFormatAlign align=EFormatAlign::left
+                      )
+    {
+        return arg(argIdx, formatFloatingPointArg(val, precision), fieldWidth, align);
+    }
 
-        str.append(numAddZeros, (CharType)'0');
+    //! Задаёт позиционные аргументы $(1), $(2) ... по порядку, с форматированием по умолчанию
+    template<typename... ArgTypes>
+    FormatMessage& args(ArgTypes&&... vals)
+    {
+        static_assert(sizeof...(ArgTypes)<=maxPositionalArgs, "FormatMessage::args: too many positional arguments");
 
-        return arg(argName, str, fieldWidth, align);
+        std::size_t argIdx = 1;
+        (arg(argIdx++, std::forward<ArgTypes>(vals)), ...);
+        return *this;
     }
 
 
@@ -406,9 +631,6 @@ StreamType& operator<<(StreamType &s, const FormatMessage<StringType> &fm)
 //----------------------------------------------------------------------------
 
 
-// using marty_utf::toUtf8;
-// using marty_utf::fromUtf8
-
 template<typename StringType> inline
 constexpr bool isWideStr()
 {
@@ -419,7 +641,7 @@ template<typename StringType> inline
 FormatMessage<StringType> formatMessage(const StringType &msg)
 {
     if constexpr (isWideStr<StringType>())
-        return FormatMessage<StringType>(marty_utf::fromUtf8(marty_tr::tr(marty_tr::to_ascii(msg), tr_get_def_category(), tr_get_def_lang())), tr_get_def_lang());
+        return FormatMessage<StringType>(marty_tr::tr_wide(msg, tr_get_def_category(), tr_get_def_lang()), tr_get_def_lang());
     else
         return FormatMessage<StringType>(                    marty_tr::tr(marty_tr::to_ascii(msg), tr_get_def_category(), tr_get_def_lang() ), tr_get_def_lang());
 }
@@ -435,7 +657,7 @@ FormatMessage<std::string> formatMessage(const char *msg)
 inline
 FormatMessage<std::wstring> formatMessage(const wchar_t *msg)
 {
-    return FormatMessage<std::wstring>(marty_utf::fromUtf8(marty_tr::tr(marty_tr::to_ascii(msg), tr_get_def_category(), tr_get_def_lang())), tr_get_def_lang());
+    return FormatMessage<std::wstring>(marty_tr::tr_wide(std::wstring(msg), tr_get_def_category(), tr_get_def_lang()), tr_get_def_lang());
 }
 
 //----------------------------------------------------------------------------
@@ -447,7 +669,7 @@ template<typename StringType> inline
 FormatMessage<StringType> formatMessage(const StringType &msg, const std::string &catId)
 {
     if constexpr (isWideStr<StringType>())
-        return FormatMessage<StringType>(marty_utf::fromUtf8(marty_tr::tr(marty_tr::to_ascii(msg), catId, tr_get_def_lang())), tr_get_def_lang());
+        return FormatMessage<StringType>(marty_tr::tr_wide(msg, catId, tr_get_def_lang()), tr_get_def_lang());
     else
         return FormatMessage<StringType>(                    marty_tr::tr(marty_tr::to_ascii(msg), catId, tr_get_def_lang() ), tr_get_def_lang());
 }
@@ -463,7 +685,7 @@ FormatMessage<std::string> formatMessage(const char *msg, const std::string &cat
 inline
 FormatMessage<std::wstring> formatMessage(const wchar_t *msg, const std::string &catId)
 {
-    return FormatMessage<std::wstring>(marty_utf::fromUtf8(marty_tr::tr(marty_tr::to_ascii(msg), catId, tr_get_def_lang())), tr_get_def_lang());
+    return FormatMessage<std::wstring>(marty_tr::tr_wide(std::wstring(msg), catId, tr_get_def_lang()), tr_get_def_lang());
 }
 
 //----------------------------------------------------------------------------
@@ -476,7 +698,7 @@ template<typename StringType> inline
 FormatMessage<StringType> formatMessage(const StringType &msg, const std::string &catId, const std::string &ltag)
 {
     if constexpr (isWideStr<StringType>())
-        return FormatMessage<StringType>(marty_utf::fromUtf8(marty_tr::tr(marty_tr::to_ascii(msg), catId, ltag)), ltag);
+        return FormatMessage<StringType>(marty_tr::tr_wide(msg, catId, ltag), ltag);
     else
         return FormatMessage<StringType>(                    marty_tr::tr(marty_tr::to_ascii(msg), catId, ltag ), ltag);
 }
@@ -492,7 +714,7 @@ FormatMessage<std::string> formatMessage(const char *msg, const std::string &cat
 inline
 FormatMessage<std::wstring> formatMessage(const wchar_t *msg, const std::string &catId, const std::string &ltag=std::string())
 {
-    return FormatMessage<std::wstring>(marty_utf::fromUtf8(marty_tr::tr(marty_tr::to_ascii(msg), catId, ltag)), ltag);
+    return FormatMessage<std::wstring>(marty_tr::tr_wide(std::wstring(msg), catId, ltag), ltag);
 }
 
 //----------------------------------------------------------------------------
@@ -500,6 +722,100 @@ FormatMessage<std::wstring> formatMessage(const wchar_t *msg, const std::string
 
 
 
+//----------------------------------------------------------------------------
+// Перевод и предкомпилированный шаблон берутся у переводчика t, а не у переводчика по умолчанию
+
+template<typename StringType> inline
+FormatMessage<StringType> formatMessage(const Translator &t, const StringType &msg, const std::string &catId, const std::string &ltag)
+{
+    if constexpr (isWideStr<StringType>())
+        return FormatMessage<StringType>(t, t.trWide(msg, catId, ltag), ltag);
+    else
+        return FormatMessage<StringType>(t, t.tr(marty_tr::to_ascii(msg), catId, ltag), ltag);
+}
+
+//------------------------------
+inline
+FormatMessage<std::string> formatMessage(const Translator &t, const char *msg, const std::string &catId, const std::string &ltag)
+{
+    return FormatMessage<std::string>(t, t.tr(marty_tr::to_ascii(msg), catId, ltag), ltag);
+}
+
+//------------------------------
+inline
+FormatMessage<std::wstring> formatMessage(const Translator &t, const wchar_t *msg, const std::string &catId, const std::string &ltag)
+{
+    return FormatMessage<std::wstring>(t, t.trWide(std::wstring(msg), catId, ltag), ltag);
+}
+
+//----------------------------------------------------------------------------
+
+
+
+
+//----------------------------------------------------------------------------
+// Множественные формы - форма выбирается по числу n и правилам языка, см. tr_plural
+// Само число в текст не подставляется, его нужно передать аргументом, например: .arg(1, n)
+
+template<typename StringType> inline
+FormatMessage<StringType> formatMessagePlural(const StringType &msg, std::int64_t n, const std::string &catId, const std::string &ltag)
+{
+    if constexpr (isWideStr<StringType>())
+        return FormatMessage<StringType>(utf::fromUtf8<typename StringType::value_type>(marty_tr::tr_plural(utf::toUtf8(msg), n, catId, ltag)), ltag);
+    else
+        return FormatMessage<StringType>(                    marty_tr::tr_plural(marty_tr::to_ascii(msg), n, catId, ltag ), ltag);
+}
+
+template<typename StringType> inline
+FormatMessage<StringType> formatMessagePlural(const StringType &msg, std::int64_t n, const std::string &catId)
+{
+    return formatMessagePlural(msg, n, catId, tr_get_def_lang());
+}
+
+template<typename StringType> inline
+FormatMessage<StringType> formatMessagePlural(const StringType &msg, std::int64_t n)
+{
+    return formatMessagePlural(msg, n, tr_get_def_category(), tr_get_def_lang());
+}
+
+//------------------------------
+inline
+FormatMessage<std::string> formatMessagePlural(const char *msg, std::int64_t n, const std::string &catId, const std::string &ltag)
+{
+    return FormatMessage<std::string>(marty_tr::tr_plural(marty_tr::to_ascii(msg), n, catId, ltag), ltag);
+}
+
+inline
+FormatMessage<std::string> formatMessagePlural(const char *msg, std::int64_t n, const std::string &catId)
+{
+    return formatMessagePlural(msg, n, catId, tr_get_def_lang());
+}
+
+inline
+FormatMessage<std::string> formatMessagePlural(const char *msg, std::int64_t n)
+{
+    return formatMessagePlural(msg, n, tr_get_def_category(), tr_get_def_lang());
+}
+
+//------------------------------
+inline
+FormatMessage<std::wstring> formatMessagePlural(const wchar_t *msg, std::int64_t n, const std::string &catId, const std::string &ltag)
+{
+    return FormatMessage<std::wstring>(utf::fromUtf8<wchar_t>(marty_tr::tr_plural(utf::toUtf8(msg), n, catId, ltag)), ltag);
+}
+
+inline
+FormatMessage<std::wstring> formatMessagePlural(const wchar_t *msg, std::int64_t n, const std::string &catId)
+{
+    return formatMessagePlural(msg, n, catId, tr_get_def_lang());
+}
+
+inline
+FormatMessage<std::wstring> formatMessagePlural(const wchar_t *msg, std::int64_t n)
+{
+    return formatMessagePlural(msg, n, tr_get_def_category(), tr_get_def_lang());
+}
+
 //----------------------------------------------------------------------------
 
 } // namespace marty_tr
@@ -2,8 +2,11 @@
 
 #include "macros.h"
 
+#include <array>
+#include <bitset>
 #include <map>
 #include <string>
+#include <string_view>
 #include <unordered_map>
 
 
@@ -18,7 +21,21 @@ namespace macros{
 template<typename StringType>
 bool getMacroTextFromMap(const StringStringMap<StringType> &m, const StringType &name, StringType &text)
 {
-    StringStringMap<StringType>::const_iterator it = m.find(name);
+    typename StringStringMap<StringType>::const_iterator it = m.find(name);
+    if (it==m.end())
+        return false;
+
+    text = it->second;
+
+    return true;
+}
+
+//------------------------------
+//! Без копирования - view на значение в map
+template<typename StringType>
+bool getMacroTextFromMap(const StringStringMap<StringType> &m, const StringType &name, std::basic_string_view<typename StringType::value_type, typename StringType::traits_type> &text)
+{
+    typename StringStringMap<StringType>::const_iterator it = m.find(name);
     if (it==m.end())
         return false;
 
@@ -45,6 +62,12 @@ struct MacroTextFromMap : public IMacroTextGetter<StringType>
         return getMacroTextFromMap(m, name, text);
     }
 
+    //! Для статического вызова из substMacros
+    bool operator()(const StringType &name, std::basic_string_view<typename StringType::value_type, typename StringType::traits_type> &text) const
+    {
+        return getMacroTextFromMap(m, name, text);
+    }
+
     const char* getName() const { return "MacroTextFromMap"; }
 
 }; // struct MacroTextFromMap
@@ -62,10 +85,61 @@ struct MacroTextFromMapRef : public IMacroTextGetter<StringType>
         return getMacroTextFromMap(m, name, text);
     }
 
+    //! Для статического вызова из substMacros
+    bool operator()(const StringType &name, std::basic_string_view<typename StringType::value_type, typename StringType::traits_type> &text) const
+    {
+        return getMacroTextFromMap(m, name, text);
+    }
+
     const char* getName() const { return "MacroTextFromMapRef"; }
 
 }; // struct MacroTextFromMapRef
 
+//------------------------------
+//! Позиционные аргументы ($(1), $(2) ...) берутся из массива по индексу, без хэширования имени, остальные - из map.
+//! Незаданный позиционный аргумент ищется в map - его могли задать по имени, arg("1", v)
+template<typename StringType, std::size_t NumArgs>
+struct MacroTextFromIndexedArgsRef : public IMacroTextGetter<StringType>
+{
+    const std::array<StringType, NumArgs>   &args;
+    const std::bitset<NumArgs>              &argsSet;
+    const StringStringMap<StringType>       &m;
+
+    MacroTextFromIndexedArgsRef( const std::array<StringType, NumArgs>   &_args
+                               , const std::bitset<NumArgs>              &_argsSet
+                               , const StringStringMap<StringType>       &_m
+                               )
+    : args(_args), argsSet(_argsSet), m(_m) {}
+
+    virtual bool operator()(const StringType &name, StringType &text) const override
+    {
+        std::size_t idx = util::parseMacroArgIndex(name);
+        if (idx && idx<=NumArgs && argsSet[idx-1])
+        {
+            text = args[idx-1];
+            return true;
+        }
+
+        return getMacroTextFromMap(m, name, text);
+    }
+
+    //! Для статического вызова из substMacros
+    bool operator()(const StringType &name, std::basic_string_view<typename StringType::value_type, typename StringType::traits_type> &text) const
+    {
+        std::size_t idx = util::parseMacroArgIndex(name);
+        if (idx && idx<=NumArgs && argsSet[idx-1])
+        {
+            text = args[idx-1];
+            return true;
+        }
+
+        return getMacroTextFromMap(m, name, text);
+    }
+
+    const char* getName() const { return "MacroTextFromIndexedArgsRef"; }
+
+}; // struct MacroTextFromIndexedArgsRef
+
 //----------------------------------------------------------------------------
 
 
@@ -75,7 +149,7 @@ struct MacroTextFromMapRef : public IMacroTextGetter<StringType>
 template<typename StreamType, typename StringType>
 StreamType& printMacros( StreamType &oss, const StringType &prefix, const StringStringMap<StringType> &macros )
 {
-    StringStringMap<StringType>::const_iterator it = macros.begin();
+    typename StringStringMap<StringType>::const_iterator it = macros.begin();
 
     std::size_t maxName = 0;
 
@@ -1,11 +1,21 @@
 #pragma once
 
+#include "container_policy.h"
+#include "simd_scan.h"
+
 #include <cctype>
+#include <cstddef>
+#include <deque>
 #include <map>
+#include <memory>
 #include <set>
+#include <stdexcept>
 #include <string>
+#include <string_view>
+#include <type_traits>
 #include <unordered_map>
 #include <unordered_set>
+#include <vector>
 
 
 //----------------------------------------------------------------------------
@@ -17,6 +27,29 @@
 #endif
 
 //----------------------------------------------------------------------------
+// Лимиты substMacros по умолчанию, 0 - без ограничения
+#if !defined(MARTY_TR_SUBST_MACROS_MAX_OUTPUT_SIZE)
+
+    //! Максимальный суммарный объём текста (в символах), порождаемого одним вызовом substMacros
+    #define MARTY_TR_SUBST_MACROS_MAX_OUTPUT_SIZE    (16u*1024u*1024u)
+
+#endif
+
+#if !defined(MARTY_TR_SUBST_MACROS_MAX_DEPTH)
+
+    //! Максимальная глубина вложенности раскрытия макросов
+    #define MARTY_TR_SUBST_MACROS_MAX_DEPTH          256u
+
+#endif
+
+#if !defined(MARTY_TR_SUBST_MACROS_MAX_STEPS)
+
+    //! Максимальное число обработанных ссылок на макросы $(...) за один вызов substMacros
+    #define MARTY_TR_SUBST_MACROS_MAX_STEPS          (1024u*1024u)
+
+#endif
+
+//----------------------------------------------------------------------------
 
 
 
@@ -55,30 +88,13 @@ namespace macros{
 
 
 
-// https://en.cppreference.com/w/cpp/language/type_alias
-#if !defined(NDEBUG)
-
-    // При отладке удобнее разглядывать std::map
-
-    template<typename StringType>
-    using StringStringMap = std::map<StringType,StringType>;
+// Тип словарей макросов - та же политика, что и у каталога (см. container_policy.h)
 
-    template<typename StringType>
-    using StringSet = std::set<StringType>;
-
-#else
-
-    // В релизе std::unordered_map быстрее
-    template<typename StringType>
-    using StringStringMap = std::unordered_map<StringType,StringType>;
-
-    template<typename StringType>
-    using StringSet = std::unordered_set<StringType>;
-
-    template<typename StringType>
-    using StringSet = std::unordered_set<StringType>;
+template<typename StringType>
+using StringStringMap = ::marty_tr::DefaultContainerPolicy::map_type<StringType,StringType>;
 
-#endif
+template<typename StringType>
+using StringSet = ::marty_tr::DefaultContainerPolicy::set_type<StringType>;
 
 
 
@@ -115,6 +131,43 @@ const int keepUnknownVars                     = smf_KeepUnknownVars
 
 
 //----------------------------------------------------------------------------
+//! Ограничения на раскрытие макросов, 0 - без ограничения
+/*! Макросы могут задаваться пользователем, и набор определений вида
+    A:=$(B)$(B), B:=$(C)$(C) ... раскрывается в экспоненциальный объём текста.
+    Проверка usedMacros от этого не спасает, она запрещает только самоссылки.
+ */
+struct SubstMacrosLimits
+{
+    //! Суммарный объём порождённого текста, включая раскрытые аргументы параметризованных макросов
+    std::size_t    maxOutputSize = MARTY_TR_SUBST_MACROS_MAX_OUTPUT_SIZE;
+    //! Глубина вложенности раскрытия
+    std::size_t    maxDepth      = MARTY_TR_SUBST_MACROS_MAX_DEPTH;
+    //! Число обработанных ссылок $(...), включая ненайденные и условные
+    std::size_t    maxSteps      = MARTY_TR_SUBST_MACROS_MAX_STEPS;
+
+    static SubstMacrosLimits unlimited()
+    {
+        return SubstMacrosLimits{0, 0, 0};
+    }
+
+}; // struct SubstMacrosLimits
+
+//------------------------------
+//! Исключение при превышении одного из SubstMacrosLimits
+class SubstMacrosLimitError : public std::runtime_error
+{
+public:
+
+    explicit SubstMacrosLimitError(const char *msg) : std::runtime_error(msg) {}
+};
+
+//----------------------------------------------------------------------------
+//! Динамический (виртуальный) источник текста макросов, текст копируется в text
+/*! Для горячих путей лучше передавать в substMacros getter конкретного типа, у которого есть
+    невиртуальный bool operator()(const StringType &name, std::basic_string_view<CharType> &text) const -
+    вызов инлайнится, а текст не копируется. Возвращаемый view должен оставаться валидным
+    до конца вызова substMacros.
+ */
 template<typename StringType>
 struct IMacroTextGetter
 {
@@ -122,6 +175,15 @@ struct IMacroTextGetter
     virtual bool operator()(const StringType &name, StringType &text) const = 0;
 };
 
+//------------------------------
+//! Getter умеет отдавать текст макроса как string_view, без копирования
+template<typename MacroTextGetter, typename StringType> constexpr
+bool isMacroTextViewGetter()
+{
+    typedef std::basic_string_view<typename StringType::value_type, typename StringType::traits_type> StringViewType;
+    return std::is_invocable_r_v<bool, const MacroTextGetter&, const StringType&, StringViewType&>;
+}
+
 //-----------------------------------------------------------------------------
 
 
@@ -149,6 +211,15 @@ struct not_pred
     //! Оператор функционального объекта
     bool operator()( ParamType ch ) const { return !actualPred(ch); }
 };
+
+//-----------------------------------------------------------------------------
+//! Предикат для trim по умолчанию - пробел и таб
+template<typename CharType>
+struct whitespace_pred
+{
+    bool operator()( CharType ch ) const { return ch==(CharType)' ' || ch==(CharType)'\t'; }
+};
+
 //-----------------------------------------------------------------------------
 //! Создаёт строку StringType из std::wstring (работает только для базового диапазона ASCII).
 template<typename StringType> inline StringType make_string( const std::wstring &str )
@@ -169,6 +240,16 @@ template<typename StringType> inline StringType make_string( const std::string &
     return res;
 }
 
+//-----------------------------------------------------------------------------
+//! Создаёт строку StringType из строки с другим типом символов - char16_t, char32_t (работает только для базового диапазона ASCII).
+template<typename StringType, typename CharT, typename Traits, typename Allocator> inline StringType make_string( const std::basic_string<CharT, Traits, Allocator> &str )
+{
+    StringType res;
+    for(auto ch : str)
+        res.append(1, (typename StringType::value_type)ch );
+    return res;
+}
+
 //-----------------------------------------------------------------------------
 //! Создаёт строку StringType из const wchar_t* (работает только для базового диапазона ASCII).
 template<typename StringType> inline StringType make_string( const wchar_t *str )
@@ -341,6 +422,11 @@ findChar(const ::std::basic_string<CharType, Traits, Allocator> &str, typename :
     typename ::std::basic_string<CharType, Traits, Allocator>::size_type size = str.size();
     for(; pos<size; ++pos)
     {
+        // Пропускаем всё, кроме скобок и искомого символа
+        pos += simd::findFirstOf(str.data()+pos, size-pos, (CharType)startBr, (CharType)endBr, (CharType)Ch);
+        if (pos>=size)
+            break;
+
         if (str[pos]==(CharType)startBr) { ++depth; continue; }
         if (str[pos]==(CharType)endBr)   { --depth; continue; }
         if (!depth && str[pos]==(CharType)Ch) return pos;
@@ -386,7 +472,7 @@ template < typename CharType
 ::std::basic_string<CharType, Traits, Allocator> filterDotsSlashes(const ::std::basic_string<CharType, Traits, Allocator> &str, int flags )
    {
 
-    ::std::basic_string<CharType, Traits, Allocator> res = str;
+    ::std::basic_string<CharType, Traits, Allocator> res(str, str.get_allocator()); // С аллокатором исходной строки (pmr)
     //res.reserve(str.size());
     for(typename ::std::basic_string<CharType, Traits, Allocator>::iterator it = res.begin(); it!=res.end(); ++it)
        {
@@ -422,7 +508,7 @@ struct MacroTextGetterProxy : public IMacroTextGetter<StringType>
         // if (getMacroTextFromMap(m, name, text))
         //     return true;
 
-        StringStringMap<StringType>::const_iterator it = m.find(name);
+        typename StringStringMap<StringType>::const_iterator it = m.find(name);
         if (it!=m.end())
         {
             text = it->second;
@@ -438,15 +524,42 @@ struct MacroTextGetterProxy : public IMacroTextGetter<StringType>
 
 
 
+//-----------------------------------------------------------------------------
+//! Разбирает имя позиционного макроса ($(1), $(2) ...), возвращает индекс (1..) или 0, если имя не является индексом
+/*! Ведущие нули не допускаются, чтобы $(01) не совпадал с $(1) - так же ведёт себя поиск по имени в map
+ */
+template<typename StringType> inline
+std::size_t parseMacroArgIndex(const StringType &name)
+{
+    typedef typename StringType::value_type CharType;
+
+    if (name.empty() || name.size()>4 || name[0]==(CharType)'0')
+        return 0;
+
+    std::size_t idx = 0;
+    for(auto ch : name)
+    {
+        if (ch<(CharType)'0' || ch>(CharType)'9')
+            return 0;
+        idx = idx*10 + (std::size_t)(ch-(CharType)'0');
+    }
+
+    return idx;
+}
+
 //-----------------------------------------------------------------------------
 template<typename StringType, typename IntType> inline
-StringType toString(IntType i)
+StringType toString(IntType i, const typename StringType::allocator_type &a = typename StringType::allocator_type())
 {
-    if constexpr (sizeof(typename StringType::value_type)>sizeof(char)) // is wide version?
+    if constexpr (std::is_same_v<StringType, std::wstring>)
         return std::to_wstring(i);
-    else
+    else if constexpr (std::is_same_v<StringType, std::string>)
         return std::to_string(i);
-
+    else
+    {
+        const std::string str = std::to_string(i); // pmr-строки, char16_t, char32_t - только цифры и знак
+        return StringType(str.begin(), str.end(), a);
+    }
 }
 
 //-----------------------------------------------------------------------------
@@ -462,249 +575,594 @@ StringType toString(IntType i)
 
 
 //-----------------------------------------------------------------------------
-template < typename CharType
-         , typename Traits
-         , typename Allocator
-         >
-::std::basic_string<CharType, Traits, Allocator>
-substMacros( const ::std::basic_string<CharType, Traits, Allocator>                          &str
-           , const IMacroTextGetter< ::std::basic_string<CharType, Traits, Allocator> >      &getMacroText
-           , int                                                                             flags
-           , StringSet< ::std::basic_string<CharType, Traits, Allocator> >                   &usedMacros
-           )
-   {
-    namespace util = ::marty_tr::macros::util;
+namespace impl_helpers{
 
-    typedef ::std::basic_string<CharType, Traits, Allocator> StringType;
 
-    StringType percentZero(1, (CharType)'%'); percentZero.append(1, (CharType)'0');
 
-    typename StringType::const_iterator it = str.begin(), mstartIt = str.end();
-    StringType res; res.reserve(str.size());
-    //bool prevSlash = false;
+//-----------------------------------------------------------------------------
+//! Маленький вектор для тривиальных типов - первые N элементов без аллокаций
+template<typename T, std::size_t N>
+class SmallVector
+{
+    T                 buf[N];
+    std::vector<T>    ext;
+    std::size_t       sz = 0;
 
-    for(; it!=str.end(); ++it)
-       {
-        if (*it!=(CharType)'$')
-           res.append(1, *it);
+public:
+
+    std::size_t size() const { return sz; }
+
+    void push_back(const T &t)
+    {
+        if (sz<N)
+        {
+            buf[sz++] = t;
+            return;
+        }
+
+        ext.resize(sz-N);
+        ext.push_back(t);
+        ++sz;
+    }
+
+    //! Только уменьшение размера
+    void truncate(std::size_t newSize)
+    {
+        if (newSize<sz)
+            sz = newSize;
+    }
+
+    const T& operator[](std::size_t idx) const { return idx<N ? buf[idx] : ext[idx-N]; }
+
+}; // class SmallVector
+
+//-----------------------------------------------------------------------------
+//! Разбирает имя параметра макроса (%0, %1 ...), возвращает индекс или npos
+/*! Совпадает с поиском по map, где ключи формируются как '%'+util::toString(idx)
+ */
+template<typename StringType> inline
+std::size_t parseMacroParamIndex(const StringType &name)
+{
+    typedef typename StringType::value_type CharType;
+
+    if (name.size()<2 || name.size()>10 || name[0]!=(CharType)'%')
+        return (std::size_t)-1;
+
+    if (name[1]==(CharType)'0' && name.size()>2)
+        return (std::size_t)-1; // Ведущие нули
+
+    std::size_t idx = 0;
+    for(std::size_t i=1; i!=name.size(); ++i)
+    {
+        CharType ch = name[i];
+        if (ch<(CharType)'0' || ch>(CharType)'9')
+            return (std::size_t)-1;
+        idx = idx*10 + (std::size_t)(ch-(CharType)'0');
+    }
+
+    return idx;
+}
+
+//-----------------------------------------------------------------------------
+//! Нерекурсивная подстановка макросов
+/*! Вместо рекурсии - явный стек фреймов. Фрейм - текст, который надо просканировать
+    (исходная строка, тело макроса, ветка условия или аргумент параметризованного макроса),
+    или вызов параметризованного макроса, который по очереди раскрывает свои аргументы, а затем тело.
+
+    Множество раскрываемых в данный момент макросов - это имена на пути от корня стека до текущего фрейма,
+    каждый фрейм видит только префикс inProgress[0..usedSize). Аналогично, параметры %N - это стек слоёв,
+    фрейм видит слои layers[0..layersSize). Поэтому ничего не копируется при входе в макрос.
+
+    Getter вызывается статически. Если он отдаёт string_view (isMacroTextViewGetter), фрейм сканирует
+    текст макроса на месте, иначе текст копируется во фрейм.
+ */
+template<typename StringType, typename MacroTextGetter = IMacroTextGetter<StringType> >
+class SubstMacrosEngine
+{
+    typedef typename StringType::value_type                                         CharType;
+    typedef typename StringType::size_type                                          size_type;
+    typedef std::basic_string_view<CharType, typename StringType::traits_type>      StringViewType;
+    typedef typename StringType::allocator_type                                     allocator_type;
+    typedef std::vector<StringType, typename std::allocator_traits<allocator_type>::template rebind_alloc<StringType> >  ParamValues;
+
+    struct Frame
+    {
+        explicit Frame(const allocator_type &a) : ownText(a), macroName(a), params(a) {}
+
+        bool                 paramCall  = false;
+        StringType           ownText    ;         // Текст фрейма, если getter не отдаёт view
+        StringViewType       text       ;
+        size_type            pos        = 0;
+        StringType          *pRes       = 0;      // Куда пишется результат
+        std::size_t          usedSize   = 0;
+        std::size_t          layersSize = 0;
+
+        // Только для вызова параметризованного макроса
+        StringType           macroName  ;
+        ParamValues          params     ;         // params[0] - %0 (число аргументов), params[i] - %i
+        std::size_t          nextParam  = 1;
+    };
+
+    const MacroTextGetter                            &getMacroText;
+    const int                                         flags;
+    const StringSet<StringType>                      &usedMacros;  // Переданные снаружи
+    const SubstMacrosLimits                           limits;
+    const allocator_type                              alloc;       // Результат и все промежуточные строки - с аллокатором исходной строки
+
+    std::deque<Frame, typename std::allocator_traits<allocator_type>::template rebind_alloc<Frame> >  frames; // deque - ссылки на элементы не инвалидируются при push_back
+    SmallVector<const StringType*, 16>                inProgress;
+    SmallVector<const ParamValues*, 8>                layers;
+
+    std::size_t                                       outputSize = 0; // Текст, записанный завершёнными шагами
+    std::size_t                                       steps      = 0;
+
+public:
+
+    SubstMacrosEngine(const MacroTextGetter &g, int f, const StringSet<StringType> &used, const SubstMacrosLimits &l, const allocator_type &a = allocator_type())
+    : getMacroText(g), flags(f), usedMacros(used), limits(l), alloc(a), frames(a)
+    {}
+
+    StringType run(const StringType &str)
+    {
+        StringType res(alloc); res.reserve(str.size());
+
+        Frame &root = frames.emplace_back(alloc);
+        root.text   = str;
+        root.pRes   = &res;
+
+        while(!frames.empty())
+        {
+            Frame &f = frames.back();
+            if (f.paramCall)
+                stepParamCall(f);
+            else if (stepText(f))
+                frames.pop_back();
+        }
+
+        return res;
+    }
+
+protected:
+
+    //! Вызывается перед добавлением фрейма
+    void checkDepth() const
+    {
+        if (limits.maxDepth && frames.size()>=limits.maxDepth)
+            throw SubstMacrosLimitError("substMacros: macro expansion depth limit exceeded");
+    }
+
+    void checkOutputSize(std::size_t stepOutputSize) const
+    {
+        if (limits.maxOutputSize && outputSize+stepOutputSize>limits.maxOutputSize)
+            throw SubstMacrosLimitError("substMacros: output size limit exceeded");
+    }
+
+    void countStep()
+    {
+        if (limits.maxSteps && ++steps>limits.maxSteps)
+            throw SubstMacrosLimitError("substMacros: macro expansion steps limit exceeded");
+    }
+
+    bool isUsed(const StringType &name, std::size_t usedSize) const
+    {
+        for(std::size_t i=0; i!=usedSize; ++i)
+        {
+            if (*inProgress[i]==name)
+                return true;
+        }
+
+        return usedMacros.find(name)!=usedMacros.end();
+    }
+
+    //! Текст макроса - view на параметр, на данные getter'а или на buf
+    bool getText(const StringType &name, StringViewType &text, StringType &buf, std::size_t layersSize) const
+    {
+        if (layersSize)
+        {
+            std::size_t idx = parseMacroParamIndex(name);
+            if (idx!=(std::size_t)-1)
+            {
+                // Внутренние слои перекрывают внешние
+                for(std::size_t i=layersSize; i!=0; --i)
+                {
+                    const ParamValues &params = *layers[i-1];
+                    if (idx<params.size())
+                    {
+                        text = params[idx];
+                        return true;
+                    }
+                }
+            }
+        }
+
+        if constexpr (isMacroTextViewGetter<MacroTextGetter, StringType>())
+        {
+            return getMacroText(name, text);
+        }
         else
-           {
-            mstartIt = it;
-            ++it;
-            if (it==str.end()) continue;
+        {
+            if (!getMacroText(name, buf))
+                return false;
+            text = buf;
+            return true;
+        }
+    }
+
+    //! Если текст лежит в buf, фрейм забирает его себе
+    static void setFrameText(Frame &fr, StringViewType text, StringType &buf)
+    {
+        if (!text.empty() && text.data()==buf.data())
+        {
+            fr.ownText = std::move(buf);
+            fr.text    = fr.ownText;
+        }
+        else
+        {
+            fr.text    = text;
+        }
+    }
+
+    //! Добавляет на стек фрейм с текстом, видимые имена/слои - префикс длины usedSize/layersSize
+    void pushText(StringType &&text, StringType *pRes, std::size_t usedSize, std::size_t layersSize, const StringType *pUsedName)
+    {
+        checkDepth();
+
+        inProgress.truncate(usedSize);
+        if (pUsedName)
+        {
+            inProgress.push_back(pUsedName);
+            ++usedSize;
+        }
+
+        layers.truncate(layersSize);
 
-            if (*it==(CharType)'$')
-               {
-                res.append(1, *it);
+        Frame &child     = frames.emplace_back(alloc);
+        child.ownText    = std::move(text);
+        child.text       = child.ownText;
+        child.pRes       = pRes;
+        child.usedSize   = usedSize;
+        child.layersSize = layersSize;
+    }
+
+    void stepParamCall(Frame &f)
+    {
+        if (f.nextParam<f.params.size())
+        {
+            // Аргументы раскрываются в контексте вызывающего, но вызываемый макрос уже считается используемым
+            std::size_t pi = f.nextParam++;
+            StringType  argText = std::move(f.params[pi]);
+            f.params[pi].clear();
+            pushText(std::move(argText), &f.params[pi], f.usedSize, f.layersSize, &f.macroName);
+            return;
+        }
+
+        if (f.nextParam==f.params.size())
+        {
+            ++f.nextParam;
+            // Тело сканируется прямо из фрейма вызова, он живёт дольше
+            pushText(StringType(alloc), f.pRes, f.usedSize, f.layersSize, &f.macroName);
+            layers.push_back(&f.params);
+            frames.back().text       = f.text;
+            frames.back().layersSize = f.layersSize+1;
+            return;
+        }
+
+        frames.pop_back();
+    }
+
+    //! Сканирует текст фрейма до следующего вложенного раскрытия, возвращает true, если текст закончился
+    bool stepText(Frame &f)
+    {
+        namespace util = ::marty_tr::macros::util;
+
+        const StringViewType str = f.text;
+        StringType          &res = *f.pRes;
+        const size_type   size = str.size();
+        size_type         pos  = f.pos;
+        const size_type   resStartSize = res.size();
+
+        // Учитываем текст, записанный этим шагом, при любом выходе
+        struct OutputCounter
+        {
+            std::size_t &outputSize; const StringType &res; size_type startSize;
+            ~OutputCounter() { outputSize += res.size()-startSize; }
+        } outputCounter{outputSize, res, resStartSize};
+
+        while(pos<size)
+        {
+            checkOutputSize(res.size()-resStartSize);
+
+            size_type dollarPos = pos + simd::findFirstOf(str.data()+pos, size-pos, (CharType)'$');
+            if (dollarPos>=size)
+            {
+                res.append(str, pos, StringType::npos);
+                break;
+            }
+
+            res.append(str, pos, dollarPos-pos);
+
+            size_type mstartPos = dollarPos;
+            pos = dollarPos+1;
+            if (pos>=size) break;
+
+            if (str[pos]==(CharType)'$')
+            {
+                res.append(1, str[pos]);
+                ++pos;
                 continue;
-               }
+            }
 
-            if (*it!=(CharType)'(')
-               {
+            if (str[pos]!=(CharType)'(')
+            {
                 res.append(1, (CharType)'$');
-                res.append(1, *it);
+                res.append(1, str[pos]);
+                ++pos;
                 continue;
-               }
+            }
 
-            ++it;
-            if (it==str.end()) continue;
+            ++pos;
+            if (pos>=size) break;
 
-            typename StringType::const_iterator start = it;
+            size_type start = pos;
             int brCnt = 1;
-            for(; it!=str.end(); ++it)
-               {
-                if (*it==(CharType)'(') { ++brCnt; continue; }
-                if (*it==(CharType)')')
-                   {
+            for(; pos<size; ++pos)
+            {
+                pos += simd::findFirstOf(str.data()+pos, size-pos, (CharType)'(', (CharType)')');
+                if (pos>=size)
+                    break;
+
+                if (str[pos]==(CharType)'(') { ++brCnt; continue; }
+                if (str[pos]==(CharType)')')
+                {
                     --brCnt;
                     if (!brCnt) break;
-                   }
-               }
+                }
+            }
 
-            if (it==str.end())
-               {
-                res.append(start, it);
-                continue;
-               }
+            if (pos>=size)
+            {
+                res.append(str, start, StringType::npos);
+                break;
+            }
+
+            size_type  endPos    = pos+1; // за закрывающей скобкой
+            StringType macroName = StringType(str, start, pos-start, alloc);
+            pos = endPos;
+
+            countStep();
 
-            StringType macroName = StringType(start, it);
-            //std::string::size_type qPos = macroName.find('?', 0);
             typename StringType::size_type qPos = util::findChar<'(', ')', '?'>(macroName);
-            //findChar(const std::string str)
             // ? not found, not an conditional
             if (qPos==StringType::npos)
-               {
-                std::vector< StringType > parts;
+            {
+                ParamValues parts(alloc);
                 typename StringType::size_type startPos = 0, nextPos = util::findChar<'(', ')', ':'>(macroName, 0);
                 do {
                     if (nextPos!=StringType::npos)
-                       {
-                        parts.push_back(StringType(macroName, startPos, nextPos-startPos));
+                    {
+                        parts.push_back(StringType(macroName, startPos, nextPos-startPos, alloc));
                         startPos = nextPos+1;
                         nextPos = util::findChar<'(', ')', ':'>(macroName, startPos);
-                       }
+                    }
                     else
-                       {
-                        parts.push_back(StringType(macroName, startPos));
+                    {
+                        parts.push_back(StringType(macroName, startPos, StringType::npos, alloc));
                         break;
-                       }
+                    }
 
-                   } while(1);
+                } while(1);
 
-                //
                 if (parts.size()<=1)
-                   {
-                    StringType
-                           macroNameChanged = util::prepareMacroName(util::filterDotsSlashes(macroName, flags), flags);
-                    if (usedMacros.find(macroNameChanged)!=usedMacros.end())
-                       continue; // allready used
-
-                    StringType macroText;
-                    if (!getMacroText(macroNameChanged, macroText))
-                       {
+                {
+                    StringType macroNameChanged = util::prepareMacroName(util::filterDotsSlashes(macroName, flags), flags);
+                    if (isUsed(macroNameChanged, f.usedSize))
+                        continue; // allready used
+
+                    StringViewType macroText;
+                    StringType     macroTextBuf(alloc);
+                    if (!getText(macroNameChanged, macroText, macroTextBuf, f.layersSize))
+                    {
                         if (flags&smf_KeepUnknownVars)
-                           {
-                            typename StringType::const_iterator endIt = it;
-                            ++endIt;
-                            res.append(mstartIt,endIt);
-                           }
+                            res.append(str, mstartPos, endPos-mstartPos);
                         continue; // macro not found
-                       }
+                    }
 
-                    StringSet< StringType > usedMacrosCopy = usedMacros;
-                    usedMacrosCopy.insert(macroNameChanged);
-                    res.append((flags&smf_DisableRecursion) ? macroText : substMacros(macroText, getMacroText, flags, usedMacrosCopy));
-                    continue;
-                   }
+                    if (flags&smf_DisableRecursion)
+                    {
+                        res.append(macroText);
+                        continue;
+                    }
+
+                    checkDepth();
+                    f.pos = pos;
+                    Frame &child = frames.emplace_back(alloc); // Имя макроса должно жить во фрейме, пока он раскрывается
+                    child.macroName = std::move(macroNameChanged);
+                    inProgress.truncate(f.usedSize);
+                    inProgress.push_back(&child.macroName);
+                    layers.truncate(f.layersSize);
+                    setFrameText(child, macroText, macroTextBuf);
+                    child.pRes       = f.pRes;
+                    child.usedSize   = f.usedSize+1;
+                    child.layersSize = f.layersSize;
+                    return false;
+                }
                 else
-                   {
+                {
                     if (!(flags&smf_ArgsAllowed))
-                       {
+                    {
                         throw std::runtime_error("Parametrized macros not allowed");
-                       }
+                    }
 
                     StringType macroNameChanged = util::prepareMacroName(util::filterDotsSlashes(parts[0], flags), flags);
 
-                    if (usedMacros.find(macroNameChanged)!=usedMacros.end())
-                       continue; // allready used
-
-                    StringType macroText;
-                    if (!getMacroText(macroNameChanged, macroText))
-                       continue; // macro not found
-
-                    StringSet< StringType > usedMacrosCopy = usedMacros;
-                    usedMacrosCopy.insert(macroNameChanged);
-
-                    StringStringMap<StringType> tmpMacros; // = macros;
+                    if (isUsed(macroNameChanged, f.usedSize))
+                        continue; // allready used
 
-                    typename StringType::size_type pi = 1, piSize = parts.size();
-
-                    for(; pi<piSize; ++pi)
-                       {
-                        StringSet< StringType > usedMacrosCopy2 = usedMacrosCopy;
-                        parts[pi] = substMacros(parts[pi], getMacroText, flags, usedMacrosCopy2);
-                       }
-
-                    tmpMacros[percentZero] = util::toString<StringType>(int(parts.size()) - 1);
-                        // util::intToStr< CharType, ::std::char_traits<CharType>, ::std::allocator<CharType> >(int(parts.size())-1);
-                    pi = 1;
+                    StringViewType macroText;
+                    StringType     macroTextBuf(alloc);
+                    if (!getText(macroNameChanged, macroText, macroTextBuf, f.layersSize))
+                        continue; // macro not found
 
-                    for(; pi<piSize; ++pi)
-                       {
-                        StringType idxStr = util::toString<StringType>(int(pi)); // ( util::intToStr< CharType, ::std::char_traits<CharType>, ::std::allocator<CharType> >(int(pi)));
-                        StringType paramMacroName(1, (CharType)'%'); paramMacroName.append(idxStr);
-                        tmpMacros[ paramMacroName ] = parts[pi];
-                       }
-
-                    #if 1
-                        //!!! Чего-то с прокси не срослось - компилятор помирает от вложенности шаблонов
-                        // Порешал, сделав getter нешаблонным параметром с виртуальным оператором ()
-                        res.append(substMacros(macroText, util::MacroTextGetterProxy<StringType>(tmpMacros, getMacroText), flags, usedMacrosCopy));
-                    #else
-                        //!!! Пока не будем ничего делать, потом разберёмся
-                        res.append(macroText);
-                    #endif
-                    continue;
-                   }
-               }
+                    checkDepth();
+                    f.pos = pos;
+
+                    Frame &call     = frames.emplace_back(alloc);
+                    call.paramCall  = true;
+                    setFrameText(call, macroText, macroTextBuf);
+                    call.pRes       = f.pRes;
+                    call.usedSize   = f.usedSize;
+                    call.layersSize = f.layersSize;
+                    call.macroName  = std::move(macroNameChanged);
+                    call.params     = std::move(parts);
+                    call.params[0]  = util::toString<StringType>(int(call.params.size()) - 1, alloc);
+                    return false;
+                }
+            }
 
             //flags = smf_ArgsAllowed|smf_ConditionAllowed
             if (!(flags&smf_ConditionAllowed))
-               {
+            {
                 throw std::runtime_error("Conditional macros not allowed");
-               }
+            }
 
-            StringType macroNameCond = util::filterDotsSlashes(StringType(macroName, 0, qPos), flags);
-            macroNameCond = util::prepareMacroName(macroNameCond, flags);
+            StringType macroNameCond = util::filterDotsSlashes(StringType(macroName, 0, qPos, alloc), flags);
+            macroNameCond = util::prepareMacroName(std::move(macroNameCond), flags);
             ++qPos;
             if (qPos>=macroName.size())
-               {
+            {
                 continue; // no true or false branches
-               }
+            }
 
             if (macroName[qPos]!='*' && macroName[qPos]!='+')
-               {
+            {
                 throw std::runtime_error( ::std::string("Conditional macro inclusion (body: '")
                                         + util::make_string<::std::string>(macroName) // MARTY_CON_NS str2con(macroName)
                                         + ::std::string("') - invalid condition, ?* nor ?+ used")
                                         );
-                //std::cout<<"Conditional macro inclusion (body: '"<<macroName<<"') - invalid condition, ?* nor ?+ used\n";
-                continue;
-               }
+            }
 
             bool onlyExist = macroName[qPos]=='*';
             typename StringType::size_type truthBranchStart = ++qPos;
             if (truthBranchStart>=macroName.size())
-               {
+            {
                 continue; // no true or false branches
-               }
+            }
 
             typename StringType::size_type colonPos = util::findChar<'(', ')', ':'>(macroName, truthBranchStart);
 
-            StringType truthPart, falsePart;
+            StringType truthPart(alloc), falsePart(alloc);
             if (colonPos==StringType::npos || colonPos>=macroName.size())
-               {
-                truthPart = StringType(macroName, truthBranchStart);
-               }
+            {
+                truthPart = StringType(macroName, truthBranchStart, StringType::npos, alloc);
+            }
             else
-               {
+            {
                 typename StringType::size_type truthBranchLen = colonPos-truthBranchStart;
-                truthPart = StringType(macroName, truthBranchStart, truthBranchLen);
-                falsePart = StringType(macroName, truthBranchStart + truthBranchLen+1);
-               }
+                truthPart = StringType(macroName, truthBranchStart, truthBranchLen, alloc);
+                falsePart = StringType(macroName, truthBranchStart + truthBranchLen+1, StringType::npos, alloc);
+            }
 
             bool cond = false;
-            StringType macroText;
-            if (getMacroText(macroNameCond, macroText))
-               { // macro exist
+            StringViewType macroText;
+            StringType     macroTextBuf(alloc);
+            if (getText(macroNameCond, macroText, macroTextBuf, f.layersSize))
+            { // macro exist
                 if (onlyExist)
-                   cond = true;
+                    cond = true;
                 else
-                   {
-                    #if 0
-                    if (! /* ::boost::algorithm:: */ ::marty::util::trim_copy(macroText, ::marty::util::CIsSpace<CharType>()).empty())
-                    #endif
-                    //if (!util::trim_copy(macroText, util::space_pred<typename StringType::value_type>()).empty())
-                    if (!util::trim_copy( macroText
-                                        , [&](typename StringType::value_type ch)
-                                          {
-                                              typedef typename StringType::value_type CharType;
-                                              return (ch==(CharType)' ' || ch==(CharType)'\t' || ch==(CharType)'\n' || ch==(CharType)'\r');
-                                          }
-                                        ).empty()
-                       )
-                       cond = true;
-                   }
-               }
-
-            macroText = cond ? truthPart : falsePart;
-            StringType
-                str = (flags&smf_DisableRecursion) ? macroText : substMacros(macroText, getMacroText, flags, usedMacros);
-            res.append(str);
-           }
-       }
+                {
+                    for(auto ch : macroText)
+                    {
+                        if (!(ch==(CharType)' ' || ch==(CharType)'\t' || ch==(CharType)'\n' || ch==(CharType)'\r'))
+                        {
+                            cond = true;
+                            break;
+                        }
+                    }
+                }
+            }
+
+            if (flags&smf_DisableRecursion)
+            {
+                res.append(cond ? truthPart : falsePart);
+                continue;
+            }
 
-    return res;
+            // Ветка условия раскрывается в том же контексте, имя условия не считается используемым
+            f.pos = pos;
+            pushText(cond ? std::move(truthPart) : std::move(falsePart), f.pRes, f.usedSize, f.layersSize, 0);
+            return false;
+        }
+
+        checkOutputSize(res.size()-resStartSize);
+
+        return true;
+    }
+
+}; // class SubstMacrosEngine
+
+
+
+} // namespace impl_helpers
+
+//-----------------------------------------------------------------------------
+
+
+
+
+//-----------------------------------------------------------------------------
+template < typename CharType
+         , typename Traits
+         , typename Allocator
+         >
+::std::basic_string<CharType, Traits, Allocator>
+substMacros( const ::std::basic_string<CharType, Traits, Allocator>                          &str
+           , const IMacroTextGetter< ::std::basic_string<CharType, Traits, Allocator> >      &getMacroText
+           , int                                                                             flags
+           , StringSet< ::std::basic_string<CharType, Traits, Allocator> >                   &usedMacros
+           , const SubstMacrosLimits                                                         &limits
+           )
+   {
+    typedef ::std::basic_string<CharType, Traits, Allocator> StringType;
+
+    impl_helpers::SubstMacrosEngine<StringType> engine(getMacroText, flags, usedMacros, limits, str.get_allocator());
+    return engine.run(str);
+   }
+
+//-----------------------------------------------------------------------------
+template < typename CharType
+         , typename Traits
+         , typename Allocator
+         >
+::std::basic_string<CharType, Traits, Allocator>
+substMacros( const ::std::basic_string<CharType, Traits, Allocator>                          &str
+           , const IMacroTextGetter< ::std::basic_string<CharType, Traits, Allocator> >      &getMacroText
+           , int                                                                             flags
+           , StringSet< ::std::basic_string<CharType, Traits, Allocator> >                   &usedMacros
+           )
+   {
+    return substMacros(str, getMacroText, flags, usedMacros, SubstMacrosLimits());
+   }
+
+//-----------------------------------------------------------------------------
+template < typename MacroTextGetter
+         , typename CharType
+         , typename Traits
+         , typename Allocator
+         >
+::std::basic_string<CharType, Traits, Allocator>
+substMacros( const ::std::basic_string<CharType, Traits, Allocator> &str
+           , const MacroTextGetter                                  &getMacroText
+           , int                                                     flags
+           , const SubstMacrosLimits                                &limits
+           )
+   {
+    typedef ::std::basic_string<CharType, Traits, Allocator> StringType;
+
+    // Getter вызывается по своему статическому типу, без виртуального вызова через IMacroTextGetter
+    StringSet<StringType> usedMacros(str.get_allocator());
+    impl_helpers::SubstMacrosEngine<StringType, MacroTextGetter> engine(getMacroText, flags, usedMacros, limits, str.get_allocator());
+    return engine.run(str);
    }
 
 //-----------------------------------------------------------------------------
@@ -719,8 +1177,7 @@ substMacros( const ::std::basic_string<CharType, Traits, Allocator> &str
            , int                                                     flags = smf_KeepUnknownVars // smf_ArgsAllowed|smf_ConditionAllowed
            )
    {
-    StringSet< ::std::basic_string<CharType, Traits, Allocator> > usedMacros;
-    return substMacros(str, getMacroText, flags, usedMacros);
+    return substMacros(str, getMacroText, flags, SubstMacrosLimits());
    }
 
 
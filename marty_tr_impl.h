@@ -1,98 +1,97 @@
 #pragma once
 
+#include "bloom_filter.h"
+#include "catalog_image.h"
+#include "container_policy.h"
 #include "enums_decl.h"
 #include "locales.h"
+#include "message_template.h"
+#include "packed_translations.h"
+#include "plural_rules.h"
+#include "utf_transcode.h"
 
 #include "marty_yaml_toml_json/json_utils.h"
 #include "marty_yaml_toml_json/yaml_json.h"
 
 #include <nlohmann/json.hpp>
 
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
 #include <exception>
+#include <memory>
+#include <memory_resource>
+#include <mutex>
+#include <optional>
 #include <stdexcept>
+#include <string>
+#include <string_view>
+#include <type_traits>
 #include <unordered_map>
 #include <unordered_set>
+#include <vector>
 
 
 
 //----------------------------------------------------------------------------
-#ifndef MARTY_ARG_USED
-
-    //! Подавление варнинга о неиспользованном аргументе
-    #define MARTY_ARG_USED(x)                   (void)(x)
-
-#endif
-
-//----------------------------------------------------------------------------
-
-
-
-
-//----------------------------------------------------------------------------
-
-
-
-
 //----------------------------------------------------------------------------
-namespace marty_tr {
+#if !defined(MARTY_TR_MISS_CACHE_SIZE)
 
+    //! Число слотов счётчиков сообщений о промахах, 0 - счётчиков нет. Нужны только при лимите сообщений (MARTY_TR_MISS_REPORT_LIMIT)
+    #define MARTY_TR_MISS_CACHE_SIZE    256
 
+#endif
 
-//----------------------------------------------------------------------------
-#if defined(MARTY_TR_FORCE_USE_UNORDERED_MAP)
+#if !defined(MARTY_TR_LOOKUP_CACHE_SIZE)
 
-    #define MARTY_TR_USE_UNORDERED_MAP
+    //! Число слотов потокового кэша найденных переводов tr() (см. Translator::setLookupCacheMode), степень двойки
+    #define MARTY_TR_LOOKUP_CACHE_SIZE  1024
 
 #endif
 
+#if !defined(MARTY_TR_MISS_REPORT_LIMIT)
 
-#if !defined(MARTY_TR_USE_UNORDERED_MAP)
+    //! Сколько раз об одном и том же промахе сообщается в IErrReportHandler, 0 - без ограничений
+    /*! По умолчанию без ограничений, как было до кэша промахов: обработчик видит каждый промах
+     */
+    #define MARTY_TR_MISS_REPORT_LIMIT  0
 
-    #if !defined(NDEBUG)
-
-    #else
+#endif
 
-        #define MARTY_TR_USE_UNORDERED_MAP
+#ifndef MARTY_ARG_USED
 
-    #endif
+    //! Подавление варнинга о неиспользованном аргументе
+    #define MARTY_ARG_USED(x)                   (void)(x)
 
 #endif
 
+//----------------------------------------------------------------------------
+
 
 
 
-// https://en.cppreference.com/w/cpp/language/type_alias
-#if !defined(MARTY_TR_USE_UNORDERED_MAP)
+//----------------------------------------------------------------------------
 
-    // При отладке удобнее разглядывать std::map
 
-    template<typename StringType>
-    using StringStringMap = std::map<StringType,StringType>;
 
-    template<typename StringType>
-    using StringSet = std::set<StringType>;
 
-    typedef StringStringMap<std::string>                                    translations_map_t;
-    typedef std::map<std::string,translations_map_t>                        category_translations_map_t;
-    typedef std::map<std::string,category_translations_map_t>               all_translations_map_t;
+//----------------------------------------------------------------------------
+namespace marty_tr {
 
-#else
 
-    // В релизе std::unordered_map быстрее
-    template<typename StringType>
-    using StringStringMap = std::unordered_map<StringType,StringType>;
 
-    template<typename StringType>
-    using StringSet = std::unordered_set<StringType>;
+//----------------------------------------------------------------------------
+// Тип контейнеров каталога задаётся политикой (см. container_policy.h), одинаковой для отладки и релиза
 
-    template<typename StringType>
-    using StringSet = std::unordered_set<StringType>;
+template<typename StringType>
+using StringStringMap = DefaultContainerPolicy::map_type<StringType,StringType>;
 
-    typedef StringStringMap<std::string>                                    translations_map_t;
-    typedef std::unordered_map<std::string,translations_map_t>              category_translations_map_t;
-    typedef std::unordered_map<std::string,category_translations_map_t>     all_translations_map_t;
+template<typename StringType>
+using StringSet = DefaultContainerPolicy::set_type<StringType>;
 
-#endif
+typedef BasicTranslationsMaps<DefaultContainerPolicy>::translations_map_t                translations_map_t;
+typedef BasicTranslationsMaps<DefaultContainerPolicy>::category_translations_map_t       category_translations_map_t;
+typedef BasicTranslationsMaps<DefaultContainerPolicy>::all_translations_map_t            all_translations_map_t;
 
 
 
@@ -138,15 +137,11 @@ std::string to_ascii(const std::string &str)
     return str;
 }
 
+//! Широкая строка (UTF-16/UTF-32) -> UTF-8
 inline
 std::string to_ascii(const std::wstring &str)
 {
-    std::string strRes; strRes.reserve(str.size());
-    for (auto ch : str)
-    {
-        strRes.append(1, (char)(unsigned char)ch);
-    }
-    return strRes;
+    return utf::toUtf8(str);
 }
 
 inline
@@ -168,13 +163,11 @@ std::wstring to_wide(const std::wstring &str)
     return str;
 }
 
+//! UTF-8 -> широкая строка (UTF-16/UTF-32)
 inline
 std::wstring to_wide(const std::string &str)
 {
-    std::wstring strRes; strRes.reserve(str.size());
-    for(auto ch : str)
-        strRes.append(1, (wchar_t)(unsigned char)ch);
-    return strRes;
+    return utf::fromUtf8<wchar_t>(str);
 }
 
 inline
@@ -187,8 +180,12 @@ std::wstring to_wide(const char* str)
 template<typename ResultStringType, typename StringType>
 ResultStringType to_string_type(StringType s)
 {
-    if constexpr (sizeof(typename ResultStringType::value_type)>1)
+    typedef typename ResultStringType::value_type ResultCharType;
+
+    if constexpr (std::is_same_v<ResultCharType, wchar_t>)
         return to_wide(s);
+    else if constexpr (sizeof(ResultCharType)>1)
+        return utf::fromUtf8<ResultCharType>(to_ascii(s)); // char16_t/char32_t
     else
         return to_ascii(s);
 }
@@ -350,101 +347,16 @@ makeErrReportHandler( MessageNotFoundHandler           mnfHandler   = DefaultMes
 
 
 
-//----------------------------------------------------------------------------
-namespace impl_helpers {
-
-inline
-IErrReportHandlerPtr& tr_get_err_handler()
-{
-    static IErrReportHandlerPtr ph = 0;
-    return ph;
-}
-
-inline
-ELangTagFormat& tr_get_lang_tag_format()
-{
-    static ELangTagFormat fmt = ELangTagFormat::langIdFull; // 0409
-    return fmt;
-}
-
-
-} // namespace impl_helpers
-
-//----------------------------------------------------------------------------
-
-
-
-
-//----------------------------------------------------------------------------
-inline
-IErrReportHandlerPtr tr_get_err_handler()
-{
-    IErrReportHandlerPtr ph = impl_helpers::tr_get_err_handler();
-    return ph;
-}
-
-inline
-IErrReportHandlerPtr tr_set_err_handler(IErrReportHandlerPtr newPh)
-{
-    auto ph = impl_helpers::tr_get_err_handler();
-    impl_helpers::tr_get_err_handler() = newPh;
-    return ph;
-}
-
-
-struct AutoRestoreErrReportHandler
-{
-protected:
-    IErrReportHandlerPtr pHandler = 0;
-
-public:
-
-    AutoRestoreErrReportHandler(IErrReportHandlerPtr pH) : pHandler(pH) {}
-    ~AutoRestoreErrReportHandler() { tr_set_err_handler(pHandler); }
-
-    AutoRestoreErrReportHandler() = delete;
-    AutoRestoreErrReportHandler(const AutoRestoreErrReportHandler &) = delete;
-    AutoRestoreErrReportHandler& operator=(const AutoRestoreErrReportHandler &) = delete;
-    AutoRestoreErrReportHandler(AutoRestoreErrReportHandler &&) = delete;
-    AutoRestoreErrReportHandler& operator=(AutoRestoreErrReportHandler &&) = delete;
-
-}; // struct AutoRestoreErrReportHandler
-
-//----------------------------------------------------------------------------
-
 
 
 
 //----------------------------------------------------------------------------
-inline
-ELangTagFormat tr_get_lang_tag_format()
-{
-    return impl_helpers::tr_get_lang_tag_format();
-}
-
-inline
-ELangTagFormat tr_set_lang_tag_format(ELangTagFormat newFmt)
-{
-    auto res = impl_helpers::tr_get_lang_tag_format();
-    if (newFmt!=ELangTagFormat::langTagNeutral && newFmt!=ELangTagFormat::langTagNeutralAuto)
-    {
-        impl_helpers::tr_get_lang_tag_format() = newFmt;
-    }
-    return res;
-}
-
 inline
 std::string tr_fix_lang_tag_format(const std::string &langTagOrId, ELangTagFormat langTagFormat)
 {
     return formatLangTag(langTagOrId, langTagFormat);
 }
 
-inline
-std::string tr_fix_lang_tag_format(const std::string &langTagOrId)
-{
-    return tr_fix_lang_tag_format(langTagOrId, tr_get_lang_tag_format());
-}
-
 //----------------------------------------------------------------------------
 
 
@@ -477,7 +389,7 @@ std::string tr_fix_category(const std::string &catId)
 
 //----------------------------------------------------------------------------
 inline
-all_translations_map_t tr_parse_translations_data(const std::string &trJson)
+all_translations_map_t tr_parse_translations_data(const std::string &trJson, ELangTagFormat langTagFormat)
 {
     std::string errMsg;
     std::string tmpJson;
@@ -505,7 +417,7 @@ all_translations_map_t tr_parse_translations_data(const std::string &trJson)
         std::string langId  = jitLang.key();
         auto &jCategory     = jitLang.value();
 
-        langId = tr_fix_lang_tag_format(langId);
+        langId = tr_fix_lang_tag_format(langId, langTagFormat);
 
         category_translations_map_t  category_translations_map;
 
@@ -575,235 +487,3515 @@ std::string tr_serialize_translations(const all_translations_map_t &trMap, unsig
     return strFromJ;
 }
 
-
 //----------------------------------------------------------------------------
 inline
-all_translations_map_t& tr_get_all_translations()
+bool tr_has_category(const all_translations_map_t &trMap, std::string catId)
 {
-    static all_translations_map_t m;
-    return m;
-}
+    catId = tr_fix_category(catId);
 
-//----------------------------------------------------------------------------
-inline
-void tr_clear()
-{
-    tr_get_all_translations().clear();
-}
+    for(const auto &langKvp : trMap)
+    {
+        // const std::string &langId                      = langKvp.first; // not used
+        const category_translations_map_t &catMap      = langKvp.second;
+        category_translations_map_t::const_iterator it = catMap.find(catId);
+        if (it!=catMap.end())
+            return true; // category found
+    }
 
-//----------------------------------------------------------------------------
-inline
-all_translations_map_t& tr_alter_get_all_translations()
-{
-    static all_translations_map_t m;
-    return m;
+    return false;
 }
 
 //----------------------------------------------------------------------------
 inline
-void tr_alter_clear()
+std::string tr_plural_msgid(const std::string &msgId, EPluralCategory c)
 {
-    tr_get_all_translations().clear();
+    return msgId + std::string(1, '#') + to_string(c);
 }
 
 //----------------------------------------------------------------------------
-inline
-void tr_set_translations(const all_translations_map_t &newAllTr)
-{
-    auto& allTr = tr_get_all_translations();
-    allTr = newAllTr;
-}
 
-//----------------------------------------------------------------------------
-inline
-void tr_init_all_translations(const std::string &trJson)
-{
-    tr_get_all_translations() = tr_parse_translations_data(trJson);
-}
 
-//----------------------------------------------------------------------------
-inline
-void tr_add_custom_translations(const all_translations_map_t &customTrMap)
-{
-    all_translations_map_t& trAllMap = tr_get_all_translations();
 
-    IErrReportHandlerPtr errHandler = tr_get_err_handler();
-    auto handleTranslationAlreadyExist = [&](const std::string& msgId, const std::string& msgPrev, const std::string& msgNew, const std::string& catId, const std::string& langId) -> bool
-    {
-        if (!errHandler)
-            return true; // allow overwrite
 
-        return errHandler->translationAlreadyExist(msgId, msgPrev, msgNew, catId, langId);
-    };
+//----------------------------------------------------------------------------
+// Ссылки на другие сообщения того же языка: $(@msgId) - в той же категории, $(@catId|msgId) - в указанной.
+// Разрешаются при построении каталога, в каталоге лежат уже подставленные тексты, поэтому в tr() ссылок нет.
+// Исходные тексты сообщений со ссылками хранятся отдельно - при замене сообщения, на которое ссылаются
+// (например, названия продукта), все ссылающиеся на него тексты пересчитываются.
+
+namespace impl_helpers {
 
+//------------------------------
+//! Вызывает handler(refPos, refLen, catId, msgId) для каждой ссылки $(@...) в тексте, экранированные $$ пропускаются
+template<typename THandler> inline
+void tr_enumerate_msg_refs(const std::string &text, const std::string &curCatId, THandler handler)
+{
+    const std::string::size_type size = text.size();
+    std::string::size_type pos = 0;
 
-    for(const auto &langKvp : customTrMap)
+    while(pos<size)
     {
-        const auto &langId  = langKvp.first;
-        const auto &catMap  = langKvp.second;
+        pos = text.find('$', pos);
+        if (pos==std::string::npos)
+            break;
 
-        for(const auto &catKvp : catMap)
+        if (pos+1<size && text[pos+1]=='$')
         {
-            const auto &catId  = catKvp.first;
-            const auto &msgMap = catKvp.second;
+            pos += 2;
+            continue;
+        }
 
-            for(const auto &msgKvp : msgMap)
-            {
-                const auto &msgId   = msgKvp.first;
-                const auto &msgText = msgKvp.second;
+        if (pos+2>=size || text[pos+1]!='(' || text[pos+2]!='@')
+        {
+            ++pos;
+            continue;
+        }
 
-                translations_map_t &trMap = trAllMap[langId][catId];
-                translations_map_t::iterator it = trMap.find(msgId);
+        std::string::size_type end = pos+3;
+        int brCnt = 1;
+        for(; end<size; ++end)
+        {
+            if (text[end]=='(') { ++brCnt; continue; }
+            if (text[end]==')')
+            {
+                --brCnt;
+                if (!brCnt) break;
+            }
+        }
 
-                bool existNotSame = false;
-                if (it!=trMap.end())
-                {
-                    if (it->second!=msgText)
-                        existNotSame = true;
-                }
+        if (end>=size)
+            break; // Незакрытая ссылка остаётся как есть
 
-                if (!existNotSame || handleTranslationAlreadyExist(msgId, it->second, msgText, catId, langId))
-                {
-                    trMap[msgId] = msgText; // overwrite prev or add new
-                }
+        std::string ref = std::string(text, pos+3, end-pos-3);
+        std::string::size_type sepPos = ref.find('|');
+        if (sepPos==std::string::npos)
+            handler(pos, end+1-pos, curCatId, ref);
+        else
+            handler(pos, end+1-pos, tr_fix_category(std::string(ref, 0, sepPos)), std::string(ref, sepPos+1));
 
-                //trMap[langId][catId][msgId] = msgText;
-                //trMap[msgId] = msgText;
-            }
-        }
+        pos = end+1;
     }
 }
 
-//----------------------------------------------------------------------------
+//------------------------------
 inline
-void tr_add_custom_translations(const std::string &trJson)
+const std::string* tr_find_msg_text(const all_translations_map_t &trAllMap, const std::string &langId, const std::string &catId, const std::string &msgId)
 {
-    all_translations_map_t customTrMap = tr_parse_translations_data(trJson);
-    tr_add_custom_translations(customTrMap);
-}
+    all_translations_map_t::const_iterator lit = trAllMap.find(langId);
+    if (lit==trAllMap.end())
+        return 0;
 
-//----------------------------------------------------------------------------
-inline
-bool tr_has_category(const all_translations_map_t &trMap, std::string catId)
-{
-    catId = tr_fix_category(catId);
+    category_translations_map_t::const_iterator cit = lit->second.find(catId);
+    if (cit==lit->second.end())
+        return 0;
 
-    for(const auto &langKvp : trMap)
-    {
-        // const std::string &langId                      = langKvp.first; // not used
-        const category_translations_map_t &catMap      = langKvp.second;
-        category_translations_map_t::const_iterator it = catMap.find(catId);
-        if (it!=catMap.end())
-            return true; // category found
-    }
+    translations_map_t::const_iterator mit = cit->second.find(msgId);
+    if (mit==cit->second.end())
+        return 0;
 
-    return false;
+    return &mit->second;
 }
 
-//----------------------------------------------------------------------------
+//------------------------------
+//! Переименовывает категорию во всех языках каталога, слияния с существующей категорией нет
 inline
-bool tr_replace_category(all_translations_map_t &trMap, std::string prevCatId, std::string newCatId)
+void tr_rename_category(all_translations_map_t &trAllMap, const std::string &prevCatId, const std::string &newCatId)
 {
-    prevCatId = tr_fix_category(prevCatId);
-    newCatId  = tr_fix_category(newCatId);
-
-    // Надо проверить, есть ли уже такая категория
-    // Потому что при переименовании будет производится замена имени существующей категории, и новое имя может
-    // совпадать с каким-то уже имеющися, а переименование не подразумевает слияния
-
-    if (tr_has_category(trMap, newCatId))
-        return false;
-
-    for(auto &langKvp : trMap)
+    for(auto &langKvp : trAllMap)
     {
-        // const std::string &langId                       = langKvp.first; // not used
-        category_translations_map_t &catMap             = langKvp.second;
-        category_translations_map_t::const_iterator nit = catMap.find(prevCatId);
+        category_translations_map_t &catMap = langKvp.second;
+        category_translations_map_t::iterator nit = catMap.find(prevCatId);
         if (nit!=catMap.end())
         {
-            auto nh  = catMap.extract(nit);
-            nh.key() = newCatId;
-            catMap.insert(std::move(nh));
+            translations_map_t msgMap = std::move(nit->second);
+            catMap.erase(nit);
+            catMap[newCatId] = std::move(msgMap);
         }
     }
-
-    return true; // Переименование прошло без ошибок (возможно, по факту ничего не было сделано, так как искомой prevCatId категории нет, но это не важно)
 }
 
-//----------------------------------------------------------------------------
-
-
-
-
-//----------------------------------------------------------------------------
-namespace impl_helpers {
-
+//------------------------------
+//! Ключ сообщения (язык, категория, msgId) одной строкой
+/*! Части разделены '\0' - в категориях бывает '/' (marty-tr/language-location)
+ */
 inline
-std::string& tr_get_def_category()
+std::string tr_msg_key(const std::string &langId, const std::string &catId, const std::string &msgId)
 {
-    static std::string n = "common";
-    return n;
+    std::string key; key.reserve(langId.size()+catId.size()+msgId.size()+2);
+    key.append(langId);
+    key.append(1, '\0');
+    key.append(catId);
+    key.append(1, '\0');
+    key.append(msgId);
+    return key;
 }
 
+//! Обратно к частям, false - это не ключ tr_msg_key
 inline
-std::string& tr_get_def_lang()
+bool tr_split_msg_key(const std::string &key, std::string &langId, std::string &catId, std::string &msgId)
 {
-    #if defined(WIN32) || defined(_WIN32)
-        static std::string n = "0409";
-    #else
-        static std::string n = "en-US";
-    #endif
-
-    return n;
-}
+    const std::string::size_type p1 = key.find('\0');
+    if (p1==std::string::npos)
+        return false;
 
-inline
-std::string& tr_alter_get_def_lang()
-{
-    #if defined(WIN32) || defined(_WIN32)
-        static std::string n = "0409";
-    #else
-        static std::string n = "en-US";
-    #endif
+    const std::string::size_type p2 = key.find('\0', p1+1);
+    if (p2==std::string::npos)
+        return false;
 
-    return n;
+    langId.assign(key, 0, p1);
+    catId .assign(key, p1+1, p2-p1-1);
+    msgId .assign(key, p2+1, std::string::npos);
+    return true;
 }
 
-inline
-bool& tr_get_msg_not_found_decorate_mode()
+//------------------------------
+//! Подстановка ссылок с обходом в глубину, цикл ссылок - исключение
+/*! Подставленные тексты копятся в resolved и попадают в каталог только в commit(), поэтому
+    при цикле ссылок (исключение из resolve) каталог остаётся прежним.
+ */
+struct MsgRefResolver
 {
-    static bool mode = true;
-    return mode;
-}
+    const all_translations_map_t              &trAllMap;
+    const all_translations_map_t              &sources;
+    IErrReportHandlerPtr                       errHandler;
+    MessageTemplateCache                      *pTemplates; // Если задан - учёт шаблонов заменённых текстов, см. MessageTemplateCache::replace
+    const PackedTranslations                  *pFallback = 0; // Где ещё искать тексты, на которые ссылаются (общий базовый каталог)
+    const CatalogImageView                    *pImage    = 0; // И образ каталога
+    std::unordered_map<std::string, int>       state; // 1 - разрешается, 2 - готово
+    std::unordered_map<std::string, std::string> resolved; // Ключ tr_msg_key -> подставленный текст
+    std::vector<std::string>                   path;
+
+    MsgRefResolver(const all_translations_map_t &m, const all_translations_map_t &src, IErrReportHandlerPtr pHandler, MessageTemplateCache *pTpl)
+    : trAllMap(m), sources(src), errHandler(pHandler), pTemplates(pTpl)
+    {}
 
-inline
-bool& tr_get_empty_msg_not_exist()
-{
-    static bool mode = false;
-    return mode;
-}
+    //! Ключ для сообщения об ошибке - с '/' вместо '\0'
+    static std::string printableKey(std::string key)
+    {
+        std::replace(key.begin(), key.end(), '\0', '/');
+        return key;
+    }
 
-} // namespace impl_helpers
+    //! Текст сообщения с учётом уже подставленных, но ещё не записанных в каталог
+    const std::string* findText(const std::string &langId, const std::string &catId, const std::string &msgId) const
+    {
+        if (!resolved.empty())
+        {
+            std::unordered_map<std::string, std::string>::const_iterator it = resolved.find(tr_msg_key(langId, catId, msgId));
+            if (it!=resolved.end())
+                return &it->second;
+        }
 
-//----------------------------------------------------------------------------
+        return tr_find_msg_text(trAllMap, langId, catId, msgId);
+    }
 
+    void resolve(const std::string &langId, const std::string &catId, const std::string &msgId)
+    {
+        const std::string *pSrc = tr_find_msg_text(sources, langId, catId, msgId);
+        if (!pSrc)
+            return; // Ссылок нет, текст в каталоге уже окончательный
 
+        const std::string key = tr_msg_key(langId, catId, msgId);
+        int &st = state[key];
+        if (st==2)
+            return;
 
+        if (st==1)
+        {
+            std::string msg = "tr: cyclic message reference: ";
+            std::vector<std::string>::const_iterator pit = std::find(path.begin(), path.end(), key);
+            for(; pit!=path.end(); ++pit)
+                msg += printableKey(*pit) + std::string(" -> ");
+            msg += printableKey(key);
+            throw std::runtime_error(msg);
+        }
 
-//----------------------------------------------------------------------------
-inline
-std::string tr_get_def_category()
-{
-    return impl_helpers::tr_get_def_category();
-}
+        st = 1;
+        path.push_back(key);
+
+        std::string res;
+        std::string::size_type lastPos = 0;
+        tr_enumerate_msg_refs( *pSrc, catId
+                             , [&](std::string::size_type refPos, std::string::size_type refLen, const std::string &refCatId, const std::string &refMsgId)
+                               {
+                                   res.append(*pSrc, lastPos, refPos-lastPos);
+                                   lastPos = refPos+refLen;
+
+                                   resolve(langId, refCatId, refMsgId);
+
+                                   const std::string *pRefText = findText(langId, refCatId, refMsgId);
+                                   if (pRefText)
+                                   {
+                                       res.append(*pRefText);
+                                       return;
+                                   }
+
+                                   std::optional<std::string_view> refText;
+                                   if (pFallback)
+                                       refText = pFallback->find(langId, refCatId, refMsgId);
+                                   if (!refText && pImage)
+                                       refText = pImage->find(langId, refCatId, refMsgId);
+                                   if (refText)
+                                   {
+                                       res.append(refText->data(), refText->size());
+                                       return;
+                                   }
+
+                                   if (errHandler)
+                                       errHandler->messageNotFound(MsgNotFound::msg, refMsgId, refCatId, langId);
+                                   res.append(*pSrc, refPos, refLen); // Неразрешённая ссылка остаётся как есть
+                               }
+                             );
+        res.append(*pSrc, lastPos, std::string::npos);
+
+        resolved[key] = std::move(res);
+
+        path.pop_back();
+        st = 2; // Ссылки на элементы unordered_map при рехэше не инвалидируются
+    }
 
-//----------------------------------------------------------------------------
-inline
-std::string tr_set_def_category(const std::string &c)
+    //! Пересчитывает сообщение по ключу tr_msg_key
+    void resolveKey(const std::string &key)
+    {
+        std::string langId, catId, msgId;
+        if (tr_split_msg_key(key, langId, catId, msgId))
+            resolve(langId, catId, msgId);
+    }
+
+    void resolveAll()
+    {
+        for(const auto &langKvp : sources)
+        {
+            for(const auto &catKvp : langKvp.second)
+            {
+                for(const auto &msgKvp : catKvp.second)
+                    resolve(langKvp.first, catKvp.first, msgKvp.first);
+            }
+        }
+    }
+
+    //! Записывает подставленные тексты в каталог target (обычно тот же, что trAllMap)
+    void commit(all_translations_map_t &target)
+    {
+        std::string langId, catId, msgId;
+        for(const auto &kv : resolved)
+        {
+            if (!tr_split_msg_key(kv.first, langId, catId, msgId))
+                continue;
+
+            auto &msgs = target[langId][catId];
+            auto mit = msgs.find(msgId);
+            if (pTemplates)
+                pTemplates->replace(mit!=msgs.end() ? &mit->second : 0, &kv.second);
+
+            if (mit!=msgs.end())
+                mit->second = kv.second;
+            else
+                msgs[msgId] = kv.second;
+        }
+
+        resolved.clear();
+    }
+
+}; // struct MsgRefResolver
+
+} // namespace impl_helpers
+
+//----------------------------------------------------------------------------
+//! Есть ли в тексте ссылки на другие сообщения ($(@msgId), $(@catId|msgId))
+inline
+bool tr_has_msg_refs(const std::string &msgText)
+{
+    bool res = false;
+    impl_helpers::tr_enumerate_msg_refs(msgText, std::string(), [&](std::string::size_type, std::string::size_type, const std::string&, const std::string&) { res = true; });
+    return res;
+}
+
+//----------------------------------------------------------------------------
+
+
+
+
+//----------------------------------------------------------------------------
+// Фильтр Блума по ключам каталога: (lang), (lang, cat), (lang, cat, msg) и отдельно (msg).
+// tr() и tr_has_msg() проверяют его до обхода вложенных map, так что заведомый промах стоит одной
+// проверки кэш-линии. По (msg) tr_has_msg() отвечает ещё до нормализации категории и языка.
+// Фильтр строится при изменении каталога, отдельные tr_add дописываются в него. Поиск фильтр только
+// читает, поэтому поиск из нескольких потоков одновременно безопасен.
+//----------------------------------------------------------------------------
+namespace impl_helpers {
+
+struct TrLookupFilter
+{
+    bool                  built      = false;
+    std::uint64_t         generation = 0;
+    BlockedBloomFilter    filter     ;
+};
+
+//------------------------------
+inline
+std::uint64_t tr_lookup_hash_msg(const std::string &msgId)
+{
+    return BlockedBloomFilter::combine(BlockedBloomFilter::hashStr(msgId), 1);
+}
+
+inline
+std::uint64_t tr_lookup_hash_lang(const std::string &langId)
+{
+    return BlockedBloomFilter::combine(BlockedBloomFilter::hashStr(langId), 2);
+}
+
+inline
+std::uint64_t tr_lookup_hash_cat(const std::string &langId, const std::string &catId)
+{
+    return BlockedBloomFilter::combine(tr_lookup_hash_lang(langId), BlockedBloomFilter::hashStr(catId));
+}
+
+inline
+std::uint64_t tr_lookup_hash_full(const std::string &langId, const std::string &catId, const std::string &msgId)
+{
+    return BlockedBloomFilter::combine(tr_lookup_hash_cat(langId, catId), BlockedBloomFilter::hashStr(msgId));
+}
+
+//------------------------------
+inline
+void tr_lookup_filter_fill(BlockedBloomFilter &filter, const all_translations_map_t &trAllMap, std::size_t reserveFactor)
+{
+    std::size_t numKeys = 0;
+    for(const auto &langKvp : trAllMap)
+    {
+        ++numKeys;
+        for(const auto &catKvp : langKvp.second)
+            numKeys += 1 + 2*catKvp.second.size();
+    }
+
+    filter.reset(numKeys*reserveFactor);
+
+    for(const auto &langKvp : trAllMap)
+    {
+        filter.insert(tr_lookup_hash_lang(langKvp.first));
+        for(const auto &catKvp : langKvp.second)
+        {
+            const std::uint64_t catHash = tr_lookup_hash_cat(langKvp.first, catKvp.first);
+            filter.insert(catHash);
+            for(const auto &msgKvp : catKvp.second)
+            {
+                filter.insert(BlockedBloomFilter::combine(catHash, BlockedBloomFilter::hashStr(msgKvp.first)));
+                filter.insert(tr_lookup_hash_msg(msgKvp.first));
+            }
+        }
+    }
+}
+
+//------------------------------
+inline
+void tr_lookup_filter_build(TrLookupFilter &f, const all_translations_map_t &trAllMap, std::uint64_t generation)
+{
+    // Запас под последующие tr_add, чтобы не перестраивать фильтр на каждое добавление
+    tr_lookup_filter_fill(f.filter, trAllMap, 2);
+
+    f.built      = true;
+    f.generation = generation;
+}
+
+//------------------------------
+//! Дописывает добавленное сообщение в фильтр, если тот был актуален до изменения каталога
+/*! false - фильтр устарел или заполнен, его надо перестроить
+ */
+inline
+bool tr_lookup_filter_on_msg_added(TrLookupFilter &f, std::uint64_t prevGeneration, std::uint64_t generation, const std::string &langId, const std::string &catId, const std::string &msgId)
+{
+    if (!f.built || f.generation!=prevGeneration || f.filter.size()+4>f.filter.getCapacity())
+        return false;
+
+    f.filter.insert(tr_lookup_hash_lang(langId));
+    f.filter.insert(tr_lookup_hash_cat(langId, catId));
+    f.filter.insert(tr_lookup_hash_full(langId, catId, msgId));
+    f.filter.insert(tr_lookup_hash_msg(msgId));
+    f.generation = generation;
+    return true;
+}
+
+} // namespace impl_helpers
+
+//----------------------------------------------------------------------------
+
+
+
+
+//----------------------------------------------------------------------------
+namespace impl_helpers {
+
+//! Ключ сообщения (tr_msg_key) -> ключи текстов, которые на него ссылаются
+typedef std::unordered_map<std::string, std::unordered_set<std::string> >  TrMsgRefDependents;
+
+//! Исходные тексты со ссылками $(@...)
+inline
+all_translations_map_t tr_collect_msg_ref_sources(const all_translations_map_t &trAllMap)
+{
+    all_translations_map_t sources;
+    for(const auto &langKvp : trAllMap)
+    {
+        for(const auto &catKvp : langKvp.second)
+        {
+            for(const auto &msgKvp : catKvp.second)
+            {
+                if (tr_has_msg_refs(msgKvp.second))
+                    sources[langKvp.first][catKvp.first][msgKvp.first] = msgKvp.second;
+            }
+        }
+    }
+
+    return sources;
+}
+
+//! Добавляет в deps ссылки текста srcText сообщения srcKey
+inline
+void tr_add_msg_ref_dependents(TrMsgRefDependents &deps, const std::string &srcKey, const std::string &langId, const std::string &catId, const std::string &srcText)
+{
+    tr_enumerate_msg_refs( srcText, catId
+                         , [&](std::string::size_type, std::string::size_type, const std::string &refCatId, const std::string &refMsgId)
+                           {
+                               deps[tr_msg_key(langId, refCatId, refMsgId)].insert(srcKey);
+                           }
+                         );
+}
+
+//! Обратный индекс ссылок для исходных текстов sources
+inline
+TrMsgRefDependents tr_build_msg_ref_dependents(const all_translations_map_t &sources)
+{
+    TrMsgRefDependents deps;
+    for(const auto &langKvp : sources)
+    {
+        for(const auto &catKvp : langKvp.second)
+        {
+            for(const auto &msgKvp : catKvp.second)
+                tr_add_msg_ref_dependents(deps, tr_msg_key(langKvp.first, catKvp.first, msgKvp.first), langKvp.first, catKvp.first, msgKvp.second);
+        }
+    }
+
+    return deps;
+}
+
+//! Разрешает ссылки $(@...) каталога, который ни от чего не зависит (общая база, образ), sources - его тексты со ссылками
+inline
+void tr_resolve_own_msg_refs(all_translations_map_t &trAllMap, const all_translations_map_t &sources)
+{
+    if (sources.empty())
+        return;
+
+    MsgRefResolver resolver(trAllMap, sources, 0, 0);
+    resolver.resolveAll();
+    resolver.commit(trAllMap);
+}
+
+inline
+void tr_resolve_own_msg_refs(all_translations_map_t &trAllMap)
+{
+    tr_resolve_own_msg_refs(trAllMap, tr_collect_msg_ref_sources(trAllMap));
+}
+
+} // namespace impl_helpers
+
+//----------------------------------------------------------------------------
+// Широкие (wchar_t, char16_t, char32_t) копии текстов каталога. Строятся лениво, при первом
+// широком запросе к языку. Ключ - широкий msgId, поэтому ни id, ни текст при поиске не перекодируются.
+// Копии неизменяемых каталогов (общей базы, образа) строятся один раз и общие для всех переводчиков
+// над ними. Переводчик копирует только свои изменения и пересобирает их, если поколение каталога изменилось.
+// Поиск и сборка копии идут под мьютексом. Собранная копия до изменения каталога уже не меняется
+// (узлы unordered_map не переезжают), поэтому найденный текст читается без блокировки.
+//----------------------------------------------------------------------------
+namespace impl_helpers {
+
+//! Мьютекс для кэшей, которые меняются при const-поиске. Копия объекта получает свой мьютекс
+class TrMutex
+{
+    std::mutex      m;
+
+public:
+
+    TrMutex() {}
+    TrMutex(const TrMutex &) {}
+    TrMutex& operator=(const TrMutex &) { return *this; }
+
+    void lock()     { m.lock(); }
+    void unlock()   { m.unlock(); }
+    bool try_lock() { return m.try_lock(); }
+};
+
+template<typename CharType>
+struct TrWideLangView
+{
+    typedef std::basic_string<CharType>                                      wide_string_t;
+    typedef std::unordered_map<wide_string_t, wide_string_t>                 wide_translations_map_t;
+
+    std::uint64_t                                                            generation = 0;
+    std::unordered_map<std::string, wide_translations_map_t>                 categories;
+
+    //! Текст сообщения или 0
+    const wide_string_t* find(const std::string &catId, const wide_string_t &msgId) const
+    {
+        auto cit = categories.find(catId);
+        if (cit==categories.end())
+            return 0;
+
+        auto mit = cit->second.find(msgId);
+        return mit!=cit->second.end() ? &mit->second : 0;
+    }
+};
+
+template<typename CharType>
+using TrWideViews = std::unordered_map<std::string, TrWideLangView<CharType> >;
+
+//------------------------------
+//! Широкие копии неизменяемого каталога (общей базы или образа): язык собирается один раз и больше не меняется
+class TrSharedWideViews
+{
+    mutable TrWideViews<wchar_t>        viewsW ;
+    mutable TrWideViews<char16_t>       views16;
+    mutable TrWideViews<char32_t>       views32;
+    mutable TrMutex                     mutex  ; // Для всех трёх views*
+
+    template<typename CharType>
+    TrWideViews<CharType>& getViews() const
+    {
+        if constexpr (std::is_same_v<CharType, wchar_t>)
+            return viewsW;
+        else if constexpr (std::is_same_v<CharType, char16_t>)
+            return views16;
+        else
+        {
+            static_assert(std::is_same_v<CharType, char32_t>, "TrSharedWideViews: unsupported wide char type");
+            return views32;
+        }
+    }
+
+public:
+
+    //! Широкая копия языка каталога catView (PackedTranslations или CatalogImageView) или 0, если языка в нём нет
+    template<typename CharType, typename TCatalogView>
+    const TrWideLangView<CharType>* getLangView(const TCatalogView &catView, const std::string &langId) const
+    {
+        if (!catView.hasLang(langId))
+            return 0;
+
+        std::lock_guard<TrMutex> lock(mutex);
+
+        auto &views = getViews<CharType>();
+
+        typename TrWideViews<CharType>::const_iterator vit = views.find(langId);
+        if (vit!=views.end())
+            return &vit->second;
+
+        TrWideLangView<CharType> view;
+        catView.enumerateLang( langId
+                             , [&](std::string_view catId, std::string_view msgId, std::string_view text)
+                               {
+                                   view.categories[std::string(catId)][utf::fromUtf8<CharType>(msgId)] = utf::fromUtf8<CharType>(text);
+                               }
+                             );
+
+        return &views.emplace(langId, std::move(view)).first->second;
+    }
+};
+
+typedef std::shared_ptr<const TrSharedWideViews>    tr_shared_wide_views_ptr_t;
+
+//------------------------------
+//! Широкие копии образа каталога, общие для всех переводчиков с этим образом (пока его держит хоть один)
+/*! Образ узнаётся по адресу и размеру - память образа не должна меняться, пока он подключён.
+ */
+inline
+tr_shared_wide_views_ptr_t tr_get_image_wide_views(const CatalogImageView &img)
+{
+    if (img.empty())
+        return tr_shared_wide_views_ptr_t();
+
+    struct ImageViews
+    {
+        const char                                 *pData;
+        std::size_t                                 size ;
+        std::weak_ptr<const TrSharedWideViews>      views;
+    };
+
+    static TrMutex                      mutex ;
+    static std::vector<ImageViews>      images;
+
+    std::lock_guard<TrMutex> lock(mutex);
+
+    images.erase( std::remove_if(images.begin(), images.end(), [](const ImageViews &iv) { return iv.views.expired(); })
+                , images.end()
+                );
+
+    for(const auto &iv : images)
+    {
+        if (iv.pData==img.data() && iv.size==img.size())
+        {
+            tr_shared_wide_views_ptr_t res = iv.views.lock();
+            if (res)
+                return res;
+        }
+    }
+
+    tr_shared_wide_views_ptr_t res = std::make_shared<const TrSharedWideViews>();
+    images.emplace_back(ImageViews{img.data(), img.size(), res});
+    return res;
+}
+
+} // namespace impl_helpers
+
+//----------------------------------------------------------------------------
+//! Неизменяемый каталог, общий для нескольких переводчиков (например, база для сотен клиентов)
+/*! Переводчик с общей базой (Translator::setSharedBase) хранит в своём каталоге только
+    собственные изменения и ищет сначала в них, затем в базе. Память растёт с числом
+    переопределений, а не с числом переводчиков. Фильтр поиска базы строится один раз здесь же.
+    Ссылки $(@...) в текстах базы разрешаются при создании в пределах самой базы. Исходные тексты
+    со ссылками и обратный индекс ссылок тоже хранятся в базе: переводчик, который переопределил
+    сообщение, на которое ссылаются тексты базы, разрешает эти тексты заново в своём каталоге.
+    Тексты хранятся упакованными в пул строк (PackedTranslations), а не в all_translations_map_t.
+    Память каталога (и самого объекта) берётся из pResource, он должен жить дольше всех переводчиков с этой базой.
+
+    Раскладка под рабочий набор: профилируемую базу (tr_make_profiled_shared_translations, или копию
+    базы переводчика - Translator::profileSharedBase) дают поработать на реальном трафике, затем
+    tr_make_hot_shared_translations строит новую базу с горячей таблицей и подменяет ею старую (setSharedBase).
+ */
+class SharedTranslations
+{
+
+protected:
+
+    PackedTranslations                  catalog         ;
+    BlockedBloomFilter                  filter          ;
+    all_translations_map_t              msgRefSources   ; // Исходные тексты со ссылками $(@...)
+    impl_helpers::TrMsgRefDependents    msgRefDependents;
+    impl_helpers::TrSharedWideViews     wideViews       ; // Широкие копии для trWide, общие для всех переводчиков с этой базой
+
+public:
+
+    explicit SharedTranslations(all_translations_map_t trMap, std::pmr::memory_resource *pResource = std::pmr::get_default_resource())
+    : catalog(pResource)
+    , msgRefSources(impl_helpers::tr_collect_msg_ref_sources(trMap))
+    , msgRefDependents(impl_helpers::tr_build_msg_ref_dependents(msgRefSources))
+    {
+        impl_helpers::tr_resolve_own_msg_refs(trMap, msgRefSources);
+        impl_helpers::tr_lookup_filter_fill(filter, trMap, 1);
+        catalog = PackedTranslations(trMap, pResource);
+    }
+
+    //! Копия профилированной базы с горячей таблицей из maxHotMsgs самых частых сообщений
+    SharedTranslations(const SharedTranslations &profiled, std::size_t maxHotMsgs, std::pmr::memory_resource *pResource = std::pmr::get_default_resource())
+    : catalog(profiled.catalog.makeHotLayout(maxHotMsgs, pResource))
+    , filter(profiled.filter)
+    , msgRefSources(profiled.msgRefSources)
+    , msgRefDependents(profiled.msgRefDependents)
+    {}
+
+    //! Подсчёт попаданий в сообщения базы, возвращает предыдущий режим (см. PackedTranslations::setProfilingMode)
+    bool setProfilingMode(bool enable)
+    {
+        return catalog.setProfilingMode(enable);
+    }
+
+    bool getProfilingMode() const
+    {
+        return catalog.getProfilingMode();
+    }
+
+    const PackedTranslations& getCatalog() const
+    {
+        return catalog;
+    }
+
+    //! Объём и экономия от дедупликации строк
+    PackedTranslationsStats getStats() const
+    {
+        return catalog.getStats();
+    }
+
+    const BlockedBloomFilter& getFilter() const
+    {
+        return filter;
+    }
+
+    bool hasMsgRefs() const
+    {
+        return !msgRefSources.empty();
+    }
+
+    //! Исходный текст со ссылками (до подстановки) или 0, если в тексте нет ссылок
+    const std::string* findMsgRefSource(const std::string &langId, const std::string &catId, const std::string &msgId) const
+    {
+        return impl_helpers::tr_find_msg_text(msgRefSources, langId, catId, msgId);
+    }
+
+    //! Широкая копия языка базы (строится при первом запросе) или 0, если языка в базе нет
+    template<typename CharType>
+    const impl_helpers::TrWideLangView<CharType>* getWideLangView(const std::string &langId) const
+    {
+        return wideViews.getLangView<CharType>(catalog, langId);
+    }
+
+    //! Ключи (tr_msg_key) текстов базы, которые ссылаются на сообщение key, или 0
+    const std::unordered_set<std::string>* findMsgRefDependents(const std::string &key) const
+    {
+        impl_helpers::TrMsgRefDependents::const_iterator it = msgRefDependents.find(key);
+        return it!=msgRefDependents.end() ? &it->second : 0;
+    }
+
+}; // class SharedTranslations
+
+typedef std::shared_ptr<const SharedTranslations>   shared_translations_ptr_t;
+typedef std::shared_ptr<SharedTranslations>         profiled_shared_translations_ptr_t; // Для профилирования - счётчики включаются/сбрасываются через неконстантный объект
+
+//------------------------------
+inline
+shared_translations_ptr_t tr_make_shared_translations(all_translations_map_t trMap, std::pmr::memory_resource *pResource = std::pmr::get_default_resource())
+{
+    return std::allocate_shared<SharedTranslations>(std::pmr::polymorphic_allocator<SharedTranslations>(pResource), std::move(trMap), pResource);
+}
+
+//------------------------------
+//! База в режиме профилирования. Подключается к переводчикам как обычная (setSharedBase), счётчики - через возвращённый объект
+inline
+profiled_shared_translations_ptr_t tr_make_profiled_shared_translations(all_translations_map_t trMap, std::pmr::memory_resource *pResource = std::pmr::get_default_resource())
+{
+    profiled_shared_translations_ptr_t res = std::allocate_shared<SharedTranslations>(std::pmr::polymorphic_allocator<SharedTranslations>(pResource), std::move(trMap), pResource);
+    res->setProfilingMode(true);
+    return res;
+}
+
+//------------------------------
+//! Новая база по счётчикам профилированной: maxHotMsgs самых частых сообщений - подряд и в горячей таблице
+inline
+shared_translations_ptr_t tr_make_hot_shared_translations(const SharedTranslations &profiled, std::size_t maxHotMsgs, std::pmr::memory_resource *pResource = std::pmr::get_default_resource())
+{
+    return std::allocate_shared<SharedTranslations>(std::pmr::polymorphic_allocator<SharedTranslations>(pResource), profiled, maxHotMsgs, pResource);
+}
+
+//------------------------------
+//! Строит образ каталога (см. catalog_image.h), ссылки $(@...) разрешаются в пределах каталога
+inline
+std::vector<char> tr_build_catalog_image(all_translations_map_t trMap)
+{
+    impl_helpers::tr_resolve_own_msg_refs(trMap);
+    return buildCatalogImage(trMap);
+}
+
+//----------------------------------------------------------------------------
+
+
+
+
+//----------------------------------------------------------------------------
+// Счётчики сообщений о промахах tr() (лимит сообщений, setMissReportLimit)
+// Промах по одному и тому же ключу (например, ещё не переведённая строка, выводимая в цикле) не дёргает
+// IErrReportHandler на каждый вызов. Таблица direct-mapped, работает только
+// для собственного каталога переводчика и сбрасывается при его изменении (getCatalogGeneration()).
+// Вытесненный из таблицы промах будет сообщён снова, поэтому дедупликация - скорее ограничение частоты.
+// Таблица меняется при поиске, поэтому закрыта мьютексом; без лимита сообщений (0) или без обработчика
+// она не используется. Сам текст-заглушка повторного промаха берётся из потокового кэша tr().
+//----------------------------------------------------------------------------
+namespace impl_helpers {
+
+struct TrMissCacheEntry
+{
+    bool             used       = false;
+    MsgNotFound      what       = MsgNotFound::msg;
+    std::uint64_t    generation = 0;
+    std::size_t      numReports = 0;
+    std::string      msgId      ;
+    std::string      catId      ;
+    std::string      langId     ;
+};
+
+//------------------------------
+//! Слот счётчика сообщений о промахе (для лимита сообщений)
+inline
+TrMissCacheEntry& tr_get_miss_cache_entry(std::vector<TrMissCacheEntry> &c, std::uint64_t generation, MsgNotFound what, const std::string &msgId, const std::string &catId, const std::string &langId)
+{
+    // Хэшируем только msgId, категория и язык сравниваются при проверке слота
+    const std::size_t h = std::hash<std::string>()(msgId);
+
+    TrMissCacheEntry &e = c[h%c.size()];
+    if ( e.used && e.generation==generation && e.what==what
+      && e.msgId==msgId && e.catId==catId && e.langId==langId
+       )
+    {
+        return e;
+    }
+
+    // Строки слота переиспользуют свой буфер
+    e.used       = true;
+    e.what       = what;
+    e.generation = generation;
+    e.numReports = 0;
+    e.msgId      = msgId;
+    e.catId      = catId;
+    e.langId     = langId;
+
+    return e;
+}
+
+} // namespace impl_helpers
+
+//----------------------------------------------------------------------------
+
+
+
+
+//----------------------------------------------------------------------------
+// Потоковый кэш tr(): найденные переводы и промахи
+// Свой у каждого потока, direct-mapped, общий для всех переводчиков. Ключ - msgId, категория и язык
+// в том виде, как их передали в tr() (до нормализации), плюс идентификатор переводчика и поколение
+// его каталога. Повторный tr() с теми же аргументами не нормализует категорию и язык и не ходит
+// по каталогу. Любое изменение каталога (tr_add, tr_clear, загрузка, слои, общая база, образ, а также
+// получение каталога для правки через getAllTranslations()) меняет поколение, и старые слоты перестают
+// совпадать. Текст в слоте - собственная копия, не view: слот не ссылается на память каталога.
+// Для промаха в слоте лежит готовый текст-заглушка ("![msgId]") и нормализованные категория и язык -
+// для обработчика ошибок, который вызывается и при повторном промахе.
+//----------------------------------------------------------------------------
+namespace impl_helpers {
+
+static_assert(MARTY_TR_LOOKUP_CACHE_SIZE>0 && (MARTY_TR_LOOKUP_CACHE_SIZE & (MARTY_TR_LOOKUP_CACHE_SIZE-1))==0, "MARTY_TR_LOOKUP_CACHE_SIZE must be a power of two");
+
+//! Уникальный идентификатор объекта, копия и присваивание получают новый
+/*! Слоты кэша одного переводчика не совпадут у его копии и у другого переводчика, созданного позже
+    по тому же адресу. Слот хранит свою копию текста, но поколение каталога у копии переводчика
+    считается дальше независимо и может совпасть с поколением оригинала при другом содержимом.
+ */
+class TrInstanceId
+{
+    std::uint64_t   id;
+
+    static std::uint64_t next()
+    {
+        static std::atomic<std::uint64_t> counter{0};
+        return counter.fetch_add(1, std::memory_order_relaxed)+1;
+    }
+
+public:
+
+    TrInstanceId() : id(next()) {}
+    TrInstanceId(const TrInstanceId &) : id(next()) {}
+    TrInstanceId& operator=(const TrInstanceId &) { id = next(); return *this; }
+
+    std::uint64_t get() const { return id; }
+};
+
+struct TrLookupCacheEntry
+{
+    std::uint64_t       owner      = 0; // TrInstanceId, 0 - слот пуст
+    std::uint64_t       generation = 0;
+    std::size_t         hash       = 0;
+    std::string         msgId      ;
+    std::string         catId      ;
+    std::string         langId     ;
+    std::string         text       ; // Перевод или, для промаха, текст-заглушка
+    bool                miss       = false;
+    MsgNotFound         what       = MsgNotFound::msg; // Для промаха
+    std::string         normCatId  ; // Для промаха
+    std::string         normLangId ; // Для промаха
+};
+
+//------------------------------
+inline
+std::vector<TrLookupCacheEntry>& tr_get_thread_lookup_cache()
+{
+    thread_local std::vector<TrLookupCacheEntry> c;
+    return c;
+}
+
+//------------------------------
+inline
+std::size_t tr_lookup_cache_hash(const std::string &msgId, const std::string &catId, const std::string &langId)
+{
+    std::size_t h = std::hash<std::string>()(msgId);
+    h ^= std::hash<std::string>()(catId ) + 0x9E3779B97F4A7C15ull + (h<<6) + (h>>2);
+    h ^= std::hash<std::string>()(langId) + 0x9E3779B97F4A7C15ull + (h<<6) + (h>>2);
+    return h;
+}
+
+//------------------------------
+//! Слот потокового кэша для ключа, совпадает ли он - проверяет вызывающий (tr_lookup_cache_match)
+inline
+TrLookupCacheEntry& tr_get_lookup_cache_entry(std::size_t h)
+{
+    std::vector<TrLookupCacheEntry> &c = tr_get_thread_lookup_cache();
+    if (c.empty())
+        c.resize(MARTY_TR_LOOKUP_CACHE_SIZE);
+
+    return c[h & (c.size()-1)];
+}
+
+inline
+bool tr_lookup_cache_match(const TrLookupCacheEntry &e, std::uint64_t owner, std::uint64_t generation, std::size_t h, const std::string &msgId, const std::string &catId, const std::string &langId)
+{
+    return e.owner==owner && e.generation==generation && e.hash==h
+        && e.msgId==msgId && e.catId==catId && e.langId==langId;
+}
+
+inline
+void tr_lookup_cache_store(TrLookupCacheEntry &e, std::uint64_t owner, std::uint64_t generation, std::size_t h, const std::string &msgId, const std::string &catId, const std::string &langId, std::string_view text)
+{
+    // Строки слота переиспользуют свой буфер
+    e.owner      = owner;
+    e.generation = generation;
+    e.hash       = h;
+    e.msgId      = msgId;
+    e.catId      = catId;
+    e.langId     = langId;
+    e.text.assign(text.data(), text.size());
+    e.miss       = false;
+}
+
+//! Промах: text - текст-заглушка, what и нормализованные категория и язык - для обработчика ошибок
+inline
+void tr_lookup_cache_store_miss(TrLookupCacheEntry &e, std::uint64_t owner, std::uint64_t generation, std::size_t h, const std::string &msgId, const std::string &catId, const std::string &langId, const std::string &text, MsgNotFound what, const std::string &normCatId, const std::string &normLangId)
+{
+    tr_lookup_cache_store(e, owner, generation, h, msgId, catId, langId, text);
+    e.miss       = true;
+    e.what       = what;
+    e.normCatId  = normCatId;
+    e.normLangId = normLangId;
+}
+
+//------------------------------
+//! Освобождает кэш текущего потока
+inline
+void tr_clear_thread_lookup_cache()
+{
+    std::vector<TrLookupCacheEntry>().swap(tr_get_thread_lookup_cache());
+}
+
+} // namespace impl_helpers
+
+//----------------------------------------------------------------------------
+
+
+
+
+//----------------------------------------------------------------------------
+// Слои каталога (overlay): базовый каталог снизу, над ним слои в порядке объявления - продукт,
+// переопределения клиента, горячие исправления. Собственный каталог переводчика хранит уже сведённый
+// результат, поэтому поиск - один проход по map независимо от числа слоёв. При изменении слоя
+// пересчитываются только затронутые им ключи, перекрытые тексты базового каталога хранятся
+// в индексе перекрытий и возвращаются, когда ключ пропадает из всех слоёв.
+
+namespace impl_helpers {
+
+struct TrCatalogLayer
+{
+    std::string                 name        ;
+    all_translations_map_t      translations;
+};
+
+struct TrOverlayEntry
+{
+    bool                        hasBase  = false;
+    std::string                 baseText ; // Исходный текст базового каталога (до подстановки ссылок)
+};
+
+//------------------------------
+inline
+std::string tr_overlay_key(const std::string &langId, const std::string &catId, const std::string &msgId)
+{
+    return tr_msg_key(langId, catId, msgId);
+}
+
+//------------------------------
+//! Как вернуть текст одного сообщения собственного каталога, если изменение пришлось откатить
+struct TrMsgTextUndo
+{
+    std::string     langId ;
+    std::string     catId  ;
+    std::string     msgId  ;
+    bool            hadLang = false;
+    bool            hadCat  = false;
+    bool            hadMsg  = false;
+    std::string     prevText;
+    bool            hadSrc  = false;
+    std::string     prevSrc ; // Исходный текст со ссылками
+    bool            wasBaseRefCopy = false; // Был текстом базы, разрешённым в своём каталоге (Translator::baseRefCopies)
+};
+
+} // namespace impl_helpers
+
+//----------------------------------------------------------------------------
+
+
+
+
+//----------------------------------------------------------------------------
+//! Переводчик - каталог, настройки и все производные индексы/кэши в одном объекте
+/*! Экземпляры независимы и могут работать параллельно в разных потоках. Один экземпляр можно
+    читать (const-методы) из нескольких потоков сразу: фильтр строится при изменении каталога,
+    счётчики сообщений о промахах и широкие копии, которые меняются при поиске, закрыты мьютексами,
+    а кэш tr() (найденные переводы и промахи) у каждого потока свой.
+    Изменение каталога и настроек - без одновременного чтения, синхронизация на вызывающем.
+    Функции tr_* работают с экземпляром по умолчанию, см. tr_get_default_translator().
+
+    Методы, принимающие all_translations_map_t, ищут/добавляют в переданном каталоге с настройками
+    этого переводчика, фильтр, кэш tr() и счётчики промахов при этом используются только для собственного каталога.
+
+    Над собственным (базовым) каталогом можно объявить слои (addLayer), см. TrCatalogLayer.
+    getAllTranslations() возвращает сведённый каталог.
+
+    Собственный каталог может лежать поверх общей неизменяемой базы (SharedTranslations) и/или
+    образа каталога (CatalogImageView, например, в разделяемой памяти), тогда он хранит только
+    изменения, а поиск, перечисление и широкие копии видят базу и образ под ними.
+    hasCategory(), replaceCategory() и getAllTranslations() работают только с изменениями.
+    Тексты базы со ссылками $(@...) на переопределённые сообщения разрешаются заново и тоже
+    попадают в изменения - результат поиска тот же, что у переводчика с полной копией базы.
+    Для образа каталога этого нет: его ссылки разрешены при построении образа.
+ */
+class Translator
+{
+
+protected:
+
+    all_translations_map_t                              translations            ;
+    all_translations_map_t                              alterTranslations       ;
+    all_translations_map_t                              msgRefSources           ; // Исходные тексты сообщений со ссылками $(@...)
+    impl_helpers::TrMsgRefDependents                    msgRefDependents        ; // Ключ сообщения -> ключи текстов, которые на него ссылаются
+    std::unordered_set<std::string>                     baseRefCopies           ; // Тексты общей базы со ссылками на свои переопределения, разрешённые заново в своём каталоге
+
+    std::vector<impl_helpers::TrCatalogLayer>           layers                  ; // Слои над базовым каталогом, по возрастанию приоритета
+    std::unordered_map<std::string, impl_helpers::TrOverlayEntry> overlayIndex  ; // Ключи каталога, взятые из слоёв
+    shared_translations_ptr_t                           sharedBase              ; // Общая неизменяемая база, translations - изменения поверх неё
+    CatalogImageView                                    catalogImage            ; // Образ каталога (например, в разделяемой памяти) под базой, память не наша
+
+    std::string                                         defCategory             = "common";
+    #if defined(WIN32) || defined(_WIN32)
+    std::string                                         defLang                 = "0409";
+    std::string                                         alterDefLang            = "0409";
+    #else
+    std::string                                         defLang                 = "en-US";
+    std::string                                         alterDefLang            = "en-US";
+    #endif
+    ELangTagFormat                                      langTagFormat           = ELangTagFormat::langIdFull; // 0409
+    bool                                                msgNotFoundDecorateMode = true ;
+    bool                                                emptyMsgNotExist        = false;
+    bool                                                lookupFilterMode        = false;
+    bool                                                lookupCacheMode         = false;
+    bool                                                missCacheMode           = true ;
+    std::size_t                                         missReportLimit         = MARTY_TR_MISS_REPORT_LIMIT;
+    IErrReportHandlerPtr                                errHandler              = 0;
+
+    std::uint64_t                                       generation              = 0;
+    impl_helpers::TrInstanceId                          instanceId              ; // Владелец слотов потокового кэша tr()
+    MessageTemplateCache                                templates               ;
+
+    impl_helpers::TrLookupFilter                        lookupFilter            ; // Строится при изменении каталога, поиск только читает
+    std::size_t                                         missCacheSize           = MARTY_TR_MISS_CACHE_SIZE;
+    mutable std::vector<impl_helpers::TrMissCacheEntry> missCache               ; // Счётчики сообщений о промахах, выделяются при первом сообщении, под missCacheMutex
+    mutable impl_helpers::TrMutex                       missCacheMutex          ;
+    mutable impl_helpers::TrWideViews<wchar_t>          wideViewsW              ; // Широкие копии своего каталога (без базы и образа)
+    mutable impl_helpers::TrWideViews<char16_t>         wideViews16             ;
+    mutable impl_helpers::TrWideViews<char32_t>         wideViews32             ;
+    mutable impl_helpers::TrMutex                       wideViewsMutex          ; // Для всех трёх wideViews*
+    impl_helpers::tr_shared_wide_views_ptr_t            imageWideViews          ; // Широкие копии образа каталога, общие для переводчиков с этим образом
+
+
+protected: // utils
+
+    bool isOwnCatalog(const all_translations_map_t &trAllMap) const
+    {
+        return &trAllMap==&translations;
+    }
+
+    //! Актуальный фильтр для trAllMap, или 0, если фильтр не используется или устарел (каталог правили напрямую)
+    const BlockedBloomFilter* getLookupFilter(const all_translations_map_t &trAllMap) const
+    {
+        if (!lookupFilterMode || !isOwnCatalog(trAllMap) || !lookupFilter.built || lookupFilter.generation!=generation)
+            return 0;
+
+        return &lookupFilter.filter;
+    }
+
+    //! Строит фильтр заново (или освобождает, если он выключен)
+    void rebuildLookupFilter()
+    {
+        if (lookupFilterMode)
+            impl_helpers::tr_lookup_filter_build(lookupFilter, translations, generation);
+        else if (lookupFilter.built)
+            lookupFilter = impl_helpers::TrLookupFilter();
+    }
+
+    //! Новое поколение после изменения одного сообщения: фильтр дописывается, а не строится заново
+    /*! Удалённое сообщение в фильтре остаётся - лишний ключ даёт только ложное "может быть"
+     */
+    void msgChanged(const std::string &langId, const std::string &catId, const std::string &msgId)
+    {
+        const std::uint64_t prevGeneration = generation++;
+        if (lookupFilterMode && !impl_helpers::tr_lookup_filter_on_msg_added(lookupFilter, prevGeneration, generation, langId, catId, msgId))
+            rebuildLookupFilter();
+    }
+
+    //! Ключи (tr_msg_key), добавленные в свой каталог без смены поколения, дописываются в фильтр
+    void addToLookupFilter(const std::vector<std::string> &keys)
+    {
+        if (!lookupFilterMode)
+            return;
+
+        std::string langId, catId, msgId;
+        for(const auto &key : keys)
+        {
+            if (!impl_helpers::tr_split_msg_key(key, langId, catId, msgId))
+                continue;
+            if (!impl_helpers::tr_lookup_filter_on_msg_added(lookupFilter, generation, generation, langId, catId, msgId))
+            {
+                rebuildLookupFilter();
+                return;
+            }
+        }
+    }
+
+    //! Поиск в каталоге (для своего - и в общей базе), catId и langId уже нормализованы. Если не найдено - what указывает, чего нет
+    std::optional<std::string_view> findNormalized(const all_translations_map_t& trAllMap, const std::string &msgId, const std::string &catId, const std::string &langId, MsgNotFound &what) const
+    {
+        const std::string *pText = findNormalizedIn(trAllMap, getLookupFilter(trAllMap), msgId, catId, langId, what);
+        if (pText)
+            return std::string_view(*pText);
+
+        if (!isOwnCatalog(trAllMap))
+            return std::nullopt;
+
+        // В своих изменениях нет - ищем в общей базе, затем в образе каталога.
+        // Сообщаем о самом точном промахе: есть язык, но нет категории - значит, нет категории
+        if (sharedBase)
+        {
+            std::optional<std::string_view> baseText = findNormalizedInView(sharedBase->getCatalog(), lookupFilterMode ? &sharedBase->getFilter() : 0, msgId, catId, langId, what);
+            if (baseText)
+                return baseText;
+        }
+
+        if (!catalogImage.empty())
+            return findNormalizedInView(catalogImage, 0, msgId, catId, langId, what);
+
+        return std::nullopt;
+    }
+
+    //! Поиск в упакованном каталоге или образе (интерфейс CatalogImageView), what уточняется, если промах точнее
+    template<typename TCatalogView>
+    std::optional<std::string_view> findNormalizedInView(const TCatalogView &catView, const BlockedBloomFilter *pFilter, const std::string &msgId, const std::string &catId, const std::string &langId, MsgNotFound &what) const
+    {
+        std::optional<std::string_view> text;
+        if (!pFilter || pFilter->mayContain(impl_helpers::tr_lookup_hash_full(langId, catId, msgId)))
+            text = catView.find(langId, catId, msgId);
+
+        if (text && !(emptyMsgNotExist && text->empty()))
+            return text;
+
+        MsgNotFound viewWhat = text || catView.hasCategory(langId, catId) ? MsgNotFound::msg
+                             : catView.hasLang(langId)                     ? MsgNotFound::cat
+                             :                                               MsgNotFound::lang;
+        if (viewWhat<what)
+            what = viewWhat;
+
+        return std::nullopt;
+    }
+
+    //! Поиск в одном каталоге, pFilter - его фильтр или 0
+    const std::string* findNormalizedIn(const all_translations_map_t& trAllMap, const BlockedBloomFilter *pFilter, const std::string &msgId, const std::string &catId, const std::string &langId, MsgNotFound &what) const
+    {
+        // Если фильтр говорит, что сообщения нет, по map проходим только чтобы понять, чего именно нет
+        const bool msgMissing = pFilter && !pFilter->mayContain(impl_helpers::tr_lookup_hash_full(langId, catId, msgId));
+        if (msgMissing && !pFilter->mayContain(impl_helpers::tr_lookup_hash_lang(langId)))
+        {
+            what = MsgNotFound::lang;
+            return 0;
+        }
+
+        all_translations_map_t::const_iterator lit = trAllMap.find(langId);
+        if (lit==trAllMap.end())
+        {
+            what = MsgNotFound::lang;
+            return 0;
+        }
+
+        const category_translations_map_t &catMap = lit->second;
+
+        category_translations_map_t::const_iterator cit = catMap.find(catId);
+        if (cit==catMap.end())
+        {
+            what = MsgNotFound::cat;
+            return 0;
+        }
+
+        what = MsgNotFound::msg;
+
+        if (msgMissing)
+            return 0;
+
+        const translations_map_t &trMap = cit->second;
+
+        translations_map_t::const_iterator mit = trMap.find(msgId);
+        if (mit==trMap.end())
+            return 0;
+
+        if (emptyMsgNotExist && mit->second.empty())
+            return 0;
+
+        return &mit->second;
+    }
+
+    //! Сообщает о промахе в обработчик ошибок, с учётом лимита сообщений
+    void reportMiss(const all_translations_map_t& trAllMap, MsgNotFound what, const std::string &msgId, const std::string &catId, const std::string &langId) const
+    {
+        if (!errHandler)
+            return;
+
+        if (missReportLimit && missCacheSize && isOwnCatalog(trAllMap))
+        {
+            std::lock_guard<impl_helpers::TrMutex> lock(missCacheMutex);
+
+            if (missCache.size()!=missCacheSize)
+                missCache.resize(missCacheSize);
+
+            impl_helpers::TrMissCacheEntry &e = impl_helpers::tr_get_miss_cache_entry(missCache, generation, what, msgId, catId, langId);
+            if (e.numReports>=missReportLimit)
+                return;
+            ++e.numReports;
+        }
+
+        // Обработчик вызывается без блокировки - он может сам звать tr()
+        errHandler->messageNotFound(what, msgId, catId, langId);
+    }
+
+    //! Текст для подстановки вместо ненайденного перевода
+    std::string notFoundText(const std::string &msgId) const
+    {
+        if (!msgNotFoundDecorateMode)
+            return msgId;
+
+        return "![" + msgId + "]";
+    }
+
+    //! Сообщает о промахе (с учётом лимита) и возвращает текст для подстановки вместо перевода
+    std::string reportNotFound(const all_translations_map_t& trAllMap, MsgNotFound what, const std::string &msgId, const std::string &catId, const std::string &langId) const
+    {
+        reportMiss(trAllMap, what, msgId, catId, langId);
+        return notFoundText(msgId);
+    }
+
+    //! Добавляет (add=true) или убирает в msgRefDependents ссылки текста srcText сообщения srcKey
+    void updateMsgRefDependents(const std::string &srcKey, const std::string &langId, const std::string &catId, const std::string &srcText, bool add)
+    {
+        if (add)
+        {
+            impl_helpers::tr_add_msg_ref_dependents(msgRefDependents, srcKey, langId, catId, srcText);
+            return;
+        }
+
+        impl_helpers::tr_enumerate_msg_refs( srcText, catId
+                                           , [&](std::string::size_type, std::string::size_type, const std::string &refCatId, const std::string &refMsgId)
+                                             {
+                                                 auto it = msgRefDependents.find(impl_helpers::tr_msg_key(langId, refCatId, refMsgId));
+                                                 if (it==msgRefDependents.end())
+                                                     return;
+                                                 it->second.erase(srcKey);
+                                                 if (it->second.empty())
+                                                     msgRefDependents.erase(it);
+                                             }
+                                           );
+    }
+
+    void rebuildMsgRefDependents()
+    {
+        msgRefDependents = impl_helpers::tr_build_msg_ref_dependents(msgRefSources);
+    }
+
+    //! Запоминает (или забывает) исходный текст сообщения со ссылками
+    void updateMsgRefSource(const std::string &langId, const std::string &catId, const std::string &msgId, const std::string &msgText)
+    {
+        const std::string *pPrevSrc = impl_helpers::tr_find_msg_text(msgRefSources, langId, catId, msgId);
+        if (!pPrevSrc && msgRefSources.empty() && !tr_has_msg_refs(msgText))
+            return; // Частый случай - ссылок в каталоге нет вообще
+
+        const std::string key = impl_helpers::tr_msg_key(langId, catId, msgId);
+        if (pPrevSrc)
+            updateMsgRefDependents(key, langId, catId, *pPrevSrc, false);
+
+        if (tr_has_msg_refs(msgText))
+        {
+            msgRefSources[langId][catId][msgId] = msgText;
+            updateMsgRefDependents(key, langId, catId, msgText, true);
+            return;
+        }
+
+        all_translations_map_t::iterator lit = msgRefSources.find(langId);
+        if (lit==msgRefSources.end())
+            return;
+
+        category_translations_map_t::iterator cit = lit->second.find(catId);
+        if (cit==lit->second.end())
+            return;
+
+        cit->second.erase(msgId);
+    }
+
+    //! Собирает исходные тексты со ссылками из только что загруженного каталога
+    void collectMsgRefSources()
+    {
+        msgRefSources.clear();
+        msgRefDependents.clear();
+
+        for(const auto &langKvp : translations)
+        {
+            for(const auto &catKvp : langKvp.second)
+            {
+                for(const auto &msgKvp : catKvp.second)
+                {
+                    if (tr_has_msg_refs(msgKvp.second))
+                        msgRefSources[langKvp.first][catKvp.first][msgKvp.first] = msgKvp.second;
+                }
+            }
+        }
+
+        rebuildMsgRefDependents();
+    }
+
+    static const translations_map_t* findCategoryMap(const all_translations_map_t &trAllMap, const std::string &langId, const std::string &catId)
+    {
+        all_translations_map_t::const_iterator lit = trAllMap.find(langId);
+        if (lit==trAllMap.end())
+            return 0; // No lang found
+
+        category_translations_map_t::const_iterator cit = lit->second.find(catId);
+        if (cit==lit->second.end())
+            return 0;
+
+        return &cit->second;
+    }
+
+    //! Записывает текст в собственный каталог, запоминая в undo, как вернуть прежний
+    void writeOwnMsgText(const std::string &langId, const std::string &catId, const std::string &msgId, const std::string &msgText, std::vector<impl_helpers::TrMsgTextUndo> &undo)
+    {
+        impl_helpers::TrMsgTextUndo u;
+        u.langId = langId;
+        u.catId  = catId;
+        u.msgId  = msgId;
+
+        all_translations_map_t::iterator lit = translations.find(langId);
+        u.hadLang = lit!=translations.end();
+        if (u.hadLang)
+        {
+            category_translations_map_t::iterator cit = lit->second.find(catId);
+            u.hadCat = cit!=lit->second.end();
+            if (u.hadCat)
+            {
+                translations_map_t::iterator mit = cit->second.find(msgId);
+                u.hadMsg = mit!=cit->second.end();
+                if (u.hadMsg)
+                    u.prevText = mit->second;
+            }
+        }
+
+        const std::string *pPrevSrc = impl_helpers::tr_find_msg_text(msgRefSources, langId, catId, msgId);
+        u.hadSrc = pPrevSrc!=0;
+        if (u.hadSrc)
+            u.prevSrc = *pPrevSrc;
+
+        // Текст базы, разрешённый в своём каталоге, становится своим переопределением
+        u.wasBaseRefCopy = !baseRefCopies.empty() && baseRefCopies.erase(impl_helpers::tr_msg_key(langId, catId, msgId))!=0;
+
+        templates.replace(u.hadMsg ? &u.prevText : 0, &msgText);
+        undo.emplace_back(std::move(u));
+
+        translations[langId][catId][msgId] = msgText;
+        updateMsgRefSource(langId, catId, msgId, msgText);
+    }
+
+    //! Откатывает writeOwnMsgText в обратном порядке
+    void undoOwnMsgTexts(std::vector<impl_helpers::TrMsgTextUndo> &undo)
+    {
+        for(std::size_t i=undo.size(); i!=0; --i)
+        {
+            impl_helpers::TrMsgTextUndo &u = undo[i-1];
+
+            updateMsgRefSource(u.langId, u.catId, u.msgId, u.hadSrc ? u.prevSrc : std::string());
+            if (u.wasBaseRefCopy)
+                baseRefCopies.insert(impl_helpers::tr_msg_key(u.langId, u.catId, u.msgId));
+
+            if (u.hadMsg)
+            {
+                std::string &text = translations[u.langId][u.catId][u.msgId];
+                templates.replace(&text, &u.prevText);
+                text = std::move(u.prevText);
+                continue;
+            }
+
+            all_translations_map_t::iterator lit = translations.find(u.langId);
+            if (lit==translations.end())
+                continue;
+
+            category_translations_map_t::iterator cit = lit->second.find(u.catId);
+            if (cit!=lit->second.end())
+            {
+                translations_map_t::iterator mit = cit->second.find(u.msgId);
+                if (mit!=cit->second.end())
+                {
+                    templates.replace(&mit->second, 0);
+                    cit->second.erase(mit);
+                }
+                if (!u.hadCat && cit->second.empty())
+                    lit->second.erase(cit);
+            }
+
+            if (!u.hadLang && lit->second.empty())
+                translations.erase(lit);
+        }
+
+        undo.clear();
+    }
+
+    //! Записывает текст одного сообщения
+    /*! В собственном каталоге пересчитываются ссылки, затронутые этим сообщением. Если новый текст
+        замыкает цикл ссылок - исключение, каталог остаётся прежним.
+     */
+    void setMsgText(all_translations_map_t &trAllMap, const std::string &langId, const std::string &catId, const std::string &msgId, const std::string &msgText)
+    {
+        if (!isOwnCatalog(trAllMap))
+        {
+            std::string &text = trAllMap[langId][catId][msgId];
+            templates.replace(&text, &msgText); // Новое сообщение - пустая строка, её шаблона в кэше нет
+            text = msgText;
+            return;
+        }
+
+        std::vector<impl_helpers::TrMsgTextUndo> undo;
+        writeOwnMsgText(langId, catId, msgId, msgText, undo);
+
+        try
+        {
+            resolveMsgRefsFor(std::vector<std::string>(1, impl_helpers::tr_msg_key(langId, catId, msgId)));
+        }
+        catch(...)
+        {
+            undoOwnMsgTexts(undo);
+            throw;
+        }
+
+        msgChanged(langId, catId, msgId);
+    }
+
+    //------------------------------
+    //! Индекс слоя по имени или layers.size()
+    std::size_t findLayerIndex(const std::string &layerName) const
+    {
+        std::size_t i = 0;
+        for(; i!=layers.size(); ++i)
+        {
+            if (layers[i].name==layerName)
+                break;
+        }
+        return i;
+    }
+
+    impl_helpers::TrCatalogLayer& getLayer(const std::string &layerName)
+    {
+        std::size_t idx = findLayerIndex(layerName);
+        if (idx==layers.size())
+            throw std::runtime_error("tr: catalog layer not found: " + layerName);
+        return layers[idx];
+    }
+
+    //! Сведённый текст ключа в собственном каталоге. Не меняет поколение - это делает вызывающий
+    void setOverlayViewText(const std::string &langId, const std::string &catId, const std::string &msgId, const std::string &msgText)
+    {
+        translations_map_t &msgs = translations[langId][catId];
+        translations_map_t::iterator mit = msgs.find(msgId);
+        templates.replace(mit!=msgs.end() ? &mit->second : 0, &msgText);
+
+        if (mit!=msgs.end())
+            mit->second = msgText;
+        else
+            msgs[msgId] = msgText;
+
+        updateMsgRefSource(langId, catId, msgId, msgText);
+    }
+
+    void eraseOverlayViewText(const std::string &langId, const std::string &catId, const std::string &msgId)
+    {
+        updateMsgRefSource(langId, catId, msgId, std::string());
+
+        all_translations_map_t::iterator lit = translations.find(langId);
+        if (lit==translations.end())
+            return;
+
+        category_translations_map_t::iterator cit = lit->second.find(catId);
+        if (cit==lit->second.end())
+            return;
+
+        translations_map_t::iterator mit = cit->second.find(msgId);
+        if (mit!=cit->second.end())
+        {
+            templates.replace(&mit->second, 0);
+            cit->second.erase(mit);
+        }
+
+        // Пустые категорию/язык тоже убираем, чтобы промах сообщался так же, как без слоя
+        if (cit->second.empty())
+            lit->second.erase(cit);
+        if (lit->second.empty())
+            translations.erase(lit);
+    }
+
+    //! Пересчитывает один ключ после изменения слоёв: текст берётся из самого приоритетного слоя, где он есть, иначе из базового каталога
+    void applyOverlayKey(const std::string &langId, const std::string &catId, const std::string &msgId)
+    {
+        const std::string *pText = 0;
+        for(std::size_t i=layers.size(); i!=0 && !pText; --i)
+            pText = impl_helpers::tr_find_msg_text(layers[i-1].translations, langId, catId, msgId);
+
+        const std::string key = impl_helpers::tr_overlay_key(langId, catId, msgId);
+        std::unordered_map<std::string, impl_helpers::TrOverlayEntry>::iterator it = overlayIndex.find(key);
+
+        if (pText)
+        {
+            if (it==overlayIndex.end())
+            {
+                // Ключ впервые перекрыт слоем - запоминаем текст базового каталога.
+                // Текст общей базы, разрешённый в своём каталоге, своим текстом не считается - после
+                // снятия слоя он разрешится заново
+                impl_helpers::TrOverlayEntry e;
+                const std::string *pBase = 0;
+                if (baseRefCopies.empty() || !baseRefCopies.erase(key))
+                {
+                    pBase = impl_helpers::tr_find_msg_text(msgRefSources, langId, catId, msgId);
+                    if (!pBase)
+                        pBase = impl_helpers::tr_find_msg_text(translations, langId, catId, msgId);
+                }
+                if (pBase)
+                {
+                    e.hasBase  = true;
+                    e.baseText = *pBase;
+                }
+                overlayIndex.emplace(key, std::move(e));
+            }
+
+            setOverlayViewText(langId, catId, msgId, *pText);
+            return;
+        }
+
+        if (it==overlayIndex.end())
+            return; // Ключ не был перекрыт
+
+        if (it->second.hasBase)
+            setOverlayViewText(langId, catId, msgId, it->second.baseText);
+        else
+            eraseOverlayViewText(langId, catId, msgId);
+
+        overlayIndex.erase(it);
+    }
+
+    //! Пересчитывает все ключи из trMap (содержимое слоя до или после изменения)
+    void applyOverlayKeys(const all_translations_map_t &trMap)
+    {
+        for(const auto &langKvp : trMap)
+        {
+            for(const auto &catKvp : langKvp.second)
+            {
+                for(const auto &msgKvp : catKvp.second)
+                    applyOverlayKey(langKvp.first, catKvp.first, msgKvp.first);
+            }
+        }
+    }
+
+    //! Накладывает все слои на только что загруженный базовый каталог
+    void applyAllOverlays()
+    {
+        overlayIndex.clear();
+        for(const auto &layer : layers)
+            applyOverlayKeys(layer.translations);
+    }
+
+    //! Возвращает в каталог перекрытые тексты базового каталога
+    void unapplyAllOverlays()
+    {
+        std::vector<impl_helpers::TrCatalogLayer> savedLayers;
+        savedLayers.swap(layers);
+
+        for(const auto &layer : savedLayers)
+            applyOverlayKeys(layer.translations);
+
+        savedLayers.swap(layers);
+    }
+
+    //! После изменения слоя: новое поколение и пересчёт ссылок
+    void onOverlaysChanged()
+    {
+        catalogChanged();
+        resolveAllMsgRefs();
+    }
+
+    //! Перекрыт ли ключ собственного каталога слоем; если да - запись в базовый каталог идёт в индекс перекрытий
+    impl_helpers::TrOverlayEntry* findOverlayEntry(const all_translations_map_t &trAllMap, const std::string &langId, const std::string &catId, const std::string &msgId)
+    {
+        if (overlayIndex.empty() || !isOwnCatalog(trAllMap))
+            return 0;
+
+        std::unordered_map<std::string, impl_helpers::TrOverlayEntry>::iterator it = overlayIndex.find(impl_helpers::tr_overlay_key(langId, catId, msgId));
+        if (it==overlayIndex.end())
+            return 0;
+
+        return &it->second;
+    }
+
+    //! Заменяет базовый каталог; если в новом каталоге цикл ссылок - исключение, остаётся прежний
+    void replaceCatalog(all_translations_map_t newAllTr)
+    {
+        all_translations_map_t  prevTranslations  = std::move(translations);
+        all_translations_map_t  prevMsgRefSources = std::move(msgRefSources);
+        std::unordered_map<std::string, impl_helpers::TrOverlayEntry> prevOverlayIndex = std::move(overlayIndex);
+        impl_helpers::TrMsgRefDependents prevMsgRefDependents = std::move(msgRefDependents);
+        std::unordered_set<std::string>  prevBaseRefCopies    = std::move(baseRefCopies);
+        MessageTemplateCache    prevTemplates     = templates; // Слои и ссылки отпускают тексты прежнего каталога
+
+        translations = std::move(newAllTr);
+        msgRefSources.clear();
+        msgRefDependents.clear();
+        baseRefCopies.clear();
+        overlayIndex.clear();
+
+        try
+        {
+            applyAllOverlays();
+            collectMsgRefSources();
+            resolveAllMsgRefs();
+        }
+        catch(...)
+        {
+            translations     = std::move(prevTranslations);
+            msgRefSources    = std::move(prevMsgRefSources);
+            overlayIndex     = std::move(prevOverlayIndex);
+            msgRefDependents = std::move(prevMsgRefDependents);
+            baseRefCopies    = std::move(prevBaseRefCopies);
+            templates        = std::move(prevTemplates);
+            throw;
+        }
+
+        catalogChanged();
+        templates.clear();
+        precompileTemplates();
+    }
+
+    template<typename CharType>
+    impl_helpers::TrWideViews<CharType>& getWideViews() const
+    {
+        if constexpr (std::is_same_v<CharType, wchar_t>)
+            return wideViewsW;
+        else if constexpr (std::is_same_v<CharType, char16_t>)
+            return wideViews16;
+        else
+        {
+            static_assert(std::is_same_v<CharType, char32_t>, "Translator: unsupported wide char type");
+            return wideViews32;
+        }
+    }
+
+    //! Актуальная широкая копия языка своего каталога (langId уже нормализован) или 0, если языка в нём нет
+    /*! Общая база и образ в неё не входят - их копии общие (SharedTranslations::getWideLangView, imageWideViews)
+     */
+    template<typename CharType>
+    const impl_helpers::TrWideLangView<CharType>* getWideLangView(const std::string &langId) const
+    {
+        std::lock_guard<impl_helpers::TrMutex> lock(wideViewsMutex);
+
+        auto &views = getWideViews<CharType>();
+
+        typename impl_helpers::TrWideViews<CharType>::iterator vit = views.find(langId);
+        if (vit!=views.end() && vit->second.generation==generation)
+            return &vit->second;
+
+        all_translations_map_t::const_iterator lit = translations.find(langId);
+        if (lit==translations.end())
+        {
+            if (vit!=views.end())
+                views.erase(vit);
+            return 0;
+        }
+
+        impl_helpers::TrWideLangView<CharType> &view = views[langId];
+        view.categories.clear();
+        view.generation = generation;
+
+        for(const auto &catKvp : lit->second)
+        {
+            auto &wideMap = view.categories[catKvp.first];
+            wideMap.reserve(catKvp.second.size());
+            for(const auto &msgKvp : catKvp.second)
+                wideMap[utf::fromUtf8<CharType>(msgKvp.first)] = utf::fromUtf8<CharType>(msgKvp.second);
+        }
+
+        return &view;
+    }
+
+
+public: // settings
+
+    Translator() {}
+
+    //! Переводчик над общей базой, свой каталог изначально пуст
+    explicit Translator(shared_translations_ptr_t base) : sharedBase(std::move(base)) {}
+
+    shared_translations_ptr_t getSharedBase() const
+    {
+        return sharedBase;
+    }
+
+    const CatalogImageView& getCatalogImage() const
+    {
+        return catalogImage;
+    }
+
+    //! Подключает образ каталога (самый нижний источник, под общей базой и своими изменениями)
+    /*! Память образа должна жить, пока переводчик с ним работает. Пустой view отключает образ.
+     */
+    CatalogImageView setCatalogImage(const CatalogImageView &img)
+    {
+        CatalogImageView res = catalogImage;
+        catalogImage   = img;
+        imageWideViews = impl_helpers::tr_get_image_wide_views(catalogImage);
+        onOverlaysChanged();
+        return res;
+    }
+
+    //! Заменяет общую базу, собственные изменения (getAllTranslations()) сохраняются
+    shared_translations_ptr_t setSharedBase(shared_translations_ptr_t base)
+    {
+        shared_translations_ptr_t res = sharedBase;
+        sharedBase = std::move(base);
+        onOverlaysChanged();
+        return res;
+    }
+
+    //! Подменяет общую базу её копией в режиме профилирования и возвращает эту копию
+    /*! Поиск этого переводчика считается в копии, остальные переводчики работают со старой базой.
+        Пока идёт профилирование, копия занимает память наравне с базой. По счётчикам копии
+        tr_make_hot_shared_translations строит новую базу, её подключают вместо старой ко всем переводчикам.
+        Базы нет - исключение.
+     */
+    profiled_shared_translations_ptr_t profileSharedBase(std::pmr::memory_resource *pResource = std::pmr::get_default_resource())
+    {
+        if (!sharedBase)
+            throw std::runtime_error("tr: translator has no shared base to profile");
+
+        profiled_shared_translations_ptr_t res = std::allocate_shared<SharedTranslations>(std::pmr::polymorphic_allocator<SharedTranslations>(pResource), *sharedBase);
+        res->setProfilingMode(true);
+        setSharedBase(res);
+        return res;
+    }
+
+    IErrReportHandlerPtr getErrHandler() const
+    {
+        return errHandler;
+    }
+
+    IErrReportHandlerPtr setErrHandler(IErrReportHandlerPtr newPh)
+    {
+        auto ph = errHandler;
+        errHandler = newPh;
+        return ph;
+    }
+
+    //------------------------------
+    ELangTagFormat getLangTagFormat() const
+    {
+        return langTagFormat;
+    }
+
+    ELangTagFormat setLangTagFormat(ELangTagFormat newFmt)
+    {
+        auto res = langTagFormat;
+        if (newFmt!=ELangTagFormat::langTagNeutral && newFmt!=ELangTagFormat::langTagNeutralAuto)
+        {
+            langTagFormat = newFmt;
+            if (langTagFormat!=res)
+                catalogChanged(); // Другая нормализация языка - кэш tr() по ненормализованным ключам устарел
+        }
+        return res;
+    }
+
+    std::string fixLangTagFormat(const std::string &langTagOrId) const
+    {
+        return tr_fix_lang_tag_format(langTagOrId, langTagFormat);
+    }
+
+    //------------------------------
+    std::string getDefCategory() const
+    {
+        return defCategory;
+    }
+
+    std::string setDefCategory(const std::string &c)
+    {
+        std::string res = defCategory;
+        defCategory = c;
+        return res;
+    }
+
+    std::string getDefLang() const
+    {
+        return defLang;
+    }
+
+    std::string setDefLang(const std::string &l)
+    {
+        std::string res = defLang;
+        defLang = l;
+        return res;
+    }
+
+    std::string alterGetDefLang() const
+    {
+        return alterDefLang;
+    }
+
+    std::string alterSetDefLang(const std::string &l)
+    {
+        std::string res = alterDefLang;
+        alterDefLang = l;
+        return res;
+    }
+
+    //------------------------------
+    bool getMsgNotFoundDecorateMode() const
+    {
+        return msgNotFoundDecorateMode;
+    }
+
+    bool setMsgNotFoundDecorateMode(bool newMode)
+    {
+        bool res = msgNotFoundDecorateMode;
+        msgNotFoundDecorateMode = newMode;
+        if (newMode!=res)
+            catalogChanged(); // В кэше промахов лежат тексты-заглушки в прежнем виде
+        return res;
+    }
+
+    bool getEmptyMsgNotExist() const
+    {
+        return emptyMsgNotExist;
+    }
+
+    bool setEmptyMsgNotExist(bool mode)
+    {
+        bool res = emptyMsgNotExist;
+        emptyMsgNotExist = mode;
+        if (mode!=res)
+            catalogChanged();
+        return res;
+    }
+
+    //------------------------------
+    bool getLookupFilterMode() const
+    {
+        return lookupFilterMode;
+    }
+
+    //! Использовать ли фильтр Блума в tr()/hasMsg(), по умолчанию - нет
+    /*! Фильтр ничего не знает о правках каталога через ссылку, полученную от getAllTranslations()
+        (tr_get_all_translations()) до последнего поиска, - после таких правок нужно вызвать catalogChanged(),
+        иначе добавленные сообщения не будут найдены. Включать, когда каталог меняется только через API.
+     */
+    bool setLookupFilterMode(bool mode)
+    {
+        bool res = lookupFilterMode;
+        lookupFilterMode = mode;
+        if (mode!=res)
+            rebuildLookupFilter();
+        return res;
+    }
+
+    //------------------------------
+    bool getLookupCacheMode() const
+    {
+        return lookupCacheMode;
+    }
+
+    //! Кэшировать ли найденные tr() переводы в потоковом кэше (MARTY_TR_LOOKUP_CACHE_SIZE слотов на поток)
+    /*! Неконстантный getAllTranslations() сам меняет поколение. Если ссылку на каталог держат и правят
+        каталог после tr(), нужно вызвать catalogChanged(), иначе кэш вернёт прежний (скопированный) текст.
+     */
+    bool setLookupCacheMode(bool mode)
+    {
+        bool res = lookupCacheMode;
+        lookupCacheMode = mode;
+        return res;
+    }
+
+    //------------------------------
+    bool getMissCacheMode() const
+    {
+        return missCacheMode;
+    }
+
+    //! Кэшировать ли промахи tr() в потоковом кэше, по умолчанию - да
+    /*! Повторный промах с теми же аргументами отдаёт готовый текст-заглушку из слота, без нормализации
+        ключей и прохода по каталогу. Обработчик ошибок вызывается, как и без кэша (с учётом лимита сообщений).
+     */
+    bool setMissCacheMode(bool mode)
+    {
+        bool res = missCacheMode;
+        missCacheMode = mode;
+        return res;
+    }
+
+    //------------------------------
+    //! Сбрасывает счётчики сообщений о промахах (лимит сообщений начинает считаться заново)
+    void clearMissCache()
+    {
+        std::lock_guard<impl_helpers::TrMutex> lock(missCacheMutex);
+        missCache.clear();
+    }
+
+    std::size_t getMissCacheSize() const
+    {
+        return missCacheSize;
+    }
+
+    //! Число слотов счётчиков сообщений о промахах для лимита (setMissReportLimit), 0 - без счётчиков (о каждом промахе сообщается)
+    std::size_t setMissCacheSize(std::size_t sz)
+    {
+        std::size_t res = missCacheSize;
+        missCacheSize = sz;
+        clearMissCache();
+        return res;
+    }
+
+    std::size_t getMissReportLimit() const
+    {
+        return missReportLimit;
+    }
+
+    //! Сколько раз сообщать об одном и том же промахе, 0 - каждый раз
+    std::size_t setMissReportLimit(std::size_t limit)
+    {
+        std::size_t res = missReportLimit;
+        missReportLimit = limit;
+        return res;
+    }
+
+    //------------------------------
+    //! Компилировать ли тексты при загрузке каталога (initAllTranslations, addCustomTranslations ...)
+    bool getPrecompileTemplatesMode() const
+    {
+        return templates.getPrecompileMode();
+    }
+
+    bool setPrecompileTemplatesMode(bool mode)
+    {
+        return templates.setPrecompileMode(mode);
+    }
+
+    void clearPrecompiledTemplates()
+    {
+        templates.clear();
+    }
+
+    void precompileTemplate(const std::string &msgText)
+    {
+        templates.precompile(msgText);
+    }
+
+    MessageTemplatePtr findPrecompiledTemplate(const std::string &msgText) const
+    {
+        return templates.find(msgText);
+    }
+
+    //! Компилирует все тексты каталога в кэш шаблонов FormatMessage
+    void precompileTemplates(const all_translations_map_t &trAllMap)
+    {
+        for(const auto &langKvp : trAllMap)
+        {
+            for(const auto &catKvp : langKvp.second)
+            {
+                for(const auto &msgKvp : catKvp.second)
+                    templates.precompile(msgKvp.second);
+            }
+        }
+    }
+
+    //! Компилирует все тексты своего каталога, если включен режим предкомпиляции
+    /*! Кэш собирается заново, чтобы счётчики ссылок шаблонов соответствовали каталогу (тексты,
+        скомпилированные через precompileTemplate, из кэша уходят).
+     */
+    void precompileTemplates()
+    {
+        if (!templates.getPrecompileMode())
+            return;
+
+        templates.clear();
+        precompileTemplates(translations);
+    }
+
+
+public: // catalog
+
+    //! Каталог для правки напрямую
+    /*! Меняет поколение: кэш tr() и широкие копии не вернут прежних текстов, фильтр не используется
+        до следующего изменения через API или catalogChanged().
+     */
+    all_translations_map_t& getAllTranslations()
+    {
+        ++generation;
+        return translations;
+    }
+
+    const all_translations_map_t& getAllTranslations() const
+    {
+        return translations;
+    }
+
+    all_translations_map_t& alterGetAllTranslations()
+    {
+        return alterTranslations;
+    }
+
+    const all_translations_map_t& alterGetAllTranslations() const
+    {
+        return alterTranslations;
+    }
+
+    //! Поколение каталога, меняется при каждом изменении, производные кэши по нему проверяют актуальность
+    std::uint64_t getCatalogGeneration() const
+    {
+        return generation;
+    }
+
+    //! Методы вызывают сами, вызывать вручную нужно после правки каталога напрямую через getAllTranslations()
+    /*! Новое поколение и перестройка фильтра - всё, что строится по каталогу, строится здесь, а не при поиске
+     */
+    void catalogChanged()
+    {
+        ++generation;
+        rebuildLookupFilter();
+    }
+
+    //------------------------------
+    all_translations_map_t parseTranslationsData(const std::string &trJson) const
+    {
+        return tr_parse_translations_data(trJson, langTagFormat);
+    }
+
+    //! Очищает базовый каталог, слои остаются
+    void clear()
+    {
+        translations.clear();
+        msgRefSources.clear();
+        msgRefDependents.clear();
+        baseRefCopies.clear();
+        templates.clear();
+        applyAllOverlays();
+        onOverlaysChanged();
+    }
+
+    void alterClear()
+    {
+        alterTranslations.clear();
+    }
+
+    void setTranslations(const all_translations_map_t &newAllTr)
+    {
+        replaceCatalog(all_translations_map_t(newAllTr));
+    }
+
+    void initAllTranslations(const std::string &trJson)
+    {
+        replaceCatalog(parseTranslationsData(trJson));
+    }
+
+    void addCustomTranslations(const all_translations_map_t &customTrMap)
+    {
+        auto handleTranslationAlreadyExist = [&](const std::string& msgId, const std::string& msgPrev, const std::string& msgNew, const std::string& catId, const std::string& langId) -> bool
+        {
+            if (!errHandler)
+                return true; // allow overwrite
+
+            return errHandler->translationAlreadyExist(msgId, msgPrev, msgNew, catId, langId);
+        };
+
+        std::string baseTextCopy; // Текст из общей базы для сравнения, в базе он не в std::string
+
+        std::vector<impl_helpers::TrMsgTextUndo> undo;
+        std::vector<std::string>                 changedKeys;
+
+        for(const auto &langKvp : customTrMap)
+        {
+            const auto &langId  = langKvp.first;
+            const auto &catMap  = langKvp.second;
+
+            for(const auto &catKvp : catMap)
+            {
+                const auto &catId  = catKvp.first;
+                const auto &msgMap = catKvp.second;
+
+                for(const auto &msgKvp : msgMap)
+                {
+                    const auto &msgId   = msgKvp.first;
+                    const auto &msgText = msgKvp.second;
+
+                    const translations_map_t *pTrMap = findCategoryMap(translations, langId, catId);
+                    const bool msgExists = pTrMap && pTrMap->find(msgId)!=pTrMap->end();
+
+                    // Ключ перекрыт слоем - работаем с текстом базового каталога, сведённый текст не меняется
+                    impl_helpers::TrOverlayEntry *pOverlay = findOverlayEntry(translations, langId, catId, msgId);
+                    if (pOverlay)
+                    {
+                        if (!pOverlay->hasBase || pOverlay->baseText==msgText || handleTranslationAlreadyExist(msgId, pOverlay->baseText, msgText, catId, langId))
+                        {
+                            pOverlay->hasBase  = true;
+                            pOverlay->baseText = msgText;
+                        }
+                        continue;
+                    }
+
+                    // Для сообщений со ссылками сравниваем с исходным текстом, а не с подставленным
+                    const std::string *pPrevText = 0;
+                    if (msgExists)
+                    {
+                        pPrevText = impl_helpers::tr_find_msg_text(msgRefSources, langId, catId, msgId);
+                        if (!pPrevText)
+                            pPrevText = &pTrMap->find(msgId)->second;
+                    }
+                    else if (sharedBase)
+                    {
+                        std::optional<std::string_view> baseText = sharedBase->getCatalog().find(langId, catId, msgId);
+                        if (baseText)
+                        {
+                            baseTextCopy.assign(baseText->data(), baseText->size());
+                            pPrevText = &baseTextCopy;
+                        }
+                    }
+
+                    bool existNotSame = false;
+                    if (pPrevText)
+                    {
+                        if (*pPrevText!=msgText)
+                            existNotSame = true;
+                    }
+
+                    if (!existNotSame || handleTranslationAlreadyExist(msgId, *pPrevText, msgText, catId, langId))
+                    {
+                        writeOwnMsgText(langId, catId, msgId, msgText, undo); // overwrite prev or add new
+                        changedKeys.emplace_back(impl_helpers::tr_msg_key(langId, catId, msgId));
+                    }
+                }
+            }
+        }
+
+        try
+        {
+            resolveMsgRefsFor(changedKeys);
+        }
+        catch(...)
+        {
+            undoOwnMsgTexts(undo);
+            throw;
+        }
+
+        catalogChanged();
+    }
+
+    void addCustomTranslations(const std::string &trJson)
+    {
+        addCustomTranslations(parseTranslationsData(trJson));
+    }
+
+    //------------------------------
+    impl_helpers::MsgRefResolver makeMsgRefResolver(const all_translations_map_t &trAllMap, const all_translations_map_t &sources)
+    {
+        impl_helpers::MsgRefResolver resolver(trAllMap, sources, errHandler, &templates);
+        if (sharedBase && isOwnCatalog(trAllMap))
+            resolver.pFallback = &sharedBase->getCatalog();
+        if (!catalogImage.empty() && isOwnCatalog(trAllMap))
+            resolver.pImage = &catalogImage;
+        return resolver;
+    }
+
+    //------------------------------
+    bool sharedBaseHasMsgRefs() const
+    {
+        return sharedBase && sharedBase->hasMsgRefs();
+    }
+
+    //! Ключи keys и все тексты, которые на них ссылаются (свои и, если includeBase, общей базы)
+    std::unordered_set<std::string> collectMsgRefAffected(std::vector<std::string> stack, bool includeBase) const
+    {
+        std::unordered_set<std::string> affected;
+        while(!stack.empty())
+        {
+            std::string key = std::move(stack.back());
+            stack.pop_back();
+            if (!affected.insert(key).second)
+                continue;
+
+            auto it = msgRefDependents.find(key);
+            if (it!=msgRefDependents.end())
+                stack.insert(stack.end(), it->second.begin(), it->second.end());
+
+            const std::unordered_set<std::string> *pBaseDeps = includeBase ? sharedBase->findMsgRefDependents(key) : 0;
+            if (pBaseDeps)
+                stack.insert(stack.end(), pBaseDeps->begin(), pBaseDeps->end());
+        }
+
+        return affected;
+    }
+
+    //! Тексты общей базы со ссылками из affected, которых нет в своём каталоге, берутся в свой каталог для разрешения заново
+    /*! Исходный текст попадает в msgRefSources, подставленный - в каталог при разрешении. Возвращает взятые ключи.
+     */
+    std::vector<std::string> pullBaseRefCopies(const std::unordered_set<std::string> &affected)
+    {
+        std::vector<std::string> pulled;
+
+        std::string langId, catId, msgId;
+        for(const auto &key : affected)
+        {
+            if (baseRefCopies.find(key)!=baseRefCopies.end() || !impl_helpers::tr_split_msg_key(key, langId, catId, msgId))
+                continue;
+
+            const std::string *pBaseSrc = sharedBase->findMsgRefSource(langId, catId, msgId);
+            if (!pBaseSrc || impl_helpers::tr_find_msg_text(translations, langId, catId, msgId))
+                continue; // Ссылок нет или есть своё переопределение
+
+            updateMsgRefSource(langId, catId, msgId, *pBaseSrc);
+            baseRefCopies.insert(key);
+            pulled.emplace_back(key);
+        }
+
+        return pulled;
+    }
+
+    //! Убирает из своего каталога тексты общей базы, разрешённые в нём (все или только keys)
+    void dropBaseRefCopies(const std::vector<std::string> &keys)
+    {
+        std::string langId, catId, msgId;
+        for(const auto &key : keys)
+        {
+            if (!baseRefCopies.erase(key) || !impl_helpers::tr_split_msg_key(key, langId, catId, msgId))
+                continue;
+            eraseOverlayViewText(langId, catId, msgId);
+        }
+    }
+
+    void dropBaseRefCopies()
+    {
+        if (!baseRefCopies.empty())
+            dropBaseRefCopies(std::vector<std::string>(baseRefCopies.begin(), baseRefCopies.end()));
+    }
+
+    //! Пересчитывает все тексты со ссылками своего каталога, поколение не меняет
+    /*! Тексты общей базы, зависящие от своих переопределений, разрешаются в своём каталоге заново
+        (база могла смениться)
+     */
+    void resolveAllMsgRefs()
+    {
+        dropBaseRefCopies();
+
+        std::vector<std::string> pulled;
+        if (sharedBaseHasMsgRefs())
+        {
+            std::vector<std::string> ownKeys;
+            for(const auto &langKvp : translations)
+            {
+                for(const auto &catKvp : langKvp.second)
+                {
+                    for(const auto &msgKvp : catKvp.second)
+                        ownKeys.emplace_back(impl_helpers::tr_msg_key(langKvp.first, catKvp.first, msgKvp.first));
+                }
+            }
+
+            pulled = pullBaseRefCopies(collectMsgRefAffected(std::move(ownKeys), true));
+        }
+
+        if (msgRefSources.empty())
+            return;
+
+        try
+        {
+            impl_helpers::MsgRefResolver resolver = makeMsgRefResolver(translations, msgRefSources);
+            resolver.resolveAll();
+            resolver.commit(translations);
+        }
+        catch(...)
+        {
+            dropBaseRefCopies(pulled);
+            throw;
+        }
+
+        addToLookupFilter(pulled);
+    }
+
+    //! Пересчитывает тексты, затронутые изменением сообщений changedKeys (tr_msg_key): сами эти сообщения и всё, что на них ссылается
+    /*! Тексты общей базы, которые ссылаются на изменённые сообщения, разрешаются заново в своём каталоге -
+        так же, как если бы база была загружена в него целиком
+     */
+    void resolveMsgRefsFor(const std::vector<std::string> &changedKeys)
+    {
+        const bool includeBase = sharedBaseHasMsgRefs();
+        if (msgRefSources.empty() && !includeBase)
+            return;
+
+        const std::unordered_set<std::string> affected = collectMsgRefAffected(changedKeys, includeBase);
+
+        std::vector<std::string> pulled;
+        if (includeBase)
+            pulled = pullBaseRefCopies(affected);
+
+        if (msgRefSources.empty())
+            return;
+
+        try
+        {
+            impl_helpers::MsgRefResolver resolver = makeMsgRefResolver(translations, msgRefSources);
+            for(const auto &key : affected)
+                resolver.resolveKey(key);
+            resolver.commit(translations);
+        }
+        catch(...)
+        {
+            dropBaseRefCopies(pulled);
+            throw;
+        }
+
+        addToLookupFilter(pulled);
+    }
+
+    //! Разрешает ссылки в каталоге trAllMap, исходные тексты со ссылками берутся из sources
+    void resolveMsgRefs(all_translations_map_t &trAllMap, const all_translations_map_t &sources)
+    {
+        impl_helpers::MsgRefResolver resolver = makeMsgRefResolver(trAllMap, sources);
+        resolver.resolveAll();
+        resolver.commit(trAllMap);
+    }
+
+    //! Пересчитывает все тексты со ссылками в своём каталоге
+    void resolveMsgRefs()
+    {
+        resolveAllMsgRefs();
+        catalogChanged();
+    }
+
+    //------------------------------
+    bool hasCategory(const std::string &catId) const
+    {
+        return tr_has_category(translations, catId);
+    }
+
+    bool replaceCategory(all_translations_map_t &trMap, std::string prevCatId, std::string newCatId)
+    {
+        prevCatId = tr_fix_category(prevCatId);
+        newCatId  = tr_fix_category(newCatId);
+
+        // Надо проверить, есть ли уже такая категория
+        // Потому что при переименовании будет производится замена имени существующей категории, и новое имя может
+        // совпадать с каким-то уже имеющися, а переименование не подразумевает слияния
+
+        if (tr_has_category(trMap, newCatId))
+            return false;
+
+        if (!isOwnCatalog(trMap))
+        {
+            impl_helpers::tr_rename_category(trMap, prevCatId, newCatId);
+            return true;
+        }
+
+        // Переименовываем в базовом каталоге и в исходных текстах со ссылками, слои накладываются заново как есть
+        auto renameOwn = [&](const std::string &fromCatId, const std::string &toCatId)
+        {
+            dropBaseRefCopies(); // Их ключи - со старой категорией, resolveAllMsgRefs разрешит их заново
+
+            const bool reapplyOverlays = !overlayIndex.empty();
+            if (reapplyOverlays)
+                unapplyAllOverlays();
+
+            impl_helpers::tr_rename_category(translations , fromCatId, toCatId);
+            impl_helpers::tr_rename_category(msgRefSources, fromCatId, toCatId);
+            rebuildMsgRefDependents();
+
+            if (reapplyOverlays)
+                applyAllOverlays();
+        };
+
+        renameOwn(prevCatId, newCatId);
+
+        // Ссылки с явной категорией ($(@cat|msg)) на старое имя перестают разрешаться, на новое - начинают,
+        // и могут замкнуть цикл - тогда переименование откатывается
+        try
+        {
+            resolveAllMsgRefs();
+        }
+        catch(...)
+        {
+            renameOwn(newCatId, prevCatId);
+            resolveAllMsgRefs();
+            throw;
+        }
+
+        catalogChanged();
+
+        return true; // Переименование прошло без ошибок (возможно, по факту ничего не было сделано, так как искомой prevCatId категории нет, но это не важно)
+    }
+
+    bool replaceCategory(const std::string &prevCatId, const std::string &newCatId)
+    {
+        return replaceCategory(translations, prevCatId, newCatId);
+    }
+
+
+public: // lookup
+
+    //! Поиск перевода без сообщений об ошибках и декорирования
+    /*! View указывает на текст в каталоге и валиден до его изменения.
+        Заменяет пару hasMsg()+tr(): нормализация ключей и проход по каталогу - один раз.
+     */
+    std::optional<std::string_view> find(const all_translations_map_t& trAllMap, const std::string &msgId, std::string catId, std::string langId) const
+    {
+        const BlockedBloomFilter *pFilter = getLookupFilter(trAllMap);
+        if (pFilter)
+        {
+            const std::uint64_t msgHash = impl_helpers::tr_lookup_hash_msg(msgId);
+            if (!pFilter->mayContain(msgHash) && (!sharedBase || !sharedBase->getFilter().mayContain(msgHash)) && catalogImage.empty())
+                return std::nullopt; // Такого msgId нет нигде, нормализовать категорию и язык не нужно
+        }
+
+        catId  = tr_fix_category(catId);
+        langId = fixLangTagFormat(langId);
+
+        MsgNotFound what = MsgNotFound::msg;
+        return findNormalized(trAllMap, msgId, catId, langId, what);
+    }
+
+    std::optional<std::string_view> find(const std::string &msgId, const std::string &catId, const std::string &langId) const
+    {
+        return find(translations, msgId, catId, langId);
+    }
+
+    std::optional<std::string_view> find(const std::string &msgId, const std::string &catId) const
+    {
+        return find(translations, msgId, catId, defLang);
+    }
+
+    std::optional<std::string_view> find(const std::string &msgId) const
+    {
+        return find(translations, msgId, defCategory, defLang);
+    }
+
+    //------------------------------
+    std::string tr(const all_translations_map_t& trAllMap, const std::string &msgId, std::string catId, std::string langId) const
+    {
+        catId  = tr_fix_category(catId);
+        langId = fixLangTagFormat(langId);
+
+        MsgNotFound what = MsgNotFound::msg;
+        std::optional<std::string_view> text = findNormalized(trAllMap, msgId, catId, langId, what);
+        if (!text)
+            return reportNotFound(trAllMap, what, msgId, catId, langId);
+
+        return std::string(*text);
+    }
+
+    std::string tr(const std::string &msgId, const std::string &catId, const std::string &langId) const
+    {
+        if (!lookupCacheMode && !missCacheMode)
+            return tr(translations, msgId, catId, langId);
+
+        const std::size_t h = impl_helpers::tr_lookup_cache_hash(msgId, catId, langId);
+        impl_helpers::TrLookupCacheEntry &e = impl_helpers::tr_get_lookup_cache_entry(h);
+        if ( (e.miss ? missCacheMode : lookupCacheMode)
+          && impl_helpers::tr_lookup_cache_match(e, instanceId.get(), generation, h, msgId, catId, langId)
+           )
+        {
+            if (!e.miss || !errHandler)
+                return e.text;
+
+            // Обработчик может сам звать tr() и занять этот слот - всё нужное копируем до вызова
+            std::string res = e.text;
+            const MsgNotFound what = e.what;
+            const std::string normCatId  = e.normCatId;
+            const std::string normLangId = e.normLangId;
+            reportMiss(translations, what, msgId, normCatId, normLangId);
+            return res;
+        }
+
+        const std::string normCatId  = tr_fix_category(catId);
+        const std::string normLangId = fixLangTagFormat(langId);
+
+        MsgNotFound what = MsgNotFound::msg;
+        std::optional<std::string_view> text = findNormalized(translations, msgId, normCatId, normLangId, what);
+        if (!text)
+        {
+            std::string res = reportNotFound(translations, what, msgId, normCatId, normLangId);
+            if (missCacheMode)
+            {
+                // Слот берём заново - обработчик мог освободить потоковый кэш (tr_clear_thread_lookup_cache)
+                impl_helpers::TrLookupCacheEntry &me = impl_helpers::tr_get_lookup_cache_entry(h);
+                impl_helpers::tr_lookup_cache_store_miss(me, instanceId.get(), generation, h, msgId, catId, langId, res, what, normCatId, normLangId);
+            }
+            return res;
+        }
+
+        if (lookupCacheMode)
+            impl_helpers::tr_lookup_cache_store(e, instanceId.get(), generation, h, msgId, catId, langId, *text);
+        return std::string(*text);
+    }
+
+    std::string tr(const std::string &msgId, const std::string &catId) const
+    {
+        return tr(msgId, catId, defLang);
+    }
+
+    std::string tr(const std::string &msgId) const
+    {
+        return tr(msgId, defCategory, defLang);
+    }
+
+    //------------------------------
+    bool hasMsg(const all_translations_map_t& trAllMap, const std::string &msgId, const std::string &catId, const std::string &langId) const
+    {
+        return find(trAllMap, msgId, catId, langId).has_value();
+    }
+
+    bool hasMsg(const std::string &msgId, const std::string &catId, const std::string &langId) const
+    {
+        return find(translations, msgId, catId, langId).has_value();
+    }
+
+    bool hasMsg(const std::string &msgId, const std::string &catId) const
+    {
+        return find(translations, msgId, catId, defLang).has_value();
+    }
+
+    bool hasMsg(const std::string &msgId) const
+    {
+        return find(translations, msgId, defCategory, defLang).has_value();
+    }
+
+    //------------------------------
+    //! Множественная форма: msgId#one, msgId#few ... по правилам языка, затем msgId#other, затем сам msgId
+    std::string trPlural(const all_translations_map_t& trAllMap, const std::string &msgId, std::int64_t n, std::string catId, std::string langId) const
+    {
+        catId  = tr_fix_category(catId);
+        langId = fixLangTagFormat(langId);
+
+        EPluralCategory c = getPluralCategory(langId, n);
+
+        MsgNotFound what = MsgNotFound::msg;
+        std::optional<std::string_view> form = findNormalized(trAllMap, tr_plural_msgid(msgId, c), catId, langId, what);
+        if (form)
+            return std::string(*form);
+
+        if (c!=EPluralCategory::other)
+        {
+            form = findNormalized(trAllMap, tr_plural_msgid(msgId, EPluralCategory::other), catId, langId, what);
+            if (form)
+                return std::string(*form);
+        }
+
+        return tr(trAllMap, msgId, catId, langId);
+    }
+
+    std::string trPlural(const std::string &msgId, std::int64_t n, const std::string &catId, const std::string &langId) const
+    {
+        return trPlural(translations, msgId, n, catId, langId);
+    }
+
+    std::string trPlural(const std::string &msgId, std::int64_t n, const std::string &catId) const
+    {
+        return trPlural(translations, msgId, n, catId, defLang);
+    }
+
+    std::string trPlural(const std::string &msgId, std::int64_t n) const
+    {
+        return trPlural(translations, msgId, n, defCategory, defLang);
+    }
+
+    //------------------------------
+    //! Поиск перевода в широкой копии каталога, text - view на закэшированный текст
+    /*! View валиден до следующего изменения каталога. Если сообщение не найдено, возвращает false
+        и ничего не сообщает обработчику ошибок - для этого есть trWide.
+     */
+    template<typename CharType>
+    bool findWide(std::basic_string_view<CharType> &text, const std::basic_string<CharType> &msgId, std::string catId, std::string langId) const
+    {
+        catId  = tr_fix_category(catId);
+        langId = fixLangTagFormat(langId);
+
+        auto findIn = [&](const impl_helpers::TrWideLangView<CharType> *pView)
+        {
+            const std::basic_string<CharType> *pText = pView ? pView->find(catId, msgId) : 0;
+            if (!pText || (emptyMsgNotExist && pText->empty()))
+                return false;
+
+            text = *pText;
+            return true;
+        };
+
+        // Сначала свои изменения, затем общая база, затем образ каталога - как в tr()
+        if (findIn(getWideLangView<CharType>(langId)))
+            return true;
+
+        if (sharedBase && findIn(sharedBase->getWideLangView<CharType>(langId)))
+            return true;
+
+        if (imageWideViews && findIn(imageWideViews->getLangView<CharType>(catalogImage, langId)))
+            return true;
+
+        return false;
+    }
+
+    //! Широкий tr: сначала кэш, если не найдено - обычный tr (с сообщением об ошибке и декорированием)
+    template<typename StringType>
+    StringType trWide(const StringType &msgId, const std::string &catId, const std::string &langId) const
+    {
+        typedef typename StringType::value_type CharType;
+
+        std::basic_string_view<CharType> text;
+        if (findWide(text, msgId, catId, langId))
+            return StringType(text);
+
+        return utf::fromUtf8<CharType>(tr(utf::toUtf8(msgId), catId, langId));
+    }
+
+
+public: // modification
+
+    void add(all_translations_map_t& trAllMap, const std::string &msgId, const std::string &msgText, std::string catId, std::string langId)
+    {
+        catId  = tr_fix_category(catId);
+        langId = fixLangTagFormat(langId);
+
+        impl_helpers::TrOverlayEntry *pOverlay = findOverlayEntry(trAllMap, langId, catId, msgId);
+        if (pOverlay)
+        {
+            // Ключ перекрыт слоем - меняется только текст базового каталога
+            pOverlay->hasBase  = true;
+            pOverlay->baseText = msgText;
+            return;
+        }
+
+        setMsgText(trAllMap, langId, catId, msgId, msgText);
+    }
+
+    void add(const std::string &msgId, const std::string &msgText, const std::string &catId, const std::string &langId)
+    {
+        add(translations, msgId, msgText, catId, langId);
+    }
+
+    void add(const std::string &msgId, const std::string &msgText, const std::string &catId)
+    {
+        add(translations, msgId, msgText, catId, defLang);
+    }
+
+    void add(const std::string &msgId, const std::string &msgText)
+    {
+        add(translations, msgId, msgText, defCategory, defLang);
+    }
+
+    //------------------------------
+    void addIfEmpty(const std::string &msgId, const std::string &msgText, std::string catId, std::string langId)
+    {
+        catId  = tr_fix_category(catId);
+        langId = fixLangTagFormat(langId);
+
+        // Ключ перекрыт слоем - в сведённом каталоге лежит текст слоя, проверяется текст базового каталога
+        impl_helpers::TrOverlayEntry *pOverlay = findOverlayEntry(translations, langId, catId, msgId);
+        if (pOverlay)
+        {
+            if (!pOverlay->hasBase || (emptyMsgNotExist && pOverlay->baseText.empty()))
+            {
+                pOverlay->hasBase  = true;
+                pOverlay->baseText = msgText;
+            }
+            return;
+        }
+
+        MsgNotFound what = MsgNotFound::msg;
+        if (findNormalized(translations, msgId, catId, langId, what))
+            return;
+
+        setMsgText(translations, langId, catId, msgId, msgText);
+    }
+
+    void addIfEmpty(const std::string &msgId, const std::string &msgText, const std::string &catId)
+    {
+        addIfEmpty(msgId, msgText, catId, defLang);
+    }
+
+    void addIfEmpty(const std::string &msgId, const std::string &msgText)
+    {
+        addIfEmpty(msgId, msgText, defCategory, defLang);
+    }
+
+
+public: // layers
+
+    //! Добавляет пустой слой поверх остальных (самый приоритетный)
+    void addLayer(const std::string &layerName)
+    {
+        if (findLayerIndex(layerName)!=layers.size())
+            throw std::runtime_error("tr: catalog layer already exists: " + layerName);
+
+        layers.emplace_back();
+        layers.back().name = layerName;
+    }
+
+    //! Удаляет слой, перекрытые им тексты возвращаются из нижних слоёв или базового каталога
+    bool removeLayer(const std::string &layerName)
+    {
+        std::size_t idx = findLayerIndex(layerName);
+        if (idx==layers.size())
+            return false;
+
+        all_translations_map_t removed = std::move(layers[idx].translations);
+        layers.erase(layers.begin()+(std::ptrdiff_t)idx);
+
+        applyOverlayKeys(removed);
+        onOverlaysChanged();
+        return true;
+    }
+
+    bool hasLayer(const std::string &layerName) const
+    {
+        return findLayerIndex(layerName)!=layers.size();
+    }
+
+    //! Имена слоёв по возрастанию приоритета
+    std::vector<std::string> getLayerNames() const
+    {
+        std::vector<std::string> res; res.reserve(layers.size());
+        for(const auto &layer : layers)
+            res.emplace_back(layer.name);
+        return res;
+    }
+
+    const all_translations_map_t& getLayerTranslations(const std::string &layerName) const
+    {
+        std::size_t idx = findLayerIndex(layerName);
+        if (idx==layers.size())
+            throw std::runtime_error("tr: catalog layer not found: " + layerName);
+        return layers[idx].translations;
+    }
+
+    //! Заменяет содержимое слоя, пересчитываются ключи старого и нового содержимого
+    void setLayerTranslations(const std::string &layerName, const all_translations_map_t &layerTr)
+    {
+        impl_helpers::TrCatalogLayer &layer = getLayer(layerName);
+
+        all_translations_map_t prevTr = std::move(layer.translations);
+        layer.translations = layerTr;
+
+        applyOverlayKeys(prevTr);
+        applyOverlayKeys(layer.translations);
+        onOverlaysChanged();
+    }
+
+    void setLayerTranslations(const std::string &layerName, const std::string &trJson)
+    {
+        setLayerTranslations(layerName, parseTranslationsData(trJson));
+    }
+
+    void clearLayer(const std::string &layerName)
+    {
+        setLayerTranslations(layerName, all_translations_map_t());
+    }
+
+    //------------------------------
+    void layerAdd(const std::string &layerName, const std::string &msgId, const std::string &msgText, std::string catId, std::string langId)
+    {
+        catId  = tr_fix_category(catId);
+        langId = fixLangTagFormat(langId);
+
+        translations_map_t &layerMsgs = getLayer(layerName).translations[langId][catId];
+        translations_map_t::iterator pit = layerMsgs.find(msgId);
+        const bool        hadLayerMsg  = pit!=layerMsgs.end();
+        const std::string prevLayerMsg = hadLayerMsg ? pit->second : std::string();
+
+        layerMsgs[msgId] = msgText;
+        applyOverlayKey(langId, catId, msgId);
+
+        const std::vector<std::string> changedKeys(1, impl_helpers::tr_msg_key(langId, catId, msgId));
+        try
+        {
+            resolveMsgRefsFor(changedKeys);
+        }
+        catch(...)
+        {
+            // Цикл ссылок - возвращаем слой и сведённый текст как было
+            translations_map_t &msgs = getLayer(layerName).translations[langId][catId];
+            if (hadLayerMsg)
+                msgs[msgId] = prevLayerMsg;
+            else
+                msgs.erase(msgId);
+            applyOverlayKey(langId, catId, msgId);
+            resolveMsgRefsFor(changedKeys);
+            throw;
+        }
+
+        msgChanged(langId, catId, msgId);
+    }
+
+    void layerAdd(const std::string &layerName, const std::string &msgId, const std::string &msgText, const std::string &catId)
+    {
+        layerAdd(layerName, msgId, msgText, catId, defLang);
+    }
+
+    void layerAdd(const std::string &layerName, const std::string &msgId, const std::string &msgText)
+    {
+        layerAdd(layerName, msgId, msgText, defCategory, defLang);
+    }
+
+    //! Удаляет сообщение из слоя, false - в слое его не было
+    bool layerErase(const std::string &layerName, const std::string &msgId, std::string catId, std::string langId)
+    {
+        catId  = tr_fix_category(catId);
+        langId = fixLangTagFormat(langId);
+
+        all_translations_map_t &layerTr = getLayer(layerName).translations;
+
+        all_translations_map_t::iterator lit = layerTr.find(langId);
+        if (lit==layerTr.end())
+            return false;
+
+        category_translations_map_t::iterator cit = lit->second.find(catId);
+        if (cit==lit->second.end())
+            return false;
+
+        translations_map_t::iterator pit = cit->second.find(msgId);
+        if (pit==cit->second.end())
+            return false;
+
+        const std::string prevLayerMsg = pit->second;
+        cit->second.erase(pit);
+        applyOverlayKey(langId, catId, msgId);
+
+        const std::vector<std::string> changedKeys(1, impl_helpers::tr_msg_key(langId, catId, msgId));
+        try
+        {
+            resolveMsgRefsFor(changedKeys);
+        }
+        catch(...)
+        {
+            // Открывшийся текст нижнего слоя замкнул цикл ссылок - возвращаем сообщение в слой
+            getLayer(layerName).translations[langId][catId][msgId] = prevLayerMsg;
+            applyOverlayKey(langId, catId, msgId);
+            resolveMsgRefsFor(changedKeys);
+            throw;
+        }
+
+        msgChanged(langId, catId, msgId);
+        return true;
+    }
+
+
+public: // enumeration
+
+    template<typename THandler>
+    void enumerateMsgIds(THandler handler, std::string catId, std::string langId) const
+    {
+        catId  = tr_fix_category(catId);
+        langId = fixLangTagFormat(langId);
+
+        // Каждый msgId - один раз: сначала образ каталога, затем общая база, затем свои изменения
+        auto isInImage = [&](std::string_view msgId)
+        {
+            return !catalogImage.empty() && catalogImage.find(langId, catId, msgId).has_value();
+        };
+
+        auto isInBase = [&](std::string_view msgId)
+        {
+            return sharedBase && sharedBase->getCatalog().find(langId, catId, msgId).has_value();
+        };
+
+        catalogImage.enumerateMsgs( langId, catId
+                                  , [&](std::string_view msgId, std::string_view)
+                                    {
+                                        handler(std::string(msgId));
+                                    }
+                                  );
+
+        if (sharedBase)
+        {
+            sharedBase->getCatalog().enumerateMsgs( langId, catId
+                                                  , [&](std::string_view msgId, std::string_view)
+                                                    {
+                                                        if (!isInImage(msgId))
+                                                            handler(std::string(msgId));
+                                                    }
+                                                  );
+        }
+
+        const translations_map_t *pTrMap = findCategoryMap(translations, langId, catId);
+        if (!pTrMap)
+            return;
+
+        translations_map_t::const_iterator mit = pTrMap->begin();
+        for(; mit!=pTrMap->end(); ++mit)
+        {
+            if (isInBase(mit->first))
+                continue;
+            if (isInImage(mit->first))
+                continue;
+            handler(mit->first);
+        }
+    }
+
+    // Тут отличие от остального API - вместо установленного по дефолту языка используем
+    // всегда en-US для перечисления сообщений в категории, считая, что en-US - эталонная
+    // трансляция и там всё есть
+    template<typename THandler>
+    void enumerateMsgIds(THandler handler, const std::string &catId) const
+    {
+        enumerateMsgIds(handler, catId, "en-US");
+    }
+
+    std::vector<std::string> getMsgIds(const std::string &catId, const std::string &langId) const
+    {
+        std::vector<std::string> res; res.reserve(32);
+
+        enumerateMsgIds( [&](const std::string &msgId)
+                         {
+                             res.emplace_back(msgId);
+                         }
+                       , catId, langId
+                       );
+        return res;
+    }
+
+    std::vector<std::string> getMsgIds(const std::string &catId) const
+    {
+        std::vector<std::string> res; res.reserve(32);
+
+        enumerateMsgIds( [&](const std::string &msgId)
+                         {
+                             res.emplace_back(msgId);
+                         }
+                       , catId
+                       );
+        return res;
+    }
+
+    //------------------------------
+    bool checkTranslationCompleteness() const
+    {
+        unsigned errCnt = 0;
+
+        std::set<std::string>                          foundLangs;
+        std::map<std::string, std::set<std::string> >  msgLangs;
+
+        auto handleNotFullyTranslated = [&](const std::string& catId, const std::string& msgId)
+        {
+            if (!errHandler)
+                return;
+
+            return errHandler->messageNotFullyTranslated(catId, msgId);
+        };
+
+        auto handleMissingTranslation = [&](const std::string& lang, const std::string& langTag)
+        {
+            if (!errHandler)
+                return;
+
+            return errHandler->messageMissingTranslation(lang, langTag);
+        };
+
+        // Пробегаемся по всем языкам, для каждого языка пробегаемся по категориям и сообщениям.
+
+        catalogImage.enumerateAll( [&](std::string_view langId, std::string_view catId, std::string_view msgId, std::string_view)
+                                   {
+                                       foundLangs.insert(std::string(langId));
+                                       msgLangs[std::string(catId) + std::string(":") + std::string(msgId)].insert(std::string(langId));
+                                   }
+                                 );
+
+        if (sharedBase)
+        {
+            sharedBase->getCatalog().enumerateAll( [&](std::string_view langId, std::string_view catId, std::string_view msgId, std::string_view)
+                                                   {
+                                                       foundLangs.insert(std::string(langId));
+                                                       msgLangs[std::string(catId) + std::string(":") + std::string(msgId)].insert(std::string(langId));
+                                                   }
+                                                 );
+        }
+
+        // Свои изменения поверх них
+        for(const auto &langKvp : translations)
+        {
+            const auto &langId  = langKvp.first;
+            const auto &catMap  = langKvp.second;
+
+            foundLangs.insert(langId);
+
+            for(const auto &catKvp : catMap)
+            {
+                const auto &catId  = catKvp.first;
+                const auto &msgMap = catKvp.second;
+
+                for(const auto &msgKvp : msgMap)
+                {
+                    const auto &msgId   = msgKvp.first;
+                    // const auto &msgText = msgKvp.second; // not used
+
+                    // Склеиваем категорию:сообщение в ключ, и инкрементируем элемент map по этому ключу.
+
+                    std::string msgFullId = catId + std::string(":") + msgId;
+
+                    msgLangs[msgFullId].insert(langId); // add found translation
+                }
+
+            } // cat
+
+        } // lang
+
+
+
+        for(const auto &msgCatKvp : msgLangs)
+        {
+            const auto &msgCat   = msgCatKvp.first;
+            const auto &msgLangs2 = msgCatKvp.second;
+
+            if (msgLangs2.size()!=foundLangs.size())
+            {
+                ++errCnt;
+
+                std::string::size_type sepPos = msgCat.find(':');
+                if (sepPos==msgCat.npos)
+                    handleNotFullyTranslated(msgCat, std::string());
+                else
+                    handleNotFullyTranslated(std::string(msgCat, 0, sepPos), std::string(msgCat, sepPos+1));
+
+
+                // iterate through all found langs
+                for(const auto &lang : foundLangs)
+                {
+                    std::set<std::string>::const_iterator it = msgLangs2.find(lang);
+                    if (it==msgLangs2.end()) // если язык не найден для данного сообщения, то выводим сообщение
+                    {
+                        auto langTag = marty_tr::formatLangTag(lang, marty_tr::ELangTagFormat::langTag);
+                        handleMissingTranslation(lang,langTag);
+                    }
+
+                } // for(const auto &lang : foundLangs)
+
+            } // if (msgLangs2.size()!=foundLangs.size())
+
+        } // for(const auto &msgCatKvp : msgLangs2)
+
+        return errCnt==0;
+    }
+
+}; // class Translator
+
+//----------------------------------------------------------------------------
+
+
+
+
+//----------------------------------------------------------------------------
+//! Переводчик по умолчанию, с ним работают все функции tr_*
+inline
+Translator& tr_get_default_translator()
+{
+    static Translator t;
+    return t;
+}
+
+//----------------------------------------------------------------------------
+
+
+
+
+//----------------------------------------------------------------------------
+inline
+IErrReportHandlerPtr tr_get_err_handler()
+{
+    return tr_get_default_translator().getErrHandler();
+}
+
+inline
+IErrReportHandlerPtr tr_set_err_handler(IErrReportHandlerPtr newPh)
+{
+    return tr_get_default_translator().setErrHandler(newPh);
+}
+
+
+struct AutoRestoreErrReportHandler
+{
+protected:
+    IErrReportHandlerPtr pHandler = 0;
+
+public:
+
+    AutoRestoreErrReportHandler(IErrReportHandlerPtr pH) : pHandler(pH) {}
+    ~AutoRestoreErrReportHandler() { tr_set_err_handler(pHandler); }
+
+    AutoRestoreErrReportHandler() = delete;
+    AutoRestoreErrReportHandler(const AutoRestoreErrReportHandler &) = delete;
+    AutoRestoreErrReportHandler& operator=(const AutoRestoreErrReportHandler &) = delete;
+    AutoRestoreErrReportHandler(AutoRestoreErrReportHandler &&) = delete;
+    AutoRestoreErrReportHandler& operator=(AutoRestoreErrReportHandler &&) = delete;
+
+}; // struct AutoRestoreErrReportHandler
+
+//----------------------------------------------------------------------------
+
+
+
+
+//----------------------------------------------------------------------------
+inline
+ELangTagFormat tr_get_lang_tag_format()
+{
+    return tr_get_default_translator().getLangTagFormat();
+}
+
+inline
+ELangTagFormat tr_set_lang_tag_format(ELangTagFormat newFmt)
+{
+    return tr_get_default_translator().setLangTagFormat(newFmt);
+}
+
+inline
+std::string tr_fix_lang_tag_format(const std::string &langTagOrId)
+{
+    return tr_get_default_translator().fixLangTagFormat(langTagOrId);
+}
+
+//----------------------------------------------------------------------------
+inline
+all_translations_map_t tr_parse_translations_data(const std::string &trJson)
+{
+    return tr_get_default_translator().parseTranslationsData(trJson);
+}
+
+//----------------------------------------------------------------------------
+inline
+all_translations_map_t& tr_get_all_translations()
+{
+    return tr_get_default_translator().getAllTranslations();
+}
+
+//------------------------------
+//! Поколение каталога, меняется при каждом изменении, производные кэши по нему проверяют актуальность
+inline
+std::uint64_t tr_get_catalog_generation()
+{
+    return tr_get_default_translator().getCatalogGeneration();
+}
+
+//------------------------------
+//! Функции tr_* вызывают сами, вызывать вручную нужно после правки каталога напрямую через tr_get_all_translations()
+inline
+void tr_catalog_changed()
+{
+    tr_get_default_translator().catalogChanged();
+}
+
+//------------------------------
+inline
+bool tr_get_lookup_filter_mode()
+{
+    return tr_get_default_translator().getLookupFilterMode();
+}
+
+//------------------------------
+//! Использовать ли фильтр Блума в tr()/tr_has_msg(). После правки каталога напрямую нужно вызвать tr_catalog_changed()
+inline
+bool tr_set_lookup_filter_mode(bool mode)
+{
+    return tr_get_default_translator().setLookupFilterMode(mode);
+}
+
+//----------------------------------------------------------------------------
+//! Компилировать ли тексты при загрузке каталога (tr_init_all_translations, tr_add_custom_translations ...)
+inline
+bool tr_get_precompile_templates_mode()
+{
+    return tr_get_default_translator().getPrecompileTemplatesMode();
+}
+
+//------------------------------
+inline
+bool tr_set_precompile_templates_mode(bool mode)
+{
+    return tr_get_default_translator().setPrecompileTemplatesMode(mode);
+}
+
+//------------------------------
+inline
+void tr_clear_precompiled_templates()
+{
+    tr_get_default_translator().clearPrecompiledTemplates();
+}
+
+//------------------------------
+//! Компилирует текст и кладёт в кэш, тексты с параметризованными/условными макросами не кэшируются
+inline
+void tr_precompile_template(const std::string &msgText)
+{
+    tr_get_default_translator().precompileTemplate(msgText);
+}
+
+//------------------------------
+//! Шаблон для текста или nullptr
+inline
+MessageTemplatePtr tr_find_precompiled_template(const std::string &msgText)
+{
+    return tr_get_default_translator().findPrecompiledTemplate(msgText);
+}
+
+//------------------------------
+//! Компилирует все тексты каталога в кэш шаблонов FormatMessage
+inline
+void tr_precompile_templates(const all_translations_map_t &trAllMap)
+{
+    tr_get_default_translator().precompileTemplates(trAllMap);
+}
+
+//------------------------------
+//! Компилирует все тексты текущего каталога, если включен tr_set_precompile_templates_mode
+inline
+void tr_precompile_templates()
+{
+    tr_get_default_translator().precompileTemplates();
+}
+
+//----------------------------------------------------------------------------
+//! Разрешает ссылки в каталоге trAllMap, исходные тексты со ссылками берутся из sources
+inline
+void tr_resolve_msg_refs(all_translations_map_t &trAllMap, const all_translations_map_t &sources)
+{
+    tr_get_default_translator().resolveMsgRefs(trAllMap, sources);
+}
+
+//------------------------------
+//! Пересчитывает все тексты со ссылками в текущем каталоге
+inline
+void tr_resolve_msg_refs()
+{
+    tr_get_default_translator().resolveMsgRefs();
+}
+
+//----------------------------------------------------------------------------
+inline
+void tr_clear()
+{
+    tr_get_default_translator().clear();
+}
+
+//----------------------------------------------------------------------------
+inline
+all_translations_map_t& tr_alter_get_all_translations()
+{
+    return tr_get_default_translator().alterGetAllTranslations();
+}
+
+//----------------------------------------------------------------------------
+inline
+void tr_alter_clear()
+{
+    tr_get_default_translator().alterClear();
+}
+
+//----------------------------------------------------------------------------
+inline
+void tr_set_translations(const all_translations_map_t &newAllTr)
+{
+    tr_get_default_translator().setTranslations(newAllTr);
+}
+
+//----------------------------------------------------------------------------
+inline
+void tr_init_all_translations(const std::string &trJson)
+{
+    tr_get_default_translator().initAllTranslations(trJson);
+}
+
+//----------------------------------------------------------------------------
+inline
+void tr_add_custom_translations(const all_translations_map_t &customTrMap)
+{
+    tr_get_default_translator().addCustomTranslations(customTrMap);
+}
+
+//----------------------------------------------------------------------------
+inline
+void tr_add_custom_translations(const std::string &trJson)
+{
+    tr_get_default_translator().addCustomTranslations(trJson);
+}
+
+//----------------------------------------------------------------------------
+inline
+bool tr_replace_category(all_translations_map_t &trMap, std::string prevCatId, std::string newCatId)
+{
+    return tr_get_default_translator().replaceCategory(trMap, prevCatId, newCatId);
+}
+
+//----------------------------------------------------------------------------
+//! Общий каталог из JSON/YAML, теги языков приводятся к формату переводчика по умолчанию
+inline
+shared_translations_ptr_t tr_make_shared_translations(const std::string &trJson, std::pmr::memory_resource *pResource = std::pmr::get_default_resource())
+{
+    return tr_make_shared_translations(tr_parse_translations_data(trJson), pResource);
+}
+
+//------------------------------
+//! Профилируемый общий каталог из JSON/YAML, см. tr_make_profiled_shared_translations
+inline
+profiled_shared_translations_ptr_t tr_make_profiled_shared_translations(const std::string &trJson, std::pmr::memory_resource *pResource = std::pmr::get_default_resource())
+{
+    return tr_make_profiled_shared_translations(tr_parse_translations_data(trJson), pResource);
+}
+
+//------------------------------
+//! Образ каталога из JSON/YAML, теги языков приводятся к формату переводчика по умолчанию
+inline
+std::vector<char> tr_build_catalog_image(const std::string &trJson)
+{
+    return tr_build_catalog_image(tr_parse_translations_data(trJson));
+}
+
+//------------------------------
+inline
+const CatalogImageView& tr_get_catalog_image()
+{
+    return tr_get_default_translator().getCatalogImage();
+}
+
+//------------------------------
+//! Подключает образ каталога к переводчику по умолчанию, память образа должна жить, пока он используется
+inline
+CatalogImageView tr_set_catalog_image(const CatalogImageView &img)
+{
+    return tr_get_default_translator().setCatalogImage(img);
+}
+
+//------------------------------
+inline
+shared_translations_ptr_t tr_get_shared_base()
+{
+    return tr_get_default_translator().getSharedBase();
+}
+
+//------------------------------
+inline
+shared_translations_ptr_t tr_set_shared_base(shared_translations_ptr_t base)
+{
+    return tr_get_default_translator().setSharedBase(base);
+}
+
+//------------------------------
+//! Профилирование общей базы переводчика по умолчанию, см. Translator::profileSharedBase
+inline
+profiled_shared_translations_ptr_t tr_profile_shared_base()
+{
+    return tr_get_default_translator().profileSharedBase();
+}
+
+//----------------------------------------------------------------------------
+//! Добавляет пустой слой каталога поверх остальных (самый приоритетный)
+inline
+void tr_add_layer(const std::string &layerName)
+{
+    tr_get_default_translator().addLayer(layerName);
+}
+
+//------------------------------
+inline
+bool tr_remove_layer(const std::string &layerName)
+{
+    return tr_get_default_translator().removeLayer(layerName);
+}
+
+//------------------------------
+inline
+bool tr_has_layer(const std::string &layerName)
+{
+    return tr_get_default_translator().hasLayer(layerName);
+}
+
+//------------------------------
+//! Имена слоёв по возрастанию приоритета
+inline
+std::vector<std::string> tr_get_layer_names()
+{
+    return tr_get_default_translator().getLayerNames();
+}
+
+//------------------------------
+inline
+const all_translations_map_t& tr_get_layer_translations(const std::string &layerName)
+{
+    return tr_get_default_translator().getLayerTranslations(layerName);
+}
+
+//------------------------------
+inline
+void tr_set_layer_translations(const std::string &layerName, const all_translations_map_t &layerTr)
+{
+    tr_get_default_translator().setLayerTranslations(layerName, layerTr);
+}
+
+inline
+void tr_set_layer_translations(const std::string &layerName, const std::string &trJson)
+{
+    tr_get_default_translator().setLayerTranslations(layerName, trJson);
+}
+
+//------------------------------
+inline
+void tr_clear_layer(const std::string &layerName)
+{
+    tr_get_default_translator().clearLayer(layerName);
+}
+
+//------------------------------
+inline
+void tr_layer_add(const std::string &layerName, const std::string &msgId, const std::string &msgText, std::string catId, std::string langId)
+{
+    tr_get_default_translator().layerAdd(layerName, msgId, msgText, catId, langId);
+}
+
+inline
+void tr_layer_add(const std::string &layerName, const std::string &msgId, const std::string &msgText, const std::string &catId)
 {
-    std::string res = impl_helpers::tr_get_def_category();
-    impl_helpers::tr_get_def_category() = c;
-    return res;
+    tr_get_default_translator().layerAdd(layerName, msgId, msgText, catId);
+}
+
+inline
+void tr_layer_add(const std::string &layerName, const std::string &msgId, const std::string &msgText)
+{
+    tr_get_default_translator().layerAdd(layerName, msgId, msgText);
+}
+
+//------------------------------
+inline
+bool tr_layer_erase(const std::string &layerName, const std::string &msgId, std::string catId, std::string langId)
+{
+    return tr_get_default_translator().layerErase(layerName, msgId, catId, langId);
+}
+
+//----------------------------------------------------------------------------
+
+
+
+
+//----------------------------------------------------------------------------
+inline
+std::string tr_get_def_category()
+{
+    return tr_get_default_translator().getDefCategory();
+}
+
+//----------------------------------------------------------------------------
+inline
+std::string tr_set_def_category(const std::string &c)
+{
+    return tr_get_default_translator().setDefCategory(c);
 }
 
 //----------------------------------------------------------------------------
@@ -815,32 +4007,28 @@ std::string tr_set_def_category(const std::string &c)
 inline
 std::string tr_get_def_lang()
 {
-    return impl_helpers::tr_get_def_lang();
+    return tr_get_default_translator().getDefLang();
 }
 
 //----------------------------------------------------------------------------
 inline
 std::string tr_set_def_lang(const std::string &l)
 {
-    std::string res = impl_helpers::tr_get_def_lang();
-    impl_helpers::tr_get_def_lang() = l;
-    return res;
+    return tr_get_default_translator().setDefLang(l);
 }
 
 //----------------------------------------------------------------------------
 inline
 std::string tr_alter_get_def_lang()
 {
-    return impl_helpers::tr_alter_get_def_lang();
+    return tr_get_default_translator().alterGetDefLang();
 }
 
 //----------------------------------------------------------------------------
 inline
 std::string tr_alter_set_def_lang(const std::string &l)
 {
-    std::string res = impl_helpers::tr_alter_get_def_lang();
-    impl_helpers::tr_alter_get_def_lang() = l;
-    return res;
+    return tr_get_default_translator().alterSetDefLang(l);
 }
 
 //----------------------------------------------------------------------------
@@ -852,36 +4040,33 @@ std::string tr_alter_set_def_lang(const std::string &l)
 inline
 bool tr_get_msg_not_found_decorate_mode()
 {
-    return impl_helpers::tr_get_msg_not_found_decorate_mode();
+    return tr_get_default_translator().getMsgNotFoundDecorateMode();
 }
 
 //----------------------------------------------------------------------------
 inline
 bool tr_set_msg_not_found_decorate_mode(bool newMode)
 {
-    bool res = impl_helpers::tr_get_msg_not_found_decorate_mode();
-    impl_helpers::tr_get_msg_not_found_decorate_mode() = newMode;
-    return res;
+    return tr_get_default_translator().setMsgNotFoundDecorateMode(newMode);
 }
 
 //----------------------------------------------------------------------------
 
 
 
+
 //----------------------------------------------------------------------------
 inline
 bool tr_get_empty_msg_not_exist()
 {
-    return impl_helpers::tr_get_empty_msg_not_exist();
+    return tr_get_default_translator().getEmptyMsgNotExist();
 }
 
 //----------------------------------------------------------------------------
 inline
 bool tr_set_empty_msg_not_exist(bool mode)
 {
-    bool res = impl_helpers::tr_get_empty_msg_not_exist();
-    impl_helpers::tr_get_empty_msg_not_exist() = mode;
-    return res;
+    return tr_get_default_translator().setEmptyMsgNotExist(mode);
 }
 
 struct AutoEmptyMsgNotExist
@@ -902,318 +4087,317 @@ public:
 
 }; // struct AutoEmptyMsgNotExist
 
-
 //----------------------------------------------------------------------------
 
 
 
 
 //----------------------------------------------------------------------------
-// Main functionality
-//----------------------------------------------------------------------------
+inline
+bool tr_get_lookup_cache_mode()
+{
+    return tr_get_default_translator().getLookupCacheMode();
+}
 
+//------------------------------
+inline
+bool tr_set_lookup_cache_mode(bool mode)
+{
+    return tr_get_default_translator().setLookupCacheMode(mode);
+}
 
-// enum class MsgNotFound
-// {
-//     msg,
-//     cat,
-//     lang
-// };
+//------------------------------
+//! Освобождает потоковый кэш tr() текущего потока (слоты всех переводчиков)
+inline
+void tr_clear_thread_lookup_cache()
+{
+    impl_helpers::tr_clear_thread_lookup_cache();
+}
 
+//------------------------------
+inline
+bool tr_get_miss_cache_mode()
+{
+    return tr_get_default_translator().getMissCacheMode();
+}
 
-//----------------------------------------------------------------------------
-// std::string tr_fix_lang_tag_format(const std::string &langTagOrId)
-// std::string tr_fix_category(const std::string &catId)
+//------------------------------
+inline
+bool tr_set_miss_cache_mode(bool mode)
+{
+    return tr_get_default_translator().setMissCacheMode(mode);
+}
 
+//------------------------------
 inline
-std::string tr(const all_translations_map_t& trAllMap, const std::string &msgId, std::string catId, std::string langId)
+void tr_clear_miss_cache()
 {
-    catId  = tr_fix_category(catId);
-    langId = tr_fix_lang_tag_format(langId);
+    tr_get_default_translator().clearMissCache();
+}
 
-    auto reportTrNotFound = [=](MsgNotFound what) // 0 - msg, 1 - cat, 2 - lang
-        {
-            // lambda [=] - похоже захватывает по константе или как-то так (хотя вроде должно по значению)
-            // Делаем руцками копию
-            // Лениво разбираться чо как
+//------------------------------
+inline
+std::size_t tr_get_miss_cache_size()
+{
+    return tr_get_default_translator().getMissCacheSize();
+}
 
-            std::string msgId_   = msgId;
-            std::string catId_   = catId;
-            std::string langId_  = langId;
+//------------------------------
+//! Число слотов счётчиков сообщений о промахах для лимита, 0 - без счётчиков (о каждом промахе сообщается)
+inline
+std::size_t tr_set_miss_cache_size(std::size_t sz)
+{
+    return tr_get_default_translator().setMissCacheSize(sz);
+}
 
-            // auto orgMsg = msg;
-            auto handler = tr_get_err_handler();
-            if (handler)
-            {
-                switch(what)
-                {
-                    case MsgNotFound::msg : msgId_  =  /* std::string("!") +  */ msgId_ ; break;
-                    case MsgNotFound::cat : catId_  =  /* std::string("!") +  */ catId_ ; break;
-                    case MsgNotFound::lang: langId_ =  /* std::string("!") +  */ langId_; break;
-                }
-                handler->messageNotFound(what, msgId_, catId_, langId_);
-            }
+//------------------------------
+inline
+std::size_t tr_get_miss_report_limit()
+{
+    return tr_get_default_translator().getMissReportLimit();
+}
+
+//------------------------------
+//! Сколько раз сообщать об одном и том же промахе, 0 - каждый раз
+inline
+std::size_t tr_set_miss_report_limit(std::size_t limit)
+{
+    return tr_get_default_translator().setMissReportLimit(limit);
+}
+
+//----------------------------------------------------------------------------
 
-            if (!tr_get_msg_not_found_decorate_mode())
-               return msgId; // orgMsg;
 
-            return "![" + msgId + "]";
-        };
 
-    all_translations_map_t::const_iterator lit = trAllMap.find(langId);
-    if (lit==trAllMap.end())
-        return reportTrNotFound(MsgNotFound::lang);
 
+//----------------------------------------------------------------------------
+// Main functionality
+//----------------------------------------------------------------------------
 
-    const category_translations_map_t &catMap = lit->second;
+//----------------------------------------------------------------------------
+//! Поиск перевода без сообщений об ошибках и декорирования
+/*! View указывает на текст в каталоге и валиден до его изменения.
+    Заменяет пару tr_has_msg()+tr(): нормализация ключей и проход по каталогу - один раз.
+ */
+inline
+std::optional<std::string_view> tr_find(const all_translations_map_t& trAllMap, const std::string &msgId, std::string catId, std::string langId)
+{
+    return tr_get_default_translator().find(trAllMap, msgId, catId, langId);
+}
 
-    category_translations_map_t::const_iterator cit = catMap.find(catId);
-    if (cit==catMap.end())
-        return reportTrNotFound(MsgNotFound::cat);
+inline
+std::optional<std::string_view> tr_find(const std::string &msgId, std::string catId, std::string langId)
+{
+    return tr_get_default_translator().find(msgId, catId, langId);
+}
 
+inline
+std::optional<std::string_view> tr_find(const all_translations_map_t& trAllMap, const std::string &msgId, const std::string &catId)
+{
+    return tr_get_default_translator().find(trAllMap, msgId, catId, tr_get_def_lang());
+}
 
-    const translations_map_t &trMap = cit->second;
+inline
+std::optional<std::string_view> tr_find(const std::string &msgId, const std::string &catId)
+{
+    return tr_get_default_translator().find(msgId, catId);
+}
 
-    translations_map_t::const_iterator mit = trMap.find(msgId);
-    if (mit==trMap.end())
-        return reportTrNotFound(MsgNotFound::msg);
+inline
+std::optional<std::string_view> tr_find(const all_translations_map_t& trAllMap, const std::string &msgId)
+{
+    return tr_get_default_translator().find(trAllMap, msgId, tr_get_def_category(), tr_get_def_lang());
+}
 
-    if (tr_get_empty_msg_not_exist() && mit->second.empty())
-        return reportTrNotFound(MsgNotFound::msg);
+inline
+std::optional<std::string_view> tr_find(const std::string &msgId)
+{
+    return tr_get_default_translator().find(msgId);
+}
 
-    return mit->second;
+//----------------------------------------------------------------------------
+inline
+std::string tr(const all_translations_map_t& trAllMap, const std::string &msgId, std::string catId, std::string langId)
+{
+    return tr_get_default_translator().tr(trAllMap, msgId, catId, langId);
 }
 
 inline
 std::string tr(const std::string &msgId, std::string catId, std::string langId)
 {
-    return tr(tr_get_all_translations(), msgId, catId, langId);
+    return tr_get_default_translator().tr(msgId, catId, langId);
 }
 
 inline
 std::string tr(const all_translations_map_t& trAllMap, const std::string &msgId, const std::string &catId)
 {
-    return tr(trAllMap, msgId, catId, tr_get_def_lang());
+    return tr_get_default_translator().tr(trAllMap, msgId, catId, tr_get_def_lang());
 }
 
 inline
 std::string tr(const std::string &msgId, const std::string &catId)
 {
-    return tr(tr_get_all_translations(), msgId, catId, tr_get_def_lang());
+    return tr_get_default_translator().tr(msgId, catId);
 }
 
 inline
 std::string tr(const all_translations_map_t& trAllMap, const std::string &msgId)
 {
-    return tr(trAllMap, msgId, tr_get_def_category(), tr_get_def_lang());
+    return tr_get_default_translator().tr(trAllMap, msgId, tr_get_def_category(), tr_get_def_lang());
 }
 
 inline
 std::string tr(const std::string &msgId)
 {
-    return tr(tr_get_all_translations(), msgId, tr_get_def_category(), tr_get_def_lang());
+    return tr_get_default_translator().tr(msgId);
 }
 
 //----------------------------------------------------------------------------
-inline
-bool tr_has_msg(const all_translations_map_t& trAllMap, const std::string &msgId, std::string catId, std::string langId)
+//! Поиск перевода в широкой копии каталога, text - view на закэшированный текст
+/*! View валиден до следующего изменения каталога. Если сообщение не найдено, возвращает false
+    и ничего не сообщает обработчику ошибок - для этого есть tr_wide.
+ */
+template<typename CharType> inline
+bool tr_find_wide(std::basic_string_view<CharType> &text, const std::basic_string<CharType> &msgId, std::string catId, std::string langId)
 {
-    catId  = tr_fix_category(catId);
-    langId = tr_fix_lang_tag_format(langId);
-
-    all_translations_map_t::const_iterator lit = trAllMap.find(langId);
-    if (lit==trAllMap.end())
-    {
-        return false;
-    }
-
-    const category_translations_map_t &catMap = lit->second;
-
-    category_translations_map_t::const_iterator cit = catMap.find(catId);
-    if (cit==catMap.end())
-    {
-        return false;
-    }
-
-    const translations_map_t &trMap = cit->second;
-
-    translations_map_t::const_iterator mit = trMap.find(msgId);
-    //if (mit==trMap.end())
-    if (mit==trMap.end())
-    {
-        return false;
-    }
+    return tr_get_default_translator().findWide(text, msgId, catId, langId);
+}
 
-    if (tr_get_empty_msg_not_exist() && mit->second.empty())
-    {
-        return false;
-    }
+//------------------------------
+//! Широкий tr: сначала кэш, если не найдено - обычный tr (с сообщением об ошибке и декорированием)
+template<typename StringType> inline
+StringType tr_wide(const StringType &msgId, const std::string &catId, const std::string &langId)
+{
+    return tr_get_default_translator().trWide(msgId, catId, langId);
+}
 
-    return true;
+//----------------------------------------------------------------------------
+inline
+bool tr_has_msg(const all_translations_map_t& trAllMap, const std::string &msgId, std::string catId, std::string langId)
+{
+    return tr_get_default_translator().hasMsg(trAllMap, msgId, catId, langId);
 }
 
 inline
 bool tr_has_msg(const std::string &msgId, std::string catId, std::string langId)
 {
-    return tr_has_msg(tr_get_all_translations(), msgId, catId, langId);
+    return tr_get_default_translator().hasMsg(msgId, catId, langId);
 }
 
 inline
 bool tr_has_msg(const all_translations_map_t& trAllMap, const std::string &msgId, std::string catId)
 {
-    return tr_has_msg(trAllMap, msgId, catId, tr_get_def_lang());
+    return tr_get_default_translator().hasMsg(trAllMap, msgId, catId, tr_get_def_lang());
 }
 
 inline
 bool tr_has_msg(const std::string &msgId, std::string catId)
 {
-    return tr_has_msg(tr_get_all_translations(), msgId, catId, tr_get_def_lang());
+    return tr_get_default_translator().hasMsg(msgId, catId);
 }
 
 inline
 bool tr_has_msg(const all_translations_map_t& trAllMap, const std::string &msgId)
 {
-    return tr_has_msg(trAllMap, msgId, tr_get_def_category(), tr_get_def_lang());
+    return tr_get_default_translator().hasMsg(trAllMap, msgId, tr_get_def_category(), tr_get_def_lang());
 }
 
 inline
 bool tr_has_msg(const std::string &msgId)
 {
-    return tr_has_msg(tr_get_all_translations(), msgId, tr_get_def_category(), tr_get_def_lang());
+    return tr_get_default_translator().hasMsg(msgId);
 }
 
 //----------------------------------------------------------------------------
-// inline
-// bool tr_has_message(const all_translations_map_t &trMap, std::string msgId, std::string catId)
-// {
-//     catId = tr_fix_category(catId);
-//
-//     for(const auto &langKvp : trMap)
-//     {
-//         // const std::string &langId                      = langKvp.first; // not used
-//         const category_translations_map_t &catMap      = langKvp.second;
-//         category_translations_map_t::const_iterator it = catMap.find(catId);
-//         if (it!=catMap.end())
-//             return true; // category found
-//     }
-//
-//     return false;
-// }
-
-
-
+inline
+std::string tr_plural(const all_translations_map_t& trAllMap, const std::string &msgId, std::int64_t n, std::string catId, std::string langId)
+{
+    return tr_get_default_translator().trPlural(trAllMap, msgId, n, catId, langId);
+}
 
+inline
+std::string tr_plural(const std::string &msgId, std::int64_t n, std::string catId, std::string langId)
+{
+    return tr_get_default_translator().trPlural(msgId, n, catId, langId);
+}
 
+inline
+std::string tr_plural(const std::string &msgId, std::int64_t n, const std::string &catId)
+{
+    return tr_get_default_translator().trPlural(msgId, n, catId);
+}
 
+inline
+std::string tr_plural(const std::string &msgId, std::int64_t n)
+{
+    return tr_get_default_translator().trPlural(msgId, n);
+}
 
 //----------------------------------------------------------------------------
 inline
 void tr_add(all_translations_map_t& trAllMap, const std::string &msgId, const std::string &msgText, std::string catId, std::string langId)
 {
-    catId  = tr_fix_category(catId);
-    langId = tr_fix_lang_tag_format(langId);
-
-    trAllMap[langId][catId][msgId] = msgText;
+    tr_get_default_translator().add(trAllMap, msgId, msgText, catId, langId);
 }
 
 inline
 void tr_add(const std::string &msgId, const std::string &msgText, std::string catId, std::string langId)
 {
-    tr_add(tr_get_all_translations(), msgId, msgText, catId, langId);
+    tr_get_default_translator().add(msgId, msgText, catId, langId);
 }
 
 //------------------------------
 inline
 void tr_add(all_translations_map_t& trAllMap, const std::string &msgId, const std::string &msgText, const std::string &catId)
 {
-    tr_add(trAllMap, msgId, msgText, catId, tr_get_def_lang());
+    tr_get_default_translator().add(trAllMap, msgId, msgText, catId, tr_get_def_lang());
 }
 
 inline
 void tr_add(const std::string &msgId, const std::string &msgText, const std::string &catId)
 {
-    tr_add(tr_get_all_translations(), msgId, msgText, catId, tr_get_def_lang());
+    tr_get_default_translator().add(msgId, msgText, catId);
 }
 
 //------------------------------
 inline
 void tr_add(all_translations_map_t& trAllMap, const std::string &msgId, const std::string &msgText)
 {
-    tr_add(trAllMap, msgId, msgText, tr_get_def_category(), tr_get_def_lang());
+    tr_get_default_translator().add(trAllMap, msgId, msgText, tr_get_def_category(), tr_get_def_lang());
 }
 
 inline
 void tr_add(const std::string &msgId, const std::string &msgText)
 {
-    tr_add(tr_get_all_translations(), msgId, msgText, tr_get_def_category(), tr_get_def_lang());
+    tr_get_default_translator().add(msgId, msgText);
 }
 
-//----------------------------------------------------------------------------
-
-
-
 //----------------------------------------------------------------------------
 inline
 void tr_add_if_empty(const std::string &msgId, const std::string &msgText, std::string catId, std::string langId)
 {
-    if (tr_has_msg(msgId, catId, langId))
-    {
-        return;
-    }
-
-    all_translations_map_t& trAllMap = tr_get_all_translations();
-
-    catId  = tr_fix_category(catId);
-    langId = tr_fix_lang_tag_format(langId);
-
-    trAllMap[langId][catId][msgId] = msgText;
+    tr_get_default_translator().addIfEmpty(msgId, msgText, catId, langId);
 }
 
 //------------------------------
 inline
 void tr_add_if_empty(const std::string &msgId, const std::string &msgText, const std::string &catId)
 {
-    tr_add_if_empty(msgId, msgText, catId, tr_get_def_lang());
+    tr_get_default_translator().addIfEmpty(msgId, msgText, catId);
 }
 
 //------------------------------
 inline
 void tr_add_if_empty(const std::string &msgId, const std::string &msgText)
 {
-    tr_add_if_empty(msgId, msgText, tr_get_def_category(), tr_get_def_lang());
+    tr_get_default_translator().addIfEmpty(msgId, msgText);
 }
 
-//----------------------------------------------------------------------------
-
-
-
 //----------------------------------------------------------------------------
 template<typename THandler> inline
 void tr_enumerate_msgids(THandler handler, std::string catId, std::string langId)
 {
-    all_translations_map_t& trAllMap = tr_get_all_translations();
-
-    catId  = tr_fix_category(catId);
-    langId = tr_fix_lang_tag_format(langId);
-
-    all_translations_map_t::const_iterator lit = trAllMap.find(langId);
-    if (lit==trAllMap.end())
-        return; // No lang found
-
-
-    const category_translations_map_t &catMap = lit->second;
-
-    category_translations_map_t::const_iterator cit = catMap.find(catId);
-    if (cit==catMap.end())
-        return;
-
-
-    const translations_map_t &trMap = cit->second;
-    translations_map_t::const_iterator mit = trMap.begin();
-    for(; mit!=trMap.end(); ++mit)
-    {
-        handler(mit->first);
-    }
+    tr_get_default_translator().enumerateMsgIds(handler, catId, langId);
 }
 
 //----------------------------------------------------------------------------
@@ -1223,137 +4407,32 @@ void tr_enumerate_msgids(THandler handler, std::string catId, std::string langId
 template<typename THandler> inline
 void tr_enumerate_msgids(THandler handler, std::string catId)
 {
-    tr_enumerate_msgids(handler, catId, "en-US");
+    tr_get_default_translator().enumerateMsgIds(handler, catId);
 }
 
 //----------------------------------------------------------------------------
 inline
 std::vector<std::string> tr_get_msgids(std::string catId, std::string langId)
 {
-    std::vector<std::string> res; res.reserve(32);
-
-    tr_enumerate_msgids( [&](const std::string &msgId)
-                         {
-                             res.emplace_back(msgId);
-                         }
-                       , catId, langId
-                       );
-    return res;
+    return tr_get_default_translator().getMsgIds(catId, langId);
 }
 
 //----------------------------------------------------------------------------
 inline
 std::vector<std::string> tr_get_msgids(std::string catId)
 {
-    std::vector<std::string> res; res.reserve(32);
-
-    tr_enumerate_msgids( [&](const std::string &msgId)
-                         {
-                             res.emplace_back(msgId);
-                         }
-                       , catId
-                       );
-    return res;
+    return tr_get_default_translator().getMsgIds(catId);
 }
 
-//----------------------------------------------------------------------------
-
-
-
 //----------------------------------------------------------------------------
 inline
 bool tr_check_translation_completeness()
 {
-    unsigned errCnt = 0;
-
-    auto allTrMap = marty_tr::tr_get_all_translations();
-
-    std::set<std::string>                          foundLangs;
-    std::map<std::string, std::set<std::string> >  msgLangs;
-
-    IErrReportHandlerPtr errHandler = tr_get_err_handler();
-    auto handleNotFullyTranslated = [&](const std::string& catId, const std::string& msgId)
-    {
-        if (!errHandler)
-            return;
-
-        return errHandler->messageNotFullyTranslated(catId, msgId);
-    };
-
-    auto handleMissingTranslation = [&](const std::string& lang, const std::string& langTag)
-    {
-        if (!errHandler)
-            return;
-
-        return errHandler->messageMissingTranslation(lang, langTag);
-    };
-
-    // Пробегаемся по всем языкам, для каждого языка пробегаемся по категориям и сообщениям.
-
-    for(const auto &langKvp : allTrMap)
-    {
-        const auto &langId  = langKvp.first;
-        const auto &catMap  = langKvp.second;
-
-        foundLangs.insert(langId);
-
-        for(const auto &catKvp : catMap)
-        {
-            const auto &catId  = catKvp.first;
-            const auto &msgMap = catKvp.second;
-
-            for(const auto &msgKvp : msgMap)
-            {
-                const auto &msgId   = msgKvp.first;
-                // const auto &msgText = msgKvp.second; // not used
-
-                // Склеиваем категорию:сообщение в ключ, и инкрементируем элемент map по этому ключу.
-
-                std::string msgFullId = catId + std::string(":") + msgId;
-
-                msgLangs[msgFullId].insert(langId); // add found translation
-            }
-
-        } // cat
-
-    } // lang
-
-
-    for(const auto &msgCatKvp : msgLangs)
-    {
-        const auto &msgCat   = msgCatKvp.first;
-        const auto &msgLangs2 = msgCatKvp.second;
-
-        if (msgLangs2.size()!=foundLangs.size())
-        {
-            ++errCnt;
-
-            std::string::size_type sepPos = msgCat.find(':');
-            if (sepPos==msgCat.npos)
-                handleNotFullyTranslated(msgCat, std::string());
-            else
-                handleNotFullyTranslated(std::string(msgCat, 0, sepPos), std::string(msgCat, sepPos+1));
-
-
-            // iterate through all found langs
-            for(const auto &lang : foundLangs)
-            {
-                std::set<std::string>::const_iterator it = msgLangs2.find(lang);
-                if (it==msgLangs2.end()) // если язык не найден для данного сообщения, то выводим сообщение
-                {
-                    auto langTag = marty_tr::formatLangTag(lang, marty_tr::ELangTagFormat::langTag);
-                    handleMissingTranslation(lang,langTag);
-                }
-
-            } // for(const auto &lang : foundLangs)
-
-        } // if (msgLangs2.size()!=foundLangs.size())
-
-    } // for(const auto &msgCatKvp : msgLangs2)
-
-    return errCnt==0;
+    return tr_get_default_translator().checkTranslationCompleteness();
 }
 
+//----------------------------------------------------------------------------
+
 
 
 
@@ -1367,4 +4446,3 @@ bool tr_check_translation_completeness()
 //----------------------------------------------------------------------------
 
 
-
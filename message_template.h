@@ -0,0 +1,328 @@
+#pragma once
+/*!
+    \file
+    \brief Предварительно разобранные (скомпилированные) тексты сообщений для FormatMessage
+
+    Текст сообщения разбирается один раз - при загрузке каталога, а не при каждом formatMessage().
+    Сообщение без плейсхолдеров помечается как literal only, и FormatMessage отдаёт его без подстановки.
+ */
+
+#include "macros.h"
+#include "simd_scan.h"
+
+#include <cstddef>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+
+//----------------------------------------------------------------------------
+// marty_tr::
+namespace marty_tr {
+
+
+
+//----------------------------------------------------------------------------
+//! Разобранный текст сообщения, разбор совпадает с substMacros для smf_KeepUnknownVars|smf_DisableRecursion (как в FormatMessage)
+template<typename StringType>
+class MessageTemplate
+{
+
+public:
+
+    typedef typename StringType::value_type                                         CharType;
+    typedef typename StringType::size_type                                          size_type;
+    typedef std::basic_string_view<CharType, typename StringType::traits_type>      StringViewType;
+
+    struct Segment
+    {
+        size_type      pos     = 0;     //!< Литерал или исходный текст плейсхолдера $(name) в buf
+        size_type      len     = 0;
+        bool           isMacro = false;
+        std::size_t    nameIdx = 0;     //!< Индекс в names
+        std::size_t    argIdx  = 0;     //!< Позиционный аргумент (1..), 0 - именованный макрос
+    };
+
+protected:
+
+    StringType                 buf      ;
+    std::vector<Segment>       segments ;
+    std::vector<StringType>    names    ;
+    bool                       compiled = false;
+
+    void appendLiteral(const StringType &text, size_type pos, size_type len)
+    {
+        if (!len)
+            return;
+
+        if (!segments.empty() && !segments.back().isMacro)
+        {
+            segments.back().len += len; // Литерал всегда дописывается в конец buf
+        }
+        else
+        {
+            Segment seg;
+            seg.pos = buf.size();
+            seg.len = len;
+            segments.push_back(seg);
+        }
+
+        buf.append(text, pos, len);
+    }
+
+public:
+
+    MessageTemplate() {}
+
+    //! Разбор текста. Если в тексте есть параметризованные или условные макросы, шаблон не компилируется (isCompiled()==false)
+    static MessageTemplate compile(const StringType &text)
+    {
+        MessageTemplate t;
+        t.buf.reserve(text.size());
+
+        const size_type size = text.size();
+        size_type       pos  = 0;
+
+        while(pos<size)
+        {
+            size_type dollarPos = pos + simd::findFirstOf(text.data()+pos, size-pos, (CharType)'$');
+            if (dollarPos>=size)
+            {
+                t.appendLiteral(text, pos, size-pos);
+                break;
+            }
+
+            t.appendLiteral(text, pos, dollarPos-pos);
+
+            pos = dollarPos+1;
+            if (pos>=size) break;
+
+            if (text[pos]==(CharType)'$')
+            {
+                t.appendLiteral(text, pos, 1);
+                ++pos;
+                continue;
+            }
+
+            if (text[pos]!=(CharType)'(')
+            {
+                t.appendLiteral(text, dollarPos, 2);
+                ++pos;
+                continue;
+            }
+
+            ++pos;
+            if (pos>=size) break;
+
+            size_type start = pos;
+            int brCnt = 1;
+            for(; pos<size; ++pos)
+            {
+                pos += simd::findFirstOf(text.data()+pos, size-pos, (CharType)'(', (CharType)')');
+                if (pos>=size)
+                    break;
+
+                if (text[pos]==(CharType)'(') { ++brCnt; continue; }
+                if (text[pos]==(CharType)')')
+                {
+                    --brCnt;
+                    if (!brCnt) break;
+                }
+            }
+
+            if (pos>=size)
+            {
+                t.appendLiteral(text, start, size-start);
+                break;
+            }
+
+            StringType name = StringType(text, start, pos-start);
+            ++pos;
+
+            // Такие макросы FormatMessage не разрешает, пусть ошибку выдаёт substMacros при форматировании
+            if ( macros::util::findChar<'(', ')', '?'>(name)!=StringType::npos
+              || macros::util::findChar<'(', ')', ':'>(name)!=StringType::npos
+               )
+            {
+                return MessageTemplate();
+            }
+
+            Segment seg;
+            seg.pos     = t.buf.size();
+            seg.len     = pos-dollarPos;
+            seg.isMacro = true;
+            seg.nameIdx = t.names.size();
+            seg.argIdx  = macros::util::parseMacroArgIndex(name);
+            t.segments.push_back(seg);
+            t.buf.append(text, dollarPos, pos-dollarPos);
+            t.names.emplace_back(std::move(name));
+        }
+
+        t.compiled = true;
+        return t;
+    }
+
+    bool isCompiled() const
+    {
+        return compiled;
+    }
+
+    //! Плейсхолдеров нет, результат форматирования всегда literalText()
+    bool isLiteralOnly() const
+    {
+        return compiled && names.empty();
+    }
+
+    //! Для isLiteralOnly() - готовый текст ($$ уже заменены на $)
+    const StringType& literalText() const
+    {
+        return buf;
+    }
+
+    //! Рендеринг, getArg(const StringType &name, std::size_t argIdx, StringViewType &text) -> bool
+    /*! Ненайденные макросы остаются в тексте как есть, лимиты проверяются так же, как в substMacros
+     */
+    template<typename ArgGetter>
+    StringType render(const ArgGetter &getArg, const macros::SubstMacrosLimits &limits) const
+    {
+        if (limits.maxSteps && names.size()>limits.maxSteps)
+            throw macros::SubstMacrosLimitError("substMacros: macro expansion steps limit exceeded");
+
+        StringType res;
+        res.reserve(buf.size());
+
+        for(const auto &seg : segments)
+        {
+            StringViewType text;
+            if (seg.isMacro && getArg(names[seg.nameIdx], seg.argIdx, text))
+                res.append(text);
+            else
+                res.append(buf, seg.pos, seg.len);
+        }
+
+        if (limits.maxOutputSize && res.size()>limits.maxOutputSize)
+            throw macros::SubstMacrosLimitError("substMacros: output size limit exceeded");
+
+        return res;
+    }
+
+}; // class MessageTemplate
+
+//----------------------------------------------------------------------------
+
+
+
+
+//----------------------------------------------------------------------------
+typedef std::shared_ptr< const MessageTemplate<std::string> >    MessageTemplatePtr;
+
+//----------------------------------------------------------------------------
+//! Кэш шаблонов, ключ - сам текст сообщения, поэтому кэш не устаревает при изменении каталога
+/*! У шаблона есть счётчик ссылок - сколько раз текст компилировали (precompile) и ещё не отпустили
+    (release). Каталог при замене и удалении сообщения отпускает прежний текст, и шаблон текста,
+    которым больше не пользуется ни одно сообщение, из кэша удаляется.
+ */
+class MessageTemplateCache
+{
+
+protected:
+
+    struct Entry
+    {
+        MessageTemplatePtr      ptr ;
+        std::size_t             refs = 0;
+    };
+
+    std::unordered_map<std::string, Entry>                 templates;
+    bool                                                   precompileMode = false;
+
+public:
+
+    //! Компилировать ли тексты при загрузке каталога
+    bool getPrecompileMode() const
+    {
+        return precompileMode;
+    }
+
+    bool setPrecompileMode(bool mode)
+    {
+        bool res = precompileMode;
+        precompileMode = mode;
+        return res;
+    }
+
+    void clear()
+    {
+        templates.clear();
+    }
+
+    //! Компилирует текст и кладёт в кэш, тексты с параметризованными/условными макросами не кэшируются
+    /*! Уже скомпилированный текст не компилируется повторно, только получает ещё одну ссылку
+     */
+    void precompile(const std::string &msgText)
+    {
+        std::unordered_map<std::string, Entry>::iterator it = templates.find(msgText);
+        if (it!=templates.end())
+        {
+            ++it->second.refs;
+            return;
+        }
+
+        MessageTemplate<std::string> t = MessageTemplate<std::string>::compile(msgText);
+        if (!t.isCompiled())
+            return;
+
+        Entry &e = templates[msgText];
+        e.ptr  = std::make_shared< const MessageTemplate<std::string> >(std::move(t));
+        e.refs = 1;
+    }
+
+    //! Отпускает ссылку на текст, последняя ссылка удаляет шаблон. Текста нет в кэше - ничего не делает
+    void release(const std::string &msgText)
+    {
+        if (templates.empty())
+            return;
+
+        std::unordered_map<std::string, Entry>::iterator it = templates.find(msgText);
+        if (it!=templates.end() && --it->second.refs==0)
+            templates.erase(it);
+    }
+
+    //! Текст сообщения каталога заменён: новый компилируется (в режиме предкомпиляции), прежний отпускается
+    /*! pPrevText - прежний текст или 0 (сообщения не было), pNewText - новый или 0 (сообщение удалено).
+        Вызывается до записи в каталог, пока прежний текст жив.
+     */
+    void replace(const std::string *pPrevText, const std::string *pNewText)
+    {
+        if (pNewText && precompileMode)
+            precompile(*pNewText);
+        if (pPrevText)
+            release(*pPrevText);
+    }
+
+    std::size_t size() const
+    {
+        return templates.size();
+    }
+
+    //! Шаблон для текста или nullptr
+    MessageTemplatePtr find(const std::string &msgText) const
+    {
+        if (templates.empty())
+            return MessageTemplatePtr();
+
+        std::unordered_map<std::string, Entry>::const_iterator it = templates.find(msgText);
+        if (it==templates.end())
+            return MessageTemplatePtr();
+
+        return it->second.ptr;
+    }
+
+}; // class MessageTemplateCache
+
+//----------------------------------------------------------------------------
+
+} // namespace marty_tr
+
@@ -0,0 +1,736 @@
+#pragma once
+/*!
+    \file
+    \brief Каталог переводов поверх пула строк (см. string_pool.h)
+
+    Все строки каталога (языки, категории, msgId, тексты) лежат в одном StringPool, таблицы хранят
+    только 32-битные смещения. Сообщение категории стоит 8 байт записи + 8 байт слота хэш-таблицы
+    (заполнение не больше половины) + сами строки, против узла map/unordered_map и двух std::string
+    с отдельными выделениями памяти в all_translations_map_t. Обход категории идёт по записям подряд,
+    строки которых тоже лежат подряд в пуле.
+
+    Интерфейс поиска и обхода - как у CatalogImageView. Удаления нет: пул монотонный, при замене
+    текста новый текст дописывается в пул, старый остаётся до пересоздания каталога.
+
+    Строки интернируются: msgId, повторяющийся во всех языках, и тексты, совпадающие в разных языках
+    и категориях, лежат в пуле один раз. Сообщение, текст которого равен msgId (например, названия
+    стран в "marty-tr/language-location"), хранится как "тождественное" - смещение текста равно
+    смещению msgId, без поиска по пулу. Сколько сэкономлено - getStats().
+
+    Пул и все таблицы берутся из memory_resource, переданного в конструктор (арена клиента,
+    huge pages и т.п.). Ресурс должен жить дольше каталога.
+
+    Горячие сообщения. В режиме профилирования (setProfilingMode) find() считает попадания в каждое
+    сообщение (relaxed atomic на запись). makeHotLayout() по этим счётчикам строит новый каталог:
+    самые частые сообщения идут в пуле первыми и подряд (их msgId и тексты занимают немного соседних
+    строк кэша), в своих категориях - первыми записями, и для них есть отдельная плотная таблица,
+    которую find() проверяет до поиска языка и категории.
+ */
+
+#include "string_pool.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <memory_resource>
+#include <optional>
+#include <string_view>
+#include <vector>
+
+
+//----------------------------------------------------------------------------
+// marty_tr::
+namespace marty_tr {
+
+
+
+//----------------------------------------------------------------------------
+struct PackedTranslationsStats
+{
+    std::size_t     numLangs        = 0;
+    std::size_t     numCats         = 0;
+    std::size_t     numMsgs         = 0;
+    std::size_t     numIdentityMsgs = 0; //!< Сообщений с текстом, равным msgId
+    std::size_t     numStringRefs   = 0; //!< Ссылок на строки в таблицах (имена, msgId, тексты)
+    std::size_t     rawStringBytes  = 0; //!< Сколько заняли бы строки без дедупликации
+    std::size_t     poolBytes       = 0; //!< Сколько занимают в пуле
+    std::size_t     savedBytes      = 0; //!< rawStringBytes-poolBytes
+    std::size_t     numHotMsgs      = 0; //!< Сообщений в горячей таблице (makeHotLayout)
+    std::size_t     memoryUsage     = 0; //!< Всего, с таблицами и индексом интернирования
+};
+
+//----------------------------------------------------------------------------
+class PackedTranslations
+{
+
+public:
+
+    typedef StringPool::offset_type     offset_type;
+
+    static constexpr std::size_t npos = (std::size_t)-1;
+
+protected:
+
+    struct MsgEntry
+    {
+        offset_type         msgId;
+        offset_type         text ;
+    };
+
+    struct Slot
+    {
+        std::uint32_t       hash ;
+        std::uint32_t       index; // Индекс записи + 1, 0 - слот пуст
+    };
+
+    struct Category
+    {
+        offset_type                   name    = 0;
+        std::size_t                   nameHash= 0;
+        std::pmr::vector<MsgEntry>    msgs    ;
+        std::pmr::vector<Slot>        slots   ; // Размер - степень двойки
+        std::size_t                   hitBase = 0; // Счётчик записи i - hitCounters[hitBase+i]
+        std::size_t                   numHits = 0; // Сколько записей имеют счётчики
+
+        explicit Category(std::pmr::memory_resource *pResource) : msgs(pResource), slots(pResource) {}
+    };
+
+    struct Lang
+    {
+        offset_type                   name    = 0;
+        std::size_t                   nameHash= 0;
+        std::pmr::vector<Category>    cats    ;
+
+        explicit Lang(std::pmr::memory_resource *pResource) : cats(pResource) {}
+    };
+
+    //! Запись горячей таблицы, ключ - язык+категория+msgId
+    struct HotEntry
+    {
+        std::uint32_t       hash   ;
+        std::uint32_t       langCat; // (индекс языка<<16 | индекс категории)+1, 0 - слот пуст
+        offset_type         msgId  ;
+        offset_type         text   ;
+    };
+
+    StringPool                  pool   ;
+    std::pmr::vector<Lang>      langs  ;
+    std::size_t                 numMsgs = 0;
+    std::pmr::vector<HotEntry>  hotSlots;    // Открытая адресация, заполнение не больше половины
+    std::size_t                 numHotMsgs = 0;
+
+    std::unique_ptr< std::atomic<std::uint64_t>[] >  hitCounters; // Только в режиме профилирования
+    std::size_t                 numHitCounters = 0;
+
+
+    static std::size_t hashStr(std::string_view str)
+    {
+        return std::hash<std::string_view>()(str);
+    }
+
+    static std::uint32_t hotHash(std::size_t hLang, std::size_t hCat, std::size_t hMsg)
+    {
+        std::uint64_t h = (std::uint64_t)hMsg;
+        h ^= (std::uint64_t)hCat  + 0x9E3779B97F4A7C15ull + (h<<6) + (h>>2);
+        h ^= (std::uint64_t)hLang + 0x9E3779B97F4A7C15ull + (h<<6) + (h>>2);
+        h ^= h>>33;
+        h *= 0xFF51AFD7ED558CCDull;
+        h ^= h>>33;
+        return (std::uint32_t)h;
+    }
+
+    std::size_t findLang(std::string_view langId, std::size_t h) const
+    {
+        for(std::size_t i=0; i!=langs.size(); ++i)
+        {
+            if (langs[i].nameHash==h && pool.get(langs[i].name)==langId)
+                return i;
+        }
+        return npos;
+    }
+
+    std::size_t findLang(std::string_view langId) const
+    {
+        return findLang(langId, hashStr(langId));
+    }
+
+    const Category* findCat(std::string_view langId, std::size_t hLang, std::string_view catId, std::size_t hCat) const
+    {
+        const std::size_t langIdx = findLang(langId, hLang);
+        if (langIdx==npos)
+            return 0;
+
+        for(const Category &c : langs[langIdx].cats)
+        {
+            if (c.nameHash==hCat && pool.get(c.name)==catId)
+                return &c;
+        }
+        return 0;
+    }
+
+    const Category* findCat(std::string_view langId, std::string_view catId) const
+    {
+        return findCat(langId, hashStr(langId), catId, hashStr(catId));
+    }
+
+    //! Слот горячей таблицы или npos
+    std::size_t findHotSlot(std::string_view langId, std::string_view catId, std::string_view msgId, std::uint32_t h) const
+    {
+        const std::size_t mask = hotSlots.size()-1;
+        for(std::size_t pos=h & mask; ; pos=(pos+1) & mask)
+        {
+            const HotEntry &e = hotSlots[pos];
+            if (!e.langCat)
+                return npos;
+            if (e.hash!=h || pool.get(e.msgId)!=msgId)
+                continue;
+
+            const Lang     &l = langs[(e.langCat-1)>>16];
+            const Category &c = l.cats[(e.langCat-1) & 0xFFFFu];
+            if (pool.get(c.name)==catId && pool.get(l.name)==langId)
+                return pos;
+        }
+    }
+
+    //! Пересоздаёт счётчики под текущий набор записей, накопленные значения сохраняются
+    void rebuildHitCounters()
+    {
+        std::size_t total = 0;
+        for(const Lang &l : langs)
+            for(const Category &c : l.cats)
+                total += c.msgs.size();
+
+        std::unique_ptr< std::atomic<std::uint64_t>[] > counters(new std::atomic<std::uint64_t>[total ? total : 1]);
+
+        std::size_t base = 0;
+        for(Lang &l : langs)
+        {
+            for(Category &c : l.cats)
+            {
+                for(std::size_t i=0; i!=c.msgs.size(); ++i)
+                    counters[base+i].store(hitCounters && i<c.numHits ? hitCounters[c.hitBase+i].load(std::memory_order_relaxed) : 0, std::memory_order_relaxed);
+
+                c.hitBase = base;
+                c.numHits = c.msgs.size();
+                base += c.msgs.size();
+            }
+        }
+
+        hitCounters    = std::move(counters);
+        numHitCounters = total;
+    }
+
+    //! Индекс записи или npos
+    std::size_t findMsg(const Category &c, std::string_view msgId, std::uint32_t h) const
+    {
+        if (c.slots.empty())
+            return npos;
+
+        const std::size_t mask = c.slots.size()-1;
+        for(std::size_t pos=h & mask; ; pos=(pos+1) & mask)
+        {
+            const Slot &s = c.slots[pos];
+            if (!s.index)
+                return npos;
+            if (s.hash==h && pool.get(c.msgs[s.index-1].msgId)==msgId)
+                return s.index-1;
+        }
+    }
+
+    static void insertSlot(std::pmr::vector<Slot> &slots, std::uint32_t h, std::uint32_t index)
+    {
+        const std::size_t mask = slots.size()-1;
+        std::size_t pos = h & mask;
+        while(slots[pos].index)
+            pos = (pos+1) & mask;
+
+        slots[pos].hash  = h;
+        slots[pos].index = index;
+    }
+
+    //! Таблица под numMsgs сообщений с заполнением не больше половины
+    void rehash(Category &c, std::size_t numMsgsExpected)
+    {
+        std::size_t numSlots = 8;
+        while(numSlots < numMsgsExpected*2)
+            numSlots *= 2;
+
+        if (numSlots<=c.slots.size())
+            return;
+
+        c.slots.assign(numSlots, Slot{0, 0});
+        for(std::size_t i=0; i!=c.msgs.size(); ++i)
+            insertSlot(c.slots, (std::uint32_t)hashStr(pool.get(c.msgs[i].msgId)), (std::uint32_t)(i+1));
+    }
+
+    MsgEntry makeEntry(std::string_view msgId, std::string_view text)
+    {
+        const offset_type msgIdOffset = pool.intern(msgId);
+        return MsgEntry{msgIdOffset, text==msgId ? msgIdOffset : pool.intern(text)};
+    }
+
+    Lang& getLangForInsert(std::string_view langId)
+    {
+        std::size_t langIdx = findLang(langId);
+        if (langIdx!=npos)
+            return langs[langIdx];
+
+        langs.emplace_back(getMemoryResource());
+        langs.back().name     = pool.intern(langId);
+        langs.back().nameHash = hashStr(langId);
+        return langs.back();
+    }
+
+    Category& getCategoryForInsert(std::string_view langId, std::string_view catId, std::size_t numMsgsHint)
+    {
+        Lang &l = getLangForInsert(langId);
+        const std::size_t h = hashStr(catId);
+        for(Category &c : l.cats)
+        {
+            if (c.nameHash==h && pool.get(c.name)==catId)
+                return c;
+        }
+
+        l.cats.emplace_back(getMemoryResource());
+        Category &c = l.cats.back();
+        c.name     = pool.intern(catId);
+        c.nameHash = h;
+        c.msgs.reserve(numMsgsHint);
+        rehash(c, numMsgsHint);
+        return c;
+    }
+
+
+public:
+
+    explicit PackedTranslations(std::pmr::memory_resource *pResource = std::pmr::get_default_resource())
+    : pool(pResource), langs(pResource), hotSlots(pResource)
+    {}
+
+    PackedTranslations(PackedTranslations &&other) = default;
+    PackedTranslations& operator=(PackedTranslations &&other) = default;
+
+    //! Копия, в режиме профилирования - со значениями счётчиков
+    PackedTranslations(const PackedTranslations &other)
+    : pool(other.pool), langs(other.langs), numMsgs(other.numMsgs), hotSlots(other.hotSlots), numHotMsgs(other.numHotMsgs)
+    {
+        if (other.hitCounters)
+        {
+            hitCounters.reset(new std::atomic<std::uint64_t>[other.numHitCounters ? other.numHitCounters : 1]);
+            numHitCounters = other.numHitCounters;
+            for(std::size_t i=0; i!=numHitCounters; ++i)
+                hitCounters[i].store(other.hitCounters[i].load(std::memory_order_relaxed), std::memory_order_relaxed);
+        }
+    }
+
+    PackedTranslations& operator=(const PackedTranslations &other)
+    {
+        if (this!=&other)
+            *this = PackedTranslations(other);
+        return *this;
+    }
+
+    //! Из all_translations_map_t или совместимого вложенного контейнера lang->cat->msg->text
+    template<typename TrMap>
+    explicit PackedTranslations(const TrMap &trAllMap, std::pmr::memory_resource *pResource = std::pmr::get_default_resource())
+    : pool(pResource), langs(pResource), hotSlots(pResource)
+    {
+        // Пул выделяется один раз с размером без учёта дедупликации, лишнее отдаётся в конце
+        std::size_t poolSize = 0;
+        for(const auto &langKvp : trAllMap)
+        {
+            poolSize += StringPool::getStoredSize(langKvp.first.size());
+            for(const auto &catKvp : langKvp.second)
+            {
+                poolSize += StringPool::getStoredSize(catKvp.first.size());
+                for(const auto &msgKvp : catKvp.second)
+                    poolSize += StringPool::getStoredSize(msgKvp.first.size()) + StringPool::getStoredSize(msgKvp.second.size());
+            }
+        }
+        pool.reserve(poolSize);
+
+        langs.reserve(trAllMap.size());
+        for(const auto &langKvp : trAllMap)
+        {
+            getLangForInsert(langKvp.first); // Язык без категорий тоже есть в каталоге
+            for(const auto &catKvp : langKvp.second)
+            {
+                Category &c = getCategoryForInsert(langKvp.first, catKvp.first, catKvp.second.size());
+                for(const auto &msgKvp : catKvp.second)
+                {
+                    c.msgs.push_back(makeEntry(msgKvp.first, msgKvp.second));
+                    insertSlot(c.slots, (std::uint32_t)hashStr(msgKvp.first), (std::uint32_t)c.msgs.size());
+                }
+                numMsgs += catKvp.second.size();
+            }
+        }
+
+        // Каталог собран, индекс интернирования понадобится только при изменении
+        pool.dropInternIndex();
+        pool.shrinkToFit();
+    }
+
+    bool        empty()       const { return numMsgs==0; }
+    std::size_t getMsgCount() const { return numMsgs; }
+
+    const StringPool& getPool() const { return pool; }
+
+    std::pmr::memory_resource* getMemoryResource() const { return langs.get_allocator().resource(); }
+
+    //! Память, занятая каталогом: пул строк и таблицы
+    std::size_t getMemoryUsage() const
+    {
+        std::size_t res = pool.capacity() + pool.getInternIndexSize() + langs.capacity()*sizeof(Lang)
+                        + hotSlots.capacity()*sizeof(HotEntry) + numHitCounters*sizeof(std::atomic<std::uint64_t>);
+        for(const Lang &l : langs)
+        {
+            res += l.cats.capacity()*sizeof(Category);
+            for(const Category &c : l.cats)
+                res += c.msgs.capacity()*sizeof(MsgEntry) + c.slots.capacity()*sizeof(Slot);
+        }
+        return res;
+    }
+
+    PackedTranslationsStats getStats() const
+    {
+        PackedTranslationsStats st;
+
+        auto countStr = [&](offset_type offset)
+        {
+            ++st.numStringRefs;
+            st.rawStringBytes += StringPool::getStoredSize(pool.get(offset).size());
+        };
+
+        st.numLangs = langs.size();
+        for(const Lang &l : langs)
+        {
+            countStr(l.name);
+            st.numCats += l.cats.size();
+            for(const Category &c : l.cats)
+            {
+                countStr(c.name);
+                for(const MsgEntry &m : c.msgs)
+                {
+                    countStr(m.msgId);
+                    countStr(m.text);
+                    if (m.text==m.msgId)
+                        ++st.numIdentityMsgs;
+                }
+            }
+        }
+
+        st.numMsgs     = numMsgs;
+        st.numHotMsgs  = numHotMsgs;
+        st.poolBytes   = pool.size();
+        st.savedBytes  = st.rawStringBytes>st.poolBytes ? st.rawStringBytes-st.poolBytes : 0;
+        st.memoryUsage = getMemoryUsage();
+        return st;
+    }
+
+    //------------------------------
+    bool hasLang(std::string_view langId) const
+    {
+        return findLang(langId)!=npos;
+    }
+
+    bool hasCategory(std::string_view langId, std::string_view catId) const
+    {
+        return findCat(langId, catId)!=0;
+    }
+
+    //! Возвращаемый string_view указывает в пул и валиден до следующего изменения каталога
+    std::optional<std::string_view> find(std::string_view langId, std::string_view catId, std::string_view msgId) const
+    {
+        const std::size_t hLang = hashStr(langId);
+        const std::size_t hCat  = hashStr(catId );
+        const std::size_t hMsg  = hashStr(msgId );
+
+        // При профилировании горячая таблица пропускается, чтобы все попадания попали в счётчики
+        if (!hotSlots.empty() && !hitCounters)
+        {
+            const std::size_t hotIdx = findHotSlot(langId, catId, msgId, hotHash(hLang, hCat, hMsg));
+            if (hotIdx!=npos)
+                return pool.get(hotSlots[hotIdx].text);
+        }
+
+        const Category *pCat = findCat(langId, hLang, catId, hCat);
+        if (!pCat)
+            return std::nullopt;
+
+        const std::size_t idx = findMsg(*pCat, msgId, (std::uint32_t)hMsg);
+        if (idx==npos)
+            return std::nullopt;
+
+        if (hitCounters)
+            hitCounters[pCat->hitBase+idx].fetch_add(1, std::memory_order_relaxed);
+
+        return pool.get(pCat->msgs[idx].text);
+    }
+
+    //! Добавляет сообщение или заменяет его текст
+    void set(std::string_view langId, std::string_view catId, std::string_view msgId, std::string_view text)
+    {
+        Category &c = getCategoryForInsert(langId, catId, 0);
+
+        const std::uint32_t h = (std::uint32_t)hashStr(msgId);
+        const std::size_t idx = findMsg(c, msgId, h);
+        if (idx!=npos)
+        {
+            MsgEntry &m = c.msgs[idx];
+            if (pool.get(m.text)!=text)
+            {
+                m.text = text==msgId ? m.msgId : pool.intern(text);
+
+                // Копия смещения текста в горячей таблице
+                if (!hotSlots.empty())
+                {
+                    const std::size_t hotIdx = findHotSlot(langId, catId, msgId, hotHash(hashStr(langId), c.nameHash, hashStr(msgId)));
+                    if (hotIdx!=npos)
+                        hotSlots[hotIdx].text = m.text;
+                }
+            }
+            return;
+        }
+
+        c.msgs.push_back(makeEntry(msgId, text));
+        ++numMsgs;
+
+        if (c.msgs.size()*2 > c.slots.size())
+            rehash(c, c.msgs.size()); // Вставит и новую запись
+        else
+            insertSlot(c.slots, h, (std::uint32_t)c.msgs.size());
+
+        if (hitCounters)
+            rebuildHitCounters();
+    }
+
+    //------------------------------
+    //! Включает/выключает подсчёт попаданий find() в сообщения, возвращает предыдущий режим
+    /*! Переключать режим, как и менять каталог, нельзя одновременно с поиском из других потоков,
+        сам подсчёт потокобезопасен. Добавление сообщения через set() в этом режиме пересоздаёт счётчики.
+     */
+    bool setProfilingMode(bool enable)
+    {
+        const bool prev = hitCounters!=0;
+        if (enable==prev)
+            return prev;
+
+        if (enable)
+        {
+            rebuildHitCounters();
+        }
+        else
+        {
+            hitCounters.reset();
+            numHitCounters = 0;
+            for(Lang &l : langs)
+                for(Category &c : l.cats)
+                    c.numHits = 0;
+        }
+
+        return prev;
+    }
+
+    bool getProfilingMode() const { return hitCounters!=0; }
+
+    void resetHitCounts() const
+    {
+        for(std::size_t i=0; i!=numHitCounters; ++i)
+            hitCounters[i].store(0, std::memory_order_relaxed);
+    }
+
+    std::uint64_t getHitCount(std::string_view langId, std::string_view catId, std::string_view msgId) const
+    {
+        const Category *pCat = findCat(langId, catId);
+        if (!pCat || !hitCounters)
+            return 0;
+
+        const std::size_t idx = findMsg(*pCat, msgId, (std::uint32_t)hashStr(msgId));
+        return idx==npos || idx>=pCat->numHits ? 0 : hitCounters[pCat->hitBase+idx].load(std::memory_order_relaxed);
+    }
+
+    //! handler(langId, catId, msgId, hits) для сообщений, в которые были попадания
+    template<typename THandler>
+    void enumerateHits(THandler handler) const
+    {
+        if (!hitCounters)
+            return;
+
+        for(const Lang &l : langs)
+        {
+            for(const Category &c : l.cats)
+            {
+                for(std::size_t i=0; i!=c.numHits; ++i)
+                {
+                    const std::uint64_t hits = hitCounters[c.hitBase+i].load(std::memory_order_relaxed);
+                    if (hits)
+                        handler(pool.get(l.name), pool.get(c.name), pool.get(c.msgs[i].msgId), hits);
+                }
+            }
+        }
+    }
+
+    std::size_t getHotMsgCount() const { return numHotMsgs; }
+
+    //! Новый каталог с тем же содержимым, maxHotMsgs самых частых по счётчикам сообщений - в горячей таблице
+    /*! Без режима профилирования счётчиков нет, получается копия без горячей таблицы.
+        У результата режим профилирования выключен. pResource==0 - ресурс этого каталога.
+     */
+    PackedTranslations makeHotLayout(std::size_t maxHotMsgs, std::pmr::memory_resource *pResource = 0) const
+    {
+        struct HotRef
+        {
+            std::uint64_t   hits   ;
+            std::uint32_t   langIdx;
+            std::uint32_t   catIdx ;
+            std::uint32_t   msgIdx ;
+        };
+
+        std::vector<HotRef> hot;
+        std::vector<char>   isHot(numHitCounters, 0);
+
+        // Ключ горячей таблицы хранит индексы языка и категории в 16 битах
+        for(std::size_t li=0; hitCounters && li!=langs.size() && li<0xFFFFu; ++li)
+        {
+            const Lang &l = langs[li];
+            for(std::size_t ci=0; ci!=l.cats.size() && ci<0xFFFFu; ++ci)
+            {
+                const Category &c = l.cats[ci];
+                for(std::size_t i=0; i!=c.numHits; ++i)
+                {
+                    const std::uint64_t hits = hitCounters[c.hitBase+i].load(std::memory_order_relaxed);
+                    if (hits)
+                        hot.push_back(HotRef{hits, (std::uint32_t)li, (std::uint32_t)ci, (std::uint32_t)i});
+                }
+            }
+        }
+
+        std::stable_sort(hot.begin(), hot.end(), [](const HotRef &a, const HotRef &b) { return a.hits>b.hits; });
+        if (hot.size()>maxHotMsgs)
+            hot.resize(maxHotMsgs);
+
+        PackedTranslations res(pResource ? pResource : getMemoryResource());
+        res.pool.reserve(pool.size());
+        res.numMsgs = numMsgs;
+
+        // Имена языков и категорий - в начале пула, они читаются при каждом поиске
+        res.langs.reserve(langs.size());
+        for(const Lang &l : langs)
+        {
+            Lang &rl = res.langs.emplace_back(res.getMemoryResource());
+            rl.name     = res.pool.intern(pool.get(l.name));
+            rl.nameHash = l.nameHash;
+            rl.cats.reserve(l.cats.size());
+            for(const Category &c : l.cats)
+            {
+                Category &rc = rl.cats.emplace_back(res.getMemoryResource());
+                rc.name     = res.pool.intern(pool.get(c.name));
+                rc.nameHash = c.nameHash;
+                rc.msgs.reserve(c.msgs.size());
+            }
+        }
+
+        // Горячие сообщения - подряд в пуле, от самого частого, и первыми записями в своих категориях
+        if (!hot.empty())
+        {
+            std::size_t numSlots = 8;
+            while(numSlots < hot.size()*2)
+                numSlots *= 2;
+            res.hotSlots.assign(numSlots, HotEntry{0, 0, 0, 0});
+        }
+
+        for(const HotRef &r : hot)
+        {
+            const Category &c  = langs[r.langIdx].cats[r.catIdx];
+            const MsgEntry &m  = c.msgs[r.msgIdx];
+            const MsgEntry  rm = res.makeEntry(pool.get(m.msgId), pool.get(m.text));
+            res.langs[r.langIdx].cats[r.catIdx].msgs.push_back(rm);
+            isHot[c.hitBase+r.msgIdx] = 1;
+
+            const std::uint32_t h    = hotHash(langs[r.langIdx].nameHash, c.nameHash, hashStr(pool.get(m.msgId)));
+            const std::size_t   mask = res.hotSlots.size()-1;
+            std::size_t pos = h & mask;
+            while(res.hotSlots[pos].langCat)
+                pos = (pos+1) & mask;
+            res.hotSlots[pos] = HotEntry{h, ((r.langIdx<<16) | r.catIdx)+1, rm.msgId, rm.text};
+        }
+        res.numHotMsgs = hot.size();
+
+        // Остальные - в прежнем порядке
+        for(std::size_t li=0; li!=langs.size(); ++li)
+        {
+            for(std::size_t ci=0; ci!=langs[li].cats.size(); ++ci)
+            {
+                const Category &c  = langs[li].cats[ci];
+                Category       &rc = res.langs[li].cats[ci];
+                for(std::size_t i=0; i!=c.msgs.size(); ++i)
+                {
+                    if (i<c.numHits && isHot[c.hitBase+i])
+                        continue;
+                    rc.msgs.push_back(res.makeEntry(pool.get(c.msgs[i].msgId), pool.get(c.msgs[i].text)));
+                }
+                res.rehash(rc, rc.msgs.size());
+            }
+        }
+
+        res.pool.dropInternIndex();
+        res.pool.shrinkToFit();
+        return res;
+    }
+
+    //------------------------------
+    //! handler(msgId, text) для всех сообщений категории, в порядке добавления
+    template<typename THandler>
+    void enumerateMsgs(std::string_view langId, std::string_view catId, THandler handler) const
+    {
+        const Category *pCat = findCat(langId, catId);
+        if (!pCat)
+            return;
+
+        for(const MsgEntry &m : pCat->msgs)
+            handler(pool.get(m.msgId), pool.get(m.text));
+    }
+
+    //! handler(catId, msgId, text) для всех сообщений языка
+    template<typename THandler>
+    void enumerateLang(std::string_view langId, THandler handler) const
+    {
+        const std::size_t langIdx = findLang(langId);
+        if (langIdx==npos)
+            return;
+
+        for(const Category &c : langs[langIdx].cats)
+        {
+            const std::string_view catId = pool.get(c.name);
+            for(const MsgEntry &m : c.msgs)
+                handler(catId, pool.get(m.msgId), pool.get(m.text));
+        }
+    }
+
+    //! handler(langId, catId, msgId, text) для всех сообщений каталога
+    template<typename THandler>
+    void enumerateAll(THandler handler) const
+    {
+        for(const Lang &l : langs)
+        {
+            const std::string_view langId = pool.get(l.name);
+            for(const Category &c : l.cats)
+            {
+                const std::string_view catId = pool.get(c.name);
+                for(const MsgEntry &m : c.msgs)
+                    handler(langId, catId, pool.get(m.msgId), pool.get(m.text));
+            }
+        }
+    }
+
+}; // class PackedTranslations
+
+//----------------------------------------------------------------------------
+
+} // namespace marty_tr
+
+// marty_tr::
+
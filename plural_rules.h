@@ -0,0 +1,338 @@
+#pragma once
+/*!
+    \file
+    \brief Правила выбора множественной формы (plural rules, по мотивам CLDR) для целых чисел
+ */
+
+#include "locales.h"
+
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+
+
+//----------------------------------------------------------------------------
+// marty_tr::
+namespace marty_tr {
+
+
+
+//----------------------------------------------------------------------------
+enum class EPluralCategory : unsigned
+{
+    zero ,
+    one  ,
+    two  ,
+    few  ,
+    many ,
+    other
+};
+
+//------------------------------
+inline
+const char* to_string(EPluralCategory c)
+{
+    switch(c)
+    {
+        case EPluralCategory::zero : return "zero" ;
+        case EPluralCategory::one  : return "one"  ;
+        case EPluralCategory::two  : return "two"  ;
+        case EPluralCategory::few  : return "few"  ;
+        case EPluralCategory::many : return "many" ;
+        case EPluralCategory::other: [[fallthrough]];
+        default                    : return "other";
+    }
+}
+
+//----------------------------------------------------------------------------
+//! Правило выбора формы - несколько целочисленных операций, без разбора строк
+typedef EPluralCategory (*PluralRuleFn)(std::uint64_t n);
+
+//----------------------------------------------------------------------------
+
+
+
+
+//----------------------------------------------------------------------------
+// Правила для целых n (v=0 в терминах CLDR), дробные формы не поддерживаются
+namespace plural_rules {
+
+//! ja, zh, ko, vi, th, id ... - только other
+inline EPluralCategory otherOnly(std::uint64_t n)
+{
+    MARTY_ARG_USED(n);
+    return EPluralCategory::other;
+}
+
+//! en, de, nl, sv, it, es ... - one: n=1
+inline EPluralCategory oneOther(std::uint64_t n)
+{
+    return n==1 ? EPluralCategory::one : EPluralCategory::other;
+}
+
+//! fr, pt, hi, fa, hy ... - one: n=0,1
+inline EPluralCategory zeroOneOther(std::uint64_t n)
+{
+    return n<=1 ? EPluralCategory::one : EPluralCategory::other;
+}
+
+//! mk, is - one: n%10=1 and n%100!=11
+inline EPluralCategory oneMod10Other(std::uint64_t n)
+{
+    return (n%10==1 && n%100!=11) ? EPluralCategory::one : EPluralCategory::other;
+}
+
+//! ru, uk, be - one/few/many
+inline EPluralCategory eastSlavic(std::uint64_t n)
+{
+    const std::uint64_t n10 = n%10, n100 = n%100;
+    if (n10==1 && n100!=11)                         return EPluralCategory::one;
+    if (n10>=2 && n10<=4 && (n100<12 || n100>14))   return EPluralCategory::few;
+    return EPluralCategory::many;
+}
+
+//! hr, sr, bs - one/few/other
+inline EPluralCategory serboCroatian(std::uint64_t n)
+{
+    const std::uint64_t n10 = n%10, n100 = n%100;
+    if (n10==1 && n100!=11)                         return EPluralCategory::one;
+    if (n10>=2 && n10<=4 && (n100<12 || n100>14))   return EPluralCategory::few;
+    return EPluralCategory::other;
+}
+
+//! pl - one/few/many
+inline EPluralCategory polish(std::uint64_t n)
+{
+    const std::uint64_t n10 = n%10, n100 = n%100;
+    if (n==1)                                       return EPluralCategory::one;
+    if (n10>=2 && n10<=4 && (n100<12 || n100>14))   return EPluralCategory::few;
+    return EPluralCategory::many;
+}
+
+//! cs, sk - one/few/other
+inline EPluralCategory czech(std::uint64_t n)
+{
+    if (n==1)                                       return EPluralCategory::one;
+    if (n>=2 && n<=4)                               return EPluralCategory::few;
+    return EPluralCategory::other;
+}
+
+//! lt - one/few/other
+inline EPluralCategory lithuanian(std::uint64_t n)
+{
+    const std::uint64_t n10 = n%10, n100 = n%100;
+    if (n100>=11 && n100<=19)                       return EPluralCategory::other;
+    if (n10==1)                                     return EPluralCategory::one;
+    if (n10>=2)                                     return EPluralCategory::few;
+    return EPluralCategory::other;
+}
+
+//! lv - zero/one/other
+inline EPluralCategory latvian(std::uint64_t n)
+{
+    const std::uint64_t n10 = n%10, n100 = n%100;
+    if (n10==0 || (n100>=11 && n100<=19))           return EPluralCategory::zero;
+    if (n10==1 && n100!=11)                         return EPluralCategory::one;
+    return EPluralCategory::other;
+}
+
+//! ro - one/few/other
+inline EPluralCategory romanian(std::uint64_t n)
+{
+    const std::uint64_t n100 = n%100;
+    if (n==1)                                       return EPluralCategory::one;
+    if (n==0 || (n100>=2 && n100<=19))              return EPluralCategory::few;
+    return EPluralCategory::other;
+}
+
+//! sl - one/two/few/other
+inline EPluralCategory slovenian(std::uint64_t n)
+{
+    const std::uint64_t n100 = n%100;
+    if (n100==1)                                    return EPluralCategory::one;
+    if (n100==2)                                    return EPluralCategory::two;
+    if (n100==3 || n100==4)                         return EPluralCategory::few;
+    return EPluralCategory::other;
+}
+
+//! he - one/two/other
+inline EPluralCategory hebrew(std::uint64_t n)
+{
+    if (n==1)                                       return EPluralCategory::one;
+    if (n==2)                                       return EPluralCategory::two;
+    return EPluralCategory::other;
+}
+
+//! ar - zero/one/two/few/many/other
+inline EPluralCategory arabic(std::uint64_t n)
+{
+    const std::uint64_t n100 = n%100;
+    if (n==0)                                       return EPluralCategory::zero;
+    if (n==1)                                       return EPluralCategory::one;
+    if (n==2)                                       return EPluralCategory::two;
+    if (n100>=3 && n100<=10)                        return EPluralCategory::few;
+    if (n100>=11)                                   return EPluralCategory::many;
+    return EPluralCategory::other;
+}
+
+//! ga - one/two/few/many/other
+inline EPluralCategory irish(std::uint64_t n)
+{
+    if (n==1)                                       return EPluralCategory::one;
+    if (n==2)                                       return EPluralCategory::two;
+    if (n>=3 && n<=6)                               return EPluralCategory::few;
+    if (n>=7 && n<=10)                              return EPluralCategory::many;
+    return EPluralCategory::other;
+}
+
+//! cy - zero/one/two/few/many/other
+inline EPluralCategory welsh(std::uint64_t n)
+{
+    switch(n)
+    {
+        case 0 : return EPluralCategory::zero;
+        case 1 : return EPluralCategory::one ;
+        case 2 : return EPluralCategory::two ;
+        case 3 : return EPluralCategory::few ;
+        case 6 : return EPluralCategory::many;
+        default: return EPluralCategory::other;
+    }
+}
+
+//! mt - one/two/few/many/other
+inline EPluralCategory maltese(std::uint64_t n)
+{
+    const std::uint64_t n100 = n%100;
+    if (n==1)                                       return EPluralCategory::one;
+    if (n==2)                                       return EPluralCategory::two;
+    if (n==0 || (n100>=3 && n100<=10))              return EPluralCategory::few;
+    if (n100>=11 && n100<=19)                       return EPluralCategory::many;
+    return EPluralCategory::other;
+}
+
+} // namespace plural_rules
+
+//----------------------------------------------------------------------------
+
+
+
+
+//----------------------------------------------------------------------------
+namespace impl_helpers {
+
+//! Правило по нейтральному тэгу языка ("ru", "en" ...)
+inline
+PluralRuleFn getPluralRuleByNeutralTag(const std::string &nlang)
+{
+    static const std::unordered_map<std::string, PluralRuleFn> m =
+    {
+        { "ja", plural_rules::otherOnly     }, { "zh", plural_rules::otherOnly     }, { "ko", plural_rules::otherOnly     },
+        { "vi", plural_rules::otherOnly     }, { "th", plural_rules::otherOnly     }, { "id", plural_rules::otherOnly     },
+        { "ms", plural_rules::otherOnly     }, { "lo", plural_rules::otherOnly     }, { "my", plural_rules::otherOnly     },
+        { "km", plural_rules::otherOnly     }, { "bo", plural_rules::otherOnly     }, { "yo", plural_rules::otherOnly     },
+        { "ii", plural_rules::otherOnly     }, { "jv", plural_rules::otherOnly     }, { "wo", plural_rules::otherOnly     },
+
+        { "fr", plural_rules::zeroOneOther  }, { "pt", plural_rules::zeroOneOther  }, { "hy", plural_rules::zeroOneOther  },
+        { "hi", plural_rules::zeroOneOther  }, { "bn", plural_rules::zeroOneOther  }, { "fa", plural_rules::zeroOneOther  },
+        { "gu", plural_rules::zeroOneOther  }, { "kn", plural_rules::zeroOneOther  }, { "zu", plural_rules::zeroOneOther  },
+        { "am", plural_rules::zeroOneOther  }, { "ff", plural_rules::zeroOneOther  }, { "kab", plural_rules::zeroOneOther },
+
+        { "mk", plural_rules::oneMod10Other }, { "is", plural_rules::oneMod10Other },
+
+        { "ru", plural_rules::eastSlavic    }, { "uk", plural_rules::eastSlavic    }, { "be", plural_rules::eastSlavic    },
+        { "hr", plural_rules::serboCroatian }, { "sr", plural_rules::serboCroatian }, { "bs", plural_rules::serboCroatian },
+        { "pl", plural_rules::polish        },
+        { "cs", plural_rules::czech         }, { "sk", plural_rules::czech         },
+        { "lt", plural_rules::lithuanian    },
+        { "lv", plural_rules::latvian       },
+        { "ro", plural_rules::romanian      },
+        { "sl", plural_rules::slovenian     },
+        { "he", plural_rules::hebrew        },
+        { "ar", plural_rules::arabic        },
+        { "ga", plural_rules::irish         },
+        { "cy", plural_rules::welsh         },
+        { "mt", plural_rules::maltese       }
+    };
+
+    std::unordered_map<std::string, PluralRuleFn>::const_iterator it = m.find(nlang);
+    if (it==m.end())
+        return plural_rules::oneOther; // Самое распространённое правило
+
+    return it->second;
+}
+
+//----------------------------------------------------------------------------
+//! Правила, заранее разложенные по всем вариантам записи языка (en-US, 0409, 409, 0x409, 0x0409)
+/*! Строится один раз, дальше выбор правила - один поиск по уже нормализованному langId
+ */
+inline
+const std::unordered_map<std::string, PluralRuleFn>& getPluralRulesMap()
+{
+    static const std::unordered_map<std::string, PluralRuleFn> m = []()
+    {
+        std::unordered_map<std::string, PluralRuleFn> rules;
+
+        std::size_t localesTotal = 0;
+        const LocaleInfo* pLocales = getLocalesInfo( &localesTotal );
+
+        for(std::size_t i=0; i!=localesTotal; ++i)
+        {
+            if (!pLocales[i].ltag)
+                continue;
+
+            std::string  ltag = pLocales[i].ltag;
+            PluralRuleFn rule = getPluralRuleByNeutralTag(getLanguageTagNeutral(ltag));
+
+            rules[ltag] = rule;
+
+            if (pLocales[i].langId==0x1000)
+                continue; // Not assigned
+
+            rules[formatLangId(pLocales[i].langId, false, true )] = rule;
+            rules[formatLangId(pLocales[i].langId, false, false)] = rule;
+            rules[formatLangId(pLocales[i].langId, true , true )] = rule;
+            rules[formatLangId(pLocales[i].langId, true , false)] = rule;
+        }
+
+        return rules;
+    }();
+
+    return m;
+}
+
+} // namespace impl_helpers
+
+//----------------------------------------------------------------------------
+
+
+
+
+//----------------------------------------------------------------------------
+//! Возвращает правило выбора множественной формы для языка (тэг или Language ID в любом формате)
+inline
+PluralRuleFn getPluralRule(const std::string &langTagOrId)
+{
+    const auto &m = impl_helpers::getPluralRulesMap();
+    std::unordered_map<std::string, PluralRuleFn>::const_iterator it = m.find(langTagOrId);
+    if (it!=m.end())
+        return it->second;
+
+    // Медленный путь - для записей, не совпадающих с таблицей локалей буквально (ru_RU и т.п.)
+    const LocaleInfo* pli = getLocaleInfo(langTagOrId, true /* neutralAllowed */);
+    if (pli && pli->ltag)
+        return impl_helpers::getPluralRuleByNeutralTag(getLanguageTagNeutral(pli->ltag));
+
+    return impl_helpers::getPluralRuleByNeutralTag(getLanguageTagNeutral(langTagOrId));
+}
+
+//------------------------------
+inline
+EPluralCategory getPluralCategory(const std::string &langTagOrId, std::int64_t n)
+{
+    return getPluralRule(langTagOrId)(n<0 ? (std::uint64_t)0-(std::uint64_t)n : (std::uint64_t)n);
+}
+
+//----------------------------------------------------------------------------
+
+} // namespace marty_tr
+
@@ -0,0 +1,205 @@
+#pragma once
+/*!
+    \file
+    \brief Векторный поиск символов в строке (SSE2/AVX2, скалярный вариант - если SIMD недоступен)
+
+    Используется при подстановке макросов для поиска '$', скобок и разделителей. Литеральный
+    текст между найденными символами копируется целиком, а не по одному символу.
+
+    MARTY_TR_NO_SIMD - отключить векторный код.
+ */
+
+#include <cstddef>
+#include <cstdint>
+
+
+//----------------------------------------------------------------------------
+#if !defined(MARTY_TR_NO_SIMD)
+
+    #if defined(__AVX2__)
+        #define MARTY_TR_SIMD_AVX2
+    #endif
+
+    #if defined(__SSE2__) || defined(_M_X64) || defined(_M_AMD64) || (defined(_M_IX86_FP) && _M_IX86_FP>=2)
+        #define MARTY_TR_SIMD_SSE2
+    #endif
+
+#endif
+
+#if defined(MARTY_TR_SIMD_AVX2)
+    #include <immintrin.h>
+#elif defined(MARTY_TR_SIMD_SSE2)
+    #include <emmintrin.h>
+#endif
+
+#if (defined(MARTY_TR_SIMD_AVX2) || defined(MARTY_TR_SIMD_SSE2)) && defined(_MSC_VER)
+    #include <intrin.h>
+#endif
+
+
+
+//----------------------------------------------------------------------------
+// marty_tr::simd::
+namespace marty_tr {
+namespace simd {
+
+
+
+//----------------------------------------------------------------------------
+namespace impl_helpers {
+
+#if defined(MARTY_TR_SIMD_AVX2) || defined(MARTY_TR_SIMD_SSE2)
+
+inline
+unsigned countTrailingZeros(std::uint32_t m)
+{
+    #if defined(_MSC_VER)
+        unsigned long idx = 0;
+        _BitScanForward(&idx, (unsigned long)m);
+        return (unsigned)idx;
+    #else
+        return (unsigned)__builtin_ctz(m);
+    #endif
+}
+
+#endif
+
+//------------------------------
+#if defined(MARTY_TR_SIMD_SSE2)
+
+template<std::size_t CharSize> inline
+__m128i set1Sse2(std::uint32_t ch)
+{
+    if constexpr (CharSize==1) return _mm_set1_epi8 ((char)ch);
+    else if constexpr (CharSize==2) return _mm_set1_epi16((short)ch);
+    else return _mm_set1_epi32((int)ch);
+}
+
+template<std::size_t CharSize> inline
+__m128i cmpEqSse2(__m128i a, __m128i b)
+{
+    if constexpr (CharSize==1) return _mm_cmpeq_epi8 (a, b);
+    else if constexpr (CharSize==2) return _mm_cmpeq_epi16(a, b);
+    else return _mm_cmpeq_epi32(a, b);
+}
+
+#endif
+
+//------------------------------
+#if defined(MARTY_TR_SIMD_AVX2)
+
+template<std::size_t CharSize> inline
+__m256i set1Avx2(std::uint32_t ch)
+{
+    if constexpr (CharSize==1) return _mm256_set1_epi8 ((char)ch);
+    else if constexpr (CharSize==2) return _mm256_set1_epi16((short)ch);
+    else return _mm256_set1_epi32((int)ch);
+}
+
+template<std::size_t CharSize> inline
+__m256i cmpEqAvx2(__m256i a, __m256i b)
+{
+    if constexpr (CharSize==1) return _mm256_cmpeq_epi8 (a, b);
+    else if constexpr (CharSize==2) return _mm256_cmpeq_epi16(a, b);
+    else return _mm256_cmpeq_epi32(a, b);
+}
+
+#endif
+
+//------------------------------
+template<typename CharType> constexpr
+bool isVectorizableChar()
+{
+    return sizeof(CharType)==1 || sizeof(CharType)==2 || sizeof(CharType)==4;
+}
+
+//------------------------------
+//! Код символа в виде беззнакового целого того же размера, что и CharType
+template<typename CharType> inline
+std::uint32_t charBits(CharType ch)
+{
+    if constexpr (sizeof(CharType)==1) return (std::uint32_t)(std::uint8_t )ch;
+    else if constexpr (sizeof(CharType)==2) return (std::uint32_t)(std::uint16_t)ch;
+    else return (std::uint32_t)ch;
+}
+
+} // namespace impl_helpers
+
+//----------------------------------------------------------------------------
+
+
+
+
+//----------------------------------------------------------------------------
+//! Индекс первого из символов chars... в [p, p+size), или size, если не найдено
+template<typename CharType, typename... Chars> inline
+std::size_t findFirstOf(const CharType *p, std::size_t size, Chars... chars)
+{
+    static_assert(sizeof...(Chars)>0, "findFirstOf: at least one char required");
+
+    std::size_t pos = 0;
+
+    if constexpr (impl_helpers::isVectorizableChar<CharType>())
+    {
+        constexpr std::size_t charSize = sizeof(CharType);
+
+        #if defined(MARTY_TR_SIMD_AVX2)
+
+            constexpr std::size_t avx2Step = 32/charSize;
+            if (size>=avx2Step)
+            {
+                const __m256i needles[] = { impl_helpers::set1Avx2<charSize>(impl_helpers::charBits((CharType)chars))... };
+                for(; pos+avx2Step<=size; pos+=avx2Step)
+                {
+                    const __m256i v = _mm256_loadu_si256((const __m256i*)(p+pos));
+                    __m256i eq = _mm256_setzero_si256();
+                    for(const auto &n : needles)
+                        eq = _mm256_or_si256(eq, impl_helpers::cmpEqAvx2<charSize>(v, n));
+
+                    const std::uint32_t mask = (std::uint32_t)_mm256_movemask_epi8(eq);
+                    if (mask)
+                        return pos + impl_helpers::countTrailingZeros(mask)/charSize;
+                }
+            }
+
+        #endif
+
+        #if defined(MARTY_TR_SIMD_SSE2)
+
+            constexpr std::size_t sse2Step = 16/charSize;
+            if (size-pos>=sse2Step)
+            {
+                const __m128i needles[] = { impl_helpers::set1Sse2<charSize>(impl_helpers::charBits((CharType)chars))... };
+                for(; pos+sse2Step<=size; pos+=sse2Step)
+                {
+                    const __m128i v = _mm_loadu_si128((const __m128i*)(p+pos));
+                    __m128i eq = _mm_setzero_si128();
+                    for(const auto &n : needles)
+                        eq = _mm_or_si128(eq, impl_helpers::cmpEqSse2<charSize>(v, n));
+
+                    const std::uint32_t mask = (std::uint32_t)_mm_movemask_epi8(eq);
+                    if (mask)
+                        return pos + impl_helpers::countTrailingZeros(mask)/charSize;
+                }
+            }
+
+        #endif
+    }
+
+    for(; pos!=size; ++pos)
+    {
+        const CharType ch = p[pos];
+        if (((ch==(CharType)chars) || ...))
+            return pos;
+    }
+
+    return size;
+}
+
+//----------------------------------------------------------------------------
+
+} // namespace simd
+} // namespace marty_tr
+
+// marty_tr::simd::
+
@@ -0,0 +1,387 @@
+#pragma once
+/*!
+    \file
+    \brief Форматирование сообщений по шаблону-литералу с проверкой плейсхолдеров во время компиляции (C++20)
+
+    \code
+    auto s1 = marty_tr::formatMessage<"Copying $(1) of $(2)">(cur, total);
+    auto s2 = marty_tr::formatMessage<"Hello, $(user)!">(marty_tr::namedArg<"user">(userName));
+    \endcode
+
+    Шаблон разбирается на этапе компиляции. Ссылка на несуществующий аргумент, неиспользованный
+    аргумент или незакрытый плейсхолдер - ошибка компиляции. Синтаксис как у FormatMessage без
+    параметризованных и условных макросов: $(N), $(name), $$ - символ '$'.
+ */
+
+#include <array>
+#include <cstddef>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <utility>
+
+
+#if (defined(_MSVC_LANG) && _MSVC_LANG>=202002L) || (!defined(_MSVC_LANG) && __cplusplus>=202002L)
+
+    #define MARTY_TR_STATIC_FORMAT_MESSAGE_SUPPORTED
+
+#endif
+
+
+#if defined(MARTY_TR_STATIC_FORMAT_MESSAGE_SUPPORTED)
+
+
+//----------------------------------------------------------------------------
+// marty_tr::
+namespace marty_tr {
+
+
+
+//----------------------------------------------------------------------------
+namespace static_format {
+
+
+
+//----------------------------------------------------------------------------
+//! Строковый литерал как параметр шаблона
+template<typename CharT, std::size_t N>
+struct FixedString
+{
+    typedef CharT char_type;
+
+    CharT data[N] = {};
+
+    constexpr FixedString(const CharT (&str)[N])
+    {
+        for(std::size_t i=0; i!=N; ++i)
+            data[i] = str[i];
+    }
+
+    static constexpr std::size_t size() { return N-1; }
+
+    constexpr std::basic_string_view<CharT> view() const { return std::basic_string_view<CharT>(&data[0], N-1); }
+
+}; // struct FixedString
+
+template<typename CharT, std::size_t N>
+FixedString(const CharT (&)[N]) -> FixedString<CharT, N>;
+
+//----------------------------------------------------------------------------
+//! Именованный аргумент, имя берётся из плейсхолдера $(name)
+template<FixedString Name, typename T>
+struct NamedArg
+{
+    const T &value;
+};
+
+//----------------------------------------------------------------------------
+
+
+
+
+//----------------------------------------------------------------------------
+// Эти функции не constexpr - их вызов при разборе шаблона прерывает компиляцию, а имя попадает в диагностику
+inline void error_unterminated_placeholder() {}
+inline void error_empty_placeholder() {}
+inline void error_parametrized_or_conditional_placeholder_not_supported() {}
+inline void error_positional_placeholder_index_out_of_range() {}
+inline void error_unknown_placeholder_name() {}
+inline void error_argument_not_used_in_template() {}
+inline void error_duplicate_argument_name() {}
+
+//----------------------------------------------------------------------------
+struct Segment
+{
+    std::size_t   pos    = 0; //!< Начало литерала в шаблоне
+    std::size_t   len    = 0; //!< Длина литерала
+    std::size_t   argIdx = 0; //!< Индекс аргумента (с нуля)
+    bool          isArg  = false;
+};
+
+//------------------------------
+template<std::size_t MaxSegments>
+struct ParsedTemplate
+{
+    std::array<Segment, MaxSegments>  segments   = {};
+    std::size_t                       numSegments = 0;
+    std::size_t                       literalLen  = 0;
+};
+
+//----------------------------------------------------------------------------
+template<typename T>
+struct ArgName
+{
+    static constexpr std::string_view name = std::string_view();
+};
+
+template<FixedString Name, typename T>
+struct ArgName< NamedArg<Name, T> >
+{
+    static constexpr auto narrowName = []()
+    {
+        std::array<char, Name.size()+1> buf = {};
+        for(std::size_t i=0; i!=Name.size(); ++i)
+            buf[i] = (char)Name.data[i];
+        return buf;
+    }();
+
+    static constexpr std::string_view name = std::string_view(narrowName.data(), Name.size());
+};
+
+//----------------------------------------------------------------------------
+template<typename CharT> constexpr
+bool equalName(std::basic_string_view<CharT> tplName, std::string_view argName)
+{
+    if (tplName.size()!=argName.size())
+        return false;
+
+    for(std::size_t i=0; i!=argName.size(); ++i)
+    {
+        if (tplName[i]!=(CharT)argName[i])
+            return false;
+    }
+
+    return true;
+}
+
+//----------------------------------------------------------------------------
+//! Разбор шаблона, поведение совпадает с substMacros для smf_KeepUnknownVars|smf_DisableRecursion
+template<FixedString Tpl, std::size_t NumArgs>
+consteval auto parseTemplate(const std::array<std::string_view, NumArgs> &argNames)
+{
+    typedef typename decltype(Tpl)::char_type CharT;
+
+    constexpr std::size_t maxSegments = Tpl.size()+1;
+
+    ParsedTemplate<maxSegments> res;
+    std::array<bool, NumArgs+1> argUsed = {}; // +1 - чтобы не было массива нулевого размера
+
+    for(std::size_t i=0; i!=NumArgs; ++i)
+    {
+        if (argNames[i].empty())
+            continue;
+        for(std::size_t j=i+1; j!=NumArgs; ++j)
+        {
+            if (argNames[i]==argNames[j])
+                error_duplicate_argument_name();
+        }
+    }
+
+    auto addLiteral = [&](std::size_t pos, std::size_t len)
+    {
+        if (!len)
+            return;
+
+        // Склеиваем соседние литералы
+        if (res.numSegments && !res.segments[res.numSegments-1].isArg && res.segments[res.numSegments-1].pos+res.segments[res.numSegments-1].len==pos)
+        {
+            res.segments[res.numSegments-1].len += len;
+        }
+        else
+        {
+            res.segments[res.numSegments++] = Segment{pos, len, 0, false};
+        }
+
+        res.literalLen += len;
+    };
+
+    const std::basic_string_view<CharT> tpl = Tpl.view();
+    std::size_t pos = 0;
+
+    while(pos<tpl.size())
+    {
+        std::size_t dollarPos = tpl.find((CharT)'$', pos);
+        if (dollarPos==tpl.npos)
+        {
+            addLiteral(pos, tpl.size()-pos);
+            break;
+        }
+
+        addLiteral(pos, dollarPos-pos);
+        pos = dollarPos+1;
+
+        if (pos>=tpl.size())
+            break; // Одиночный '$' в конце
+
+        if (tpl[pos]==(CharT)'$')
+        {
+            addLiteral(pos, 1);
+            ++pos;
+            continue;
+        }
+
+        if (tpl[pos]!=(CharT)'(')
+        {
+            addLiteral(dollarPos, 2);
+            ++pos;
+            continue;
+        }
+
+        std::size_t nameStart = pos+1;
+        std::size_t nameEnd   = tpl.find((CharT)')', nameStart);
+        if (nameEnd==tpl.npos)
+            error_unterminated_placeholder();
+
+        std::basic_string_view<CharT> name = tpl.substr(nameStart, nameEnd-nameStart);
+        if (name.empty())
+            error_empty_placeholder();
+
+        for(auto ch : name)
+        {
+            if (ch==(CharT)'(' || ch==(CharT)':' || ch==(CharT)'?')
+                error_parametrized_or_conditional_placeholder_not_supported();
+        }
+
+        std::size_t argIdx = NumArgs;
+
+        bool isIndex = name[0]!=(CharT)'0';
+        std::size_t idx = 0;
+        for(auto ch : name)
+        {
+            if (ch<(CharT)'0' || ch>(CharT)'9')
+            {
+                isIndex = false;
+                break;
+            }
+            idx = idx*10 + (std::size_t)(ch-(CharT)'0');
+        }
+
+        if (isIndex)
+        {
+            if (idx<1 || idx>NumArgs)
+                error_positional_placeholder_index_out_of_range();
+            argIdx = idx-1;
+        }
+        else
+        {
+            for(std::size_t i=0; i!=NumArgs; ++i)
+            {
+                if (equalName(name, argNames[i]))
+                {
+                    argIdx = i;
+                    break;
+                }
+            }
+
+            if (argIdx==NumArgs)
+                error_unknown_placeholder_name();
+        }
+
+        argUsed[argIdx] = true;
+        res.segments[res.numSegments++] = Segment{0, 0, argIdx, true};
+        pos = nameEnd+1;
+    }
+
+    for(std::size_t i=0; i!=NumArgs; ++i)
+    {
+        if (!argUsed[i])
+            error_argument_not_used_in_template();
+    }
+
+    return res;
+}
+
+//----------------------------------------------------------------------------
+template<FixedString Tpl, typename... Args>
+struct CompiledTemplate
+{
+    static constexpr std::array<std::string_view, sizeof...(Args)> argNames = { ArgName<Args>::name... };
+    static constexpr auto parsed = parseTemplate<Tpl, sizeof...(Args)>(argNames);
+};
+
+//----------------------------------------------------------------------------
+
+
+
+
+//----------------------------------------------------------------------------
+//! Форматирование значения по умолчанию - как у FormatMessage::args()
+template<typename StringType, typename T> inline
+StringType toArgString(const T &val)
+{
+    typedef typename StringType::value_type CharType;
+
+    if constexpr (std::is_integral_v<T>)
+    {
+        const std::string str = std::to_string(val); // только ASCII цифры и знак
+        return StringType(str.begin(), str.end());
+    }
+    else if constexpr (std::is_floating_point_v<T>)
+    {
+        std::basic_ostringstream<CharType> oss;
+        oss.precision(2);
+        oss << val;
+        return oss.str();
+    }
+    else
+    {
+        return StringType(val);
+    }
+}
+
+template<typename StringType, FixedString Name, typename T> inline
+StringType toArgString(const NamedArg<Name, T> &val)
+{
+    return toArgString<StringType>(val.value);
+}
+
+} // namespace static_format
+
+//----------------------------------------------------------------------------
+
+
+
+
+//----------------------------------------------------------------------------
+template<static_format::FixedString Name, typename T> inline
+static_format::NamedArg<Name, T> namedArg(const T &val)
+{
+    return static_format::NamedArg<Name, T>{val};
+}
+
+//----------------------------------------------------------------------------
+//! Форматирование по литеральному шаблону, разобранному и проверенному при компиляции
+template<static_format::FixedString Tpl, typename... Args> inline
+std::basic_string<typename decltype(Tpl)::char_type> formatMessage(const Args&... args)
+{
+    typedef typename decltype(Tpl)::char_type    CharType;
+    typedef std::basic_string<CharType>          StringType;
+    typedef static_format::CompiledTemplate<Tpl, Args...> Compiled;
+
+    const std::array<StringType, sizeof...(Args)> argStrings = { static_format::toArgString<StringType>(args)... };
+
+    std::size_t resLen = Compiled::parsed.literalLen;
+    for(std::size_t i=0; i!=Compiled::parsed.numSegments; ++i)
+    {
+        if (Compiled::parsed.segments[i].isArg)
+            resLen += argStrings[Compiled::parsed.segments[i].argIdx].size();
+    }
+
+    StringType res;
+    res.reserve(resLen);
+
+    [&]<std::size_t... SegIdx>(std::index_sequence<SegIdx...>)
+    {
+        ( [&]()
+          {
+              constexpr static_format::Segment seg = Compiled::parsed.segments[SegIdx];
+              if constexpr (seg.isArg)
+                  res.append(argStrings[seg.argIdx]);
+              else
+                  res.append(&Tpl.data[seg.pos], seg.len);
+          }()
+        , ...
+        );
+    }(std::make_index_sequence<Compiled::parsed.numSegments>());
+
+    return res;
+}
+
+//----------------------------------------------------------------------------
+
+} // namespace marty_tr
+
+
+#endif // MARTY_TR_STATIC_FORMAT_MESSAGE_SUPPORTED
+
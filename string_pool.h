@@ -0,0 +1,239 @@
+#pragma once
+/*!
+    \file
+    \brief Пул строк - монотонная арена, строки адресуются 32-битными смещениями
+
+    Строки дописываются подряд в один буфер: длина (varint, 1 байт для строк короче 128 байт) и сами байты.
+    Вместо отдельного выделения памяти на каждую std::string - одно смещение на строку, соседние строки
+    лежат рядом. Освобождения отдельных строк нет, память возвращается только clear().
+    Смещения, в отличие от указателей, не меняются при росте буфера.
+
+    intern() дописывает строку, только если такой в пуле ещё нет, и возвращает смещение уже лежащей.
+    Индекс для intern() (8 байт на слот, заполнение не больше половины) строится по требованию
+    и может быть освобождён dropInternIndex(), когда пул больше не меняется.
+
+    Буфер и индекс берутся из memory_resource, переданного в конструктор (по умолчанию -
+    std::pmr::get_default_resource()). Копия пула, как и у std::pmr-контейнеров, использует ресурс по умолчанию.
+ */
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <memory_resource>
+#include <stdexcept>
+#include <string_view>
+#include <vector>
+
+
+//----------------------------------------------------------------------------
+// marty_tr::
+namespace marty_tr {
+
+
+
+//----------------------------------------------------------------------------
+class StringPool
+{
+
+public:
+
+    typedef std::uint32_t    offset_type;
+
+    static constexpr offset_type    maxOffset = (offset_type)-1;
+
+protected:
+
+    struct InternSlot
+    {
+        std::uint32_t        hash  ;
+        offset_type          offset; // maxOffset - слот пуст
+    };
+
+    std::pmr::vector<char>        buf;
+    std::pmr::vector<InternSlot>  internSlots;
+    std::size_t              internNumUsed = 0;
+    std::size_t              internedUpTo  = 0; // Строки до этого места буфера уже в индексе
+
+    static std::size_t lengthPrefixSize(std::size_t len)
+    {
+        std::size_t n = 1;
+        while(len>=0x80)
+        {
+            len >>= 7;
+            ++n;
+        }
+        return n;
+    }
+
+    static std::uint32_t hashStr(std::string_view str)
+    {
+        return (std::uint32_t)std::hash<std::string_view>()(str);
+    }
+
+    //! Смещение строки, равной str, или maxOffset. pPos - слот, куда её вставлять
+    offset_type internFind(std::string_view str, std::uint32_t h, std::size_t *pPos) const
+    {
+        const std::size_t mask = internSlots.size()-1;
+        std::size_t pos = h & mask;
+        for(; internSlots[pos].offset!=maxOffset; pos=(pos+1) & mask)
+        {
+            if (internSlots[pos].hash==h && get(internSlots[pos].offset)==str)
+                return internSlots[pos].offset;
+        }
+
+        if (pPos)
+            *pPos = pos;
+        return maxOffset;
+    }
+
+    void internReserve(std::size_t numStrings)
+    {
+        std::size_t numSlots = 16;
+        while(numSlots < numStrings*2)
+            numSlots *= 2;
+
+        if (numSlots<=internSlots.size())
+            return;
+
+        std::pmr::vector<InternSlot> prevSlots(numSlots, InternSlot{0, maxOffset}, internSlots.get_allocator());
+        prevSlots.swap(internSlots);
+
+        const std::size_t mask = internSlots.size()-1;
+        for(const InternSlot &s : prevSlots)
+        {
+            if (s.offset==maxOffset)
+                continue;
+
+            std::size_t pos = s.hash & mask;
+            while(internSlots[pos].offset!=maxOffset)
+                pos = (pos+1) & mask;
+            internSlots[pos] = s;
+        }
+    }
+
+    void internInsert(std::string_view str, std::uint32_t h, offset_type offset)
+    {
+        internReserve(internNumUsed+1);
+
+        std::size_t pos = 0;
+        if (internFind(str, h, &pos)!=maxOffset)
+            return; // Дубликат, добавленный через add()
+
+        internSlots[pos] = InternSlot{h, offset};
+        ++internNumUsed;
+    }
+
+    //! Добавляет в индекс строки, дописанные через add() (или все, если индекс был освобождён)
+    void internIndexTail()
+    {
+        while(internedUpTo<buf.size())
+        {
+            const offset_type      offset = (offset_type)internedUpTo;
+            const std::string_view str    = get(offset);
+            internInsert(str, hashStr(str), offset);
+            internedUpTo = (std::size_t)(str.data()+str.size()-buf.data());
+        }
+    }
+
+
+public:
+
+    explicit StringPool(std::pmr::memory_resource *pResource = std::pmr::get_default_resource())
+    : buf(pResource), internSlots(pResource)
+    {}
+
+    std::pmr::memory_resource* getMemoryResource() const { return buf.get_allocator().resource(); }
+
+    //! Сколько байт займёт строка длины len вместе с префиксом длины
+    static std::size_t getStoredSize(std::size_t len)
+    {
+        return lengthPrefixSize(len)+len;
+    }
+
+    void reserve(std::size_t numBytes)  { buf.reserve(numBytes); }
+    void clear()                        { buf.clear(); buf.shrink_to_fit(); dropInternIndex(); }
+    void shrinkToFit()                  { buf.shrink_to_fit(); }
+
+    bool        empty()       const { return buf.empty(); }
+    std::size_t size()        const { return buf.size(); }     //!< Занято байт
+    std::size_t capacity()    const { return buf.capacity(); } //!< Выделено байт
+    const char* data()        const { return buf.data(); }
+
+    //! Дописывает строку в пул, возвращает её смещение
+    offset_type add(std::string_view str)
+    {
+        const std::size_t offset = buf.size();
+        if (offset+getStoredSize(str.size()) > (std::size_t)maxOffset)
+            throw std::runtime_error("tr: string pool is full");
+
+        std::size_t len = str.size();
+        while(len>=0x80)
+        {
+            buf.push_back((char)(unsigned char)(0x80 | (len & 0x7F)));
+            len >>= 7;
+        }
+        buf.push_back((char)(unsigned char)len);
+        buf.insert(buf.end(), str.begin(), str.end());
+
+        return (offset_type)offset;
+    }
+
+    //! Как add(), но одинаковые строки хранятся один раз
+    offset_type intern(std::string_view str)
+    {
+        internIndexTail();
+        internReserve(internNumUsed+1);
+
+        const std::uint32_t h   = hashStr(str);
+        std::size_t         pos = 0;
+        const offset_type   found = internFind(str, h, &pos);
+        if (found!=maxOffset)
+            return found;
+
+        const offset_type offset = add(str);
+        internSlots[pos] = InternSlot{h, offset};
+        ++internNumUsed;
+        internedUpTo = buf.size();
+
+        return offset;
+    }
+
+    //! Освобождает индекс intern(), при следующем intern() он будет построен заново
+    void dropInternIndex()
+    {
+        std::pmr::vector<InternSlot>(internSlots.get_allocator()).swap(internSlots);
+        internNumUsed = 0;
+        internedUpTo  = 0;
+    }
+
+    //! Память индекса intern()
+    std::size_t getInternIndexSize() const { return internSlots.capacity()*sizeof(InternSlot); }
+
+    //! Строка по смещению, полученному от add(). View валиден до следующего add() или clear()
+    std::string_view get(offset_type offset) const
+    {
+        const unsigned char *p = (const unsigned char*)buf.data()+offset;
+
+        std::size_t len   = 0;
+        unsigned    shift = 0;
+        for(;;)
+        {
+            const unsigned char b = *p++;
+            len |= (std::size_t)(b & 0x7F) << shift;
+            if (!(b & 0x80))
+                break;
+            shift += 7;
+        }
+
+        return std::string_view((const char*)p, len);
+    }
+
+}; // class StringPool
+
+//----------------------------------------------------------------------------
+
+} // namespace marty_tr
+
+// marty_tr::
+
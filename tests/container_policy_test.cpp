@@ -0,0 +1,204 @@
+// FlatHashMap и SortedVectorMap против std::unordered_map на случайной последовательности операций
+
+#include "../container_policy.h"
+#include "test_check.h"
+
+#include <cstdint>
+#include <random>
+#include <string>
+#include <unordered_map>
+#include <utility>
+
+
+//----------------------------------------------------------------------------
+template<typename MapType, typename RefMap>
+bool sameContent(const MapType &m, const RefMap &ref)
+{
+    if (m.size()!=ref.size() || m.empty()!=ref.empty())
+        return false;
+
+    std::size_t n = 0;
+    for(typename MapType::const_iterator it=m.begin(); it!=m.end(); ++it, ++n)
+    {
+        typename RefMap::const_iterator rit = ref.find(it->first);
+        if (rit==ref.end() || rit->second!=it->second)
+            return false;
+    }
+
+    return n==ref.size();
+}
+
+//----------------------------------------------------------------------------
+inline
+std::string keyOf(unsigned k)
+{
+    return "key_" + std::to_string(k);
+}
+
+//----------------------------------------------------------------------------
+//! Случайные вставки/удаления/поиск, ключи из небольшого диапазона - много повторов, рост и "дырки"
+template<typename MapType>
+void checkRandomOps(unsigned seed, unsigned keyRange, unsigned numOps)
+{
+    typedef typename MapType::mapped_type   mapped_type;
+
+    MapType                                        m;
+    std::unordered_map<std::string, mapped_type>   ref;
+    std::mt19937                                   rng(seed);
+
+    for(unsigned i=0; i!=numOps; ++i)
+    {
+        const std::string key = keyOf(rng()%keyRange);
+        const int         val = (int)(rng()%1000);
+
+        switch(rng()%8)
+        {
+            case 0:
+            {
+                m[key] = val;
+                ref[key] = val;
+                break;
+            }
+            case 1:
+            {
+                auto res    = m.insert(typename MapType::value_type(key, val));
+                auto refRes = ref.insert(std::make_pair(key, val));
+                MARTY_TR_TEST_CHECK(res.second==refRes.second);
+                MARTY_TR_TEST_CHECK(res.first->first==key && res.first->second==refRes.first->second);
+                break;
+            }
+            case 2:
+            {
+                auto res    = m.try_emplace(key, val);
+                auto refRes = ref.try_emplace(key, val);
+                MARTY_TR_TEST_CHECK(res.second==refRes.second);
+                MARTY_TR_TEST_CHECK(res.first->second==refRes.first->second);
+                break;
+            }
+            case 3:
+            case 4:
+            {
+                MARTY_TR_TEST_CHECK(m.erase(key)==ref.erase(key));
+                break;
+            }
+            case 5:
+            {
+                // Удаление через итератор
+                auto it = m.find(key);
+                MARTY_TR_TEST_CHECK((it==m.end())==(ref.find(key)==ref.end()));
+                if (it!=m.end())
+                {
+                    m.erase(it);
+                    ref.erase(key);
+                }
+                break;
+            }
+            case 6:
+            {
+                const MapType &cm = m;
+                auto it  = cm.find(key);
+                auto rit = ref.find(key);
+                MARTY_TR_TEST_CHECK((it==cm.end())==(rit==ref.end()));
+                if (it!=cm.end() && rit!=ref.end())
+                    MARTY_TR_TEST_CHECK(it->second==rit->second && cm.at(key)==rit->second);
+                MARTY_TR_TEST_CHECK(cm.count(key)==ref.count(key));
+                break;
+            }
+            default:
+            {
+                // Правка значения через итератор
+                auto it = m.find(key);
+                if (it!=m.end())
+                {
+                    it->second += 1;
+                    ref[key]   += 1;
+                }
+                break;
+            }
+        }
+
+        if (i%97==0)
+            MARTY_TR_TEST_CHECK(sameContent(m, ref));
+    }
+
+    MARTY_TR_TEST_CHECK(sameContent(m, ref));
+
+    // Удаление при обходе: erase(it) возвращает следующий ещё не пройденный элемент
+    for(auto it=m.begin(); it!=m.end(); )
+    {
+        if (it->second%2)
+        {
+            ref.erase(it->first);
+            it = m.erase(it);
+        }
+        else
+        {
+            ++it;
+        }
+    }
+    MARTY_TR_TEST_CHECK(sameContent(m, ref));
+
+    // Копия, перемещение, swap
+    MapType copy = m;
+    MARTY_TR_TEST_CHECK(sameContent(copy, ref));
+
+    MapType moved = std::move(copy);
+    MARTY_TR_TEST_CHECK(sameContent(moved, ref));
+
+    MapType other;
+    other["only_in_other"] = 1;
+    other.swap(moved);
+    MARTY_TR_TEST_CHECK(sameContent(other, ref));
+    MARTY_TR_TEST_CHECK(moved.size()==1 && moved.count("only_in_other")==1);
+
+    m.clear();
+    MARTY_TR_TEST_CHECK(m.empty() && m.begin()==m.end() && m.find(keyOf(0))==m.end());
+}
+
+//----------------------------------------------------------------------------
+//! reserve не меняет содержимое, at() на отсутствующий ключ - исключение
+template<typename MapType>
+void checkReserveAndAt()
+{
+    MapType m;
+    for(unsigned i=0; i!=100; ++i)
+        m[keyOf(i)] = (int)i;
+
+    m.reserve(10000);
+    MARTY_TR_TEST_CHECK(m.size()==100);
+    for(unsigned i=0; i!=100; ++i)
+        MARTY_TR_TEST_CHECK(m.at(keyOf(i))==(int)i);
+
+    bool thrown = false;
+    try
+    {
+        m.at("missing");
+    }
+    catch(const std::out_of_range &)
+    {
+        thrown = true;
+    }
+    MARTY_TR_TEST_CHECK(thrown);
+}
+
+//----------------------------------------------------------------------------
+int main()
+{
+    typedef marty_tr::FlatHashMap<std::string, int>       flat_map_t;
+    typedef marty_tr::SortedVectorMap<std::string, int>   sorted_map_t;
+
+    const unsigned keyRanges[] = { 4, 64, 5000 };
+    for(unsigned seed=1; seed!=6; ++seed)
+    {
+        for(unsigned keyRange : keyRanges)
+        {
+            checkRandomOps<flat_map_t  >(seed, keyRange, 20000);
+            checkRandomOps<sorted_map_t>(seed, keyRange, 20000);
+        }
+    }
+
+    checkReserveAndAt<flat_map_t  >();
+    checkReserveAndAt<sorted_map_t>();
+
+    return marty_tr_test::result("container_policy_test");
+}
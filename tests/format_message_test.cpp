@@ -0,0 +1,83 @@
+// FormatMessage: подстановка аргументов по индексу и по имени, через substMacros и через предкомпилированный шаблон,
+// шаблон из кэша заданного переводчика
+
+#include "../format_message.h"
+#include "test_check.h"
+
+#include <string>
+
+
+using namespace marty_tr;
+
+//----------------------------------------------------------------------------
+//! Позиционный аргумент, заданный по имени ("1"), подставляется в $(1) (user-026)
+static void testIndexByName(bool precompiled)
+{
+    tr_clear_precompiled_templates();
+    if (precompiled)
+        tr_precompile_template("a=$(1), b=$(2), c=$(3)");
+
+    MARTY_TR_TEST_CHECK(FormatMessage<std::string>("a=$(1)").arg(std::string("1"), std::string("ONE")).toString()=="a=ONE");
+
+    auto fm = FormatMessage<std::string>("a=$(1), b=$(2), c=$(3)");
+    fm.arg(std::string("1"), std::string("ONE")).arg(2, std::string("TWO"));
+    MARTY_TR_TEST_CHECK(fm.toString()=="a=ONE, b=TWO, c=$(3)");
+
+    // Заданный по индексу аргумент важнее заданного по имени
+    fm.arg(1, std::string("one"));
+    MARTY_TR_TEST_CHECK(fm.toString()=="a=one, b=TWO, c=$(3)");
+
+    tr_clear_precompiled_templates();
+}
+
+//----------------------------------------------------------------------------
+//! Шаблон берётся у того переводчика, который передан, а не у переводчика по умолчанию (user-041)
+static void testTemplateSource()
+{
+    tr_clear_precompiled_templates();
+
+    const std::string text = "Copying $(1) of $(2)";
+
+    Translator t;
+    t.setLangTagFormat(ELangTagFormat::langTag);
+    t.setPrecompileTemplatesMode(true);
+    t.add("copying", text, "app", "en-US");
+
+    const MessageTemplatePtr pTpl = t.findPrecompiledTemplate(text);
+    MARTY_TR_TEST_CHECK(pTpl!=0);
+    MARTY_TR_TEST_CHECK(!tr_find_precompiled_template(text));
+
+    const long refs = pTpl.use_count();
+    {
+        // Без переводчика - кэш переводчика по умолчанию, шаблона там нет
+        FormatMessage<std::string> fmDefault(text);
+        MARTY_TR_TEST_CHECK(pTpl.use_count()==refs);
+
+        FormatMessage<std::string> fm(t, text);
+        MARTY_TR_TEST_CHECK(pTpl.use_count()==refs+1);
+        MARTY_TR_TEST_CHECK(fm.args(3, 10).toString()=="Copying 3 of 10");
+
+        auto fm2 = formatMessage(t, "copying", "app", "en-US");
+        MARTY_TR_TEST_CHECK(pTpl.use_count()==refs+2);
+        MARTY_TR_TEST_CHECK(fm2.args(1, 2).toString()=="Copying 1 of 2");
+    }
+    MARTY_TR_TEST_CHECK(pTpl.use_count()==refs);
+
+    // Явно переданный шаблон используется как есть
+    auto pOther = std::make_shared< const MessageTemplate<std::string> >(MessageTemplate<std::string>::compile("Other $(1)"));
+    MARTY_TR_TEST_CHECK(FormatMessage<std::string>(pOther, text).arg(1, std::string("x")).toString()=="Other x");
+    MARTY_TR_TEST_CHECK(FormatMessage<std::string>(MessageTemplatePtr(), text).arg(1, std::string("x")).toString()=="Copying x of $(2)");
+
+    // Широкая строка - кэша шаблонов нет, перевод берётся у t
+    MARTY_TR_TEST_CHECK(formatMessage(t, L"copying", "app", "en-US").args(1, 2).toString()==L"Copying 1 of 2");
+}
+
+//----------------------------------------------------------------------------
+int main()
+{
+    testIndexByName(false);
+    testIndexByName(true);
+    testTemplateSource();
+
+    return marty_tr_test::result("format_message_test");
+}
@@ -0,0 +1,193 @@
+// Ограничения раскрытия макросов (SubstMacrosLimits): глубина, объём вывода, число шагов.
+// Лимиты по умолчанию, отключение через unlimited() и те же лимиты в MessageTemplate::render
+
+#include "../macros.h"
+#include "../message_template.h"
+#include "test_check.h"
+
+#include <cstddef>
+#include <map>
+#include <string>
+#include <string_view>
+
+
+namespace macros = marty_tr::macros;
+
+//----------------------------------------------------------------------------
+struct MapGetter
+{
+    std::map<std::string, std::string>  m;
+
+    bool operator()(const std::string &name, std::string_view &text) const
+    {
+        auto it = m.find(name);
+        if (it==m.end())
+            return false;
+        text = it->second;
+        return true;
+    }
+};
+
+//----------------------------------------------------------------------------
+//! true, если вызов бросил SubstMacrosLimitError
+template<typename Fn>
+bool throwsLimitError(Fn fn)
+{
+    try
+    {
+        fn();
+    }
+    catch(const macros::SubstMacrosLimitError &)
+    {
+        return true;
+    }
+    return false;
+}
+
+static macros::SubstMacrosLimits makeLimits(std::size_t maxOutputSize, std::size_t maxDepth, std::size_t maxSteps)
+{
+    macros::SubstMacrosLimits limits;
+    limits.maxOutputSize = maxOutputSize;
+    limits.maxDepth      = maxDepth;
+    limits.maxSteps      = maxSteps;
+    return limits;
+}
+
+//----------------------------------------------------------------------------
+//! Цепочка m0 -> m1 -> ... -> mN, mN = "end"
+static MapGetter makeChain(std::size_t n)
+{
+    MapGetter g;
+    for(std::size_t i=0; i!=n; ++i)
+        g.m["m"+std::to_string(i)] = "$(m"+std::to_string(i+1)+")";
+    g.m["m"+std::to_string(n)] = "end";
+    return g;
+}
+
+//! Удвоение на каждом уровне: b0 = $(b1)$(b1), ..., bN = leaf
+static MapGetter makeBomb(std::size_t n, const std::string &leaf)
+{
+    MapGetter g;
+    for(std::size_t i=0; i!=n; ++i)
+        g.m["b"+std::to_string(i)] = "$(b"+std::to_string(i+1)+")$(b"+std::to_string(i+1)+")";
+    g.m["b"+std::to_string(n)] = leaf;
+    return g;
+}
+
+static std::string repeatRef(const std::string &ref, std::size_t n)
+{
+    std::string res;
+    res.reserve(ref.size()*n);
+    for(std::size_t i=0; i!=n; ++i)
+        res.append(ref);
+    return res;
+}
+
+//----------------------------------------------------------------------------
+static void testDepth()
+{
+    const std::string str = "$(m0)";
+
+    MapGetter chain = makeChain(20);
+    MARTY_TR_TEST_CHECK( throwsLimitError([&]() { macros::substMacros(str, chain, macros::smf_KeepUnknownVars, makeLimits(0, 10, 0)); }));
+    MARTY_TR_TEST_CHECK(macros::substMacros(str, chain, macros::smf_KeepUnknownVars, makeLimits(0, 30, 0))=="end");
+
+    // Лимит по умолчанию и его отключение
+    MapGetter longChain = makeChain(MARTY_TR_SUBST_MACROS_MAX_DEPTH+10);
+    MARTY_TR_TEST_CHECK( throwsLimitError([&]() { macros::substMacros(str, longChain); }));
+    MARTY_TR_TEST_CHECK(macros::substMacros(str, longChain, macros::smf_KeepUnknownVars, macros::SubstMacrosLimits::unlimited())=="end");
+}
+
+//----------------------------------------------------------------------------
+static void testOutputSize()
+{
+    const std::string str = "$(b0)";
+
+    MapGetter small = makeBomb(4, "xy"); // 32 символа
+    MARTY_TR_TEST_CHECK( throwsLimitError([&]() { macros::substMacros(str, small, macros::smf_KeepUnknownVars, makeLimits(31, 0, 0)); }));
+    MARTY_TR_TEST_CHECK(macros::substMacros(str, small, macros::smf_KeepUnknownVars, makeLimits(32, 0, 0))==repeatRef("xy", 16));
+
+    // Лимит по умолчанию: 2^30 копий листа
+    MapGetter bomb = makeBomb(30, std::string(1000, 'x'));
+    MARTY_TR_TEST_CHECK( throwsLimitError([&]() { macros::substMacros(str, bomb); }));
+
+    // Без лимита раскрывается текст больше лимита по умолчанию
+    const std::size_t leafSize = 1000;
+    std::size_t levels = 0;
+    while(((std::size_t)1<<levels)*leafSize<=MARTY_TR_SUBST_MACROS_MAX_OUTPUT_SIZE)
+        ++levels;
+    MapGetter big = makeBomb(levels, std::string(leafSize, 'x'));
+    MARTY_TR_TEST_CHECK( throwsLimitError([&]() { macros::substMacros(str, big); }));
+    MARTY_TR_TEST_CHECK(macros::substMacros(str, big, macros::smf_KeepUnknownVars, macros::SubstMacrosLimits::unlimited()).size()==((std::size_t)1<<levels)*leafSize);
+}
+
+//----------------------------------------------------------------------------
+static void testSteps()
+{
+    MapGetter g;
+    g.m["a"] = "A";
+
+    // Ненайденные макросы тоже считаются шагами
+    const std::string str4 = "$(a)$(a)$(u)$(a)";
+    MARTY_TR_TEST_CHECK( throwsLimitError([&]() { macros::substMacros(str4, g, macros::smf_KeepUnknownVars, makeLimits(0, 0, 3)); }));
+    MARTY_TR_TEST_CHECK(macros::substMacros(str4, g, macros::smf_KeepUnknownVars, makeLimits(0, 0, 4))=="AA$(u)A");
+
+    const std::string many = repeatRef("$(a)", MARTY_TR_SUBST_MACROS_MAX_STEPS+1);
+    MARTY_TR_TEST_CHECK( throwsLimitError([&]() { macros::substMacros(many, g); }));
+    MARTY_TR_TEST_CHECK(macros::substMacros(many, g, macros::smf_KeepUnknownVars, macros::SubstMacrosLimits::unlimited())==std::string(MARTY_TR_SUBST_MACROS_MAX_STEPS+1, 'A'));
+}
+
+//----------------------------------------------------------------------------
+//! MessageTemplate::render проверяет те же лимиты шагов и объёма, что и substMacros с флагами FormatMessage
+static void testTemplateRender()
+{
+    const int fmFlags = macros::smf_KeepUnknownVars | macros::smf_DisableRecursion;
+
+    MapGetter g;
+    g.m["a"] = "AAAA";
+
+    auto getArg = [&](const std::string &name, std::size_t, std::string_view &text)
+                  {
+                      return g(name, text);
+                  };
+
+    const std::string str4 = "$(a)$(a)$(u)$(a)";
+    const auto t4 = marty_tr::MessageTemplate<std::string>::compile(str4);
+    MARTY_TR_TEST_CHECK(t4.isCompiled());
+
+    const macros::SubstMacrosLimits limitsList[] =
+        { makeLimits(0, 0, 3), makeLimits(0, 0, 4), makeLimits(15, 0, 0), makeLimits(16, 0, 0), macros::SubstMacrosLimits(), macros::SubstMacrosLimits::unlimited() };
+
+    for(const auto &limits : limitsList)
+    {
+        const bool substThrows  = throwsLimitError([&]() { macros::substMacros(str4, g, fmFlags, limits); });
+        const bool renderThrows = throwsLimitError([&]() { t4.render(getArg, limits); });
+        MARTY_TR_TEST_CHECK(substThrows==renderThrows);
+        if (!renderThrows)
+            MARTY_TR_TEST_CHECK(t4.render(getArg, limits)=="AAAAAAAA$(u)AAAA");
+    }
+
+    MARTY_TR_TEST_CHECK( throwsLimitError([&]() { t4.render(getArg, makeLimits(0, 0, 3)); }));
+    MARTY_TR_TEST_CHECK( throwsLimitError([&]() { t4.render(getArg, makeLimits(15, 0, 0)); }));
+
+    // Лимиты по умолчанию: шаги и объём
+    const auto tMany = marty_tr::MessageTemplate<std::string>::compile(repeatRef("$(a)", MARTY_TR_SUBST_MACROS_MAX_STEPS+1));
+    MARTY_TR_TEST_CHECK( throwsLimitError([&]() { tMany.render(getArg, macros::SubstMacrosLimits()); }));
+    MARTY_TR_TEST_CHECK(tMany.render(getArg, macros::SubstMacrosLimits::unlimited()).size()==4*(MARTY_TR_SUBST_MACROS_MAX_STEPS+1));
+
+    g.m["big"] = std::string(MARTY_TR_SUBST_MACROS_MAX_OUTPUT_SIZE, 'x');
+    const auto tBig = marty_tr::MessageTemplate<std::string>::compile("$(big)!");
+    MARTY_TR_TEST_CHECK( throwsLimitError([&]() { tBig.render(getArg, macros::SubstMacrosLimits()); }));
+    MARTY_TR_TEST_CHECK(tBig.render(getArg, macros::SubstMacrosLimits::unlimited()).size()==MARTY_TR_SUBST_MACROS_MAX_OUTPUT_SIZE+1);
+}
+
+//----------------------------------------------------------------------------
+int main()
+{
+    testDepth();
+    testOutputSize();
+    testSteps();
+    testTemplateRender();
+
+    return marty_tr_test::result("macros_limits_test");
+}
@@ -0,0 +1,175 @@
+// Итеративный substMacros против рекурсивного эталона (tests/baseline/macros_recursive.h):
+// случайные тексты с вложенными, параметризованными и условными макросами, все сочетания флагов
+
+#include "../macros.h"
+#include "baseline/macros_recursive.h"
+#include "test_check.h"
+
+#include <exception>
+#include <map>
+#include <random>
+#include <string>
+#include <string_view>
+
+
+//----------------------------------------------------------------------------
+template<typename GetterBase>
+struct MapMacroGetter : public GetterBase
+{
+    std::map<std::string, std::string>  m;
+
+    bool operator()(const std::string &name, std::string &text) const override
+    {
+        auto it = m.find(name);
+        if (it==m.end())
+            return false;
+        text = it->second;
+        return true;
+    }
+};
+
+//! Геттер с выдачей string_view (без копирования текста) - есть только у новой версии
+struct MapMacroViewGetter
+{
+    const std::map<std::string, std::string>   *pm = 0;
+
+    bool operator()(const std::string &name, std::string_view &text) const
+    {
+        auto it = pm->find(name);
+        if (it==pm->end())
+            return false;
+        text = it->second;
+        return true;
+    }
+};
+
+//----------------------------------------------------------------------------
+//! Случайный текст: литералы, "$$", "$x", скобки, $(name), $(name:args), $(name?*yes:no), $(name?x)
+std::string genText(std::mt19937 &rng, int depth)
+{
+    static const char* names[] = { "a", "b", "c", "d", "e", "f", "%0", "%1", "%2", "%3", "%01", "zz", "A", "a.b", "a/b", "sp" };
+
+    std::string res;
+    const int n = (int)(rng()%5);
+    for(int i=0; i<n; ++i)
+    {
+        switch(rng()%12)
+        {
+            case 0 : res += "x";  break;
+            case 1 : res += "$$"; break;
+            case 2 : res += "$x"; break;
+            case 3 : res += ":";  break;
+            case 4 : res += "(" + (depth>0 ? genText(rng, depth-1) : std::string()) + ")"; break;
+            default:
+            {
+                const std::string name = names[rng()%16];
+                const int kind = depth>0 ? (int)(rng()%4) : 0;
+                if (kind==0)
+                {
+                    res += "$(" + name + ")";
+                }
+                else if (kind==1)
+                {
+                    res += "$(" + name;
+                    const int numArgs = (int)(rng()%3)+1;
+                    for(int j=0; j<numArgs; ++j)
+                        res += ":" + genText(rng, depth-1);
+                    res += ")";
+                }
+                else if (kind==2)
+                {
+                    res += "$(" + name + "?" + (rng()%2 ? "*" : "+") + genText(rng, depth-1);
+                    if (rng()%2)
+                        res += ":" + genText(rng, depth-1);
+                    res += ")";
+                }
+                else
+                {
+                    res += "$(" + name + "?" + (rng()%5==0 ? "x" : "*") + ")"; // В том числе неверное условие
+                }
+            }
+        }
+    }
+    return res;
+}
+
+//----------------------------------------------------------------------------
+//! Результат или текст исключения - циклы и неверный синтаксис тоже должны совпадать
+template<typename Fn>
+std::string runSubst(Fn fn)
+{
+    try
+    {
+        return "R:" + fn();
+    }
+    catch(const std::exception &e)
+    {
+        return std::string("E:") + e.what();
+    }
+}
+
+//----------------------------------------------------------------------------
+int main()
+{
+    namespace cur  = marty_tr::macros;
+    namespace base = marty_tr_baseline::macros;
+
+    static const char* macroNames[] = { "a", "b", "c", "d", "e", "f", "A", "a_b", "sp" };
+
+    std::mt19937 rng(12345);
+    int numShown = 0;
+
+    for(int iter=0; iter<100000; ++iter)
+    {
+        MapMacroGetter< base::IMacroTextGetter<std::string> > baseGetter;
+        MapMacroGetter< cur ::IMacroTextGetter<std::string> > curGetter;
+
+        const int numMacros = (int)(rng()%7);
+        for(int i=0; i<numMacros; ++i)
+        {
+            const std::string name = macroNames[rng()%9];
+            const std::string text = name=="sp" ? std::string(" \t") : genText(rng, 2);
+            baseGetter.m[name] = text;
+            curGetter .m[name] = text;
+        }
+
+        const std::string str = genText(rng, 3);
+
+        int flags = 0;
+        if (rng()%2)   flags |= cur::smf_ArgsAllowed;
+        if (rng()%2)   flags |= cur::smf_ConditionAllowed;
+        if (rng()%2)   flags |= cur::smf_DisableRecursion;
+        if (rng()%2)   flags |= cur::smf_KeepUnknownVars;
+        if (rng()%2)   flags |= cur::smf_changeDot;
+        if (rng()%2)   flags |= cur::smf_changeSlash;
+        if (rng()%3==0) flags |= cur::smf_uppercaseNames;
+
+        const std::string expected = runSubst([&]() { return base::substMacros(str, baseGetter, flags); });
+
+        MapMacroViewGetter viewGetter;
+        viewGetter.pm = &curGetter.m;
+
+        const std::string results[] =
+            { runSubst([&]() { return cur::substMacros(str, curGetter, flags); })
+            , runSubst([&]() { return cur::substMacros(str, viewGetter, flags); })
+            , runSubst([&]() { cur::StringSet<std::string> used; return cur::substMacros(str, (const cur::IMacroTextGetter<std::string>&)curGetter, flags, used); })
+            };
+
+        for(const auto &res : results)
+        {
+            if (res==expected)
+                continue;
+
+            MARTY_TR_TEST_CHECK(res==expected);
+            if (numShown++<5)
+            {
+                std::cout << "  flags=" << flags << " text=[" << str << "]\n";
+                for(const auto &kv : curGetter.m)
+                    std::cout << "    " << kv.first << "=[" << kv.second << "]\n";
+                std::cout << "  expected " << expected << "\n  got      " << res << "\n";
+            }
+        }
+    }
+
+    return marty_tr_test::result("macros_subst_test");
+}
@@ -0,0 +1,272 @@
+// Переводчик над общей базой (user-043) против переводчика с полной копией того же каталога:
+// одинаковые переопределения, слои и ссылки $(@...) - одинаковые тексты и одинаковые ошибки (циклы ссылок).
+// Широкие копии базы и образа каталога общие для переводчиков
+
+#include "../marty_tr.h"
+#include "test_check.h"
+
+#include <exception>
+#include <functional>
+#include <random>
+#include <string>
+#include <string_view>
+#include <vector>
+
+
+using namespace marty_tr;
+
+//----------------------------------------------------------------------------
+static const char* const keys[] = { "k0", "k1", "k2", "k3", "k4", "k5" };
+static const std::size_t numKeys = sizeof(keys)/sizeof(keys[0]);
+
+//----------------------------------------------------------------------------
+static Translator makeTranslator()
+{
+    Translator t;
+    t.setLangTagFormat(ELangTagFormat::langTag);
+    return t;
+}
+
+static Translator makeFullCopy(const all_translations_map_t &baseMap)
+{
+    Translator t = makeTranslator();
+    t.addCustomTranslations(baseMap);
+    return t;
+}
+
+static Translator makeTenant(const all_translations_map_t &baseMap)
+{
+    Translator t(tr_make_shared_translations(baseMap));
+    t.setLangTagFormat(ELangTagFormat::langTag);
+    return t;
+}
+
+//----------------------------------------------------------------------------
+//! Тексты всех ключей обоих переводчиков совпадают
+static bool sameTexts(const Translator &tenant, const Translator &full, bool show)
+{
+    bool res = true;
+    auto check = [&](const std::string &msgId, const std::string &catId)
+    {
+        const std::string a = tenant.tr(msgId, catId, "en-US");
+        const std::string b = full  .tr(msgId, catId, "en-US");
+        if (a==b)
+            return;
+        res = false;
+        if (show)
+            std::cout << "  " << catId << "/" << msgId << ": tenant [" << a << "], full copy [" << b << "]\n";
+    };
+
+    for(auto k : keys)
+        check(k, "app");
+    check("q", "other");
+
+    return res;
+}
+
+//! Операция над обоими переводчиками: исключение (цикл ссылок) - у обоих или ни у одного
+static bool applyBoth(Translator &tenant, Translator &full, const std::function<void(Translator&)> &op)
+{
+    bool tenantThrew = false;
+    bool fullThrew   = false;
+    try { op(tenant); } catch(const std::exception &) { tenantThrew = true; }
+    try { op(full  ); } catch(const std::exception &) { fullThrew   = true; }
+    return tenantThrew==fullThrew;
+}
+
+//----------------------------------------------------------------------------
+//! Сценарий из ревью: база y = "Y uses $(@x)", клиент переопределяет x
+static void testOverrideReferencedMsg()
+{
+    all_translations_map_t baseMap;
+    baseMap["en-US"]["app"]["x"] = "X-base";
+    baseMap["en-US"]["app"]["y"] = "Y uses $(@x)";
+    baseMap["en-US"]["app"]["z"] = "Z: $(@y)";
+    baseMap["en-US"]["app"]["c"] = "C: $(@other|q)";
+    baseMap["en-US"]["other"]["q"] = "Q-base";
+
+    Translator tenant = makeTenant(baseMap);
+    Translator full   = makeFullCopy(baseMap);
+
+    MARTY_TR_TEST_CHECK(tenant.tr("z", "app", "en-US")=="Z: Y uses X-base");
+
+    tenant.add("x", "X-over", "app", "en-US");
+    full  .add("x", "X-over", "app", "en-US");
+    MARTY_TR_TEST_CHECK(full  .tr("y", "app", "en-US")=="Y uses X-over");
+    MARTY_TR_TEST_CHECK(tenant.tr("y", "app", "en-US")=="Y uses X-over");
+    MARTY_TR_TEST_CHECK(tenant.tr("z", "app", "en-US")=="Z: Y uses X-over");
+
+    tenant.add("q", "Q-over", "other", "en-US");
+    MARTY_TR_TEST_CHECK(tenant.tr("c", "app", "en-US")=="C: Q-over");
+
+    // Цикл через тексты базы: x -> z -> y -> x. Исключение, каталог прежний
+    bool threw = false;
+    try { tenant.add("x", "$(@z)", "app", "en-US"); } catch(const std::exception &) { threw = true; }
+    MARTY_TR_TEST_CHECK(threw);
+    MARTY_TR_TEST_CHECK(tenant.tr("x", "app", "en-US")=="X-over");
+    MARTY_TR_TEST_CHECK(tenant.tr("z", "app", "en-US")=="Z: Y uses X-over");
+
+    // Слой поверх переопределения и его снятие
+    tenant.addLayer("fix");
+    tenant.layerAdd("fix", "x", "X-layer", "app", "en-US");
+    MARTY_TR_TEST_CHECK(tenant.tr("z", "app", "en-US")=="Z: Y uses X-layer");
+    tenant.removeLayer("fix");
+    MARTY_TR_TEST_CHECK(tenant.tr("z", "app", "en-US")=="Z: Y uses X-over");
+
+    // Фильтр поиска видит тексты базы, разрешённые в своём каталоге
+    Translator filtered = makeTenant(baseMap);
+    filtered.setLookupFilterMode(true);
+    filtered.add("x", "X-f", "app", "en-US");
+    MARTY_TR_TEST_CHECK(filtered.tr("z", "app", "en-US")=="Z: Y uses X-f");
+
+    // Новая база: тексты, разрешённые по старой, пересчитываются по новой
+    all_translations_map_t newBaseMap = baseMap;
+    newBaseMap["en-US"]["app"]["y"] = "New Y with $(@x)";
+    tenant.setSharedBase(tr_make_shared_translations(newBaseMap));
+    MARTY_TR_TEST_CHECK(tenant.tr("y", "app", "en-US")=="New Y with X-over");
+    MARTY_TR_TEST_CHECK(tenant.tr("z", "app", "en-US")=="Z: New Y with X-over");
+}
+
+//----------------------------------------------------------------------------
+//! Случайный текст со ссылками на ключи каталога; acyclic - ссылки только на ключи с индексом больше i (база без циклов)
+static std::string genText(std::mt19937 &rng, std::size_t i, bool acyclic)
+{
+    std::string res = std::string("T") + std::to_string(rng()%100);
+    const int numRefs = (int)(rng()%3);
+    for(int r=0; r<numRefs; ++r)
+    {
+        if (acyclic)
+        {
+            if (i+1>=numKeys)
+                break;
+            res += " $(@" + std::string(keys[i+1+rng()%(numKeys-i-1)]) + ")";
+        }
+        else
+        {
+            res += rng()%6 ? " $(@" + std::string(keys[rng()%numKeys]) + ")" : std::string(" $(@other|q)");
+        }
+    }
+    return res;
+}
+
+//----------------------------------------------------------------------------
+static void testRandomDifferential()
+{
+    std::mt19937 rng(4321);
+    int numShown = 0;
+
+    for(int iter=0; iter!=300; ++iter)
+    {
+        all_translations_map_t baseMap;
+        for(std::size_t i=0; i!=numKeys; ++i)
+        {
+            if (rng()%5)
+                baseMap["en-US"]["app"][keys[i]] = genText(rng, i, true);
+        }
+        baseMap["en-US"]["other"]["q"] = "Q";
+
+        Translator tenant = makeTenant(baseMap);
+        Translator full   = makeFullCopy(baseMap);
+        if (iter%2)
+        {
+            tenant.setLookupFilterMode(true);
+            full  .setLookupFilterMode(true);
+        }
+        tenant.addLayer("L");
+        full  .addLayer("L");
+
+        for(int step=0; step!=20; ++step)
+        {
+            const std::string key  = keys[rng()%numKeys];
+            const std::string text = genText(rng, 0, false);
+            const unsigned    kind = (unsigned)(rng()%6);
+
+            std::function<void(Translator&)> op;
+            if (kind<3)
+                op = [&](Translator &t) { t.add(key, text, "app", "en-US"); };
+            else if (kind==3)
+                op = [&](Translator &t) { t.add("q", text, "other", "en-US"); };
+            else if (kind==4)
+                op = [&](Translator &t) { t.layerAdd("L", key, text, "app", "en-US"); };
+            else
+                op = [&](Translator &t) { t.layerErase("L", key, "app", "en-US"); };
+
+            const bool sameErr = applyBoth(tenant, full, op);
+            MARTY_TR_TEST_CHECK(sameErr);
+
+            const bool same = sameTexts(tenant, full, numShown<5);
+            MARTY_TR_TEST_CHECK(same);
+            if (!sameErr || !same)
+            {
+                if (numShown++<5)
+                    std::cout << "  iter " << iter << ", step " << step << ": op " << kind << " " << key << " = [" << text << "]\n";
+                break;
+            }
+        }
+    }
+}
+
+//----------------------------------------------------------------------------
+//! Широкие копии базы и образа общие для переводчиков, свои копии - только у переопределений
+static void testSharedWideViews()
+{
+    all_translations_map_t baseMap;
+    baseMap["en-US"]["app"]["x"] = "X-base";
+    baseMap["en-US"]["app"]["y"] = "Y uses $(@x)";
+    baseMap["en-US"]["app"]["e"] = "E-base";
+
+    const shared_translations_ptr_t base = tr_make_shared_translations(baseMap);
+    Translator a(base);
+    Translator b(base);
+    a.setLangTagFormat(ELangTagFormat::langTag);
+    b.setLangTagFormat(ELangTagFormat::langTag);
+
+    std::basic_string_view<wchar_t> ta, tb;
+    MARTY_TR_TEST_CHECK(a.findWide(ta, std::wstring(L"x"), "app", "en-US") && ta==L"X-base");
+    MARTY_TR_TEST_CHECK(b.findWide(tb, std::wstring(L"x"), "app", "en-US") && tb==L"X-base");
+    MARTY_TR_TEST_CHECK(ta.data()==tb.data());
+
+    // Переопределение и текст базы, который на него ссылается, - из своей копии, остальное - из общей
+    a.add("x", "X-over", "app", "en-US");
+    MARTY_TR_TEST_CHECK(a.trWide(std::wstring(L"x"), "app", "en-US")==L"X-over");
+    MARTY_TR_TEST_CHECK(a.trWide(std::wstring(L"y"), "app", "en-US")==L"Y uses X-over");
+    MARTY_TR_TEST_CHECK(b.trWide(std::wstring(L"y"), "app", "en-US")==L"Y uses X-base");
+    MARTY_TR_TEST_CHECK(a.findWide(ta, std::wstring(L"e"), "app", "en-US") && b.findWide(tb, std::wstring(L"e"), "app", "en-US") && ta.data()==tb.data());
+    MARTY_TR_TEST_CHECK(a.trWide(std::u16string(u"y"), "app", "en-US")==u"Y uses X-over");
+
+    // Пустое переопределение при emptyMsgNotExist не прячет текст базы - как в tr()
+    a.add("e", "", "app", "en-US");
+    MARTY_TR_TEST_CHECK(a.trWide(std::wstring(L"e"), "app", "en-US")==utf::fromUtf8<wchar_t>(a.tr("e", "app", "en-US")));
+
+    // Образ каталога: одна копия на образ
+    all_translations_map_t imageMap;
+    imageMap["en-US"]["img"]["i"] = "I-image";
+    const std::vector<char> imageData = tr_build_catalog_image(imageMap);
+    const CatalogImageView image(imageData.data(), imageData.size());
+
+    Translator c = makeTranslator();
+    Translator d = makeTranslator();
+    c.setCatalogImage(image);
+    d.setCatalogImage(image);
+    std::basic_string_view<wchar_t> tc, td;
+    MARTY_TR_TEST_CHECK(c.findWide(tc, std::wstring(L"i"), "img", "en-US") && tc==L"I-image");
+    MARTY_TR_TEST_CHECK(d.findWide(td, std::wstring(L"i"), "img", "en-US") && tc.data()==td.data());
+
+    c.add("i", "I-over", "img", "en-US");
+    MARTY_TR_TEST_CHECK(c.trWide(std::wstring(L"i"), "img", "en-US")==L"I-over");
+    MARTY_TR_TEST_CHECK(d.trWide(std::wstring(L"i"), "img", "en-US")==L"I-image");
+
+    c.setCatalogImage(CatalogImageView());
+    MARTY_TR_TEST_CHECK(!d.findWide(td, std::wstring(L"missing"), "img", "en-US"));
+    MARTY_TR_TEST_CHECK(c.trWide(std::wstring(L"i"), "img", "en-US")==L"I-over");
+}
+
+//----------------------------------------------------------------------------
+int main()
+{
+    testOverrideReferencedMsg();
+    testRandomDifferential();
+    testSharedWideViews();
+
+    return marty_tr_test::result("shared_base_test");
+}
@@ -0,0 +1,68 @@
+// formatMessage<"..."> (C++20): позиционные и именованные аргументы, $$, '$' в конце, широкие строки
+
+#include "../static_format_message.h"
+#include "test_check.h"
+
+#include <string>
+
+
+#if !defined(MARTY_TR_STATIC_FORMAT_MESSAGE_SUPPORTED)
+    #error "static_format_message_test requires C++20"
+#endif
+
+
+using marty_tr::formatMessage;
+using marty_tr::namedArg;
+
+//----------------------------------------------------------------------------
+static void testPositional()
+{
+    MARTY_TR_TEST_CHECK(formatMessage<"Copying $(1) of $(2)">(3, 10)=="Copying 3 of 10");
+    MARTY_TR_TEST_CHECK(formatMessage<"$(2)-$(1)-$(2)">(std::string("a"), "b")=="b-a-b");
+    MARTY_TR_TEST_CHECK(formatMessage<"$(1)">(-42)=="-42");
+    MARTY_TR_TEST_CHECK(formatMessage<"x=$(1)">(1.5)=="x=1.5");
+    MARTY_TR_TEST_CHECK(formatMessage<"No args">()=="No args");
+    MARTY_TR_TEST_CHECK(formatMessage<"">()=="");
+}
+
+//----------------------------------------------------------------------------
+static void testNamed()
+{
+    const std::string user = "Bob";
+    MARTY_TR_TEST_CHECK(formatMessage<"Hello, $(user)!">(namedArg<"user">(user))=="Hello, Bob!");
+    MARTY_TR_TEST_CHECK(formatMessage<"$(b)/$(a)/$(b)">(namedArg<"a">(1), namedArg<"b">(2))=="2/1/2");
+
+    // Именованный аргумент доступен и по индексу
+    MARTY_TR_TEST_CHECK(formatMessage<"$(n) $(1)">(namedArg<"n">(7))=="7 7");
+}
+
+//----------------------------------------------------------------------------
+//! '$' вне плейсхолдера - как в substMacros
+static void testDollar()
+{
+    MARTY_TR_TEST_CHECK(formatMessage<"Price: $$$(1)">(5)=="Price: $5");
+    MARTY_TR_TEST_CHECK(formatMessage<"$$(1)">()=="$(1)");
+    MARTY_TR_TEST_CHECK(formatMessage<"Total $(1)$">(5)=="Total 5");
+    MARTY_TR_TEST_CHECK(formatMessage<"$">()=="");
+    MARTY_TR_TEST_CHECK(formatMessage<"a$b $(1)">(1)=="a$b 1");
+}
+
+//----------------------------------------------------------------------------
+static void testWide()
+{
+    MARTY_TR_TEST_CHECK(formatMessage<L"Copying $(1) of $(2)">(3, 10)==L"Copying 3 of 10");
+    MARTY_TR_TEST_CHECK(formatMessage<L"Hello, $(user)!">(namedArg<"user">(std::wstring(L"Bob")))==L"Hello, Bob!");
+    MARTY_TR_TEST_CHECK(formatMessage<L"$$$(1)$">(L"x")==L"$x");
+    MARTY_TR_TEST_CHECK(formatMessage<L"x=$(1)">(0.25)==L"x=0.25");
+}
+
+//----------------------------------------------------------------------------
+int main()
+{
+    testPositional();
+    testNamed();
+    testDollar();
+    testWide();
+
+    return marty_tr_test::result("static_format_message_test");
+}
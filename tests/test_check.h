@@ -0,0 +1,40 @@
+#pragma once
+/*!
+    \file
+    \brief Минимальные проверки для тестов marty_tr (без внешних фреймворков)
+ */
+
+#include <iostream>
+
+
+//----------------------------------------------------------------------------
+namespace marty_tr_test {
+
+inline int& failures()
+{
+    static int n = 0;
+    return n;
+}
+
+//! Код возврата теста: 0 - все проверки прошли
+inline int result(const char *testName)
+{
+    if (failures())
+        std::cout << testName << ": " << failures() << " check(s) failed\n";
+    else
+        std::cout << testName << ": ok\n";
+    return failures() ? 1 : 0;
+}
+
+} // namespace marty_tr_test
+
+//----------------------------------------------------------------------------
+#define MARTY_TR_TEST_CHECK(expr)                                                              \
+            do                                                                                 \
+            {                                                                                  \
+                if (!(expr))                                                                   \
+                {                                                                              \
+                    ++marty_tr_test::failures();                                               \
+                    std::cout << __FILE__ << "(" << __LINE__ << "): check failed: " #expr "\n"; \
+                }                                                                              \
+            } while(0)
@@ -0,0 +1,324 @@
+// Сброс производных кэшей переводчика при изменении каталога: потоковый кэш tr(), фильтр поиска,
+// кэш промахов и широкие копии. Плюс одновременное чтение одного переводчика из нескольких потоков.
+
+#include "../marty_tr.h"
+#include "test_check.h"
+
+#include <atomic>
+#include <string>
+#include <thread>
+#include <vector>
+
+
+using namespace marty_tr;
+
+//----------------------------------------------------------------------------
+static Translator makeTranslator()
+{
+    Translator t;
+    t.setLangTagFormat(ELangTagFormat::langTag);
+    return t;
+}
+
+//----------------------------------------------------------------------------
+//! Потоковый кэш tr() (user-050): любое изменение каталога и настроек, влияющих на поиск, меняет поколение
+static void testLookupCache()
+{
+    Translator t = makeTranslator();
+    t.setLookupCacheMode(true);
+
+    t.add("hello", "Hello", "app", "en-US");
+    MARTY_TR_TEST_CHECK(t.tr("hello", "app", "en-US")=="Hello");
+    MARTY_TR_TEST_CHECK(t.tr("hello", "app", "en-US")=="Hello"); // Из кэша
+
+    t.add("hello", "Hi", "app", "en-US");
+    MARTY_TR_TEST_CHECK(t.tr("hello", "app", "en-US")=="Hi");
+
+    // Правка напрямую: получение каталога для правки меняет поколение
+    t.getAllTranslations()["en-US"]["app"]["hello"] = "Hey";
+    MARTY_TR_TEST_CHECK(t.tr("hello", "app", "en-US")=="Hey");
+
+    // Правка по ранее полученной ссылке после tr() - нужен catalogChanged()
+    all_translations_map_t &all = t.getAllTranslations();
+    MARTY_TR_TEST_CHECK(t.tr("hello", "app", "en-US")=="Hey");
+    all["en-US"]["app"]["hello"] = std::string(100, 'x'); // Прежний текст освобождается - слот хранит свою копию
+    t.catalogChanged();
+    MARTY_TR_TEST_CHECK(t.tr("hello", "app", "en-US")==std::string(100, 'x'));
+
+    // Пустой текст и режим "пустое сообщение не существует"
+    t.add("empty", "", "app", "en-US");
+    MARTY_TR_TEST_CHECK(t.tr("empty", "app", "en-US")=="");
+    t.setEmptyMsgNotExist(true);
+    MARTY_TR_TEST_CHECK(t.tr("empty", "app", "en-US")!="");
+    t.setEmptyMsgNotExist(false);
+    MARTY_TR_TEST_CHECK(t.tr("empty", "app", "en-US")=="");
+
+    // Слой перекрывает и возвращает базовый текст
+    t.add("title", "Base", "app", "en-US");
+    MARTY_TR_TEST_CHECK(t.tr("title", "app", "en-US")=="Base");
+    t.addLayer("fix");
+    t.layerAdd("fix", "title", "Fixed", "app", "en-US");
+    MARTY_TR_TEST_CHECK(t.tr("title", "app", "en-US")=="Fixed");
+    t.layerErase("fix", "title", "app", "en-US");
+    MARTY_TR_TEST_CHECK(t.tr("title", "app", "en-US")=="Base");
+
+    // Другой переводчик и копия не видят слоты этого
+    Translator other = makeTranslator();
+    other.setLookupCacheMode(true);
+    other.add("title", "Other", "app", "en-US");
+    MARTY_TR_TEST_CHECK(t.tr("title", "app", "en-US")=="Base");
+    MARTY_TR_TEST_CHECK(other.tr("title", "app", "en-US")=="Other");
+
+    Translator copy = t;
+    copy.add("title", "Copy", "app", "en-US");
+    MARTY_TR_TEST_CHECK(copy.tr("title", "app", "en-US")=="Copy");
+    MARTY_TR_TEST_CHECK(t.tr("title", "app", "en-US")=="Base");
+
+    // Переводчик, созданный на месте уничтоженного, не получает его слоты
+    {
+        Translator *p = new Translator(makeTranslator());
+        p->setLookupCacheMode(true);
+        p->add("k", "old", "app", "en-US");
+        MARTY_TR_TEST_CHECK(p->tr("k", "app", "en-US")=="old");
+        delete p;
+
+        p = new Translator(makeTranslator());
+        p->setLookupCacheMode(true);
+        p->add("k", "new", "app", "en-US");
+        MARTY_TR_TEST_CHECK(p->tr("k", "app", "en-US")=="new");
+        delete p;
+    }
+
+    // Общая база
+    all_translations_map_t baseMap;
+    baseMap["en-US"]["app"]["base_only"] = "From base";
+    Translator overBase = makeTranslator();
+    overBase.setLookupCacheMode(true);
+    MARTY_TR_TEST_CHECK(overBase.tr("base_only", "app", "en-US")!="From base");
+    overBase.setSharedBase(tr_make_shared_translations(baseMap));
+    MARTY_TR_TEST_CHECK(overBase.tr("base_only", "app", "en-US")=="From base");
+}
+
+//----------------------------------------------------------------------------
+//! Фильтр поиска (user-039): строится при изменении каталога, устаревший фильтр не даёт ложных промахов
+static void testLookupFilter()
+{
+    Translator t = makeTranslator();
+    MARTY_TR_TEST_CHECK(!t.getLookupFilterMode()); // По умолчанию выключен
+    t.setLookupFilterMode(true);
+
+    t.add("a", "A", "app", "en-US");
+    MARTY_TR_TEST_CHECK(t.hasMsg("a", "app", "en-US"));
+    MARTY_TR_TEST_CHECK(!t.hasMsg("b", "app", "en-US"));
+
+    // Дописывание в фильтр по одному сообщению, с переполнением и перестройкой
+    for(int i=0; i!=5000; ++i)
+        t.add("m" + std::to_string(i), "text", "cat" + std::to_string(i%7), i%2 ? "en-US" : "ru-RU");
+    bool allFound = true;
+    for(int i=0; i!=5000; ++i)
+        allFound = allFound && t.hasMsg("m" + std::to_string(i), "cat" + std::to_string(i%7), i%2 ? "en-US" : "ru-RU");
+    MARTY_TR_TEST_CHECK(allFound);
+
+    // Правка напрямую без catalogChanged(): фильтр устарел и не используется
+    t.getAllTranslations()["de-DE"]["direct"]["d"] = "D";
+    MARTY_TR_TEST_CHECK(t.hasMsg("d", "direct", "de-DE"));
+    MARTY_TR_TEST_CHECK(t.tr("d", "direct", "de-DE")=="D");
+
+    t.catalogChanged();
+    MARTY_TR_TEST_CHECK(t.hasMsg("d", "direct", "de-DE"));
+    MARTY_TR_TEST_CHECK(!t.hasMsg("e", "direct", "de-DE"));
+
+    // Удалённое из слоя сообщение остаётся в фильтре, но не находится
+    t.addLayer("L");
+    t.layerAdd("L", "layer_only", "X", "app", "en-US");
+    MARTY_TR_TEST_CHECK(t.hasMsg("layer_only", "app", "en-US"));
+    t.layerErase("L", "layer_only", "app", "en-US");
+    MARTY_TR_TEST_CHECK(!t.hasMsg("layer_only", "app", "en-US"));
+
+    // Выключение и повторное включение
+    t.setLookupFilterMode(false);
+    t.add("after_off", "1", "app", "en-US");
+    t.setLookupFilterMode(true);
+    MARTY_TR_TEST_CHECK(t.hasMsg("after_off", "app", "en-US"));
+}
+
+//----------------------------------------------------------------------------
+//! Лимит сообщений о промахе (user-038) сбрасывается при изменении каталога
+static void testMissCache()
+{
+    int reports = 0;
+    auto handler = makeErrReportHandler([&](MsgNotFound, const std::string&, const std::string&, const std::string&) { ++reports; });
+
+    Translator t = makeTranslator();
+    t.setErrHandler(&handler);
+    t.add("present", "P", "app", "en-US");
+
+    MARTY_TR_TEST_CHECK(t.getMissReportLimit()==0); // По умолчанию сообщается о каждом промахе
+    for(int i=0; i!=5; ++i)
+        t.tr("missing", "app", "en-US");
+    MARTY_TR_TEST_CHECK(reports==5);
+
+    reports = 0;
+    t.setMissReportLimit(1);
+    for(int i=0; i!=5; ++i)
+        t.tr("missing", "app", "en-US");
+    MARTY_TR_TEST_CHECK(reports==1);
+
+    // Изменение каталога - о промахе сообщается снова
+    t.add("other", "O", "app", "en-US");
+    t.tr("missing", "app", "en-US");
+    MARTY_TR_TEST_CHECK(reports==2);
+
+    // Кэш промахов не прячет добавленное через API сообщение
+    t.add("missing", "Found", "app", "en-US");
+    MARTY_TR_TEST_CHECK(t.tr("missing", "app", "en-US")=="Found");
+
+    // Без счётчиков лимит не действует
+    reports = 0;
+    t.setMissCacheSize(0);
+    t.tr("missing2", "app", "en-US");
+    t.tr("missing2", "app", "en-US");
+    MARTY_TR_TEST_CHECK(reports==2);
+
+    t.setErrHandler(0);
+}
+
+//----------------------------------------------------------------------------
+//! Повторный промах (user-038) отдаётся из слота потокового кэша: заглушка готова, каталог не просматривается
+static void testMissFallbackCache()
+{
+    int reports = 0;
+    std::string reportedLang;
+    auto handler = makeErrReportHandler([&](MsgNotFound, const std::string&, const std::string&, const std::string &langId) { ++reports; reportedLang = langId; });
+
+    Translator t = makeTranslator();
+    t.setErrHandler(&handler);
+    t.add("present", "P", "app", "en-US");
+
+    MARTY_TR_TEST_CHECK(t.getMissCacheMode()); // По умолчанию включен, лимит сообщений не нужен
+    MARTY_TR_TEST_CHECK(t.tr("gone", "app", "en-us")=="![gone]");
+
+    // Правка по ранее полученной ссылке без catalogChanged(): повторный промах берётся из слота
+    all_translations_map_t &all = t.getAllTranslations();
+    MARTY_TR_TEST_CHECK(t.tr("gone", "app", "en-us")=="![gone]");
+    reports = 0;
+    all["en-US"]["app"]["gone"] = "Back";
+    MARTY_TR_TEST_CHECK(t.tr("gone", "app", "en-us")=="![gone]");
+
+    // Обработчик вызывается и для промаха из слота, с нормализованным языком
+    MARTY_TR_TEST_CHECK(reports==1);
+    MARTY_TR_TEST_CHECK(reportedLang=="en-US");
+
+    t.catalogChanged();
+    MARTY_TR_TEST_CHECK(t.tr("gone", "app", "en-us")=="Back");
+
+    // Смена вида заглушки сбрасывает слоты промахов
+    MARTY_TR_TEST_CHECK(t.tr("gone2", "app", "en-US")=="![gone2]");
+    t.setMsgNotFoundDecorateMode(false);
+    MARTY_TR_TEST_CHECK(t.tr("gone2", "app", "en-US")=="gone2");
+    t.setMsgNotFoundDecorateMode(true);
+
+    // Без кэша промахов правка видна сразу
+    t.setMissCacheMode(false);
+    MARTY_TR_TEST_CHECK(t.tr("gone3", "app", "en-US")=="![gone3]");
+    all_translations_map_t &all2 = t.getAllTranslations();
+    MARTY_TR_TEST_CHECK(t.tr("gone3", "app", "en-US")=="![gone3]");
+    all2["en-US"]["app"]["gone3"] = "Three";
+    MARTY_TR_TEST_CHECK(t.tr("gone3", "app", "en-US")=="Three");
+    t.setMissCacheMode(true);
+
+    // Обработчик, который сам зовёт tr() и освобождает потоковый кэш
+    auto reentrant = makeErrReportHandler([&](MsgNotFound, const std::string &msgId, const std::string&, const std::string&)
+                                          {
+                                              if (msgId=="outer")
+                                              {
+                                                  t.tr("inner", "app", "en-US");
+                                                  tr_clear_thread_lookup_cache();
+                                              }
+                                          });
+    t.setErrHandler(&reentrant);
+    for(int i=0; i!=3; ++i)
+    {
+        MARTY_TR_TEST_CHECK(t.tr("outer", "app", "en-US")=="![outer]");
+        MARTY_TR_TEST_CHECK(t.tr("inner", "app", "en-US")=="![inner]");
+        MARTY_TR_TEST_CHECK(t.tr("present", "app", "en-US")=="P");
+    }
+
+    t.setErrHandler(0);
+}
+
+//----------------------------------------------------------------------------
+//! Широкие копии (user-035): пересобираются после изменения каталога
+static void testWideViews()
+{
+    Translator t = makeTranslator();
+    t.add("w", "wide", "app", "en-US");
+    MARTY_TR_TEST_CHECK(t.trWide(std::wstring(L"w"), "app", "en-US")==L"wide");
+    MARTY_TR_TEST_CHECK(t.trWide(std::u16string(u"w"), "app", "en-US")==u"wide");
+
+    t.add("w", "changed", "app", "en-US");
+    MARTY_TR_TEST_CHECK(t.trWide(std::wstring(L"w"), "app", "en-US")==L"changed");
+    MARTY_TR_TEST_CHECK(t.trWide(std::u16string(u"w"), "app", "en-US")==u"changed");
+}
+
+//----------------------------------------------------------------------------
+//! Одновременное чтение одного переводчика: фильтр, кэш промахов с лимитом, кэш tr(), широкие копии
+static void testConcurrentReaders()
+{
+    Translator t = makeTranslator();
+    t.setLookupFilterMode(true);
+    t.setLookupCacheMode(true);
+    t.setMissReportLimit(1);
+    for(int i=0; i!=200; ++i)
+    {
+        t.add("k" + std::to_string(i), "en" + std::to_string(i), "app", "en-US");
+        t.add("k" + std::to_string(i), "ru" + std::to_string(i), "app", "ru-RU");
+    }
+
+    const Translator &ct = t;
+    std::atomic<int> bad{0};
+
+    auto reader = [&]()
+    {
+        for(int round=0; round!=20; ++round)
+        {
+            for(int i=0; i!=400; ++i)
+            {
+                const std::string key      = "k" + std::to_string(i);
+                const bool        expected = i<200;
+                if (ct.hasMsg(key, "app", "en-US")!=expected)
+                    ++bad;
+                if (expected && ct.tr(key, "app", "en-US")!="en" + std::to_string(i))
+                    ++bad;
+                if (!expected && ct.tr(key, "app", "en-US").empty())
+                    ++bad;
+
+                const std::wstring wkey(key.begin(), key.end());
+                const std::wstring wres = ct.trWide(wkey, "app", i%2 ? "ru-RU" : "en-US");
+                if (expected && wres!=std::wstring(i%2 ? L"ru" : L"en") + std::to_wstring(i))
+                    ++bad;
+            }
+        }
+    };
+
+    std::vector<std::thread> threads;
+    for(int i=0; i!=4; ++i)
+        threads.emplace_back(reader);
+    for(auto &th : threads)
+        th.join();
+
+    MARTY_TR_TEST_CHECK(bad==0);
+}
+
+//----------------------------------------------------------------------------
+int main()
+{
+    testLookupCache();
+    testLookupFilter();
+    testMissCache();
+    testMissFallbackCache();
+    testWideViews();
+    testConcurrentReaders();
+
+    return marty_tr_test::result("translator_cache_test");
+}
@@ -0,0 +1,426 @@
+#pragma once
+/*!
+    \file
+    \brief Перекодирование UTF-8 <-> UTF-16/UTF-32 для wchar_t, char16_t, char32_t
+
+    Ширина wchar_t определяет кодировку: 2 байта - UTF-16 (Windows), 4 байта - UTF-32.
+    Некорректные последовательности заменяются на U+FFFD.
+
+    ASCII участки перекодируются блоками по 16/32 байта (SSE2/AVX2, см. simd_scan.h),
+    MARTY_TR_NO_SIMD - отключить векторный код.
+ */
+
+#include "simd_scan.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+
+//----------------------------------------------------------------------------
+// marty_tr::utf::
+namespace marty_tr {
+namespace utf {
+
+
+
+//----------------------------------------------------------------------------
+namespace impl_helpers {
+
+constexpr std::uint32_t replacementChar = 0xFFFDu;
+
+//! Декодирует один символ UTF-8 начиная с pos, сдвигает pos
+inline
+std::uint32_t decodeUtf8(const char *p, std::size_t size, std::size_t &pos)
+{
+    const std::uint32_t b0 = (std::uint8_t)p[pos++];
+    if (b0<0x80)
+        return b0;
+
+    std::size_t   numCont = 0;
+    std::uint32_t cp      = 0;
+    std::uint32_t minCp   = 0;
+
+    if ((b0&0xE0)==0xC0)      { numCont = 1; cp = b0&0x1F; minCp = 0x80;    }
+    else if ((b0&0xF0)==0xE0) { numCont = 2; cp = b0&0x0F; minCp = 0x800;   }
+    else if ((b0&0xF8)==0xF0) { numCont = 3; cp = b0&0x07; minCp = 0x10000; }
+    else
+        return replacementChar;
+
+    for(std::size_t i=0; i!=numCont; ++i)
+    {
+        if (pos>=size || ((std::uint8_t)p[pos]&0xC0)!=0x80)
+            return replacementChar; // Обрезанная последовательность, продолжение не съедаем
+        cp = (cp<<6) | ((std::uint8_t)p[pos++]&0x3F);
+    }
+
+    if (cp<minCp || cp>0x10FFFF || (cp>=0xD800 && cp<=0xDFFF))
+        return replacementChar;
+
+    return cp;
+}
+
+//------------------------------
+//! Запись символа в UTF-16 (CharType размером 2 байта) или UTF-32, сдвигает dst
+template<typename CharType> inline
+void writeCodepoint(CharType *&dst, std::uint32_t cp)
+{
+    if constexpr (sizeof(CharType)==2)
+    {
+        if (cp>=0x10000)
+        {
+            cp -= 0x10000;
+            *dst++ = (CharType)(0xD800 + (cp>>10));
+            *dst++ = (CharType)(0xDC00 + (cp&0x3FF));
+            return;
+        }
+    }
+
+    *dst++ = (CharType)cp;
+}
+
+//------------------------------
+//! Запись символа в UTF-8, сдвигает dst
+inline
+void writeUtf8(char *&dst, std::uint32_t cp)
+{
+    if (cp<0x80)
+    {
+        *dst++ = (char)cp;
+    }
+    else if (cp<0x800)
+    {
+        *dst++ = (char)(0xC0 | (cp>>6));
+        *dst++ = (char)(0x80 | (cp&0x3F));
+    }
+    else if (cp<0x10000)
+    {
+        *dst++ = (char)(0xE0 | (cp>>12));
+        *dst++ = (char)(0x80 | ((cp>>6)&0x3F));
+        *dst++ = (char)(0x80 | (cp&0x3F));
+    }
+    else
+    {
+        *dst++ = (char)(0xF0 | (cp>>18));
+        *dst++ = (char)(0x80 | ((cp>>12)&0x3F));
+        *dst++ = (char)(0x80 | ((cp>>6)&0x3F));
+        *dst++ = (char)(0x80 | (cp&0x3F));
+    }
+}
+
+//------------------------------
+#if defined(MARTY_TR_SIMD_SSE2)
+
+//! Все 16-битные элементы < 0x80
+inline
+bool isAsciiOnly16(__m128i v)
+{
+    const __m128i hiBits = _mm_and_si128(v, _mm_set1_epi16((short)0xFF80));
+    return _mm_movemask_epi8(_mm_cmpeq_epi8(hiBits, _mm_setzero_si128()))==0xFFFF;
+}
+
+//! Все 32-битные элементы < 0x80
+inline
+bool isAsciiOnly32(__m128i v)
+{
+    const __m128i hiBits = _mm_and_si128(v, _mm_set1_epi32((int)0xFFFFFF80));
+    return _mm_movemask_epi8(_mm_cmpeq_epi8(hiBits, _mm_setzero_si128()))==0xFFFF;
+}
+
+#endif
+
+//------------------------------
+//! Индекс первого байта >= 0x80, или size
+inline
+std::size_t findFirstNonAscii(const char *p, std::size_t size)
+{
+    std::size_t pos = 0;
+
+    #if defined(MARTY_TR_SIMD_AVX2)
+
+        for(; pos+32<=size; pos+=32)
+        {
+            const std::uint32_t mask = (std::uint32_t)_mm256_movemask_epi8(_mm256_loadu_si256((const __m256i*)(p+pos)));
+            if (mask)
+                return pos + simd::impl_helpers::countTrailingZeros(mask);
+        }
+
+    #endif
+
+    #if defined(MARTY_TR_SIMD_SSE2)
+
+        for(; pos+16<=size; pos+=16)
+        {
+            const std::uint32_t mask = (std::uint32_t)_mm_movemask_epi8(_mm_loadu_si128((const __m128i*)(p+pos)));
+            if (mask)
+                return pos + simd::impl_helpers::countTrailingZeros(mask);
+        }
+
+    #endif
+
+    for(; pos!=size; ++pos)
+    {
+        if ((std::uint8_t)p[pos]>=0x80)
+            return pos;
+    }
+
+    return size;
+}
+
+//------------------------------
+//! Расширяет ASCII префикс src блоками по 16/32 байта, возвращает число обработанных байт (кратно размеру блока)
+template<typename CharType> inline
+std::size_t widenAsciiBlocks(const char *src, std::size_t size, CharType *dst)
+{
+    std::size_t pos = 0;
+
+    #if defined(MARTY_TR_SIMD_AVX2)
+
+        for(; pos+32<=size; pos+=32)
+        {
+            const __m256i v = _mm256_loadu_si256((const __m256i*)(src+pos));
+            if (_mm256_movemask_epi8(v))
+                return pos;
+
+            const __m128i lo = _mm256_castsi256_si128(v);
+            const __m128i hi = _mm256_extracti128_si256(v, 1);
+
+            if constexpr (sizeof(CharType)==2)
+            {
+                _mm256_storeu_si256((__m256i*)(dst+pos   ), _mm256_cvtepu8_epi16(lo));
+                _mm256_storeu_si256((__m256i*)(dst+pos+16), _mm256_cvtepu8_epi16(hi));
+            }
+            else
+            {
+                _mm256_storeu_si256((__m256i*)(dst+pos   ), _mm256_cvtepu8_epi32(lo));
+                _mm256_storeu_si256((__m256i*)(dst+pos+ 8), _mm256_cvtepu8_epi32(_mm_srli_si128(lo, 8)));
+                _mm256_storeu_si256((__m256i*)(dst+pos+16), _mm256_cvtepu8_epi32(hi));
+                _mm256_storeu_si256((__m256i*)(dst+pos+24), _mm256_cvtepu8_epi32(_mm_srli_si128(hi, 8)));
+            }
+        }
+
+    #elif defined(MARTY_TR_SIMD_SSE2)
+
+        const __m128i zero = _mm_setzero_si128();
+        for(; pos+16<=size; pos+=16)
+        {
+            const __m128i v = _mm_loadu_si128((const __m128i*)(src+pos));
+            if (_mm_movemask_epi8(v))
+                return pos;
+
+            const __m128i lo = _mm_unpacklo_epi8(v, zero);
+            const __m128i hi = _mm_unpackhi_epi8(v, zero);
+
+            if constexpr (sizeof(CharType)==2)
+            {
+                _mm_storeu_si128((__m128i*)(dst+pos  ), lo);
+                _mm_storeu_si128((__m128i*)(dst+pos+8), hi);
+            }
+            else
+            {
+                _mm_storeu_si128((__m128i*)(dst+pos   ), _mm_unpacklo_epi16(lo, zero));
+                _mm_storeu_si128((__m128i*)(dst+pos+ 4), _mm_unpackhi_epi16(lo, zero));
+                _mm_storeu_si128((__m128i*)(dst+pos+ 8), _mm_unpacklo_epi16(hi, zero));
+                _mm_storeu_si128((__m128i*)(dst+pos+12), _mm_unpackhi_epi16(hi, zero));
+            }
+        }
+
+    #else
+
+        (void)src; (void)size; (void)dst;
+
+    #endif
+
+    return pos;
+}
+
+//------------------------------
+//! Сужает ASCII префикс src блоками по 16 символов, возвращает число обработанных символов (кратно 16)
+template<typename CharType> inline
+std::size_t narrowAsciiBlocks(const CharType *src, std::size_t size, char *dst)
+{
+    std::size_t pos = 0;
+
+    #if defined(MARTY_TR_SIMD_SSE2)
+
+        for(; pos+16<=size; pos+=16)
+        {
+            __m128i lo, hi;
+
+            if constexpr (sizeof(CharType)==2)
+            {
+                lo = _mm_loadu_si128((const __m128i*)(src+pos  ));
+                hi = _mm_loadu_si128((const __m128i*)(src+pos+8));
+                if (!isAsciiOnly16(_mm_or_si128(lo, hi)))
+                    return pos;
+            }
+            else
+            {
+                const __m128i v0 = _mm_loadu_si128((const __m128i*)(src+pos   ));
+                const __m128i v1 = _mm_loadu_si128((const __m128i*)(src+pos+ 4));
+                const __m128i v2 = _mm_loadu_si128((const __m128i*)(src+pos+ 8));
+                const __m128i v3 = _mm_loadu_si128((const __m128i*)(src+pos+12));
+                if (!isAsciiOnly32(_mm_or_si128(_mm_or_si128(v0, v1), _mm_or_si128(v2, v3))))
+                    return pos;
+                // Все значения < 0x80, знаковое насыщение ничего не портит
+                lo = _mm_packs_epi32(v0, v1);
+                hi = _mm_packs_epi32(v2, v3);
+            }
+
+            _mm_storeu_si128((__m128i*)(dst+pos), _mm_packus_epi16(lo, hi));
+        }
+
+    #else
+
+        (void)src; (void)size; (void)dst;
+
+    #endif
+
+    return pos;
+}
+
+} // namespace impl_helpers
+
+//----------------------------------------------------------------------------
+
+
+
+
+//----------------------------------------------------------------------------
+//! Проверка корректности UTF-8 (overlong, суррогаты, > U+10FFFF, обрезанные последовательности)
+inline
+bool isValidUtf8(std::string_view str)
+{
+    const char *p = str.data();
+    const std::size_t size = str.size();
+    std::size_t pos = 0;
+
+    while(pos<size)
+    {
+        pos += impl_helpers::findFirstNonAscii(p+pos, size-pos);
+        if (pos>=size)
+            break;
+
+        const std::size_t start = pos;
+        if (impl_helpers::decodeUtf8(p, size, pos)==impl_helpers::replacementChar)
+        {
+            // U+FFFD, записанный честно (EF BF BD), ошибкой не является
+            if (pos-start!=3 || (std::uint8_t)p[start]!=0xEF || (std::uint8_t)p[start+1]!=0xBF || (std::uint8_t)p[start+2]!=0xBD)
+                return false;
+        }
+    }
+
+    return true;
+}
+
+//------------------------------
+//! UTF-8 -> UTF-16 (CharType размером 2 байта) или UTF-32 (4 байта)
+template<typename CharType> inline
+std::basic_string<CharType> fromUtf8(std::string_view str)
+{
+    static_assert(sizeof(CharType)==2 || sizeof(CharType)==4, "fromUtf8: CharType must be 16 or 32 bit");
+
+    const char *p = str.data();
+    const std::size_t size = str.size();
+    if (!size)
+        return std::basic_string<CharType>();
+
+    // Код. единиц на выходе не больше, чем байт на входе
+    std::basic_string<CharType> res;
+    res.resize(size);
+
+    CharType *const dstBegin = &res[0];
+    CharType *dst = dstBegin;
+    std::size_t pos = 0;
+
+    while(pos<size)
+    {
+        const std::size_t n = impl_helpers::widenAsciiBlocks(p+pos, size-pos, dst);
+        pos += n;
+        dst += n;
+
+        // Хвост блока или не-ASCII - посимвольно до следующей границы блока
+        const std::size_t blockEnd = pos+32<size ? pos+32 : size;
+        while(pos<blockEnd)
+        {
+            if ((std::uint8_t)p[pos]<0x80)
+                *dst++ = (CharType)p[pos++];
+            else
+                impl_helpers::writeCodepoint(dst, impl_helpers::decodeUtf8(p, size, pos));
+        }
+    }
+
+    res.resize((std::size_t)(dst-dstBegin));
+    return res;
+}
+
+//------------------------------
+//! UTF-16/UTF-32 -> UTF-8
+template<typename CharType> inline
+std::string toUtf8(std::basic_string_view<CharType> str)
+{
+    static_assert(sizeof(CharType)==2 || sizeof(CharType)==4, "toUtf8: CharType must be 16 or 32 bit");
+
+    const std::size_t size = str.size();
+    if (!size)
+        return std::string();
+
+    // UTF-16: до 3 байт на код. единицу (суррогатная пара - 4 байта на две), UTF-32: до 4 байт
+    std::string res;
+    res.resize(size*(sizeof(CharType)==2 ? 3 : 4));
+
+    char *const dstBegin = &res[0];
+    char *dst = dstBegin;
+    std::size_t pos = 0;
+
+    while(pos<size)
+    {
+        const std::size_t n = impl_helpers::narrowAsciiBlocks(str.data()+pos, size-pos, dst);
+        pos += n;
+        dst += n;
+
+        const std::size_t blockEnd = pos+16<size ? pos+16 : size;
+        for(; pos<blockEnd; ++pos)
+        {
+            std::uint32_t cp = (std::uint32_t)str[pos];
+            if constexpr (sizeof(CharType)==2)
+            {
+                cp &= 0xFFFFu;
+                if (cp>=0xD800 && cp<=0xDBFF && pos+1<size && ((std::uint32_t)str[pos+1]&0xFC00u)==0xDC00u)
+                {
+                    cp = 0x10000 + ((cp-0xD800)<<10) + (((std::uint32_t)str[pos+1]&0xFFFFu)-0xDC00);
+                    ++pos;
+                }
+            }
+
+            if ((cp>=0xD800 && cp<=0xDFFF) || cp>0x10FFFF)
+                cp = impl_helpers::replacementChar; // Непарный суррогат
+
+            impl_helpers::writeUtf8(dst, cp);
+        }
+    }
+
+    res.resize((std::size_t)(dst-dstBegin));
+    return res;
+}
+
+template<typename CharType> inline
+std::string toUtf8(const std::basic_string<CharType> &str)
+{
+    return toUtf8(std::basic_string_view<CharType>(str));
+}
+
+template<typename CharType> inline
+std::string toUtf8(const CharType *str)
+{
+    return str ? toUtf8(std::basic_string_view<CharType>(str)) : std::string();
+}
+
+//----------------------------------------------------------------------------
+
+} // namespace utf
+} // namespace marty_tr
+
+// marty_tr::utf::
+